@@ -0,0 +1,289 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+/*
+ * Compares the rbtree and the timer wheel event timer backends.
+ *
+ * For each number of timers the driver adds them with random timeouts
+ * of up to a minute, re-arms each of them with a new timeout, deletes
+ * them, and finally adds them again and expires them by advancing the
+ * time a millisecond at a time, as the event loop does.  The time per
+ * timer of each phase is printed for both backends.
+ *
+ * Before that, both backends are checked with timers placed beyond
+ * the root slots of the wheel: the time is advanced by the timeout
+ * returned by ngx_event_find_timer() only, as an idle worker does, and
+ * the timeout must not exceed the earliest deadline.
+ *
+ * The driver is linked with the objects of a built tree:
+ *
+ *     cc -O2 -I src/core -I src/event -I src/os/unix -I objs \
+ *         -o objs/event_timer contrib/bench/event_timer.c \
+ *         objs/src/event/ngx_event_timer.o objs/src/core/ngx_rbtree.o
+ *
+ *     objs/event_timer [10000,100000,1000000]
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+#define NGX_BENCH_TIMEOUT  60000
+#define NGX_BENCH_CHECK    1000
+
+
+typedef struct {
+    double        add;
+    double        readd;
+    double        del;
+    double        expire;
+} ngx_bench_result_t;
+
+
+static void ngx_bench_run(ngx_uint_t method, ngx_event_t *events,
+    ngx_msec_t *timeouts, ngx_uint_t n, ngx_bench_result_t *res);
+static void ngx_bench_handler(ngx_event_t *ev);
+static ngx_int_t ngx_bench_check(ngx_uint_t method);
+static double ngx_bench_now(void);
+
+
+volatile ngx_msec_t  ngx_current_msec;
+
+static ngx_log_t     ngx_bench_log;
+static ngx_uint_t    ngx_bench_expired;
+
+
+#if (NGX_DEBUG)
+
+void
+ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
+    const char *fmt, ...)
+{
+}
+
+#endif
+
+
+int
+main(int argc, char *const *argv)
+{
+    char                *p;
+    ngx_uint_t           i, n;
+    ngx_msec_t          *timeouts;
+    ngx_event_t         *events;
+    ngx_bench_result_t   rbtree, wheel;
+
+    p = (argc > 1) ? argv[1] : "10000,100000,1000000";
+
+    if (ngx_bench_check(NGX_EVENT_TIMER_RBTREE) != NGX_OK
+        || ngx_bench_check(NGX_EVENT_TIMER_WHEEL) != NGX_OK)
+    {
+        return 1;
+    }
+
+    printf("%8s  %-6s %9s %9s %9s %9s  (ns per timer)\n",
+           "timers", "method", "add", "re-add", "del", "expire");
+
+    while (*p) {
+        n = strtoul(p, &p, 10);
+
+        if (*p == ',') {
+            p++;
+        }
+
+        if (n == 0) {
+            continue;
+        }
+
+        events = calloc(n, sizeof(ngx_event_t));
+        timeouts = malloc(2 * n * sizeof(ngx_msec_t));
+
+        if (events == NULL || timeouts == NULL) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+
+        srandom(1);
+
+        for (i = 0; i < 2 * n; i++) {
+            timeouts[i] = 1 + random() % NGX_BENCH_TIMEOUT;
+        }
+
+        for (i = 0; i < n; i++) {
+            events[i].log = &ngx_bench_log;
+            events[i].handler = ngx_bench_handler;
+        }
+
+        ngx_bench_run(NGX_EVENT_TIMER_RBTREE, events, timeouts, n, &rbtree);
+        ngx_bench_run(NGX_EVENT_TIMER_WHEEL, events, timeouts, n, &wheel);
+
+        printf("%8lu  %-6s %9.1f %9.1f %9.1f %9.1f\n",
+               (unsigned long) n, "rbtree",
+               rbtree.add, rbtree.readd, rbtree.del, rbtree.expire);
+        printf("%8lu  %-6s %9.1f %9.1f %9.1f %9.1f\n",
+               (unsigned long) n, "wheel",
+               wheel.add, wheel.readd, wheel.del, wheel.expire);
+
+        free(events);
+        free(timeouts);
+    }
+
+    return 0;
+}
+
+
+static void
+ngx_bench_run(ngx_uint_t method, ngx_event_t *events, ngx_msec_t *timeouts,
+    ngx_uint_t n, ngx_bench_result_t *res)
+{
+    double      start;
+    ngx_uint_t  i;
+    ngx_msec_t  end;
+
+    ngx_current_msec = 1000;
+
+    (void) ngx_event_timer_init(&ngx_bench_log, method);
+
+    start = ngx_bench_now();
+
+    for (i = 0; i < n; i++) {
+        ngx_event_add_timer(&events[i], timeouts[i]);
+    }
+
+    res->add = (ngx_bench_now() - start) / n;
+
+    /* the new timeouts differ by more than NGX_TIMER_LAZY_DELAY mostly */
+
+    start = ngx_bench_now();
+
+    for (i = 0; i < n; i++) {
+        ngx_event_add_timer(&events[i], timeouts[n + i]);
+    }
+
+    res->readd = (ngx_bench_now() - start) / n;
+
+    start = ngx_bench_now();
+
+    for (i = 0; i < n; i++) {
+        if (events[i].timer_set) {
+            ngx_event_del_timer(&events[i]);
+        }
+    }
+
+    res->del = (ngx_bench_now() - start) / n;
+
+    for (i = 0; i < n; i++) {
+        ngx_event_add_timer(&events[i], timeouts[i]);
+    }
+
+    ngx_bench_expired = 0;
+    end = ngx_current_msec + NGX_BENCH_TIMEOUT;
+
+    start = ngx_bench_now();
+
+    while (ngx_current_msec != end) {
+        ngx_current_msec++;
+        ngx_event_expire_timers();
+    }
+
+    res->expire = (ngx_bench_now() - start) / n;
+
+    if (ngx_bench_expired != n || ngx_event_no_timers_left() != NGX_OK) {
+        fprintf(stderr, "%lu of %lu timers expired\n",
+                (unsigned long) ngx_bench_expired, (unsigned long) n);
+        exit(1);
+    }
+}
+
+
+static void
+ngx_bench_handler(ngx_event_t *ev)
+{
+    ngx_bench_expired++;
+}
+
+
+static ngx_int_t
+ngx_bench_check(ngx_uint_t method)
+{
+    ngx_uint_t      i;
+    ngx_msec_t      timer, earliest;
+    ngx_msec_int_t  diff;
+    ngx_event_t     events[NGX_BENCH_CHECK];
+
+    ngx_memzero(events, sizeof(events));
+
+    /* the base of the wheel is not aligned to a root slot boundary */
+
+    ngx_current_msec = 1000 + 100;
+
+    (void) ngx_event_timer_init(&ngx_bench_log, method);
+
+    srandom(1);
+
+    /* the timeouts of the first wheel level, 2^14 to 2^20 milliseconds */
+
+    for (i = 0; i < NGX_BENCH_CHECK; i++) {
+        events[i].log = &ngx_bench_log;
+        events[i].handler = ngx_bench_handler;
+
+        ngx_event_add_timer(&events[i],
+                            (1 << 14) + random() % ((1 << 20) - (1 << 14)));
+    }
+
+    ngx_bench_expired = 0;
+
+    while (ngx_bench_expired != NGX_BENCH_CHECK) {
+
+        earliest = NGX_TIMER_INFINITE;
+
+        for (i = 0; i < NGX_BENCH_CHECK; i++) {
+            if (!events[i].timer_set) {
+                continue;
+            }
+
+            diff = (ngx_msec_int_t) (events[i].timer.key - ngx_current_msec);
+
+            if (diff < 0) {
+                fprintf(stderr, "%s: timer %lu expired %ld ms late\n",
+                        method ? "wheel" : "rbtree", (unsigned long) i,
+                        (long) -diff);
+                return NGX_ERROR;
+            }
+
+            if ((ngx_msec_t) diff < earliest) {
+                earliest = diff;
+            }
+        }
+
+        timer = ngx_event_find_timer();
+
+        if (timer > earliest) {
+            fprintf(stderr, "%s: timeout %lu ms, the earliest timer "
+                    "is due in %lu ms\n", method ? "wheel" : "rbtree",
+                    (unsigned long) timer, (unsigned long) earliest);
+            return NGX_ERROR;
+        }
+
+        ngx_current_msec += timer;
+        ngx_event_expire_timers();
+    }
+
+    return NGX_OK;
+}
+
+
+static double
+ngx_bench_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
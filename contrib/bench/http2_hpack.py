@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+
+# Copyright (C) Nginx, Inc.
+
+"""Measures the size of HTTP/2 response header blocks.
+
+A client sends requests one after another on a single connection to
+a location returning a small JSON response with cache-control and
+set-cookie headers, and sums the HEADERS frame payloads it receives,
+for each value of http2_hpack_table_size.
+
+    http2_hpack.py [-n REQUESTS] [-t SIZE,SIZE...] objs/nginx
+"""
+
+import argparse
+import os
+import socket
+import struct
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from nginx_bench import Nginx
+
+
+PORT = 19580
+
+
+def frame(type, flags, sid, payload=b''):
+    return (struct.pack('>I', len(payload))[1:] + bytes([type, flags])
+            + struct.pack('>I', sid) + payload)
+
+
+def request(path):
+    path = path.encode()
+    authority = b'localhost'
+
+    # :method GET, :scheme http, :path and :authority without indexing
+
+    return (b'\x82\x86\x04' + bytes([len(path)]) + path
+            + b'\x01' + bytes([len(authority)]) + authority)
+
+
+def run(requests):
+    s = socket.create_connection(('127.0.0.1', PORT))
+    s.sendall(b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n' + frame(4, 0, 0))
+
+    sizes = []
+    buf = b''
+
+    for n in range(requests):
+        sid = 2 * n + 1
+        s.sendall(frame(1, 5, sid, request('/api/items?page=%d' % n)))
+
+        size = 0
+        done = False
+
+        while not done:
+            while len(buf) < 9 or len(buf) < 9 + int.from_bytes(buf[:3],
+                                                                'big'):
+                data = s.recv(65536)
+                if not data:
+                    raise ConnectionError('connection closed')
+                buf += data
+
+            length = int.from_bytes(buf[:3], 'big')
+            type, flags = buf[3], buf[4]
+            fsid = int.from_bytes(buf[5:9], 'big') & 0x7fffffff
+            buf = buf[9 + length:]
+
+            if type == 4 and not flags & 1:
+                s.sendall(frame(4, 1, 0))
+
+            elif type == 7:
+                raise ConnectionError('GOAWAY')
+
+            elif fsid == sid:
+                if type in (1, 9):
+                    size += length
+
+                if type == 3 or flags & 1:
+                    done = True
+
+        sizes.append(size)
+
+    s.close()
+
+    return sizes
+
+
+def conf(size):
+    return '''
+events { }
+http {
+    access_log off;
+
+    server {
+        listen 127.0.0.1:%d http2;
+        http2_hpack_table_size %d;
+
+        location /api/ {
+            root html;
+            default_type application/json;
+            add_header Cache-Control "private, max-age=0, must-revalidate";
+            add_header Set-Cookie "session=4f2a9c1e7b3d5a6f; Path=/; HttpOnly";
+            add_header Vary Accept-Encoding;
+        }
+    }
+}
+''' % (PORT, size)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('nginx')
+    parser.add_argument('-n', '--requests', type=int, default=100)
+    parser.add_argument('-t', '--table-sizes', default='0,4096')
+    args = parser.parse_args()
+
+    print('%d requests on one connection' % args.requests)
+
+    for size in map(int, args.table_sizes.split(',')):
+        with Nginx(args.nginx, conf(size),
+                   {'html/api/items': b'{"items":[],"page":1}'}) as nginx:
+            nginx.start(PORT)
+            sizes = run(args.requests)
+
+        print('http2_hpack_table_size %-5d  first %4d bytes  then %6.1f '
+              'bytes per response  total %d bytes'
+              % (size, sizes[0], sum(sizes[1:]) / max(1, len(sizes) - 1),
+                 sum(sizes)))
+
+
+if __name__ == '__main__':
+    main()
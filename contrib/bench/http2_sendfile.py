@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+
+# Copyright (C) Nginx, Inc.
+
+"""Measures HTTP/2 downloads of a static file.
+
+A client allowing the largest frame size and flow control windows
+downloads a file several times on one cleartext connection, with
+sendfile off and on.  The number and the average size of DATA frames,
+the transfer rate and the worker CPU time per gigabyte are printed.
+Several nginx binaries may be given to compare them.
+
+    http2_sendfile.py [-s MBYTES] [-r REQUESTS] objs/nginx [old/nginx]
+"""
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from nginx_bench import Nginx
+
+
+PORT = 19680
+WINDOW = 2 ** 31 - 1
+
+
+def frame(type, flags, sid, payload=b''):
+    return (struct.pack('>I', len(payload))[1:] + bytes([type, flags])
+            + struct.pack('>I', sid) + payload)
+
+
+def recv_exactly(s, buf, n):
+    view = memoryview(buf)
+
+    while n:
+        got = s.recv_into(view, min(n, len(buf)))
+        if got == 0:
+            raise ConnectionError('connection closed')
+        n -= got
+
+
+def run(requests):
+    s = socket.create_connection(('127.0.0.1', PORT))
+
+    # SETTINGS_INITIAL_WINDOW_SIZE and SETTINGS_MAX_FRAME_SIZE
+
+    s.sendall(b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+              + frame(4, 0, 0, struct.pack('>HIHI', 4, WINDOW,
+                                           5, 2 ** 24 - 1))
+              + frame(8, 0, 0, struct.pack('>I', WINDOW - 65535)))
+
+    header = bytearray(9)
+    buf = bytearray(1024 * 1024)
+    frames = 0
+    total = 0
+
+    for n in range(requests):
+        sid = 2 * n + 1
+        s.sendall(frame(1, 5, sid, b'\x82\x86\x41\x09localhost'
+                                   b'\x04\x05/file'))
+        received = 0
+
+        while True:
+            recv_exactly(s, header, 9)
+
+            length = int.from_bytes(header[:3], 'big')
+            type, flags = header[3], header[4]
+            fsid = int.from_bytes(header[5:9], 'big') & 0x7fffffff
+
+            recv_exactly(s, buf, length)
+
+            if type == 4 and not flags & 1:
+                s.sendall(frame(4, 1, 0))
+
+            elif type == 7:
+                raise ConnectionError('GOAWAY')
+
+            elif type == 0:
+                frames += 1
+                received += length
+
+            if fsid == sid and (type == 3 or flags & 1):
+                break
+
+        total += received
+
+        # the stream window is fresh for each request
+
+        s.sendall(frame(8, 0, 0, struct.pack('>I', received)))
+
+    s.close()
+
+    return frames, total
+
+
+def conf(sendfile):
+    return '''
+events { }
+http {
+    access_log off;
+
+    server {
+        listen 127.0.0.1:%d http2;
+        root html;
+        sendfile %s;
+    }
+}
+''' % (PORT, sendfile)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('nginx', nargs='+')
+    parser.add_argument('-s', '--size', type=int, default=256,
+                        help='file size, megabytes')
+    parser.add_argument('-r', '--requests', type=int, default=8)
+    args = parser.parse_args()
+
+    print('%d requests of a %dM file on one connection'
+          % (args.requests, args.size))
+
+    for binary in args.nginx:
+        for sendfile in ('off', 'on'):
+            with Nginx(binary, conf(sendfile), {'html/file': b''}) as nginx:
+
+                with open(nginx.path('html/file'), 'wb') as f:
+                    f.truncate(args.size * 1024 * 1024)
+
+                nginx.start(PORT)
+
+                cpu = nginx.cpu()
+                start = time.monotonic()
+
+                frames, total = run(args.requests)
+
+                elapsed = time.monotonic() - start
+                cpu = nginx.cpu() - cpu
+
+            print('%s sendfile %-3s  %7d frames of %7.0f bytes  %6.0f MB/s  '
+                  '%5.2f worker CPU s/GB'
+                  % (binary, sendfile, frames, total / frames,
+                     total / (1 << 20) / elapsed, cpu / (total / (1 << 30))))
+
+
+if __name__ == '__main__':
+    main()
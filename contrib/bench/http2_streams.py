@@ -0,0 +1,176 @@
+#!/usr/bin/env python3
+
+# Copyright (C) Nginx, Inc.
+
+"""Measures HTTP/2 downloads on many concurrent weighted streams.
+
+A client opens a few hundred streams on one cleartext connection at
+once, each with a PRIORITY weight from 1 to 256, and downloads a static
+file on all of them, which keeps that many streams in the output queue
+of the connection.  The number of DATA frames, the transfer rate, the
+worker CPU time per frame and per gigabyte are printed.
+
+Several nginx binaries may be given to compare them, for example one
+built before DATA frames were scheduled by weight, when each queued
+frame walked the list of the frames already queued:
+
+    http2_streams.py [-n STREAMS] [-s KBYTES] objs/nginx [old/nginx]
+"""
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from nginx_bench import Nginx
+
+
+PORT = 19681
+WINDOW = 2 ** 31 - 1
+
+
+def frame(type, flags, sid, payload=b''):
+    return (struct.pack('>I', len(payload))[1:] + bytes([type, flags])
+            + struct.pack('>I', sid) + payload)
+
+
+def recv_exactly(s, buf, n):
+    view = memoryview(buf)
+
+    while n:
+        got = s.recv_into(view, min(n, len(buf)))
+        if got == 0:
+            raise ConnectionError('connection closed')
+        n -= got
+
+
+def weight(n):
+    return (n * 37) % 256 + 1
+
+
+def run(s, streams, first):
+    header = bytearray(9)
+    buf = bytearray(1 << 24)
+
+    # HEADERS with END_STREAM, END_HEADERS and PRIORITY, depending on
+    # the root stream with the weight given
+
+    requests = []
+
+    for n in range(streams):
+        requests.append(frame(1, 0x25, first + 2 * n,
+                              struct.pack('>IB', 0, weight(n) - 1)
+                              + b'\x82\x86\x41\x09localhost'
+                                b'\x04\x05/file'))
+
+    s.sendall(b''.join(requests))
+
+    active = streams
+    frames = 0
+    total = 0
+
+    while active:
+        recv_exactly(s, header, 9)
+
+        length = int.from_bytes(header[:3], 'big')
+        type, flags = header[3], header[4]
+        sid = int.from_bytes(header[5:9], 'big') & 0x7fffffff
+
+        recv_exactly(s, buf, length)
+
+        if type == 4 and not flags & 1:
+            s.sendall(frame(4, 1, 0))
+
+        elif type == 7:
+            raise ConnectionError('GOAWAY')
+
+        elif type == 3:
+            raise ConnectionError('RST_STREAM on stream %d' % sid)
+
+        elif type == 0:
+            frames += 1
+            total += length
+
+        if sid and flags & 1:
+            active -= 1
+
+    # the windows of the streams are fresh for the next round
+
+    s.sendall(frame(8, 0, 0, struct.pack('>I', total)))
+
+    return frames, total
+
+
+def conf(streams, chunk):
+    return '''
+events { }
+http {
+    access_log off;
+
+    server {
+        listen 127.0.0.1:%d http2;
+        root html;
+        http2_max_concurrent_streams %d;
+        http2_chunk_size %dk;
+    }
+}
+''' % (PORT, streams, chunk)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('nginx', nargs='+')
+    parser.add_argument('-n', '--streams', type=int, default=256)
+    parser.add_argument('-s', '--size', type=int, default=1024,
+                        help='file size, kilobytes')
+    parser.add_argument('-r', '--rounds', type=int, default=8)
+    parser.add_argument('-c', '--chunk', type=int, default=8,
+                        help='http2_chunk_size, kilobytes')
+    args = parser.parse_args()
+
+    print('%d rounds of %d concurrent streams downloading a %dK file, '
+          '%dK chunks' % (args.rounds, args.streams, args.size, args.chunk))
+
+    for binary in args.nginx:
+        with Nginx(binary, conf(args.streams, args.chunk),
+                   {'html/file': b'x' * (args.size * 1024)}) as nginx:
+
+            nginx.start(PORT)
+
+            s = socket.create_connection(('127.0.0.1', PORT))
+
+            # SETTINGS_INITIAL_WINDOW_SIZE and SETTINGS_MAX_FRAME_SIZE
+
+            s.sendall(b'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+                      + frame(4, 0, 0, struct.pack('>HIHI', 4, WINDOW,
+                                                   5, 2 ** 24 - 1))
+                      + frame(8, 0, 0, struct.pack('>I', WINDOW - 65535)))
+
+            frames = 0
+            total = 0
+
+            cpu = nginx.cpu()
+            start = time.monotonic()
+
+            for r in range(args.rounds):
+                f, t = run(s, args.streams, 1 + 2 * args.streams * r)
+                frames += f
+                total += t
+
+            elapsed = time.monotonic() - start
+            cpu = nginx.cpu() - cpu
+
+            s.close()
+
+        print('%s  %7d frames  %6.0f MB/s  %5.2f us CPU/frame  '
+              '%5.2f worker CPU s/GB'
+              % (binary, frames, total / (1 << 20) / elapsed,
+                 cpu / frames * 1e6, cpu / (total / (1 << 30))))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+
+# Copyright (C) Nginx, Inc.
+
+"""Compares the io_uring and epoll event methods.
+
+Keepalive clients request a small static file, and then several clients
+download a large static file at once, with "use epoll" and "use io_uring".
+The request rate, the latency percentiles and the worker CPU time per
+request are printed for the small responses, the transfer rate and
+the worker CPU time per gigabyte for the large file.
+
+    io_uring.py [-n REQUESTS] [-c CLIENTS] [-s MBYTES] objs/nginx
+"""
+
+import argparse
+import asyncio
+import os
+import socket
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from nginx_bench import Nginx, percentile
+
+
+PORT = 19980
+
+
+async def small(requests, clients):
+    latency = []
+
+    async def client(n):
+        reader, writer = await asyncio.open_connection('127.0.0.1', PORT)
+
+        for _ in range(n):
+            start = time.monotonic()
+            writer.write(b'GET /small HTTP/1.1\r\nHost: bench\r\n\r\n')
+            await writer.drain()
+
+            head = await reader.readuntil(b'\r\n\r\n')
+
+            length = 0
+            for line in head.split(b'\r\n'):
+                if line.lower().startswith(b'content-length:'):
+                    length = int(line[15:])
+
+            await reader.readexactly(length)
+
+            latency.append(time.monotonic() - start)
+
+        writer.close()
+
+    start = time.monotonic()
+    await asyncio.gather(*[client(requests // clients)
+                           for _ in range(clients)])
+
+    return latency, time.monotonic() - start
+
+
+def large(clients, requests):
+    def client():
+        s = socket.create_connection(('127.0.0.1', PORT))
+        buf = bytearray(1024 * 1024)
+
+        for _ in range(requests):
+            s.sendall(b'GET /large HTTP/1.1\r\nHost: bench\r\n\r\n')
+
+            head = b''
+            while b'\r\n\r\n' not in head:
+                head += s.recv(4096)
+
+            head, body = head.split(b'\r\n\r\n', 1)
+
+            length = 0
+            for line in head.split(b'\r\n'):
+                if line.lower().startswith(b'content-length:'):
+                    length = int(line[15:])
+
+            length -= len(body)
+
+            while length:
+                n = s.recv_into(buf, min(length, len(buf)))
+                if n == 0:
+                    raise ConnectionError('connection closed')
+                length -= n
+
+        s.close()
+
+    threads = [threading.Thread(target=client) for _ in range(clients)]
+
+    start = time.monotonic()
+
+    for t in threads:
+        t.start()
+
+    for t in threads:
+        t.join()
+
+    return time.monotonic() - start
+
+
+def conf(method, workers):
+    return '''
+worker_processes %d;
+events {
+    use %s;
+    worker_connections 4096;
+}
+http {
+    access_log off;
+    keepalive_requests 1000000;
+
+    server {
+        listen 127.0.0.1:%d;
+        root html;
+        sendfile on;
+    }
+}
+''' % (workers, method, PORT)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('nginx')
+    parser.add_argument('-n', '--requests', type=int, default=64000)
+    parser.add_argument('-c', '--clients', type=int, default=64)
+    parser.add_argument('-w', '--workers', type=int, default=1)
+    parser.add_argument('-s', '--size', type=int, default=64,
+                        help='large file size, megabytes')
+    parser.add_argument('-d', '--downloads', type=int, default=8,
+                        help='large file downloads per client')
+    parser.add_argument('-l', '--large-clients', type=int, default=4)
+    args = parser.parse_args()
+
+    print('%d small requests by %d clients, %d downloads of a %dM file '
+          'by %d clients, %d workers'
+          % (args.requests, args.clients,
+             args.downloads * args.large_clients, args.size,
+             args.large_clients, args.workers))
+
+    for method in ('epoll', 'io_uring'):
+        with Nginx(args.nginx, conf(method, args.workers),
+                   {'html/small': b'x' * 128, 'html/large': b''}) as nginx:
+
+            with open(nginx.path('html/large'), 'wb') as f:
+                f.truncate(args.size * 1024 * 1024)
+
+            nginx.start(PORT)
+
+            cpu = nginx.cpu()
+
+            latency, elapsed = asyncio.run(small(args.requests,
+                                                 args.clients))
+
+            small_cpu = nginx.cpu() - cpu
+
+            cpu = nginx.cpu()
+
+            large_elapsed = large(args.large_clients, args.downloads)
+
+            large_cpu = nginx.cpu() - cpu
+            errors = len(nginx.errors())
+
+        total = args.size * args.downloads * args.large_clients / 1024
+
+        print('%-8s small %6.0f r/s  p50 %5.2fms  p99 %6.2fms  '
+              '%5.1f us CPU/r  large %6.0f MB/s  %5.2f CPU s/GB  alerts %d'
+              % (method, len(latency) / elapsed,
+                 percentile(latency, 0.5) * 1000,
+                 percentile(latency, 0.99) * 1000,
+                 small_cpu / len(latency) * 1e6,
+                 total * 1024 / large_elapsed, large_cpu / total, errors))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+
+# Copyright (C) Nginx, Inc.
+
+"""Compares limit_req zones with different numbers of shards.
+
+Several workers serve a small static file under a limit_req keyed by
+a request argument, and keepalive clients send requests with random
+keys, so that every request looks up and mostly adds a node.  A small
+zone makes the workers expire nodes all the time.  The request rate,
+the latency percentiles, the responses other than 200, and the lock
+counters of the zone from "stub_status zones" are printed for each
+number of shards.
+
+    limit_req_shards.py [-n REQUESTS] [-c CLIENTS] [-s 1,4,16] objs/nginx
+"""
+
+import argparse
+import asyncio
+import os
+import random
+import sys
+import time
+import urllib.request
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from nginx_bench import Nginx, percentile
+
+
+PORT = 19880
+
+
+async def load(requests, clients, keys):
+    latency = []
+    statuses = {}
+
+    async def client(n):
+        reader, writer = await asyncio.open_connection('127.0.0.1', PORT)
+
+        for _ in range(n):
+            start = time.monotonic()
+            writer.write(b'GET /?k=%d HTTP/1.1\r\nHost: bench\r\n\r\n'
+                         % random.randrange(keys))
+            await writer.drain()
+
+            head = await reader.readuntil(b'\r\n\r\n')
+            status = int(head[9:12])
+
+            length = 0
+            for line in head.split(b'\r\n'):
+                if line.lower().startswith(b'content-length:'):
+                    length = int(line[15:])
+
+            await reader.readexactly(length)
+
+            latency.append(time.monotonic() - start)
+            statuses[status] = statuses.get(status, 0) + 1
+
+        writer.close()
+
+    start = time.monotonic()
+    await asyncio.gather(*[client(requests // clients)
+                           for _ in range(clients)])
+
+    return latency, statuses, time.monotonic() - start
+
+
+def zone_locks():
+    with urllib.request.urlopen('http://127.0.0.1:%d/status' % PORT) as f:
+        lines = f.read().decode().splitlines()
+
+    locks = contended = 0
+
+    for line in lines:
+        fields = line.split()
+
+        # "zone size locks contended ..." and "zone shard locks contended"
+
+        if fields and fields[0] == 'z':
+            locks += int(fields[2])
+            contended += int(fields[3])
+
+    return locks, contended
+
+
+def conf(shards, workers, size, rate):
+    return '''
+worker_processes %d;
+events { worker_connections 4096; }
+http {
+    access_log off;
+    keepalive_requests 1000000;
+
+    limit_req_zone $arg_k zone=z:%s rate=%dr/s shards=%d;
+
+    server {
+        listen 127.0.0.1:%d reuseport;
+        root html;
+
+        location = / {
+            limit_req zone=z burst=10 nodelay;
+        }
+
+        location = /status {
+            stub_status zones;
+        }
+    }
+}
+''' % (workers, size, rate, shards, PORT)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('nginx')
+    parser.add_argument('-n', '--requests', type=int, default=64000)
+    parser.add_argument('-c', '--clients', type=int, default=64)
+    parser.add_argument('-w', '--workers', type=int, default=4)
+    parser.add_argument('-s', '--shards', default='1,4,16')
+    parser.add_argument('-k', '--keys', type=int, default=100000,
+                        help='number of distinct keys')
+    parser.add_argument('-z', '--zone-size', default='256k')
+    parser.add_argument('-r', '--rate', type=int, default=1000)
+    args = parser.parse_args()
+
+    print('%d requests, %d clients, %d workers, %d keys, %s zone'
+          % (args.requests, args.clients, args.workers, args.keys,
+             args.zone_size))
+
+    for shards in map(int, args.shards.split(',')):
+        with Nginx(args.nginx,
+                   conf(shards, args.workers, args.zone_size, args.rate),
+                   {'html/index.html': b'ok'}) as nginx:
+            nginx.start(PORT)
+
+            latency, statuses, elapsed = asyncio.run(
+                load(args.requests, args.clients, args.keys))
+
+            locks, contended = zone_locks()
+            errors = len(nginx.errors())
+
+        others = ' '.join('%d:%d' % (s, n) for s, n in sorted(statuses.items())
+                          if s != 200) or '-'
+
+        print('shards %-3d %6.0f r/s  p50 %5.1fms  p99 %6.1fms  '
+              'locks %8d contended %6d  non-200 %s  alerts %d'
+              % (shards, len(latency) / elapsed,
+                 percentile(latency, 0.5) * 1000,
+                 percentile(latency, 0.99) * 1000,
+                 locks, contended, others, errors))
+
+
+if __name__ == '__main__':
+    main()
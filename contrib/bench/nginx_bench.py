@@ -0,0 +1,113 @@
+
+# Copyright (C) Nginx, Inc.
+
+"""Helpers shared by the benchmark scripts: running nginx from a
+temporary prefix and reading the CPU time of its workers."""
+
+import os
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+
+class Nginx:
+
+    def __init__(self, binary, conf, files=None):
+        self.binary = os.path.abspath(binary)
+        self.prefix = tempfile.mkdtemp(prefix='nginx-bench-')
+        self.proc = None
+
+        # workers of nginx started by root run as nobody
+
+        os.chmod(self.prefix, 0o755)
+
+        os.mkdir(os.path.join(self.prefix, 'conf'))
+        os.mkdir(os.path.join(self.prefix, 'logs'))
+
+        with open(os.path.join(self.prefix, 'conf', 'nginx.conf'), 'w') as f:
+            f.write('daemon off;\n'
+                    'pid logs/nginx.pid;\n'
+                    'error_log logs/error.log warn;\n')
+            f.write(conf)
+
+        for name, data in (files or {}).items():
+            path = os.path.join(self.prefix, name)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, 'wb') as f:
+                f.write(data)
+
+    def path(self, name):
+        return os.path.join(self.prefix, name)
+
+    def start(self, port):
+        self.proc = subprocess.Popen([self.binary, '-p', self.prefix + '/',
+                                      '-c', self.path('conf/nginx.conf')])
+        wait_port(port, self.proc)
+
+    def workers(self):
+        out = subprocess.check_output(['ps', '-o', 'pid=', '--ppid',
+                                       str(self.proc.pid)])
+        return [int(pid) for pid in out.split()]
+
+    def cpu(self):
+        """CPU seconds used by the workers so far."""
+
+        ticks = 0
+
+        for pid in self.workers():
+            with open('/proc/%d/stat' % pid) as f:
+                fields = f.read().rsplit(')', 1)[1].split()
+            ticks += int(fields[11]) + int(fields[12])
+
+        return ticks / os.sysconf('SC_CLK_TCK')
+
+    def errors(self):
+        if not os.path.exists(self.path('logs/error.log')):
+            return []
+
+        with open(self.path('logs/error.log')) as f:
+            return [l for l in f if '[alert]' in l or '[crit]' in l
+                    or '[emerg]' in l]
+
+    def stop(self):
+        if self.proc:
+            self.proc.send_signal(signal.SIGQUIT)
+            try:
+                self.proc.wait(10)
+            except subprocess.TimeoutExpired:
+                self.proc.kill()
+                self.proc.wait()
+            self.proc = None
+
+        for line in self.errors():
+            sys.stderr.write(line)
+
+        shutil.rmtree(self.prefix, ignore_errors=True)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.stop()
+
+
+def wait_port(port, proc=None, timeout=10):
+    end = time.monotonic() + timeout
+
+    while True:
+        try:
+            socket.create_connection(('127.0.0.1', port), 1).close()
+            return
+        except OSError:
+            if time.monotonic() > end or (proc and proc.poll() is not None):
+                raise
+            time.sleep(0.05)
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[max(0, int(len(values) * p + 0.5) - 1)]
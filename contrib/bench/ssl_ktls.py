@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+
+# Copyright (C) Nginx, Inc.
+
+"""Measures HTTPS downloads of a static file with ssl_ktls off and on.
+
+A client downloads a file several times on one keepalive connection.
+The transfer rate and the worker CPU time per gigabyte are printed,
+together with the number of connections the kernel started to encrypt,
+from /proc/net/tls_stat.  The kernel needs the "tls" module, and nginx
+an OpenSSL built with kTLS support.  A certificate is made with the
+openssl command.
+
+    ssl_ktls.py [-s MBYTES] [-r REQUESTS] objs/nginx
+"""
+
+import argparse
+import os
+import socket
+import ssl
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from nginx_bench import Nginx
+
+
+PORT = 19780
+
+
+def tls_stat():
+    try:
+        with open('/proc/net/tls_stat') as f:
+            stat = dict(line.split() for line in f)
+    except OSError:
+        return None
+
+    return int(stat['TlsTxSw']) + int(stat.get('TlsTxDevice', 0))
+
+
+def run(requests, size):
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    context.check_hostname = False
+    context.verify_mode = ssl.CERT_NONE
+
+    buf = bytearray(1024 * 1024)
+    total = 0
+
+    with context.wrap_socket(socket.create_connection(('127.0.0.1', PORT)),
+                             server_hostname='localhost') as s:
+
+        for _ in range(requests):
+            s.sendall(b'GET /file HTTP/1.1\r\nHost: localhost\r\n\r\n')
+
+            head = b''
+            while b'\r\n\r\n' not in head:
+                head += s.recv(1)
+
+            if not head.startswith(b'HTTP/1.1 200'):
+                raise ConnectionError(head.split(b'\r\n')[0].decode())
+
+            left = size
+            while left:
+                n = s.recv_into(buf, min(left, len(buf)))
+                if n == 0:
+                    raise ConnectionError('connection closed')
+                left -= n
+
+            total += size
+
+    return total
+
+
+def conf(ktls):
+    return '''
+events { }
+http {
+    access_log off;
+
+    server {
+        listen 127.0.0.1:%d ssl;
+
+        ssl_certificate cert.pem;
+        ssl_certificate_key cert.key;
+        ssl_ktls %s;
+
+        root html;
+        sendfile on;
+    }
+}
+''' % (PORT, ktls)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('nginx')
+    parser.add_argument('-s', '--size', type=int, default=256,
+                        help='file size, megabytes')
+    parser.add_argument('-r', '--requests', type=int, default=4)
+    args = parser.parse_args()
+
+    size = args.size * 1024 * 1024
+
+    print('%d requests of a %dM file on one connection'
+          % (args.requests, args.size))
+
+    for ktls in ('off', 'on'):
+        with Nginx(args.nginx, conf(ktls), {'html/file': b''}) as nginx:
+
+            with open(nginx.path('html/file'), 'wb') as f:
+                f.truncate(size)
+
+            subprocess.check_call(['openssl', 'req', '-x509', '-nodes',
+                                   '-newkey', 'rsa:2048', '-days', '1',
+                                   '-subj', '/CN=localhost',
+                                   '-keyout', nginx.path('conf/cert.key'),
+                                   '-out', nginx.path('conf/cert.pem')],
+                                  stderr=subprocess.DEVNULL)
+
+            nginx.start(PORT)
+
+            stat = tls_stat()
+            cpu = nginx.cpu()
+            start = time.monotonic()
+
+            total = run(args.requests, size)
+
+            elapsed = time.monotonic() - start
+            cpu = nginx.cpu() - cpu
+
+            if stat is not None:
+                stat = '%d kTLS connections' % (tls_stat() - stat)
+            else:
+                stat = 'no kernel TLS'
+
+        print('ssl_ktls %-3s  %6.0f MB/s  %5.2f worker CPU s/GB  %s'
+              % (ktls, total / (1 << 20) / elapsed,
+                 cpu / (total / (1 << 30)), stat))
+
+
+if __name__ == '__main__':
+    main()
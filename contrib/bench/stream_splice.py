@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+
+# Copyright (C) Nginx, Inc.
+
+"""Compares the stream proxy with and without proxy_splice.
+
+A backend sends the same file to every connection with sendfile(),
+clients read it through the stream proxy and discard it.  The transfer
+rate and the CPU time the workers spent per gigabyte are printed.
+
+    stream_splice.py [-s MBYTES] [-c CONNECTIONS] objs/nginx
+"""
+
+import argparse
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from nginx_bench import Nginx, wait_port
+
+
+PORT = 19480
+BACKEND = 19490
+
+
+def backend(size, repeat):
+    with tempfile.TemporaryFile() as f:
+        f.truncate(size)
+
+        server = socket.create_server(('127.0.0.1', BACKEND), backlog=128)
+
+        def send(conn):
+            with conn:
+                try:
+                    for _ in range(repeat):
+                        conn.sendfile(f, 0)
+                except OSError:
+                    pass
+
+        while True:
+            conn, _ = server.accept()
+            threading.Thread(target=send, args=(conn,), daemon=True).start()
+
+
+def client(total):
+    buf = bytearray(1024 * 1024)
+
+    with socket.create_connection(('127.0.0.1', PORT)) as s:
+        while True:
+            n = s.recv_into(buf)
+            if n == 0:
+                break
+            total.append(n)
+
+
+def conf(splice, workers):
+    return '''
+worker_processes %d;
+events { worker_connections 1024; }
+stream {
+    server {
+        listen 127.0.0.1:%d;
+        proxy_pass 127.0.0.1:%d;
+        proxy_buffer_size 64k;
+        proxy_splice %s;
+    }
+}
+''' % (workers, PORT, BACKEND, splice)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('nginx')
+    parser.add_argument('-s', '--size', type=int, default=64,
+                        help='file size, megabytes')
+    parser.add_argument('-r', '--repeat', type=int, default=16,
+                        help='times the file is sent per connection')
+    parser.add_argument('-c', '--connections', type=int, default=4)
+    parser.add_argument('-w', '--workers', type=int, default=1)
+    parser.add_argument('--backend', action='store_true',
+                        help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.backend:
+        backend(args.size * 1024 * 1024, args.repeat)
+        return
+
+    backends = subprocess.Popen([sys.executable] + sys.argv + ['--backend'])
+
+    try:
+        wait_port(BACKEND)
+
+        print('%d connections, %d x %dM each, %d workers'
+              % (args.connections, args.repeat, args.size, args.workers))
+
+        for splice in ('off', 'on'):
+            with Nginx(args.nginx, conf(splice, args.workers)) as nginx:
+                nginx.start(PORT)
+
+                total = []
+                threads = [threading.Thread(target=client, args=(total,))
+                           for _ in range(args.connections)]
+
+                cpu = nginx.cpu()
+                start = time.monotonic()
+
+                for t in threads:
+                    t.start()
+                for t in threads:
+                    t.join()
+
+                elapsed = time.monotonic() - start
+                cpu = nginx.cpu() - cpu
+
+            gbytes = sum(total) / (1 << 30)
+
+            print('proxy_splice %-3s  %7.0f MB/s  %5.2f worker CPU s/GB'
+                  % (splice, sum(total) / (1 << 20) / elapsed,
+                     cpu / gbytes if gbytes else 0))
+
+    finally:
+        backends.kill()
+        backends.wait()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+
+# Copyright (C) Nginx, Inc.
+
+"""Compares the HTTP upstream balancers under the same load.
+
+Ten backends answer after an exponentially distributed delay, two of
+them much slower than the others.  Every balancer gets the same number
+of requests from the same number of keepalive clients, and the request
+latency percentiles seen by the clients are printed.
+
+    upstream_balancers.py [-n REQUESTS] [-c CLIENTS] objs/nginx
+"""
+
+import argparse
+import asyncio
+import os
+import random
+import subprocess
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from nginx_bench import Nginx, percentile, wait_port
+
+
+PORT = 19380
+BACKEND = 19390
+
+BALANCERS = [
+    ('round robin', ''),
+    ('least_conn', 'least_conn;'),
+    ('random', 'random;'),
+    ('random two', 'random two;'),
+    ('random two least_time', 'random two least_time;'),
+]
+
+
+async def backend(fast, slow, nslow):
+
+    async def handle(reader, writer, delay):
+        try:
+            while await reader.readuntil(b'\r\n\r\n'):
+                await asyncio.sleep(random.expovariate(1 / delay))
+                writer.write(b'HTTP/1.1 200 OK\r\n'
+                             b'Content-Length: 2\r\n\r\nok')
+                await writer.drain()
+        except (asyncio.IncompleteReadError, ConnectionError):
+            pass
+        writer.close()
+
+    for i in range(10):
+        delay = slow if i < nslow else fast
+        await asyncio.start_server(
+            lambda r, w, d=delay: handle(r, w, d), '127.0.0.1', BACKEND + i)
+
+    await asyncio.Event().wait()
+
+
+async def load(requests, clients):
+    latency = []
+
+    async def client(n):
+        reader, writer = await asyncio.open_connection('127.0.0.1', PORT)
+
+        for _ in range(n):
+            start = time.monotonic()
+            writer.write(b'GET / HTTP/1.1\r\nHost: bench\r\n\r\n')
+            await writer.drain()
+            await reader.readuntil(b'\r\n\r\n')
+            await reader.readexactly(2)
+            latency.append(time.monotonic() - start)
+
+        writer.close()
+
+    start = time.monotonic()
+    await asyncio.gather(*[client(requests // clients)
+                           for _ in range(clients)])
+
+    return latency, time.monotonic() - start
+
+
+def conf(balancer, workers):
+    servers = ''.join('        server 127.0.0.1:%d;\n' % (BACKEND + i)
+                      for i in range(10))
+
+    return '''
+worker_processes %d;
+events { worker_connections 4096; }
+http {
+    access_log off;
+    keepalive_requests 1000000;
+
+    upstream backend {
+        zone backend 64k;
+        %s
+%s        keepalive 64;
+    }
+
+    server {
+        listen 127.0.0.1:%d;
+
+        location / {
+            proxy_pass http://backend;
+            proxy_http_version 1.1;
+            proxy_set_header Connection "";
+        }
+    }
+}
+''' % (workers, balancer, servers, PORT)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('nginx')
+    parser.add_argument('-n', '--requests', type=int, default=6400)
+    parser.add_argument('-c', '--clients', type=int, default=64)
+    parser.add_argument('-w', '--workers', type=int, default=2)
+    parser.add_argument('--fast', type=float, default=0.005)
+    parser.add_argument('--slow', type=float, default=0.060)
+    parser.add_argument('--slow-backends', type=int, default=2)
+    parser.add_argument('--backend', action='store_true',
+                        help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.backend:
+        asyncio.run(backend(args.fast, args.slow, args.slow_backends))
+        return
+
+    backends = subprocess.Popen([sys.executable] + sys.argv + ['--backend'])
+
+    try:
+        wait_port(BACKEND + 9)
+
+        print('%d requests, %d clients, %d workers'
+              % (args.requests, args.clients, args.workers))
+
+        for name, balancer in BALANCERS:
+            with Nginx(args.nginx, conf(balancer, args.workers)) as nginx:
+                nginx.start(PORT)
+
+                latency, elapsed = asyncio.run(load(args.requests,
+                                                    args.clients))
+
+            print('%-22s %6.0f r/s  p50 %6.1fms  p90 %6.1fms  p99 %6.1fms'
+                  % (name, len(latency) / elapsed,
+                     percentile(latency, 0.5) * 1000,
+                     percentile(latency, 0.9) * 1000,
+                     percentile(latency, 0.99) * 1000))
+
+    finally:
+        backends.kill()
+        backends.wait()
+
+
+if __name__ == '__main__':
+    main()
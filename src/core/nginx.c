@@ -22,6 +22,7 @@ static char *ngx_set_env(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_set_priority(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_set_worker_slab_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 
 static ngx_conf_enum_t  ngx_debug_points[] = 
@@ -215,6 +216,22 @@ static ngx_command_t  ngx_core_commands[] =
 		NULL 
     },
 
+	//﷨: worker_slab_cache number|off
+	//Ĭֵ: worker_slab_cache off
+	//ÿworkerΪÿ鹲ڴÿchunkСһ˽л(magazine)
+	//໺numberchunkͷֻڻΪջʱ
+	//Դ˼ٶworker֮Թڴľ
+	//workerеĿchunkʱ޷ǰworkerʹá
+	//汾ҲڹڴУworker쳣˳masterеchunk黹
+    { 
+		ngx_string("worker_slab_cache"),
+		NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+		ngx_set_worker_slab_cache,
+		0,
+		0,
+		NULL 
+    },
+
 	//﷨: working_directory path
 	//ָcoredumpļĿ¼
 	//worker̵ĹĿ¼Ψһ;coredumpļõĿ¼
@@ -591,6 +608,11 @@ ngx_add_inherited_sockets(ngx_cycle_t *cycle)
 			
 			//ʼļ
             ls->fd = (ngx_socket_t) s;
+
+#if (NGX_HAVE_REUSEPORT_EBPF)
+            //eBPF׽ֱexec̳
+            ls->reuseport_map = -1;
+#endif
         }
     }
 
@@ -1110,6 +1132,7 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
 
     ccf->rlimit_nofile = NGX_CONF_UNSET;
     ccf->rlimit_core = NGX_CONF_UNSET;
+    ccf->slab_cache = NGX_CONF_UNSET_UINT;
 
     ccf->user = (ngx_uid_t) NGX_CONF_UNSET_UINT;
     ccf->group = (ngx_gid_t) NGX_CONF_UNSET_UINT;
@@ -1133,6 +1156,7 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_msec_value(ccf->timer_resolution, 0);
     ngx_conf_init_value(ccf->worker_processes, 1);
     ngx_conf_init_value(ccf->debug_points, 0);
+    ngx_conf_init_uint_value(ccf->slab_cache, 0);
 
 #if (NGX_HAVE_CPU_AFFINITY)
 
@@ -1531,3 +1555,38 @@ ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_set_worker_slab_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_int_t         n;
+    ngx_str_t        *value;
+    ngx_core_conf_t  *ccf;
+
+    ccf = (ngx_core_conf_t *) conf;
+
+    if (ccf->slab_cache != NGX_CONF_UNSET_UINT)
+	{
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) 
+	{
+        ccf->slab_cache = 0;
+        return NGX_CONF_OK;
+    }
+
+    n = ngx_atoi(value[1].data, value[1].len);
+
+    if (n == NGX_ERROR || n == 0) 
+	{
+        return "invalid value";
+    }
+
+    ccf->slab_cache = n;
+
+    return NGX_CONF_OK;
+}
@@ -32,6 +32,10 @@ ngx_create_listening(ngx_conf_t *cf, void *sockaddr, socklen_t socklen)
     }
     ngx_memzero(ls, sizeof(ngx_listening_t));
 
+#if (NGX_HAVE_REUSEPORT_EBPF)
+    ls->reuseport_map = -1;
+#endif
+
 	/*set the socket address*/
     sa = ngx_palloc(cf->pool, socklen);
     if (sa == NULL) 
@@ -210,6 +214,15 @@ ngx_set_inherited_sockets(ngx_cycle_t *cycle)
 
         ls[i].backlog = NGX_LISTEN_BACKLOG;
 
+		/*get the socket type*/
+        olen = sizeof(int);
+        if (getsockopt(ls[i].fd, SOL_SOCKET, SO_TYPE, (void *) &ls[i].type, &olen) == -1)
+		{
+            ngx_log_error(NGX_LOG_CRIT, cycle->log, ngx_socket_errno, "getsockopt(SO_TYPE) %V failed", &ls[i].addr_text);
+            ls[i].ignore = 1;
+            continue;
+        }
+
 		/*get the recv buffer size*/
         olen = sizeof(int);
         if (getsockopt(ls[i].fd, SOL_SOCKET, SO_RCVBUF, (void *) &ls[i].rcvbuf, &olen) == -1)
@@ -530,6 +543,12 @@ ngx_open_listening_sockets(ngx_cycle_t *cycle)
             }
 #endif
 
+            if (ls[i].type != SOCK_STREAM)
+			{
+                ls[i].fd = s;
+                continue;
+            }
+
             if (listen(s, ls[i].backlog) == -1)
 			{
                 err = ngx_socket_errno;
@@ -849,6 +868,13 @@ ngx_close_listening_sockets(ngx_cycle_t *cycle)
 
         ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0, "close listening %V #%d ", &ls[i].addr_text, ls[i].fd);
 
+		/*UDP sessions of an exiting worker still send responses through the listening socket*/
+        if (ls[i].type == SOCK_DGRAM && ngx_process == NGX_PROCESS_WORKER)
+		{
+            ls[i].fd = (ngx_socket_t) -1;
+            continue;
+        }
+
         if (ngx_close_socket(ls[i].fd) == -1) {
             ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_socket_errno, ngx_close_socket_n " %V failed", &ls[i].addr_text);
         }
@@ -978,8 +1004,13 @@ ngx_close_connection(ngx_connection_t *c)
         ngx_del_timer(c->write);
     }
 
-	/*remove from kernel io*/
-    if (ngx_del_conn) 
+	/*remove from kernel io, the events of a shared socket belong to the listening connection*/
+    if (c->shared)
+	{
+        /* void */
+
+    }
+	else if (ngx_del_conn) 
 	{
         ngx_del_conn(c, NGX_CLOSE_EVENT);
 
@@ -1021,6 +1052,11 @@ ngx_close_connection(ngx_connection_t *c)
 	/*close socket */
     fd = c->fd;
     c->fd = (ngx_socket_t) -1;
+
+    if (c->shared)
+	{
+        return;
+    }
     if (ngx_close_socket(fd) == -1) 
 	{
         err = ngx_socket_errno;
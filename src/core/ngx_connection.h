@@ -49,8 +49,17 @@ struct ngx_listening_s
     ngx_listening_t    *previous;
     ngx_connection_t   *connection;
 
+    ngx_rbtree_t        rbtree;			/*UDP׽ϵĻỰԿͻ˵ַΪ*/
+    ngx_rbtree_node_t   sentinel;
+
     ngx_uint_t          worker;  		/*ü׽worker̵ı*/
 
+    void               *accept_stat;	/*ڴеngx_event_listening_stat_tûͳʱΪNULL*/
+
+#if (NGX_HAVE_REUSEPORT_EBPF)
+    int                 reuseport_map;	/*reuseporteBPF׽ֱworker̵ıΪûʱΪ-1*/
+#endif
+
     unsigned            open:1;
     unsigned            remain:1;
     unsigned            ignore:1;				/* Ը׽ */
@@ -69,6 +78,9 @@ struct ngx_listening_s
 #if (NGX_HAVE_REUSEPORT)
     unsigned            reuseport:1;			/* reuseport״̬*/	
     unsigned            add_reuseport:1;       	/* Ƿreuseport*/
+#endif
+#if (NGX_HAVE_REUSEPORT_EBPF)
+    unsigned            reuseport_steered:1;	/* reuseporteBPFCPUѡ׽*/
 #endif
     unsigned            keepalive:2;
 
@@ -134,6 +146,8 @@ struct ngx_connection_s
     ngx_event_t        *write;		
 	//ӶӦ׽־
     ngx_socket_t        fd;   
+	//׽ͣSOCK_STREAMSOCK_DGRAM
+    int                 type;
 	/*4ԱԷָʽ֣ ˵ÿӶԲòͬĽշ ÿ¼ģ鶼ؾΪ*/
 	//ֱӽַķϵͳĲָͬͬĺ
     ngx_recv_pt         recv;	
@@ -172,6 +186,8 @@ struct ngx_connection_s
 	//ڽաͻ˷ֽÿ¼ģɾӳзĿռֶΡ
 	//磬HTTPģУĴСclient_header_buffer_size	
     ngx_buf_t          *buffer;		
+	//UDPỰָrbtreeеĽڵ㣬TCPΪNULL
+    ngx_udp_session_t  *udp;
 	//˫Ԫصʽӵngx_cycle_tĽṹreuseable_connections_queue˫Уʾõ
     ngx_queue_t         queue;		
 	//ʹôngx_connection_tṹÿνһԿͻ˵ӣ˷ʱ(ngx_peer_connection_sҲʹ)number 1
@@ -256,6 +272,8 @@ NGX_TCP_NOPUSH_DISABLED
     unsigned            tcp_nopush:2;    	
 
     unsigned            need_last_buf:1;
+	//־λΪ 1ʱʾfdڼ׽(UDPỰ)رʱܹرfdҲɾ¼
+    unsigned            shared:1;
 
 #if (NGX_HAVE_IOCP)
     unsigned            accept_context_updated:1;	
@@ -481,6 +481,11 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                     continue;
                 }
 
+                if (nls[n].type != ls[i].type)
+				{
+                    continue;
+                }
+
                 if (ngx_cmp_sockaddr(nls[n].sockaddr, nls[n].socklen, ls[i].sockaddr, ls[i].socklen, 1) == NGX_OK)
                 {
                     nls[n].fd = ls[i].fd;
@@ -662,6 +667,15 @@ old_shm_zone_done:
     ls = old_cycle->listening.elts;
     for (i = 0; i < old_cycle->listening.nelts; i++) {
 
+#if (NGX_HAVE_REUSEPORT_EBPF)
+        /* the map of a group not steered by the new cycle */
+
+        if (ls[i].reuseport_map != -1) {
+            (void) close(ls[i].reuseport_map);
+            ls[i].reuseport_map = -1;
+        }
+#endif
+
         if (ls[i].remain || ls[i].fd == (ngx_socket_t) -1) {
             continue;
         }
@@ -126,6 +126,9 @@ typedef struct
 	//ָNginx worker̵niceȼ
 	int                      priority;
 
+	//worker˽еĹڴchunkУÿslot໺chunk0ʾر
+	ngx_uint_t               slab_cache;
+
 	ngx_uint_t               cpu_affinity_n;	/*cpu_affinityԪظ*/
 	uint64_t                *cpu_affinity;  	/*uint64_t͵飬ÿԪرʾһ̵CPU׺*/
 
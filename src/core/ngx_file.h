@@ -27,6 +27,7 @@ struct ngx_file_s
 #if (NGX_THREADS)
     ngx_int_t                (*thread_handler)(ngx_thread_task_t *task, ngx_file_t *file);
     void                      *thread_ctx;
+    ngx_thread_task_t         *thread_task;	/*̳߳дļ*/
 #endif
 
 #if (NGX_HAVE_FILE_AIO)
@@ -79,6 +80,7 @@ typedef struct
     unsigned                   log_level:8;
     unsigned                   persistent:1;
     unsigned                   clean:1;
+    unsigned                   thread_write:1;	/*̳ͨ߳дļ*/
 } ngx_temp_file_t;
 
 
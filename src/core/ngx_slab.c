@@ -56,6 +56,42 @@
 
 #endif
 
+/*
+ * per-process magazine of free chunks of one slot, filled and drained
+ * in batches under the pool mutex and used without locking in between
+ */
+typedef struct
+{
+    ngx_uint_t        count;
+    void            **chunks;
+} ngx_slab_magazine_t;
+
+/*
+ * һworkerһ鹲ڴеȫmagazineҲ鹲ڴв
+ * pool->cachesϣworker쳣˳workerݴ˰лchunk黹pool
+ */
+typedef struct ngx_slab_cache_s  ngx_slab_cache_t;
+
+struct ngx_slab_cache_s
+{
+    ngx_slab_pool_t      *pool;
+    ngx_pid_t             pid;			/*worker*/
+    ngx_slab_cache_t     *next;			/*pool->caches*/
+    ngx_slab_magazine_t  *magazines;	/*ÿslotһmagazine*/
+};
+
+
+static void *ngx_slab_alloc_chunk(ngx_slab_pool_t *pool, size_t size);
+static void ngx_slab_free_chunk(ngx_slab_pool_t *pool, void *p);
+static ngx_slab_cache_t *ngx_slab_cache_create(ngx_slab_pool_t *pool);
+static void ngx_slab_cache_free(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache);
+static void ngx_slab_cache_reclaim(ngx_slab_pool_t *pool);
+static ngx_slab_cache_t *ngx_slab_cache_get(ngx_slab_pool_t *pool);
+static ngx_slab_magazine_t *ngx_slab_cache_magazine(ngx_slab_pool_t *pool, size_t size);
+static ngx_slab_magazine_t *ngx_slab_cache_chunk(ngx_slab_pool_t *pool, void *p);
+static void *ngx_slab_cache_refill(ngx_slab_pool_t *pool, size_t size, ngx_slab_magazine_t *mag);
+static void ngx_slab_cache_drain(ngx_slab_pool_t *pool, ngx_slab_magazine_t *mag, ngx_uint_t n);
+static void ngx_slab_cache_drain_pool(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page, ngx_uint_t pages);
 static void ngx_slab_error(ngx_slab_pool_t *pool, ngx_uint_t level, char *text);
@@ -65,6 +101,16 @@ static ngx_uint_t  ngx_slab_max_size;  		/*slot
 static ngx_uint_t  ngx_slab_exact_size;		/*һuintptr_t͵λͼҳлʱÿһĴС*/
 static ngx_uint_t  ngx_slab_exact_shift;
 
+static ngx_uint_t         ngx_slab_pool_index;	/*һʼpool*/
+
+static ngx_uint_t         ngx_slab_cache_size;	/*ÿmagazinechunk0ʾر*/
+static ngx_slab_cache_t **ngx_slab_caches;		/*pool->indexΪ±*/
+static ngx_uint_t         ngx_slab_caches_n;
+
+#if (NGX_THREADS)
+static pthread_t          ngx_slab_cache_thread;	/*¼ѭֻ̣߳ʹû*/
+#endif
+
 
 void
 ngx_slab_init(ngx_slab_pool_t *pool)
@@ -129,19 +175,137 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
+
+    pool->index = ngx_slab_pool_index++;
+    pool->locks = 0;
+    pool->contended = 0;
+    pool->refills = 0;
+    pool->drains = 0;
+
+    pool->shards = NULL;
+    pool->shard_size = 0;
+    pool->nshards = 0;
+
+    pool->caches = NULL;
+
+    for (n = 0; n < NGX_SLAB_ORPHANS; n++)
+    {
+        pool->orphans[n] = 0;
+    }
+}
+
+
+void
+ngx_slab_lock(ngx_slab_pool_t *pool)
+{
+    if (!ngx_shmtx_trylock(&pool->mutex))
+    {
+        ngx_shmtx_lock(&pool->mutex);
+        pool->contended++;
+    }
+
+    pool->locks++;
+}
+
+
+void
+ngx_slab_unlock(ngx_slab_pool_t *pool)
+{
+    ngx_shmtx_unlock(&pool->mutex);
+}
+
+
+/*
+ * The shards are allocated by the zone, each of "size" bytes starting
+ * with ngx_slab_shard_t.  They are recorded in the pool, so that
+ * the lock counters of the shards can be reported.
+ */
+
+ngx_int_t
+ngx_slab_shards_init(ngx_slab_pool_t *pool, void *shards, size_t size,
+    ngx_uint_t n)
+{
+    ngx_uint_t         i;
+    ngx_slab_shard_t  *shard;
+
+    for (i = 0; i < n; i++) {
+        shard = (ngx_slab_shard_t *) ((u_char *) shards + i * size);
+
+        if (ngx_shmtx_create(&shard->mutex, &shard->lock, NULL) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        shard->locks = 0;
+        shard->contended = 0;
+    }
+
+    pool->shards = shards;
+    pool->shard_size = size;
+    pool->nshards = n;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_slab_shard_lock(ngx_slab_shard_t *shard)
+{
+    if (!ngx_shmtx_trylock(&shard->mutex))
+    {
+        ngx_shmtx_lock(&shard->mutex);
+        shard->contended++;
+    }
+
+    shard->locks++;
+}
+
+
+ngx_uint_t
+ngx_slab_shard_trylock(ngx_slab_shard_t *shard)
+{
+    if (!ngx_shmtx_trylock(&shard->mutex))
+    {
+        return 0;
+    }
+
+    shard->locks++;
+
+    return 1;
+}
+
+
+void
+ngx_slab_shard_unlock(ngx_slab_shard_t *shard)
+{
+    ngx_shmtx_unlock(&shard->mutex);
 }
 
 
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
-    void  *p;
+    void                 *p;
+    ngx_slab_magazine_t  *mag;
 
-    ngx_shmtx_lock(&pool->mutex);
+    mag = ngx_slab_cache_magazine(pool, size);
 
-    p = ngx_slab_alloc_locked(pool, size);
+    if (mag && mag->count)
+    {
+        return mag->chunks[--mag->count];
+    }
 
-    ngx_shmtx_unlock(&pool->mutex);
+    ngx_slab_lock(pool);
+
+    if (mag)
+    {
+        p = ngx_slab_cache_refill(pool, size, mag);
+    }
+    else
+    {
+        p = ngx_slab_alloc_chunk(pool, size);
+    }
+
+    ngx_slab_unlock(pool);
 
     return p;
 }
@@ -149,6 +313,27 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+    ngx_slab_magazine_t  *mag;
+
+    mag = ngx_slab_cache_magazine(pool, size);
+
+    if (mag == NULL)
+    {
+        return ngx_slab_alloc_chunk(pool, size);
+    }
+
+    if (mag->count)
+    {
+        return mag->chunks[--mag->count];
+    }
+
+    return ngx_slab_cache_refill(pool, size, mag);
+}
+
+
+static void *
+ngx_slab_alloc_chunk(ngx_slab_pool_t *pool, size_t size)
 {
     size_t            s;
     uintptr_t         p, n, m, mask, *bitmap;
@@ -419,11 +604,11 @@ ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size)
 {
     void  *p;
 
-    ngx_shmtx_lock(&pool->mutex);
-
-    p = ngx_slab_calloc_locked(pool, size);
-
-    ngx_shmtx_unlock(&pool->mutex);
+    p = ngx_slab_alloc(pool, size);
+    if (p)
+    {
+        ngx_memzero(p, size);
+    }
 
     return p;
 }
@@ -447,16 +632,56 @@ ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
-    ngx_shmtx_lock(&pool->mutex);
+    ngx_slab_magazine_t  *mag;
 
-    ngx_slab_free_locked(pool, p);
+    mag = ngx_slab_cache_chunk(pool, p);
 
-    ngx_shmtx_unlock(&pool->mutex);
+    if (mag)
+    {
+        if (mag->count == ngx_slab_cache_size)
+        {
+            ngx_slab_lock(pool);
+            ngx_slab_cache_drain(pool, mag, ngx_slab_cache_size - ngx_slab_cache_size / 2);
+            ngx_slab_unlock(pool);
+        }
+
+        mag->chunks[mag->count++] = p;
+
+        return;
+    }
+
+    ngx_slab_lock(pool);
+
+    ngx_slab_free_chunk(pool, p);
+
+    ngx_slab_unlock(pool);
 }
 
 
 void
 ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+    ngx_slab_magazine_t  *mag;
+
+    mag = ngx_slab_cache_chunk(pool, p);
+
+    if (mag == NULL)
+    {
+        ngx_slab_free_chunk(pool, p);
+        return;
+    }
+
+    if (mag->count == ngx_slab_cache_size)
+    {
+        ngx_slab_cache_drain(pool, mag, ngx_slab_cache_size - ngx_slab_cache_size / 2);
+    }
+
+    mag->chunks[mag->count++] = p;
+}
+
+
+static void
+ngx_slab_free_chunk(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
@@ -673,6 +898,421 @@ fail:
 }
 
 
+/*
+ * workerfork̳֮֮߳ǰãÿ˽еchunk(magazine)
+ * master̲ܻchunkfork̻ͬһڴ档
+ * Ϊcycleйڴ仺棬֮չngx_slab_caches
+ * ڴ治ɻʱ鹲ڴ治ʹû档
+ * ûм̳߳еֱ߳ʹpool
+ */
+void
+ngx_slab_cache_init(ngx_cycle_t *cycle, ngx_uint_t size)
+{
+    ngx_uint_t        i;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_list_part_t  *part;
+    ngx_slab_pool_t  *pool;
+
+    /* indexes of all pools are below the counter inherited from the master */
+
+    ngx_slab_caches = ngx_calloc(ngx_slab_pool_index * sizeof(ngx_slab_cache_t *), cycle->log);
+    if (ngx_slab_caches == NULL)
+    {
+        return;
+    }
+
+    ngx_slab_caches_n = ngx_slab_pool_index;
+    ngx_slab_cache_size = size;
+
+#if (NGX_THREADS)
+    ngx_slab_cache_thread = pthread_self();
+#endif
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++)
+    {
+        if (i >= part->nelts)
+        {
+            if (part->next == NULL)
+            {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        pool = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        if (pool->index < ngx_slab_caches_n)
+        {
+            ngx_slab_caches[pool->index] = ngx_slab_cache_create(pool);
+        }
+    }
+}
+
+
+/*̻chunk黹Եpoolworker˳ʱ*/
+void
+ngx_slab_cache_flush(void)
+{
+    ngx_uint_t         i;
+    ngx_slab_pool_t   *pool;
+    ngx_slab_cache_t  *cache;
+
+    for (i = 0; i < ngx_slab_caches_n; i++)
+    {
+        cache = ngx_slab_caches[i];
+
+        if (cache == NULL)
+        {
+            continue;
+        }
+
+        pool = cache->pool;
+
+        ngx_slab_lock(pool);
+        ngx_slab_cache_reclaim(pool);
+        ngx_slab_cache_free(pool, cache);
+        ngx_slab_unlock(pool);
+
+        ngx_slab_caches[i] = NULL;
+    }
+
+    ngx_slab_cache_size = 0;
+}
+
+
+/*
+ * masterworker쳣˳SIGCHLDеãֻpidؼ
+ * pool->orphansʱpoolܱworkerУpoolҲܱ˳worker
+ * һ룬黹chunkһ黹worker
+ * ڳʱաûпλʱchunkй©0
+ */
+ngx_uint_t
+ngx_slab_cache_orphan(ngx_slab_pool_t *pool, ngx_pid_t pid)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < NGX_SLAB_ORPHANS; i++)
+    {
+        if (ngx_atomic_cmp_set(&pool->orphans[i], 0, (ngx_atomic_uint_t) pid))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+/*ڳ»masterǵ쳣˳workerĻ*/
+static void
+ngx_slab_cache_reclaim(ngx_slab_pool_t *pool)
+{
+    ngx_pid_t          pid;
+    ngx_uint_t         i;
+    ngx_slab_cache_t  *cache;
+
+    for (i = 0; i < NGX_SLAB_ORPHANS; i++)
+    {
+        pid = (ngx_pid_t) pool->orphans[i];
+
+        if (pid == 0)
+        {
+            continue;
+        }
+
+        for (cache = pool->caches; cache; cache = cache->next)
+        {
+            if (cache->pid == pid)
+            {
+                ngx_slab_cache_free(pool, cache);
+
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                              "chunk cache of %P was released%s",
+                              pid, pool->log_ctx);
+                break;
+            }
+        }
+
+        pool->orphans[i] = 0;
+    }
+}
+
+
+static ngx_slab_cache_t *
+ngx_slab_cache_create(ngx_slab_pool_t *pool)
+{
+    u_char            *p;
+    size_t             size;
+    ngx_uint_t         i, n, log_nomem;
+    ngx_slab_cache_t  *cache;
+
+    n = ngx_pagesize_shift - pool->min_shift;
+    size = sizeof(ngx_slab_cache_t) + n * (sizeof(ngx_slab_magazine_t) + ngx_slab_cache_size * sizeof(void *));
+
+    ngx_slab_lock(pool);
+
+    /* a respawned worker may reuse the pid of the one it replaces */
+
+    ngx_slab_cache_reclaim(pool);
+
+    log_nomem = pool->log_nomem;
+    pool->log_nomem = 0;
+
+    p = ngx_slab_alloc_chunk(pool, size);
+
+    pool->log_nomem = log_nomem;
+
+    if (p == NULL)
+    {
+        ngx_slab_unlock(pool);
+        return NULL;
+    }
+
+    cache = (ngx_slab_cache_t *) p;
+    p += sizeof(ngx_slab_cache_t);
+
+    cache->pool = pool;
+    cache->pid = ngx_pid;
+
+    cache->magazines = (ngx_slab_magazine_t *) p;
+    p += n * sizeof(ngx_slab_magazine_t);
+
+    for (i = 0; i < n; i++)
+    {
+        cache->magazines[i].count = 0;
+        cache->magazines[i].chunks = (void **) p;
+        p += ngx_slab_cache_size * sizeof(void *);
+    }
+
+    cache->next = pool->caches;
+    pool->caches = cache;
+
+    ngx_slab_unlock(pool);
+
+    return cache;
+}
+
+
+/*ڳ¹黹еchunkͷŻ汾*/
+static void
+ngx_slab_cache_free(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache)
+{
+    ngx_slab_cache_t  **cachep;
+
+    ngx_slab_cache_drain_pool(pool, cache);
+
+    for (cachep = (ngx_slab_cache_t **) &pool->caches; *cachep; cachep = &(*cachep)->next)
+    {
+        if (*cachep == cache)
+        {
+            *cachep = cache->next;
+            break;
+        }
+    }
+
+    ngx_slab_free_chunk(pool, cache);
+}
+
+
+static ngx_slab_cache_t *
+ngx_slab_cache_get(ngx_slab_pool_t *pool)
+{
+    if (pool->index >= ngx_slab_caches_n)
+    {
+        return NULL;
+    }
+
+    return ngx_slab_caches[pool->index];
+}
+
+
+/*sizeСķӦmagazineɻʱNULL*/
+static ngx_slab_magazine_t *
+ngx_slab_cache_magazine(ngx_slab_pool_t *pool, size_t size)
+{
+    size_t             s;
+    ngx_uint_t         shift;
+    ngx_slab_cache_t  *cache;
+
+    if (ngx_slab_cache_size == 0 || size > ngx_slab_max_size)
+    {
+        return NULL;
+    }
+
+#if (NGX_THREADS)
+    if (!pthread_equal(pthread_self(), ngx_slab_cache_thread))
+    {
+        return NULL;
+    }
+#endif
+
+    if (size > pool->min_size)
+    {
+        shift = 1;
+        for (s = size - 1; s >>= 1; shift++) { /* void */ }
+    }
+    else
+    {
+        shift = pool->min_shift;
+    }
+
+    cache = ngx_slab_cache_get(pool);
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    return &cache->magazines[shift - pool->min_shift];
+}
+
+
+/*
+ * شͷŵchunkslotmagazineҳڴ淵NULL
+ * chunkδͷ֮ǰҳͺshiftı䣬
+ */
+static ngx_slab_magazine_t *
+ngx_slab_cache_chunk(ngx_slab_pool_t *pool, void *p)
+{
+    ngx_uint_t         n, shift;
+    ngx_slab_page_t   *page;
+    ngx_slab_cache_t  *cache;
+
+    if (ngx_slab_cache_size == 0)
+    {
+        return NULL;
+    }
+
+#if (NGX_THREADS)
+    if (!pthread_equal(pthread_self(), ngx_slab_cache_thread))
+    {
+        return NULL;
+    }
+#endif
+
+    if ((u_char *) p < pool->start || (u_char *) p >= pool->end)
+    {
+        return NULL;
+    }
+
+    n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
+    page = &pool->pages[n];
+
+    switch (page->prev & NGX_SLAB_PAGE_MASK)
+    {
+
+    case NGX_SLAB_SMALL:
+    case NGX_SLAB_BIG:
+        shift = page->slab & NGX_SLAB_SHIFT_MASK;
+        break;
+
+    case NGX_SLAB_EXACT:
+        shift = ngx_slab_exact_shift;
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        return NULL;
+    }
+
+    if ((uintptr_t) p & ((1 << shift) - 1))
+    {
+        /* let ngx_slab_free_chunk() report the wrong chunk */
+        return NULL;
+    }
+
+    cache = ngx_slab_cache_get(pool);
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+
+    return &cache->magazines[shift - pool->min_shift];
+}
+
+
+/*
+ * ڳһΪmagazineһchunkһchunk
+ * ʧʱȰѱ̻ĸpoolchunkȫ黹һ
+ */
+static void *
+ngx_slab_cache_refill(ngx_slab_pool_t *pool, size_t size, ngx_slab_magazine_t *mag)
+{
+    void        *p, *chunk;
+    ngx_uint_t   n, log_nomem;
+
+    log_nomem = pool->log_nomem;
+    pool->log_nomem = 0;
+
+    p = ngx_slab_alloc_chunk(pool, size);
+
+    if (p == NULL)
+    {
+        pool->log_nomem = log_nomem;
+
+        ngx_slab_cache_drain_pool(pool, ngx_slab_cache_get(pool));
+
+        return ngx_slab_alloc_chunk(pool, size);
+    }
+
+    for (n = ngx_slab_cache_size / 2; n; n--)
+    {
+        chunk = ngx_slab_alloc_chunk(pool, size);
+        if (chunk == NULL)
+        {
+            break;
+        }
+
+        mag->chunks[mag->count++] = chunk;
+    }
+
+    pool->log_nomem = log_nomem;
+    pool->refills++;
+
+    return p;
+}
+
+
+static void
+ngx_slab_cache_drain(ngx_slab_pool_t *pool, ngx_slab_magazine_t *mag, ngx_uint_t n)
+{
+    if (mag->count == 0)
+    {
+        return;
+    }
+
+    while (n-- && mag->count)
+    {
+        ngx_slab_free_chunk(pool, mag->chunks[--mag->count]);
+    }
+
+    pool->drains++;
+}
+
+
+static void
+ngx_slab_cache_drain_pool(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache)
+{
+    ngx_uint_t  i, n;
+
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    for (i = 0; i < n; i++)
+    {
+        ngx_slab_cache_drain(pool, &cache->magazines[i], cache->magazines[i].count);
+    }
+}
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
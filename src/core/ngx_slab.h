@@ -13,6 +13,9 @@
 #include <ngx_core.h>
 
 
+#define NGX_SLAB_ORPHANS  8
+
+
 typedef struct ngx_slab_page_s  ngx_slab_page_t;
 
 struct ngx_slab_page_s 
@@ -22,6 +25,17 @@ struct ngx_slab_page_s
     uintptr_t         prev;
 };
 
+//ƬÿƬλڷƬṹĿͷ
+typedef struct 
+{
+    ngx_shmtx_sh_t    lock;
+    ngx_shmtx_t       mutex;
+
+    /*ͳڳmutexʱ*/
+    ngx_uint_t        locks;		/**/
+    ngx_uint_t        contended;	/*ʱĴ*/
+} ngx_slab_shard_t;
+
 //ڹڴз
 typedef struct 
 {
@@ -46,6 +60,23 @@ typedef struct
 
     void             *data;			//ڴ˽(ڹڴз)
     void             *addr;			/*ڴʼַ*/
+
+    ngx_uint_t        index;		/*poolţڲҽ˽еchunk*/
+
+    /*ͳڳmutexʱ*/
+    ngx_uint_t        locks;		/**/
+    ngx_uint_t        contended;	/*ʱĴ*/
+    ngx_uint_t        refills;		/*magazine*/
+    ngx_uint_t        drains;		/*magazine黹*/
+
+    u_char           *shards;		/*Ƭ飬ûзƬʱΪNULL*/
+    size_t            shard_size;	/*ƬṹĴС*/
+    ngx_uint_t        nshards;		/*Ƭ*/
+
+    void             *caches;		/*worker̵magazinengx_slab.c*/
+
+    /*쳣˳workerpidmasterд룬worker仺沢*/
+    ngx_atomic_t      orphans[NGX_SLAB_ORPHANS];
 } ngx_slab_pool_t;
 
 
@@ -56,6 +87,16 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+void ngx_slab_lock(ngx_slab_pool_t *pool);
+void ngx_slab_unlock(ngx_slab_pool_t *pool);
+ngx_int_t ngx_slab_shards_init(ngx_slab_pool_t *pool, void *shards,
+    size_t size, ngx_uint_t n);
+void ngx_slab_shard_lock(ngx_slab_shard_t *shard);
+ngx_uint_t ngx_slab_shard_trylock(ngx_slab_shard_t *shard);
+void ngx_slab_shard_unlock(ngx_slab_shard_t *shard);
+void ngx_slab_cache_init(ngx_cycle_t *cycle, ngx_uint_t size);
+void ngx_slab_cache_flush(void);
+ngx_uint_t ngx_slab_cache_orphan(ngx_slab_pool_t *pool, ngx_pid_t pid);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
@@ -27,12 +27,32 @@ typedef struct {
     (q)->last = &(q)->first
 
 
+/*
+ * Each thread of a pool has its own bounded ring of tasks.  The event loop
+ * is the only producer and spreads tasks over the rings round-robin, while
+ * the threads take tasks from their own ring first and steal them from
+ * the other rings when it is empty.  Both sides are lock-free, the mutex
+ * and the condition variable are used only to put idle threads to sleep.
+ */
+
+typedef struct {
+    ngx_atomic_t              head;     /* advanced by the pool threads */
+    ngx_atomic_t              tail;     /* advanced by the event loop */
+    ngx_atomic_uint_t         mask;
+    ngx_thread_task_t       **tasks;
+    ngx_thread_pool_t        *pool;
+} ngx_thread_pool_ring_t;
+
+
 struct ngx_thread_pool_s 
 {
     ngx_thread_mutex_t        mtx;
-    ngx_thread_pool_queue_t   queue;
-    ngx_int_t                 waiting;
     ngx_thread_cond_t         cond;
+    ngx_atomic_t              idle;     /* threads sleeping on cond */
+    ngx_atomic_t              queued;   /* tasks in the rings */
+
+    ngx_thread_pool_ring_t   *rings;
+    ngx_uint_t                next;
 
     ngx_log_t                *log;
 
@@ -40,6 +60,10 @@ struct ngx_thread_pool_s
     ngx_uint_t                threads;
     ngx_int_t                 max_queue;
 
+#if (NGX_STAT_STUB)
+    ngx_thread_pool_stat_t   *stat;
+#endif
+
     u_char                   *file;
     ngx_uint_t                line;
 };
@@ -50,8 +74,16 @@ static ngx_int_t ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log,
 static void ngx_thread_pool_destroy(ngx_thread_pool_t *tp);
 static void ngx_thread_pool_exit_handler(void *data, ngx_log_t *log);
 
+static ngx_int_t ngx_thread_pool_push(ngx_thread_pool_t *tp,
+    ngx_thread_task_t *task);
+static ngx_thread_task_t *ngx_thread_pool_take(ngx_thread_pool_t *tp,
+    ngx_uint_t self);
 static void *ngx_thread_pool_cycle(void *data);
 static void ngx_thread_pool_handler(ngx_event_t *ev);
+#if (NGX_STAT_STUB)
+static ngx_uint_t ngx_thread_pool_usec(void);
+static void ngx_thread_pool_account(ngx_thread_task_t *task);
+#endif
 
 static char *ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
@@ -106,14 +138,20 @@ static ngx_uint_t               ngx_thread_pool_task_id;
 static ngx_atomic_t             ngx_thread_pool_done_lock;
 static ngx_thread_pool_queue_t  ngx_thread_pool_done;
 
+#if (NGX_STAT_STUB)
+static ngx_thread_pool_stat_t   ngx_stat_thread_pools0[NGX_THREAD_POOL_STATS];
+ngx_thread_pool_stat_t         *ngx_stat_thread_pools = ngx_stat_thread_pools0;
+#endif
+
 
 static ngx_int_t
 ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
 {
-    int             err;
-    pthread_t       tid;
-    ngx_uint_t      n;
-    pthread_attr_t  attr;
+    int                      err;
+    pthread_t                tid;
+    ngx_uint_t               n, size;
+    pthread_attr_t           attr;
+    ngx_thread_pool_ring_t  *ring;
 
     if (ngx_notify == NULL) {
         ngx_log_error(NGX_LOG_ALERT, log, 0,
@@ -121,7 +159,40 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
         return NGX_ERROR;
     }
 
-    ngx_thread_pool_queue_init(&tp->queue);
+#if !(NGX_HAVE_ATOMIC_OPS)
+
+    ngx_log_error(NGX_LOG_ALERT, log, 0,
+                  "thread pools require atomic operations");
+    return NGX_ERROR;
+
+#endif
+
+    /* the rings together hold at least max_queue tasks */
+
+    size = ((ngx_uint_t) tp->max_queue + tp->threads - 1) / tp->threads;
+
+    for (n = 1; n < size; n <<= 1) { /* void */ }
+
+    size = n;
+
+    tp->rings = ngx_pcalloc(pool, tp->threads * sizeof(ngx_thread_pool_ring_t));
+    if (tp->rings == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (n = 0; n < tp->threads; n++) {
+        ring = &tp->rings[n];
+
+        ring->tasks = ngx_palloc(pool, size * sizeof(ngx_thread_task_t *));
+        if (ring->tasks == NULL) {
+            return NGX_ERROR;
+        }
+
+        ring->mask = size - 1;
+        ring->pool = tp;
+    }
+
+    tp->next = 0;
 
     if (ngx_thread_mutex_create(&tp->mtx, log) != NGX_OK) {
         return NGX_ERROR;
@@ -151,7 +222,8 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
 #endif
 
     for (n = 0; n < tp->threads; n++) {
-        err = pthread_create(&tid, &attr, ngx_thread_pool_cycle, tp);
+        err = pthread_create(&tid, &attr, ngx_thread_pool_cycle,
+                             &tp->rings[n]);
         if (err) {
             ngx_log_error(NGX_LOG_ALERT, log, err,
                           "pthread_create() failed");
@@ -180,15 +252,13 @@ ngx_thread_pool_destroy(ngx_thread_pool_t *tp)
     for (n = 0; n < tp->threads; n++) {
         lock = 1;
 
-        if (ngx_thread_task_post(tp, &task) != NGX_OK) {
+        if (ngx_thread_pool_push(tp, &task) != NGX_OK) {
             return;
         }
 
         while (lock) {
             ngx_sched_yield();
         }
-
-        task.event.active = 0;
     }
 
     (void) ngx_thread_cond_destroy(&tp->cond, tp->log);
@@ -233,52 +303,170 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
         return NGX_ERROR;
     }
 
-    if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-        return NGX_ERROR;
-    }
+    /* the sleeping threads take the tasks at once */
 
-    if (tp->waiting >= tp->max_queue) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    if ((ngx_atomic_int_t) (tp->queued - tp->idle) < tp->max_queue) {
 
-        ngx_log_error(NGX_LOG_ERR, tp->log, 0,
-                      "thread pool \"%V\" queue overflow: %i tasks waiting",
-                      &tp->name, tp->waiting);
-        return NGX_ERROR;
+        task->event.active = 1;
+
+        task->id = ngx_thread_pool_task_id++;
+        task->next = NULL;
+
+#if (NGX_STAT_STUB)
+        task->pool = tp;
+
+        if (tp->stat) {
+            task->posted = ngx_thread_pool_usec();
+        }
+#endif
+
+        if (ngx_thread_pool_push(tp, task) == NGX_OK) {
+
+#if (NGX_STAT_STUB)
+            if (tp->stat) {
+                (void) ngx_atomic_fetch_add(&tp->stat->depth, 1);
+            }
+#endif
+
+            ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
+                           "task #%ui added to thread pool \"%V\"",
+                           task->id, &tp->name);
+
+            return NGX_OK;
+        }
+
+        task->event.active = 0;
     }
 
-    task->event.active = 1;
+#if (NGX_STAT_STUB)
+    if (tp->stat) {
+        (void) ngx_atomic_fetch_add(&tp->stat->overflows, 1);
+    }
+#endif
 
-    task->id = ngx_thread_pool_task_id++;
-    task->next = NULL;
+    ngx_log_error(NGX_LOG_ERR, tp->log, 0,
+                  "thread pool \"%V\" queue overflow: %A tasks waiting",
+                  &tp->name, tp->queued);
 
-    if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
-        return NGX_ERROR;
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_thread_pool_push(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
+{
+    ngx_uint_t               n;
+    ngx_atomic_uint_t        tail;
+    ngx_thread_pool_ring_t  *ring;
+
+    for (n = 0; n < tp->threads; n++) {
+
+        ring = &tp->rings[tp->next];
+
+        if (++tp->next == tp->threads) {
+            tp->next = 0;
+        }
+
+        tail = ring->tail;
+
+        if (tail - ring->head > ring->mask) {
+            /* the ring is full */
+            continue;
+        }
+
+        ring->tasks[tail & ring->mask] = task;
+
+        (void) ngx_atomic_fetch_add(&tp->queued, 1);
+
+        ngx_memory_barrier();
+
+        /*
+         * publish the task; the locked operation is also a full barrier
+         * which orders it before the idle threads check below
+         */
+
+        (void) ngx_atomic_fetch_add(&ring->tail, 1);
+
+        if (tp->idle) {
+            (void) ngx_thread_mutex_lock(&tp->mtx, tp->log);
+            (void) ngx_thread_cond_signal(&tp->cond, tp->log);
+            (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+        }
+
+        return NGX_OK;
     }
 
-    *tp->queue.last = task;
-    tp->queue.last = &task->next;
+    return NGX_DECLINED;
+}
 
-    tp->waiting++;
 
-    (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+static ngx_thread_task_t *
+ngx_thread_pool_take(ngx_thread_pool_t *tp, ngx_uint_t self)
+{
+    ngx_uint_t               i, n;
+    ngx_atomic_uint_t        head;
+    ngx_thread_task_t       *task;
+    ngx_thread_pool_ring_t  *ring;
 
-    ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
-                   "task #%ui added to thread pool \"%V\"",
-                   task->id, &tp->name);
+    /* the own ring first, then steal from the others */
 
-    return NGX_OK;
+    for (i = 0; i < tp->threads; i++) {
+
+        n = self + i;
+
+        if (n >= tp->threads) {
+            n -= tp->threads;
+        }
+
+        ring = &tp->rings[n];
+
+        for ( ;; ) {
+            head = ring->head;
+
+            if (head == ring->tail) {
+                break;
+            }
+
+            ngx_memory_barrier();
+
+            /*
+             * the slot cannot be reused before the head is moved,
+             * so the task read is valid if the head did not change
+             */
+
+            task = ring->tasks[head & ring->mask];
+
+            if (ngx_atomic_cmp_set(&ring->head, head, head + 1)) {
+                (void) ngx_atomic_fetch_add(&tp->queued, -1);
+
+#if (NGX_STAT_STUB)
+                task->stolen = (i != 0);
+#endif
+
+                return task;
+            }
+
+            ngx_cpu_pause();
+        }
+    }
+
+    return NULL;
 }
 
 
 static void *
 ngx_thread_pool_cycle(void *data)
 {
-    ngx_thread_pool_t *tp = data;
+    ngx_thread_pool_ring_t *ring = data;
 
     int                 err;
     sigset_t            set;
+    ngx_uint_t          self, notify;
     ngx_thread_task_t  *task;
+    ngx_thread_pool_t  *tp;
+
+    tp = ring->pool;
+    self = ring - tp->rings;
 
 #if 0
     ngx_time_update();
@@ -301,37 +489,54 @@ ngx_thread_pool_cycle(void *data)
     }
 
     for ( ;; ) {
-        if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
-        }
+        task = ngx_thread_pool_take(tp, self);
 
-        /* the number may become negative */
-        tp->waiting--;
+        if (task == NULL) {
 
-        while (tp->queue.first == NULL) {
-            if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
-                != NGX_OK)
-            {
-                (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+            if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
                 return NULL;
             }
-        }
 
-        task = tp->queue.first;
-        tp->queue.first = task->next;
+            /*
+             * the locked increment orders the idle counter update
+             * before the rings are checked again, so a task posted
+             * meanwhile is either seen here or followed by a signal
+             */
 
-        if (tp->queue.first == NULL) {
-            tp->queue.last = &tp->queue.first;
-        }
+            (void) ngx_atomic_fetch_add(&tp->idle, 1);
+
+            for ( ;; ) {
+                task = ngx_thread_pool_take(tp, self);
+
+                if (task) {
+                    break;
+                }
 
-        if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
+                if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
+                    != NGX_OK)
+                {
+                    (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+                    return NULL;
+                }
+            }
+
+            (void) ngx_atomic_fetch_add(&tp->idle, -1);
+
+            if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
+                return NULL;
+            }
         }
 
 #if 0
         ngx_time_update();
 #endif
 
+#if (NGX_STAT_STUB)
+        if (task->pool && task->pool->stat) {
+            task->started = ngx_thread_pool_usec();
+        }
+#endif
+
         ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
                        "run task #%ui in thread pool \"%V\"",
                        task->id, &tp->name);
@@ -342,16 +547,31 @@ ngx_thread_pool_cycle(void *data)
                        "complete task #%ui in thread pool \"%V\"",
                        task->id, &tp->name);
 
+#if (NGX_STAT_STUB)
+        if (task->pool && task->pool->stat) {
+            task->completed = ngx_thread_pool_usec();
+        }
+#endif
+
         task->next = NULL;
 
         ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
 
+        /*
+         * the handler takes all the completed tasks at once, so only
+         * the task added to an empty list has to notify the event loop
+         */
+
+        notify = (ngx_thread_pool_done.first == NULL);
+
         *ngx_thread_pool_done.last = task;
         ngx_thread_pool_done.last = &task->next;
 
         ngx_unlock(&ngx_thread_pool_done_lock);
 
-        (void) ngx_notify(ngx_thread_pool_handler);
+        if (notify) {
+            (void) ngx_notify(ngx_thread_pool_handler);
+        }
     }
 }
 
@@ -376,6 +596,10 @@ ngx_thread_pool_handler(ngx_event_t *ev)
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
                        "run completion handler for task #%ui", task->id);
 
+#if (NGX_STAT_STUB)
+        ngx_thread_pool_account(task);
+#endif
+
         event = &task->event;
         task = task->next;
 
@@ -387,6 +611,101 @@ ngx_thread_pool_handler(ngx_event_t *ev)
 }
 
 
+#if (NGX_STAT_STUB)
+
+static ngx_uint_t
+ngx_thread_pool_usec(void)
+{
+    struct timeval  tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (ngx_uint_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+static void
+ngx_thread_pool_account(ngx_thread_task_t *task)
+{
+    ngx_int_t                d;
+    ngx_thread_pool_stat_t  *st;
+
+    if (task->pool == NULL || task->pool->stat == NULL) {
+        return;
+    }
+
+    st = task->pool->stat;
+
+    (void) ngx_atomic_fetch_add(&st->depth, -1);
+    (void) ngx_atomic_fetch_add(&st->tasks, 1);
+
+    if (task->stolen) {
+        (void) ngx_atomic_fetch_add(&st->steals, 1);
+    }
+
+    /* the wall clock may step back */
+
+    d = (ngx_int_t) (task->started - task->posted);
+
+    if (d > 0) {
+        (void) ngx_atomic_fetch_add(&st->wait, d);
+    }
+
+    d = (ngx_int_t) (task->completed - task->started);
+
+    if (d > 0) {
+        (void) ngx_atomic_fetch_add(&st->service, d);
+    }
+}
+
+
+/*
+ * Runs in the master or single process on every configuration load and
+ * binds the pools to counter slots in the statistics zone by name;
+ * slots are never released.
+ */
+
+void
+ngx_thread_pool_stats(ngx_cycle_t *cycle)
+{
+    size_t                    len;
+    ngx_uint_t                i, n;
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_stat_t   *st;
+    ngx_thread_pool_conf_t   *tcf;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts; i++) {
+
+        tpp[i]->stat = NULL;
+
+        len = ngx_min(tpp[i]->name.len, NGX_THREAD_POOL_NAME_LEN);
+
+        for (n = 0; n < NGX_THREAD_POOL_STATS; n++) {
+            st = &ngx_stat_thread_pools[n];
+
+            if (st->len == 0) {
+                ngx_memcpy(st->name, tpp[i]->name.data, len);
+                st->len = len;
+            }
+
+            if (st->len == len
+                && ngx_strncmp(st->name, tpp[i]->name.data, len) == 0)
+            {
+                tpp[i]->stat = st;
+                break;
+            }
+        }
+    }
+}
+
+#endif
+
+
 static void *
 ngx_thread_pool_create_conf(ngx_cycle_t *cycle)
 {
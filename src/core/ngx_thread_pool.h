@@ -14,6 +14,9 @@
 #include <ngx_event.h>
 
 
+typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
+
+
 struct ngx_thread_task_s 
 {
     ngx_thread_task_t   *next;
@@ -21,10 +24,39 @@ struct ngx_thread_task_s
     void                *ctx;
     void               (*handler)(void *data, ngx_log_t *log);
     ngx_event_t          event;
+
+#if (NGX_STAT_STUB)
+    ngx_thread_pool_t   *pool;
+    ngx_uint_t           posted;     /* usec */
+    ngx_uint_t           started;    /* usec */
+    ngx_uint_t           completed;  /* usec */
+    unsigned             stolen:1;
+#endif
 };
 
 
-typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
+#if (NGX_STAT_STUB)
+
+#define NGX_THREAD_POOL_STATS      16
+#define NGX_THREAD_POOL_NAME_LEN   32
+
+/* counters of a thread pool, summed over all workers */
+typedef struct {
+    ngx_atomic_t         depth;      /* posted and not yet completed tasks */
+    ngx_atomic_t         tasks;      /* completed tasks */
+    ngx_atomic_t         steals;     /* tasks run by a thread of another queue */
+    ngx_atomic_t         overflows;
+    ngx_atomic_t         wait;       /* total usec from post to start */
+    ngx_atomic_t         service;    /* total usec from start to completion */
+    size_t               len;        /* 0 - the slot is free */
+    u_char               name[NGX_THREAD_POOL_NAME_LEN];
+} ngx_thread_pool_stat_t;
+
+extern ngx_thread_pool_stat_t  *ngx_stat_thread_pools;
+
+void ngx_thread_pool_stats(ngx_cycle_t *cycle);
+
+#endif
 
 
 ngx_thread_pool_t *ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name);
@@ -0,0 +1,1856 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The readiness of sockets is reported by the poll requests: the listening
+ * sockets use the oneshot requests that are rearmed on completion and thus
+ * behave as level-triggered, the other connections use the multishot
+ * POLLIN requests that behave as edge-triggered, like EPOLLET.  The write
+ * events use the oneshot POLLOUT requests that are armed on demand: a write
+ * event becomes inactive once it is reported, and ngx_handle_write_event()
+ * arms it again after a short write, as the multishot requests may miss
+ * the wakeup of a socket that got send buffer space back after a short
+ * sendfile().  All the changes are submitted in batch together with waiting
+ * for completions, so an event loop iteration costs a single io_uring_enter()
+ * syscall.
+ *
+ * The connections are read through the ring as well: when recv() finds
+ * no data, a receive request is submitted instead of waiting for POLLIN,
+ * and the kernel completes it into one of the buffers provided to the ring
+ * once the data arrive, so the data come with the completion and
+ * the connections waiting for data do not hold a buffer.  The POLLIN of
+ * a connection with the receive request in flight is ignored.  The socket
+ * must not be read bypassing c->recv() while the request is in flight,
+ * this is reported by the NGX_IO_ASYNC_RECV flag.  A buffer that cannot
+ * be provided back because the submission queue is full is queued and
+ * provided before the next submission.
+ *
+ * The connections are accepted through the ring too: a listening socket
+ * has a oneshot accept request in flight instead of the poll one, and
+ * the accepted socket, or the error, is kept until ngx_event_accept()
+ * takes it with ngx_io.accept(), which submits the next request.  The
+ * request is canceled when the accept events are disabled, a socket
+ * accepted meanwhile is served anyway.
+ *
+ * The data are still sent with send() and sendfile() on the POLLOUT
+ * readiness: a send request would own the buffers until its completion,
+ * while the callers of c->send() reuse or free them once it returns.
+ *
+ * The low bits of a request user data are the instance bit of
+ * a connection, the file AIO flag, both of them for a receive request,
+ * or the accept flag.  The highest bit, which is never set in user space
+ * addresses, marks the POLLOUT requests.
+ */
+
+#define NGX_IO_URING_AIO       2
+#define NGX_IO_URING_RECV      3
+#define NGX_IO_URING_ACCEPT    4
+#define NGX_IO_URING_MASK      7
+#define NGX_IO_URING_WRITE     ((uint64_t) 1 << 63)
+
+#define NGX_IO_URING_BGID      0
+
+
+typedef struct {
+    ngx_uint_t  entries;
+    ngx_bufs_t  recv_buffers;
+} ngx_io_uring_conf_t;
+
+
+typedef struct {
+    u_char     *pos;
+    u_char     *last;
+    ngx_uint_t  bid;
+    ngx_err_t   err;
+
+    unsigned    active:1;
+    unsigned    canceled:1;
+    unsigned    buffer:1;
+    unsigned    nobufs:1;
+    unsigned    eof:1;
+    unsigned    error:1;
+} ngx_io_uring_recv_t;
+
+
+typedef struct {
+    ngx_connection_t  *connection;
+    ngx_socket_t       fd;
+    ngx_err_t          err;
+    socklen_t          socklen;
+
+    unsigned           active:1;
+    unsigned           canceled:1;
+    unsigned           error:1;
+
+    u_char             sockaddr[NGX_SOCKADDRLEN];
+} ngx_io_uring_accept_t;
+
+
+static ngx_int_t ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_io_uring_notify_init(ngx_log_t *log);
+static void ngx_io_uring_notify_handler(ngx_event_t *ev);
+static void ngx_io_uring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_add_connection(ngx_connection_t *c);
+static ngx_int_t ngx_io_uring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_notify(ngx_event_handler_pt handler);
+static ngx_int_t ngx_io_uring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_init_process(ngx_cycle_t *cycle);
+
+static ssize_t ngx_io_uring_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+static ssize_t ngx_io_uring_recv_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit);
+static ngx_io_uring_recv_t *ngx_io_uring_recv_state(ngx_connection_t *c);
+static ngx_int_t ngx_io_uring_recv_submit(ngx_connection_t *c,
+    ngx_io_uring_recv_t *r);
+static void ngx_io_uring_recv_complete(ngx_cycle_t *cycle,
+    ngx_io_uring_recv_t *r, ngx_int_t res, uint32_t cflags, ngx_uint_t flags);
+static void ngx_io_uring_recv_close(ngx_connection_t *c, ngx_log_t *log);
+static void ngx_io_uring_recv_release(ngx_uint_t bid, ngx_log_t *log);
+static ngx_int_t ngx_io_uring_recv_provide(ngx_uint_t bid, ngx_log_t *log);
+static void ngx_io_uring_recv_flush(ngx_log_t *log);
+
+static ngx_socket_t ngx_io_uring_accept(ngx_connection_t *lc,
+    struct sockaddr *sa, socklen_t *socklen);
+static ngx_io_uring_accept_t *ngx_io_uring_accept_state(ngx_connection_t *c);
+static void ngx_io_uring_accept_submit(ngx_connection_t *c,
+    ngx_io_uring_accept_t *a, ngx_log_t *log);
+static void ngx_io_uring_accept_complete(ngx_cycle_t *cycle,
+    ngx_io_uring_accept_t *a, ngx_int_t res, ngx_uint_t flags);
+static void ngx_io_uring_accept_cancel(ngx_connection_t *c,
+    ngx_io_uring_accept_t *a, ngx_log_t *log);
+static void ngx_io_uring_accept_flush(ngx_log_t *log);
+static void ngx_io_uring_accept_closed(ngx_io_uring_accept_t *a,
+    ngx_socket_t s);
+
+static ngx_int_t ngx_io_uring_arm(ngx_connection_t *c, ngx_event_t *ev,
+    ngx_log_t *log);
+static ngx_int_t ngx_io_uring_disarm(ngx_connection_t *c, ngx_event_t *ev,
+    ngx_log_t *log);
+static struct io_uring_sqe *ngx_io_uring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_submit(ngx_log_t *log);
+
+static void *ngx_io_uring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf);
+static char *ngx_io_uring_recv_buffers(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static int                   ring = -1;
+
+static u_char               *ring_ptr;
+static size_t                ring_size;
+static struct io_uring_sqe  *sqes;
+static size_t                sqes_size;
+
+static unsigned             *sq_head;
+static unsigned             *sq_tail;
+static unsigned             *sq_array;
+static unsigned              sq_mask;
+static unsigned              sq_entries;
+static unsigned              sq_local_tail;
+
+static unsigned             *cq_head;
+static unsigned             *cq_tail;
+static unsigned              cq_mask;
+static struct io_uring_cqe  *cqes;
+
+static int                   notify_fd = -1;
+static ngx_event_t           notify_event;
+static ngx_event_t           notify_write_event;
+static ngx_connection_t      notify_conn;
+
+static ngx_io_uring_recv_t  *recvs;
+static ngx_connection_t     *recv_connections;
+static ngx_uint_t            recv_n;
+static u_char               *recv_buffers;
+static size_t                recv_size;
+static ngx_uint_t           *recv_pending;
+static ngx_uint_t            recv_npending;
+
+static ngx_io_uring_accept_t  *accepts;
+static ngx_listening_t        *accept_listening;
+static ngx_uint_t              accept_n;
+static ngx_uint_t              accept_retry;
+
+static ngx_os_io_t           ngx_io_uring_io;
+
+#if (NGX_HAVE_FILE_AIO)
+ngx_uint_t                   ngx_io_uring_file_aio;
+#endif
+
+
+static ngx_str_t      io_uring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_io_uring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, entries),
+      NULL },
+
+    { ngx_string("io_uring_recv_buffers"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE2,
+      ngx_io_uring_recv_buffers,
+      0,
+      offsetof(ngx_io_uring_conf_t, recv_buffers),
+      NULL },
+
+      ngx_null_command
+};
+
+
+ngx_event_module_t  ngx_io_uring_module_ctx = {
+    &io_uring_name,
+    ngx_io_uring_create_conf,            /* create configuration */
+    ngx_io_uring_init_conf,              /* init configuration */
+
+    {
+        ngx_io_uring_add_event,          /* add an event */
+        ngx_io_uring_del_event,          /* delete an event */
+        ngx_io_uring_add_event,          /* enable an event */
+        ngx_io_uring_del_event,          /* disable an event */
+        ngx_io_uring_add_connection,     /* add an connection */
+        ngx_io_uring_del_connection,     /* delete an connection */
+        ngx_io_uring_notify,             /* trigger a notify */
+        ngx_io_uring_process_events,     /* process the events */
+        ngx_io_uring_init,               /* init the events */
+        ngx_io_uring_done,               /* done the events */
+    }
+};
+
+ngx_module_t  ngx_io_uring_module = {
+    NGX_MODULE_V1,
+    &ngx_io_uring_module_ctx,            /* module context */
+    ngx_io_uring_commands,               /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    ngx_io_uring_init_process,           /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly as syscalls
+ * instead of liburing usage to avoid an external dependency.
+ */
+
+static int
+io_uring_setup(u_int entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, u_int to_submit, u_int min_complete, u_int flags,
+    void *arg, size_t argsz)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, argsz);
+}
+
+
+static ngx_int_t
+ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    size_t                   cq_size;
+    ngx_io_uring_conf_t     *iucf;
+    struct io_uring_params   p;
+
+    iucf = ngx_event_get_conf(cycle->conf_ctx, ngx_io_uring_module);
+
+    if (ring == -1) {
+        ngx_memzero(&p, sizeof(struct io_uring_params));
+
+        ring = io_uring_setup(iucf->entries, &p);
+
+        if (ring == -1) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "io_uring_setup() failed");
+            return NGX_ERROR;
+        }
+
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP)
+            || !(p.features & IORING_FEAT_EXT_ARG))
+        {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                          "io_uring is not supported by the kernel, "
+                          "Linux 5.13 or newer is required");
+            goto failed;
+        }
+
+        ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+        if (cq_size > ring_size) {
+            ring_size = cq_size;
+        }
+
+        ring_ptr = mmap(NULL, ring_size, PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+
+        if (ring_ptr == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_SQ_RING) failed");
+            goto failed;
+        }
+
+        sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+        sqes = mmap(NULL, sqes_size, PROT_READ|PROT_WRITE,
+                    MAP_SHARED|MAP_POPULATE, ring, IORING_OFF_SQES);
+
+        if (sqes == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                          "mmap(IORING_OFF_SQES) failed");
+
+            (void) munmap(ring_ptr, ring_size);
+            goto failed;
+        }
+
+        sq_head = (unsigned *) (ring_ptr + p.sq_off.head);
+        sq_tail = (unsigned *) (ring_ptr + p.sq_off.tail);
+        sq_array = (unsigned *) (ring_ptr + p.sq_off.array);
+        sq_mask = *(unsigned *) (ring_ptr + p.sq_off.ring_mask);
+        sq_entries = p.sq_entries;
+        sq_local_tail = *sq_tail;
+
+        cq_head = (unsigned *) (ring_ptr + p.cq_off.head);
+        cq_tail = (unsigned *) (ring_ptr + p.cq_off.tail);
+        cq_mask = *(unsigned *) (ring_ptr + p.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe *) (ring_ptr + p.cq_off.cqes);
+
+        if (ngx_io_uring_notify_init(cycle->log) != NGX_OK) {
+            ngx_io_uring_module_ctx.actions.notify = NULL;
+        }
+
+#if (NGX_HAVE_FILE_AIO)
+        ngx_io_uring_file_aio = ngx_file_aio;
+#endif
+    }
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_io_uring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_EPOLL_EVENT;
+
+    return NGX_OK;
+
+failed:
+
+    if (close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_io_uring_notify_init(ngx_log_t *log)
+{
+    notify_fd = eventfd(0, EFD_NONBLOCK);
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.handler = ngx_io_uring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+    notify_event.index = NGX_INVALID_INDEX;
+
+    notify_write_event.log = log;
+
+    notify_conn.fd = notify_fd;
+    notify_conn.read = &notify_event;
+    notify_conn.write = &notify_write_event;
+    notify_conn.log = log;
+
+    if (ngx_io_uring_arm(&notify_conn, &notify_event, log) != NGX_OK) {
+
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_event_handler_pt  handler;
+
+    n = read(notify_fd, &count, sizeof(uint64_t));
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+    if ((size_t) n != sizeof(uint64_t) && ngx_errno != NGX_EAGAIN) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+                      "read() eventfd %d failed", notify_fd);
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+
+static void
+ngx_io_uring_done(ngx_cycle_t *cycle)
+{
+    if (munmap(sqes, sqes_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_SQES) failed");
+    }
+
+    if (munmap(ring_ptr, ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "munmap(IORING_OFF_SQ_RING) failed");
+    }
+
+    if (close(ring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ring = -1;
+
+    if (notify_fd != -1) {
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+    }
+
+#if (NGX_HAVE_FILE_AIO)
+    ngx_io_uring_file_aio = 0;
+#endif
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring add event: fd:%d ev:%i fl:%ui",
+                   c->fd, event, flags);
+
+    if (ngx_io_uring_arm(c, ev, ev->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    ngx_connection_t       *c;
+    ngx_io_uring_accept_t  *a;
+
+    c = ev->data;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d ev:%i fl:%ui",
+                   c->fd, event, flags);
+
+    ev->active = 0;
+
+    /*
+     * the accept request is canceled as it would take connections
+     * from the other workers while the accept events are disabled
+     */
+
+    if (ev->accept) {
+        a = ngx_io_uring_accept_state(c);
+
+        if (a) {
+            ngx_io_uring_accept_cancel(c, a, ev->log);
+            return NGX_OK;
+        }
+    }
+
+    /*
+     * the poll request is left armed unless the file descriptor is going
+     * to be closed, the events of the inactive event are just ignored;
+     * the closed file descriptor is not removed automatically as
+     * the request holds a reference to the file
+     */
+
+    if (flags & NGX_CLOSE_EVENT) {
+
+        if (!ev->write) {
+            ngx_io_uring_recv_close(c, ev->log);
+        }
+
+        return ngx_io_uring_disarm(c, ev, ev->log);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_connection(ngx_connection_t *c)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring add connection: fd:%d", c->fd);
+
+    if (ngx_io_uring_arm(c, c->read, c->log) != NGX_OK
+        || ngx_io_uring_arm(c, c->write, c->log) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 1;
+    c->write->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring del connection: fd:%d", c->fd);
+
+    c->read->active = 0;
+    c->write->active = 0;
+
+    if (flags & NGX_CLOSE_EVENT) {
+        ngx_io_uring_recv_close(c, c->log);
+    }
+
+    if (ngx_io_uring_disarm(c, c->read, c->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_io_uring_disarm(c, c->write, c->log);
+}
+
+
+static ngx_int_t
+ngx_io_uring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_arm(ngx_connection_t *c, ngx_event_t *ev, ngx_log_t *log)
+{
+    struct io_uring_sqe    *sqe;
+    ngx_io_uring_accept_t  *a;
+
+    if (ev->accept) {
+        a = ngx_io_uring_accept_state(c);
+
+        if (a) {
+            ngx_io_uring_accept_submit(c, a, log);
+            return NGX_OK;
+        }
+    }
+
+    /* the event index is used as the armed flag */
+
+    if (ev->index != NGX_INVALID_INDEX) {
+        return NGX_OK;
+    }
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->user_data = (uintptr_t) c | ev->instance;
+
+    if (ev->write) {
+        sqe->poll32_events = POLLOUT;
+        sqe->user_data |= NGX_IO_URING_WRITE;
+
+    } else if (ev->accept) {
+        sqe->poll32_events = POLLIN;
+
+    } else {
+        sqe->poll32_events = POLLIN|POLLRDHUP;
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring poll add: fd:%d ev:%04XD multi:%ud",
+                   c->fd, sqe->poll32_events, sqe->len);
+
+    ev->index = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_disarm(ngx_connection_t *c, ngx_event_t *ev, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (ev->index == NGX_INVALID_INDEX) {
+        return NGX_OK;
+    }
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t) c | ev->instance;
+    sqe->user_data = 0;
+
+    if (ev->write) {
+        sqe->addr |= NGX_IO_URING_WRITE;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring poll remove: fd:%d w:%d", c->fd, ev->write);
+
+    ev->index = NGX_INVALID_INDEX;
+
+    return NGX_OK;
+}
+
+
+static struct io_uring_sqe *
+ngx_io_uring_get_sqe(ngx_log_t *log)
+{
+    unsigned              head, index;
+    struct io_uring_sqe  *sqe;
+
+    head = *sq_head;
+
+    ngx_memory_barrier();
+
+    if (sq_local_tail - head >= sq_entries) {
+
+        if (ngx_io_uring_submit(log) != NGX_OK) {
+            return NULL;
+        }
+
+        head = *sq_head;
+
+        ngx_memory_barrier();
+
+        if (sq_local_tail - head >= sq_entries) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue overflow");
+            return NULL;
+        }
+    }
+
+    index = sq_local_tail & sq_mask;
+
+    sqe = &sqes[index];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    sq_array[index] = index;
+    sq_local_tail++;
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_io_uring_submit(ngx_log_t *log)
+{
+    int       n;
+    unsigned  pending;
+
+    ngx_memory_barrier();
+
+    *sq_tail = sq_local_tail;
+
+    ngx_memory_barrier();
+
+    pending = sq_local_tail - *sq_head;
+
+    if (pending == 0) {
+        return NGX_OK;
+    }
+
+    n = io_uring_enter(ring, pending, 0, 0, NULL, 0);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring_enter: %ud submitted:%d", pending, n);
+
+    if (n == -1 && ngx_errno != NGX_EAGAIN && ngx_errno != NGX_EBUSY) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_FILE_AIO)
+
+ngx_int_t
+ngx_io_uring_file_read(ngx_event_t *ev, ngx_fd_t fd, u_char *buf, size_t size,
+    off_t offset)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(ev->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t) buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uintptr_t) ev | NGX_IO_URING_AIO;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_io_uring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                               n;
+    u_int                             wait;
+    uint32_t                          cflags;
+    uint64_t                          data;
+    unsigned                          head, tail, pending;
+    ngx_int_t                         instance;
+    ngx_uint_t                        level, events, pollout;
+    ngx_err_t                         err;
+    ngx_event_t                      *rev, *wev;
+    ngx_queue_t                      *queue;
+    ngx_connection_t                 *c;
+    ngx_io_uring_recv_t              *r;
+    ngx_io_uring_accept_t            *a;
+    struct io_uring_cqe              *cqe;
+    struct __kernel_timespec          ts;
+    struct io_uring_getevents_arg     arg;
+#if (NGX_HAVE_FILE_AIO)
+    ngx_event_t                      *e;
+    ngx_event_aio_t                  *aio;
+#endif
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M", timer);
+
+    if (recv_npending) {
+        ngx_io_uring_recv_flush(cycle->log);
+    }
+
+    if (accept_retry || (ngx_exiting && accepts)) {
+        ngx_io_uring_accept_flush(cycle->log);
+    }
+
+    ngx_memory_barrier();
+
+    *sq_tail = sq_local_tail;
+
+    ngx_memory_barrier();
+
+    pending = sq_local_tail - *sq_head;
+
+    /* do not wait if there are completions not yet processed */
+
+    wait = (*cq_tail == *cq_head) ? 1 : 0;
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (wait && timer != NGX_TIMER_INFINITE) {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+        arg.ts = (uintptr_t) &ts;
+    }
+
+    n = io_uring_enter(ring, pending, wait,
+                       IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(struct io_uring_getevents_arg));
+
+    err = (n == -1) ? ngx_errno : 0;
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err && err != ETIME && err != NGX_EBUSY && err != NGX_EAGAIN) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    events = 0;
+
+    head = *cq_head;
+
+    for ( ;; ) {
+
+        tail = *cq_tail;
+
+        ngx_memory_barrier();
+
+        if (head == tail) {
+            break;
+        }
+
+        cqe = &cqes[head & cq_mask];
+
+        data = cqe->user_data;
+        n = cqe->res;
+        cflags = cqe->flags;
+
+        head++;
+
+        ngx_memory_barrier();
+
+        *cq_head = head;
+
+        events++;
+
+        if (data == 0) {
+            /* a poll remove, cancel or buffers completion */
+            continue;
+        }
+
+        if ((data & NGX_IO_URING_MASK) == NGX_IO_URING_RECV) {
+            r = (ngx_io_uring_recv_t *) (uintptr_t) (data & ~NGX_IO_URING_MASK);
+            ngx_io_uring_recv_complete(cycle, r, n, cflags, flags);
+            continue;
+        }
+
+        if ((data & NGX_IO_URING_MASK) == NGX_IO_URING_ACCEPT) {
+            a = (ngx_io_uring_accept_t *) (uintptr_t)
+                    (data & ~NGX_IO_URING_MASK);
+            ngx_io_uring_accept_complete(cycle, a, n, flags);
+            continue;
+        }
+
+#if (NGX_HAVE_FILE_AIO)
+
+        if (data & NGX_IO_URING_AIO) {
+            e = (ngx_event_t *) (uintptr_t) (data & ~NGX_IO_URING_MASK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring aio event: %p %d", e, n);
+
+            e->complete = 1;
+            e->active = 0;
+            e->ready = 1;
+
+            aio = e->data;
+            aio->res = n;
+
+            ngx_post_event(e, &ngx_posted_events);
+
+            continue;
+        }
+
+#endif
+
+        if (n == -NGX_ECANCELED) {
+            /* the request of a closed connection */
+            continue;
+        }
+
+        pollout = (data & NGX_IO_URING_WRITE) ? 1 : 0;
+        instance = data & 1;
+
+        data &= ~(NGX_IO_URING_WRITE|NGX_IO_URING_MASK);
+        c = (ngx_connection_t *) (uintptr_t) data;
+
+        rev = c->read;
+        wev = c->write;
+
+        if (c->fd == -1 || rev->instance != instance) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in this iteration
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            continue;
+        }
+
+        if (n < 0) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring poll error on fd:%d %d", c->fd, n);
+        }
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d ev:%04XD w:%ui",
+                       c->fd, (n < 0) ? POLLERR : n, pollout);
+
+        if (pollout) {
+
+            /* the oneshot POLLOUT request, the errors are reported as well */
+
+            wev->index = NGX_INVALID_INDEX;
+
+            if (!wev->active) {
+                continue;
+            }
+
+            wev->active = 0;
+            wev->ready = 1;
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_post_event(wev, &ngx_posted_events);
+
+            } else {
+                wev->handler(wev);
+            }
+
+            continue;
+        }
+
+        if (!(cflags & IORING_CQE_F_MORE)) {
+
+            /* the oneshot request completed or the multishot one ended */
+
+            rev->index = NGX_INVALID_INDEX;
+
+            if (rev->active && ngx_io_uring_arm(c, rev, cycle->log) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        r = ngx_io_uring_recv_state(c);
+
+        if (!rev->active || (r && r->active && !r->canceled)) {
+            /* the data will come with the receive request completion */
+            continue;
+        }
+
+        if (n > 0 && (n & POLLRDHUP)) {
+            rev->pending_eof = 1;
+        }
+
+        rev->ready = 1;
+
+        if (flags & NGX_POST_EVENTS) {
+            queue = rev->accept ? &ngx_posted_accept_events
+                                : &ngx_posted_events;
+
+            ngx_post_event(rev, queue);
+
+        } else {
+            rev->handler(rev);
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring events: %ui", events);
+
+    if (events == 0 && err == 0 && wait && timer == NGX_TIMER_INFINITE) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                      "io_uring_enter() returned no events without timeout");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t              i, n;
+    ngx_listening_t        *ls;
+    ngx_connection_t       *c;
+    ngx_io_uring_conf_t    *iucf;
+    ngx_io_uring_accept_t  *a;
+    struct io_uring_sqe    *sqe;
+
+    /*
+     * the receive requests state is indexed by the connections that are
+     * allocated after the events are initialized
+     */
+
+    if (ring == -1
+        || ngx_event_actions.process_events != ngx_io_uring_process_events
+        || recvs != NULL)
+    {
+        return NGX_OK;
+    }
+
+    iucf = ngx_event_get_conf(cycle->conf_ctx, ngx_io_uring_module);
+
+    n = iucf->recv_buffers.num;
+    recv_size = iucf->recv_buffers.size;
+
+    recv_buffers = ngx_alloc(n * recv_size, cycle->log);
+    if (recv_buffers == NULL) {
+        return NGX_ERROR;
+    }
+
+    recvs = ngx_calloc(cycle->connection_n * sizeof(ngx_io_uring_recv_t),
+                       cycle->log);
+    if (recvs == NULL) {
+        return NGX_ERROR;
+    }
+
+    recv_pending = ngx_alloc(n * sizeof(ngx_uint_t), cycle->log);
+    if (recv_pending == NULL) {
+        return NGX_ERROR;
+    }
+
+    recv_connections = cycle->connections;
+    recv_n = cycle->connection_n;
+
+    sqe = ngx_io_uring_get_sqe(cycle->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = n;
+    sqe->addr = (uintptr_t) recv_buffers;
+    sqe->len = recv_size;
+    sqe->off = 0;
+    sqe->buf_group = NGX_IO_URING_BGID;
+
+    ngx_io_uring_io = ngx_os_io;
+    ngx_io_uring_io.recv = ngx_io_uring_recv;
+    ngx_io_uring_io.recv_chain = ngx_io_uring_recv_chain;
+    ngx_io_uring_io.flags |= NGX_IO_ASYNC_RECV;
+    ngx_io_uring_io.accept = ngx_io_uring_accept;
+
+    ngx_io = ngx_io_uring_io;
+
+    /*
+     * the listening sockets were added by ngx_event_process_init(),
+     * their poll requests are replaced by the accept ones
+     */
+
+    accept_n = cycle->listening.nelts;
+    accept_listening = cycle->listening.elts;
+
+    accepts = ngx_calloc(accept_n * sizeof(ngx_io_uring_accept_t),
+                         cycle->log);
+    if (accepts == NULL) {
+        return NGX_ERROR;
+    }
+
+    ls = cycle->listening.elts;
+
+    for (i = 0; i < accept_n; i++) {
+        a = &accepts[i];
+        a->fd = (ngx_socket_t) -1;
+
+        c = ls[i].connection;
+
+        if (c == NULL || ls[i].type != SOCK_STREAM) {
+            continue;
+        }
+
+        a->connection = c;
+
+        if (c->read->active) {
+            if (ngx_io_uring_disarm(c, c->read, cycle->log) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_io_uring_accept_submit(c, a, cycle->log);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ssize_t
+ngx_io_uring_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ssize_t               n;
+    ngx_event_t          *rev;
+    ngx_io_uring_recv_t  *r;
+
+    r = ngx_io_uring_recv_state(c);
+
+    if (r == NULL
+        || r->canceled
+        || !(r->active || r->buffer || r->eof || r->error))
+    {
+        n = ngx_os_io.recv(c, buf, size);
+
+        if (r == NULL || r->canceled) {
+            return n;
+        }
+
+        if (n != NGX_AGAIN) {
+            r->nobufs = 0;
+            return n;
+        }
+
+        /*
+         * after the buffers were exhausted the connection waits
+         * for POLLIN once to not resubmit the request in a loop,
+         * it waits for POLLIN as well if the request cannot be submitted
+         */
+
+        if (!r->nobufs) {
+            (void) ngx_io_uring_recv_submit(c, r);
+        }
+
+        return NGX_AGAIN;
+    }
+
+    rev = c->read;
+
+    if (r->buffer) {
+        n = ngx_min((size_t) (r->last - r->pos), size);
+
+        ngx_memcpy(buf, r->pos, n);
+        r->pos += n;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "io_uring recv: fd:%d %z of %uz", c->fd, n, size);
+
+        if (r->pos == r->last) {
+            ngx_io_uring_recv_release(r->bid, c->log);
+            r->buffer = 0;
+        }
+
+        return n;
+    }
+
+    rev->ready = 0;
+
+    if (r->eof) {
+        rev->eof = 1;
+        return 0;
+    }
+
+    if (r->error) {
+        rev->error = 1;
+        return ngx_connection_error(c, r->err, "recv() failed");
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv: fd:%d in flight", c->fd);
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_io_uring_recv_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
+{
+    size_t                size;
+    ssize_t               n, total;
+    ngx_io_uring_recv_t  *r;
+
+    r = ngx_io_uring_recv_state(c);
+
+    if (r == NULL
+        || r->canceled
+        || !(r->active || r->buffer || r->eof || r->error))
+    {
+        n = ngx_os_io.recv_chain(c, in, limit);
+
+        if (r == NULL || r->canceled) {
+            return n;
+        }
+
+        if (n != NGX_AGAIN) {
+            r->nobufs = 0;
+            return n;
+        }
+
+        if (!r->nobufs) {
+            (void) ngx_io_uring_recv_submit(c, r);
+        }
+
+        return NGX_AGAIN;
+    }
+
+    if (!r->buffer) {
+        return ngx_io_uring_recv(c, NULL, 0);
+    }
+
+    /* the chain bufs are filled from the last position, as readv() does */
+
+    total = 0;
+
+    for ( /* void */ ; in && r->buffer; in = in->next) {
+
+        size = in->buf->end - in->buf->last;
+
+        if (limit) {
+            if (total >= limit) {
+                break;
+            }
+
+            if ((off_t) size > limit - total) {
+                size = (size_t) (limit - total);
+            }
+        }
+
+        if (size == 0) {
+            continue;
+        }
+
+        n = ngx_io_uring_recv(c, in->buf->last, size);
+
+        total += n;
+
+        if ((size_t) n < size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+
+static ngx_io_uring_recv_t *
+ngx_io_uring_recv_state(ngx_connection_t *c)
+{
+    ngx_uint_t  i;
+
+    if (recvs == NULL || c->fd == (ngx_socket_t) -1) {
+        return NULL;
+    }
+
+    i = (ngx_uint_t) (c - recv_connections);
+
+    /* the connections of the previous cycle and the fake ones */
+
+    if (i >= recv_n) {
+        return NULL;
+    }
+
+    return &recvs[i];
+}
+
+
+static ngx_int_t
+ngx_io_uring_recv_submit(ngx_connection_t *c, ngx_io_uring_recv_t *r)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(c->log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->len = recv_size;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = NGX_IO_URING_BGID;
+    sqe->user_data = (uintptr_t) r | NGX_IO_URING_RECV;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv submit: fd:%d", c->fd);
+
+    r->active = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_recv_complete(ngx_cycle_t *cycle, ngx_io_uring_recv_t *r,
+    ngx_int_t res, uint32_t cflags, ngx_uint_t flags)
+{
+    ngx_uint_t         bid;
+    ngx_event_t       *rev;
+    ngx_connection_t  *c;
+
+    r->active = 0;
+
+    bid = cflags >> IORING_CQE_BUFFER_SHIFT;
+
+    if (r->canceled) {
+
+        /* the request of a closed connection */
+
+        r->canceled = 0;
+
+        if (cflags & IORING_CQE_F_BUFFER) {
+            ngx_io_uring_recv_release(bid, cycle->log);
+        }
+
+        return;
+    }
+
+    c = &recv_connections[r - recvs];
+    rev = c->read;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring recv: fd:%d %i", c->fd, res);
+
+    if (res > 0) {
+        r->pos = recv_buffers + bid * recv_size;
+        r->last = r->pos + res;
+        r->bid = bid;
+        r->buffer = 1;
+
+    } else if (res == 0) {
+        r->eof = 1;
+
+    } else if (res == -ENOBUFS) {
+
+        /* the data are left in the socket and are read by recv() */
+
+        r->nobufs = 1;
+
+    } else {
+        r->err = -res;
+        r->error = 1;
+    }
+
+    rev->ready = 1;
+
+    if (!rev->active) {
+        return;
+    }
+
+    if (flags & NGX_POST_EVENTS) {
+        ngx_post_event(rev, &ngx_posted_events);
+
+    } else {
+        rev->handler(rev);
+    }
+}
+
+
+static void
+ngx_io_uring_recv_close(ngx_connection_t *c, ngx_log_t *log)
+{
+    ngx_io_uring_recv_t  *r;
+    struct io_uring_sqe  *sqe;
+
+    r = ngx_io_uring_recv_state(c);
+
+    if (r == NULL) {
+        return;
+    }
+
+    if (r->buffer) {
+        ngx_io_uring_recv_release(r->bid, log);
+    }
+
+    r->buffer = 0;
+    r->nobufs = 0;
+    r->eof = 0;
+    r->error = 0;
+
+    if (!r->active || r->canceled) {
+        return;
+    }
+
+    /*
+     * the request holds a reference to the socket, so it is canceled
+     * to close the socket, and its result is discarded
+     */
+
+    r->canceled = 1;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t) r | NGX_IO_URING_RECV;
+    sqe->user_data = 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring recv cancel: fd:%d", c->fd);
+}
+
+
+static void
+ngx_io_uring_recv_release(ngx_uint_t bid, ngx_log_t *log)
+{
+    /*
+     * the buffer is returned to the ring with the next submission,
+     * if the submission queue is full, it is queued to not shrink
+     * the ring, each buffer is queued at most once
+     */
+
+    if (ngx_io_uring_recv_provide(bid, log) != NGX_OK) {
+        recv_pending[recv_npending++] = bid;
+    }
+}
+
+
+static ngx_int_t
+ngx_io_uring_recv_provide(ngx_uint_t bid, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (uintptr_t) (recv_buffers + bid * recv_size);
+    sqe->len = recv_size;
+    sqe->off = bid;
+    sqe->buf_group = NGX_IO_URING_BGID;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_recv_flush(ngx_log_t *log)
+{
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring recv pending buffers: %ui", recv_npending);
+
+    while (recv_npending) {
+
+        if (ngx_io_uring_recv_provide(recv_pending[recv_npending - 1], log)
+            != NGX_OK)
+        {
+            return;
+        }
+
+        recv_npending--;
+    }
+}
+
+
+static ngx_socket_t
+ngx_io_uring_accept(ngx_connection_t *lc, struct sockaddr *sa,
+    socklen_t *socklen)
+{
+    ngx_err_t               err;
+    ngx_socket_t            s;
+    ngx_io_uring_accept_t  *a;
+
+    a = ngx_io_uring_accept_state(lc);
+
+    if (a == NULL) {
+#if (NGX_HAVE_ACCEPT4)
+        return accept4(lc->fd, sa, socklen, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
+        return accept(lc->fd, sa, socklen);
+#endif
+    }
+
+    if (a->fd == (ngx_socket_t) -1 && !a->error) {
+
+        if (lc->read->active) {
+            ngx_io_uring_accept_submit(lc, a, lc->log);
+        }
+
+        ngx_set_socket_errno(NGX_EAGAIN);
+        return (ngx_socket_t) -1;
+    }
+
+    s = a->fd;
+    err = a->err;
+
+    if (s != (ngx_socket_t) -1) {
+        *socklen = ngx_min(*socklen, a->socklen);
+        ngx_memcpy(sa, a->sockaddr, *socklen);
+    }
+
+    a->fd = (ngx_socket_t) -1;
+    a->error = 0;
+
+    if (lc->read->active) {
+        ngx_io_uring_accept_submit(lc, a, lc->log);
+    }
+
+    if (s == (ngx_socket_t) -1) {
+        ngx_set_socket_errno(err);
+    }
+
+    return s;
+}
+
+
+static ngx_io_uring_accept_t *
+ngx_io_uring_accept_state(ngx_connection_t *c)
+{
+    ngx_uint_t  i;
+
+    if (accepts == NULL || c->listening == NULL) {
+        return NULL;
+    }
+
+    i = (ngx_uint_t) (c->listening - accept_listening);
+
+    /* the listening sockets of the previous cycle */
+
+    if (i >= accept_n || accepts[i].connection != c) {
+        return NULL;
+    }
+
+    return &accepts[i];
+}
+
+
+static void
+ngx_io_uring_accept_submit(ngx_connection_t *c, ngx_io_uring_accept_t *a,
+    ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    /* the request in flight may be being canceled, it is resubmitted then */
+
+    if (a->active) {
+        return;
+    }
+
+    if (a->fd != (ngx_socket_t) -1 || a->error) {
+
+        /* the accepted socket is not taken by ngx_event_accept() yet */
+
+        c->read->ready = 1;
+        ngx_post_event(c->read, &ngx_posted_accept_events);
+        return;
+    }
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        accept_retry = 1;
+        return;
+    }
+
+    a->socklen = NGX_SOCKADDRLEN;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = c->fd;
+    sqe->addr = (uintptr_t) a->sockaddr;
+    sqe->addr2 = (uintptr_t) &a->socklen;
+    sqe->accept_flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+    sqe->user_data = (uintptr_t) a | NGX_IO_URING_ACCEPT;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring accept submit: fd:%d", c->fd);
+
+    a->active = 1;
+}
+
+
+static void
+ngx_io_uring_accept_complete(ngx_cycle_t *cycle, ngx_io_uring_accept_t *a,
+    ngx_int_t res, ngx_uint_t flags)
+{
+    ngx_event_t       *rev;
+    ngx_connection_t  *c;
+
+    a->active = 0;
+    a->canceled = 0;
+
+    c = a->connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring accept: %p %i", a, res);
+
+    if (c == NULL || c->fd == (ngx_socket_t) -1 || !c->read->accept) {
+
+        /* the listening socket was closed, its connection may be reused */
+
+        a->connection = NULL;
+
+        if (res >= 0) {
+            ngx_io_uring_accept_closed(a, res);
+        }
+
+        return;
+    }
+
+    rev = c->read;
+
+    if (res >= 0) {
+        a->fd = res;
+
+    } else if (res != -NGX_ECANCELED && rev->active) {
+        a->err = -res;
+        a->error = 1;
+    }
+
+    if (a->fd == (ngx_socket_t) -1 && !a->error) {
+
+        /* the accept events were disabled and possibly enabled again */
+
+        if (rev->active) {
+            ngx_io_uring_accept_submit(c, a, cycle->log);
+        }
+
+        return;
+    }
+
+    /*
+     * the socket accepted while the accept events were being disabled
+     * is served right away, as a worker may not get the accept mutex
+     * back for long or may exit
+     */
+
+    rev->ready = 1;
+
+    if (flags & NGX_POST_EVENTS) {
+        ngx_post_event(rev, &ngx_posted_accept_events);
+
+    } else {
+        rev->handler(rev);
+    }
+}
+
+
+static void
+ngx_io_uring_accept_cancel(ngx_connection_t *c, ngx_io_uring_accept_t *a,
+    ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (!a->active || a->canceled) {
+        return;
+    }
+
+    a->canceled = 1;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t) a | NGX_IO_URING_ACCEPT;
+    sqe->user_data = 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring accept cancel: fd:%d", c->fd);
+}
+
+
+static void
+ngx_io_uring_accept_flush(ngx_log_t *log)
+{
+    ngx_uint_t              i;
+    ngx_socket_t            s;
+    ngx_connection_t       *c;
+    ngx_io_uring_accept_t  *a;
+
+    accept_retry = 0;
+
+    for (i = 0; i < accept_n; i++) {
+        a = &accepts[i];
+        c = a->connection;
+
+        if (c == NULL) {
+            continue;
+        }
+
+        if (c->fd == (ngx_socket_t) -1 || !c->read->accept) {
+
+            /* the listening socket was closed when exiting */
+
+            if (a->fd != (ngx_socket_t) -1) {
+                s = a->fd;
+                a->fd = (ngx_socket_t) -1;
+
+                ngx_io_uring_accept_closed(a, s);
+            }
+
+            if (!a->active) {
+                a->connection = NULL;
+            }
+
+            continue;
+        }
+
+        if (c->read->active) {
+            ngx_io_uring_accept_submit(c, a, log);
+        }
+    }
+}
+
+
+
+static void
+ngx_io_uring_accept_closed(ngx_io_uring_accept_t *a, ngx_socket_t s)
+{
+    ngx_event_t        ev;
+    ngx_listening_t   *ls;
+    ngx_connection_t   lc;
+
+    /*
+     * the connection accepted by the request before the listening socket
+     * was closed is established already, so the exiting worker serves it,
+     * as it serves the UDP sessions; it is handled by ngx_event_accept()
+     * with a stub of the closed listening connection
+     */
+
+    ls = &accept_listening[a - accepts];
+
+    ngx_memzero(&lc, sizeof(ngx_connection_t));
+    ngx_memzero(&ev, sizeof(ngx_event_t));
+
+    lc.fd = (ngx_socket_t) -1;
+    lc.read = &ev;
+    lc.listening = ls;
+    lc.log = &ls->log;
+
+    ev.data = &lc;
+    ev.log = &ls->log;
+    ev.accept = 1;
+
+    a->connection = &lc;
+    a->fd = s;
+
+    ngx_event_accept(&ev);
+
+    a->connection = NULL;
+}
+
+static void *
+ngx_io_uring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_io_uring_conf_t  *iucf;
+
+    iucf = ngx_pcalloc(cycle->pool, sizeof(ngx_io_uring_conf_t));
+    if (iucf == NULL) {
+        return NULL;
+    }
+
+    iucf->entries = NGX_CONF_UNSET;
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     iucf->recv_buffers = { 0, 0 };
+     */
+
+    return iucf;
+}
+
+
+static char *
+ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_io_uring_conf_t *iucf = conf;
+
+    ngx_conf_init_uint_value(iucf->entries, 512);
+
+    if (iucf->recv_buffers.num == 0) {
+        iucf->recv_buffers.num = 256;
+        iucf->recv_buffers.size = 16384;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_io_uring_recv_buffers(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_io_uring_conf_t *iucf = conf;
+
+    char  *rv;
+
+    rv = ngx_conf_set_bufs_slot(cf, cmd, conf);
+    if (rv != NGX_CONF_OK) {
+        return rv;
+    }
+
+    /* the buffer id of a completion is 16 bits */
+
+    if (iucf->recv_buffers.num > 65536) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "too many io_uring receive buffers");
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
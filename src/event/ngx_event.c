@@ -9,6 +9,10 @@
 #include <ngx_core.h>
 #include <ngx_event.h>
 
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
 
 #define DEFAULT_CONNECTIONS  512
 
@@ -22,10 +26,19 @@ extern ngx_module_t ngx_select_module;
 
 static char *ngx_event_init_conf(ngx_cycle_t *cycle, void *conf);
 static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle);
+#if (NGX_HAVE_REUSEPORT_EBPF)
+static void ngx_event_reuseport_steering(ngx_cycle_t *cycle,
+    ngx_core_conf_t *ccf, ngx_flag_t on);
+static void ngx_event_reuseport_map_free(ngx_cycle_t *cycle, int map);
+#endif
+#if (NGX_STAT_STUB)
+static void ngx_event_listening_stats(ngx_cycle_t *cycle);
+#endif
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle);
 static char *ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_event_use(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_event_multi_accept(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static void *ngx_event_core_create_conf(ngx_cycle_t *cycle);
 static char *ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf);
@@ -75,6 +88,25 @@ ngx_atomic_t   ngx_stat_writing0;
 ngx_atomic_t  *ngx_stat_writing = &ngx_stat_writing0;
 ngx_atomic_t   ngx_stat_waiting0;
 ngx_atomic_t  *ngx_stat_waiting = &ngx_stat_waiting0;
+ngx_atomic_t   ngx_stat_http2_pushes0;
+ngx_atomic_t  *ngx_stat_http2_pushes = &ngx_stat_http2_pushes0;
+ngx_atomic_t   ngx_stat_http2_push_cancels0;
+ngx_atomic_t  *ngx_stat_http2_push_cancels = &ngx_stat_http2_push_cancels0;
+ngx_atomic_t   ngx_stat_ssl_handshakes_queued0;
+ngx_atomic_t  *ngx_stat_ssl_handshakes_queued =
+                                            &ngx_stat_ssl_handshakes_queued0;
+ngx_atomic_t   ngx_stat_ssl_handshakes_completed0;
+ngx_atomic_t  *ngx_stat_ssl_handshakes_completed =
+                                            &ngx_stat_ssl_handshakes_completed0;
+ngx_uint_t     ngx_stat_workers = 1;
+ngx_atomic_t   ngx_stat_worker_accepted0;
+ngx_atomic_t  *ngx_stat_worker_accepted = &ngx_stat_worker_accepted0;
+ngx_atomic_t   ngx_stat_worker_local0;
+ngx_atomic_t  *ngx_stat_worker_local = &ngx_stat_worker_local0;
+ngx_uint_t     ngx_stat_cpus;
+ngx_atomic_t  *ngx_stat_cpu_accepted;
+static ngx_event_listening_stat_t  ngx_stat_listening0[NGX_EVENT_LISTENING_STATS];
+ngx_event_listening_stat_t  *ngx_stat_listening = ngx_stat_listening0;
 
 #endif
 
@@ -126,6 +158,13 @@ ngx_module_t  ngx_events_module =
 static ngx_str_t  event_core_name = ngx_string("event_core");
 
 
+static ngx_conf_enum_t  ngx_event_timer_methods[] = {
+    { ngx_string("rbtree"), NGX_EVENT_TIMER_RBTREE },
+    { ngx_string("wheel"), NGX_EVENT_TIMER_WHEEL },
+    { ngx_null_string, 0 }
+};
+
+
 static ngx_command_t  ngx_event_core_commands[] = 
 {
 	/*
@@ -162,20 +201,22 @@ static ngx_command_t  ngx_event_core_commands[] =
     },
 
 	/*
-	﷨:	multi_accept on | off;
+	﷨:	multi_accept on | off | number;
 	Ĭֵ:	multi_accept off;
 	:	events
 	رʱһֻһӡ򣬹һλὫȫ롣
+	ָnumberʱÿ¼֪ͨnumberӣʣµһ¼ѭ
+	ʹӷ籩ڼӵĶд¼ͶʱᱻʱƳ١
 	ʹkqueueӴʽʱɺָΪkqueueԱжӵȴ롣
 	ʹrtsigӴʽԶmulti_accept
 	Ӧngx_event_t(¼)availableֶ
 	*/
     { 
 		ngx_string("multi_accept"),
-		NGX_EVENT_CONF|NGX_CONF_FLAG,
-		ngx_conf_set_flag_slot,
+		NGX_EVENT_CONF|NGX_CONF_TAKE1,
+		ngx_event_multi_accept,
+		0,
 		0,
-		offsetof(ngx_event_conf_t, multi_accept),
 		NULL 
 	},
 	
@@ -212,6 +253,41 @@ static ngx_command_t  ngx_event_core_commands[] =
 		NULL 
     },
 
+	/*
+	﷨:	timer_method rbtree | wheel;
+	Ĭֵ:	timer_method rbtree;
+	:	events
+	ѡʱʵַʽrbtreeʹúӺɾʱĸӶΪO(log n)
+	wheelʹ÷ֲʱ֣ӺɾʱĸӶΪO(1)дkeepaliveӵĳ
+	*/
+    { 
+		ngx_string("timer_method"),
+		NGX_EVENT_CONF|NGX_CONF_TAKE1,
+		ngx_conf_set_enum_slot,
+		0,
+		offsetof(ngx_event_conf_t, timer_method),
+		&ngx_event_timer_methods 
+    },
+
+	/*
+	﷨:	reuseport_cpu_steering on | off;
+	Ĭֵ:	reuseport_cpu_steering off;
+	:	events
+	Ϊreuseportļ˿ڹһSO_ATTACH_REUSEPORT_EBPF
+	ӰݰCPUworker_cpu_affinityаڸCPUϵworkeṛ
+	ʹնСacceptͬһCPUɡûworker󶨵CPUworker䡣
+	workeṟ׽ֱвҸý̵׽֣׽reuseportе˳޹ء
+	Ҫworker_cpu_affinityLinux 4.19ϵں
+	*/
+    { 
+		ngx_string("reuseport_cpu_steering"),
+		NGX_EVENT_CONF|NGX_CONF_FLAG,
+		ngx_conf_set_flag_slot,
+		0,
+		offsetof(ngx_event_conf_t, reuseport_steering),
+		NULL 
+    },
+
 	//﷨: debug_connection [IP|CIDR]
 	//ָĿͻdebug־Ȼerror_logõ־
 	//ʹǰҪȷִconfigureʱѾ--with-debug򲻻Ч
@@ -534,11 +610,36 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 #endif /* !(NGX_WIN32) */
 
     if (ccf->master == 0) {
+
+#if (NGX_STAT_STUB)
+        /* without a master process the counters are process local */
+        ngx_event_listening_stats(cycle);
+#if (NGX_THREADS)
+        ngx_thread_pool_stats(cycle);
+#endif
+#endif
+
         return NGX_OK;
     }
 
+#if (NGX_HAVE_REUSEPORT_EBPF)
+
+    /* a steering turned off on reload is detached */
+
+    if (!ngx_test_config) {
+        ngx_event_reuseport_steering(cycle, ccf, ecf->reuseport_steering);
+    }
+
+#endif
+
     if (ngx_accept_mutex_ptr) 
 	{
+#if (NGX_STAT_STUB)
+        ngx_event_listening_stats(cycle);
+#if (NGX_THREADS)
+        ngx_thread_pool_stats(cycle);
+#endif
+#endif
         return NGX_OK;
     }
 
@@ -559,7 +660,27 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_stat_active */
            + cl          /* ngx_stat_reading */
            + cl          /* ngx_stat_writing */
-           + cl;         /* ngx_stat_waiting */
+           + cl          /* ngx_stat_waiting */
+           + cl          /* ngx_stat_http2_pushes */
+           + cl          /* ngx_stat_http2_push_cancels */
+           + cl          /* ngx_stat_ssl_handshakes_queued */
+           + cl;         /* ngx_stat_ssl_handshakes_completed */
+
+    ngx_stat_cpus = (ngx_ncpu > 0) ? ngx_ncpu : 1;
+
+    /* the zone is never reallocated, so size it for any worker_processes */
+
+    size += 2 * NGX_MAX_PROCESSES * sizeof(ngx_atomic_t)
+                         /* ngx_stat_worker_accepted, ngx_stat_worker_local */
+           + ngx_stat_cpus * sizeof(ngx_atomic_t)
+                         /* ngx_stat_cpu_accepted */
+           + NGX_EVENT_LISTENING_STATS * sizeof(ngx_event_listening_stat_t);
+                         /* ngx_stat_listening */
+
+#if (NGX_THREADS)
+    size += NGX_THREAD_POOL_STATS * sizeof(ngx_thread_pool_stat_t);
+                         /* ngx_stat_thread_pools */
+#endif
 
 #endif
 
@@ -602,6 +723,27 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
     ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
     ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
+    ngx_stat_http2_pushes = (ngx_atomic_t *) (shared + 10 * cl);
+    ngx_stat_http2_push_cancels = (ngx_atomic_t *) (shared + 11 * cl);
+    ngx_stat_ssl_handshakes_queued = (ngx_atomic_t *) (shared + 12 * cl);
+    ngx_stat_ssl_handshakes_completed = (ngx_atomic_t *) (shared + 13 * cl);
+
+    ngx_stat_workers = NGX_MAX_PROCESSES;
+    ngx_stat_worker_accepted = (ngx_atomic_t *) (shared + 14 * cl);
+    ngx_stat_worker_local = ngx_stat_worker_accepted + NGX_MAX_PROCESSES;
+    ngx_stat_cpu_accepted = ngx_stat_worker_local + NGX_MAX_PROCESSES;
+    ngx_stat_listening = (ngx_event_listening_stat_t *)
+                             (ngx_stat_cpu_accepted + ngx_stat_cpus);
+
+    ngx_event_listening_stats(cycle);
+
+#if (NGX_THREADS)
+    ngx_stat_thread_pools = (ngx_thread_pool_stat_t *)
+                                (ngx_stat_listening
+                                 + NGX_EVENT_LISTENING_STATS);
+
+    ngx_thread_pool_stats(cycle);
+#endif
 
 #endif
 
@@ -609,6 +751,336 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 }
 
 
+#if (NGX_STAT_STUB)
+
+/*
+ * Runs in the master or single process on every configuration load and
+ * binds listening sockets to counter slots by address, so the counters of
+ * an address survive reloads; slots are never released.
+ */
+
+static void
+ngx_event_listening_stats(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                   i, n;
+    ngx_listening_t             *ls;
+    ngx_event_listening_stat_t  *st;
+
+    ls = cycle->listening.elts;
+    for (i = 0; i < cycle->listening.nelts; i++) {
+
+        ls[i].accept_stat = NULL;
+
+        if (ls[i].socklen > NGX_SOCKADDRLEN) {
+            continue;
+        }
+
+        for (n = 0; n < NGX_EVENT_LISTENING_STATS; n++) {
+            st = &ngx_stat_listening[n];
+
+            if (st->socklen == 0) {
+                ngx_memcpy(st->sockaddr, ls[i].sockaddr, ls[i].socklen);
+                st->socklen = ls[i].socklen;
+            }
+
+            if (st->socklen == ls[i].socklen
+                && ngx_memcmp(st->sockaddr, ls[i].sockaddr, ls[i].socklen)
+                   == 0)
+            {
+                ls[i].accept_stat = st;
+                break;
+            }
+        }
+    }
+}
+
+#endif
+
+
+#if (NGX_HAVE_REUSEPORT_EBPF)
+
+#define ngx_event_bpf_insn(code, dst, src, off, imm)                          \
+    (struct bpf_insn) { code, dst, src, off, imm }
+
+
+/*
+ * The program takes the CPU that received the packet and selects the
+ * socket of the first worker whose worker_cpu_affinity mask has this CPU,
+ * other CPUs are spread over all workers.  The sockets are looked up in
+ * a map indexed by the worker number, so the order of the sockets in
+ * the reuseport group, which changes as sockets are inherited and closed
+ * on reload, does not matter.  If the map has no socket for the worker,
+ * the kernel hash selects a socket.
+ *
+ * The maps are made anew on each configuration load, since a socket may
+ * be in one map only: the previous maps of a group are emptied first.
+ */
+
+static void
+ngx_event_reuseport_steering(ngx_cycle_t *cycle, ngx_core_conf_t *ccf,
+    ngx_flag_t on)
+{
+    int               map, prog, detach;
+    uint32_t          key;
+    uint64_t          mask, value;
+    ngx_int_t         worker;
+    ngx_uint_t        i, j, n, m, cpu;
+    ngx_listening_t  *ls, *ols;
+    union bpf_attr    attr;
+    struct bpf_insn   code[2 * 64 + 16];
+
+    if (on && ccf->cpu_affinity == NULL) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"reuseport_cpu_steering\" requires "
+                      "\"worker_cpu_affinity\", ignored");
+        on = 0;
+    }
+
+    n = 0;
+    m = 0;
+
+    if (on) {
+
+        /* r6 = ctx, r7 = cpu, r0 = cpu % worker_processes */
+
+        code[n++] = ngx_event_bpf_insn(BPF_ALU64|BPF_MOV|BPF_X, 6, 1, 0, 0);
+        code[n++] = ngx_event_bpf_insn(BPF_JMP|BPF_CALL, 0, 0, 0,
+                                       BPF_FUNC_get_smp_processor_id);
+        code[n++] = ngx_event_bpf_insn(BPF_ALU64|BPF_MOV|BPF_X, 7, 0, 0, 0);
+        code[n++] = ngx_event_bpf_insn(BPF_ALU64|BPF_MOD|BPF_K, 0, 0, 0,
+                                       ccf->worker_processes);
+
+        for (cpu = 0; cpu < 64; cpu++) {
+
+            for (worker = 0; worker < ccf->worker_processes; worker++) {
+
+                mask = ((ngx_uint_t) worker < ccf->cpu_affinity_n)
+                       ? ccf->cpu_affinity[worker]
+                       : ccf->cpu_affinity[ccf->cpu_affinity_n - 1];
+
+                if (mask & ((uint64_t) 1 << cpu)) {
+                    code[n++] = ngx_event_bpf_insn(BPF_JMP|BPF_JNE|BPF_K,
+                                                   7, 0, 1, cpu);
+                    code[n++] = ngx_event_bpf_insn(BPF_ALU64|BPF_MOV|BPF_K,
+                                                   0, 0, 0, worker);
+                    break;
+                }
+            }
+        }
+
+        /* bpf_sk_select_reuseport(ctx, map, &worker, 0) */
+
+        code[n++] = ngx_event_bpf_insn(BPF_STX|BPF_MEM|BPF_W, 10, 0, -4, 0);
+        code[n++] = ngx_event_bpf_insn(BPF_ALU64|BPF_MOV|BPF_X, 1, 6, 0, 0);
+
+        m = n;
+
+        code[n++] = ngx_event_bpf_insn(BPF_LD|BPF_DW|BPF_IMM, 2,
+                                       BPF_PSEUDO_MAP_FD, 0, 0);
+        code[n++] = ngx_event_bpf_insn(0, 0, 0, 0, 0);
+        code[n++] = ngx_event_bpf_insn(BPF_ALU64|BPF_MOV|BPF_X, 3, 10, 0, 0);
+        code[n++] = ngx_event_bpf_insn(BPF_ALU64|BPF_ADD|BPF_K, 3, 0, 0, -4);
+        code[n++] = ngx_event_bpf_insn(BPF_ALU64|BPF_MOV|BPF_K, 4, 0, 0, 0);
+        code[n++] = ngx_event_bpf_insn(BPF_JMP|BPF_CALL, 0, 0, 0,
+                                       BPF_FUNC_sk_select_reuseport);
+        code[n++] = ngx_event_bpf_insn(BPF_ALU64|BPF_MOV|BPF_K, 0, 0, 0,
+                                       SK_PASS);
+        code[n++] = ngx_event_bpf_insn(BPF_JMP|BPF_EXIT, 0, 0, 0, 0);
+    }
+
+    ls = cycle->listening.elts;
+    for (i = 0; i < cycle->listening.nelts; i++) {
+
+        if (!ls[i].reuseport || ls[i].worker != 0
+            || ls[i].fd == (ngx_socket_t) -1)
+        {
+            continue;
+        }
+
+        /* the map of the group is kept by the previous cycle */
+
+        detach = 0;
+
+        for (j = 0; j < cycle->listening.nelts; j++) {
+
+            ols = ls[j].previous;
+
+            if (ols == NULL
+                || ols->reuseport_map == -1
+                || ls[j].type != ls[i].type
+                || ngx_cmp_sockaddr(ls[j].sockaddr, ls[j].socklen,
+                                    ls[i].sockaddr, ls[i].socklen, 1)
+                   != NGX_OK)
+            {
+                continue;
+            }
+
+            ngx_event_reuseport_map_free(cycle, ols->reuseport_map);
+
+            ols->reuseport_map = -1;
+            detach = 1;
+        }
+
+        if (!on) {
+
+#ifdef SO_DETACH_REUSEPORT_BPF
+            if (detach
+                && setsockopt(ls[i].fd, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF,
+                              (const void *) &detach, sizeof(int))
+                   == -1)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                              "setsockopt(SO_DETACH_REUSEPORT_BPF) %V failed, "
+                              "ignored", &ls[i].addr_text);
+            }
+#endif
+
+            continue;
+        }
+
+        ngx_memzero(&attr, sizeof(union bpf_attr));
+
+        attr.map_type = BPF_MAP_TYPE_REUSEPORT_SOCKARRAY;
+        attr.key_size = sizeof(uint32_t);
+        attr.value_size = sizeof(uint64_t);
+        attr.max_entries = ccf->worker_processes;
+
+        map = syscall(SYS_bpf, BPF_MAP_CREATE, &attr, sizeof(union bpf_attr));
+
+        if (map == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "bpf(BPF_MAP_CREATE) for %V failed, ignored",
+                          &ls[i].addr_text);
+            continue;
+        }
+
+        for (j = 0; j < cycle->listening.nelts; j++) {
+
+            if (!ls[j].reuseport
+                || ls[j].fd == (ngx_socket_t) -1
+                || ls[j].worker >= (ngx_uint_t) ccf->worker_processes
+                || ls[j].type != ls[i].type
+                || ngx_cmp_sockaddr(ls[j].sockaddr, ls[j].socklen,
+                                    ls[i].sockaddr, ls[i].socklen, 1)
+                   != NGX_OK)
+            {
+                continue;
+            }
+
+            key = ls[j].worker;
+            value = ls[j].fd;
+
+            ngx_memzero(&attr, sizeof(union bpf_attr));
+
+            attr.map_fd = map;
+            attr.key = (uintptr_t) &key;
+            attr.value = (uintptr_t) &value;
+            attr.flags = BPF_ANY;
+
+            if (syscall(SYS_bpf, BPF_MAP_UPDATE_ELEM, &attr,
+                        sizeof(union bpf_attr))
+                == -1)
+            {
+                ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                              "bpf(BPF_MAP_UPDATE_ELEM) for %V "
+                              "worker %ui failed, ignored",
+                              &ls[j].addr_text, ls[j].worker);
+            }
+        }
+
+        code[m].imm = map;
+
+        ngx_memzero(&attr, sizeof(union bpf_attr));
+
+        attr.prog_type = BPF_PROG_TYPE_SK_REUSEPORT;
+        attr.insns = (uintptr_t) code;
+        attr.insn_cnt = n;
+        attr.license = (uintptr_t) "GPL";
+
+        prog = syscall(SYS_bpf, BPF_PROG_LOAD, &attr, sizeof(union bpf_attr));
+
+        if (prog == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "bpf(BPF_PROG_LOAD) for %V failed, ignored",
+                          &ls[i].addr_text);
+            ngx_event_reuseport_map_free(cycle, map);
+            continue;
+        }
+
+        /* the program is shared by all sockets of the group */
+
+        if (setsockopt(ls[i].fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_EBPF,
+                       (const void *) &prog, sizeof(int))
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                          "setsockopt(SO_ATTACH_REUSEPORT_EBPF) %V failed, "
+                          "ignored", &ls[i].addr_text);
+            ngx_event_reuseport_map_free(cycle, map);
+            (void) close(prog);
+            continue;
+        }
+
+        /* the attached program holds the map */
+
+        (void) close(prog);
+
+        ls[i].reuseport_map = map;
+
+        for (j = 0; j < cycle->listening.nelts; j++) {
+
+            if (ls[j].reuseport
+                && ls[j].fd != (ngx_socket_t) -1
+                && ls[j].worker < (ngx_uint_t) ccf->worker_processes
+                && ls[j].type == ls[i].type
+                && ngx_cmp_sockaddr(ls[j].sockaddr, ls[j].socklen,
+                                    ls[i].sockaddr, ls[i].socklen, 1)
+                   == NGX_OK)
+            {
+                ls[j].reuseport_steered = 1;
+            }
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "reuseport cpu steering on %V, %ui instructions",
+                       &ls[i].addr_text, n);
+    }
+}
+
+
+static void
+ngx_event_reuseport_map_free(ngx_cycle_t *cycle, int map)
+{
+    uint32_t        key;
+    union bpf_attr  attr;
+
+    /* the sockets are removed at once, so that a new map may have them */
+
+    for (key = 0; key < NGX_MAX_PROCESSES; key++) {
+
+        ngx_memzero(&attr, sizeof(union bpf_attr));
+
+        attr.map_fd = map;
+        attr.key = (uintptr_t) &key;
+
+        if (syscall(SYS_bpf, BPF_MAP_DELETE_ELEM, &attr,
+                    sizeof(union bpf_attr))
+            == -1
+            && ngx_errno != NGX_ENOENT)
+        {
+            break;
+        }
+    }
+
+    if (close(map) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "close() reuseport map failed");
+    }
+}
+
+#endif
+
+
 #if !(NGX_WIN32)
 
 static void
@@ -662,8 +1134,8 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ngx_queue_init(&ngx_posted_accept_events);
     ngx_queue_init(&ngx_posted_events);
 
-	//ʼʵֵĶʱ
-    if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
+	//ʼʱtimer_methodʹúʱ
+    if (ngx_event_timer_init(cycle->log, ecf->timer_method) == NGX_ERROR) {
         return NGX_ERROR;
     }
 
@@ -884,7 +1356,15 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
 #else
 
-        rev->handler = ngx_event_accept;
+        if (ls[i].type == SOCK_DGRAM) {
+            ngx_rbtree_init(&ls[i].rbtree, &ls[i].sentinel,
+                            ngx_udp_rbtree_insert_value);
+
+            rev->handler = ngx_event_recvmsg;
+
+        } else {
+            rev->handler = ngx_event_accept;
+        }
 
 		//ûaccept_mutexͽ׽ӦĶ¼뵽¼ģУ
 		//Ҫںִкngx_process_events_and_timers()ڽоֻռaccept_mutex
@@ -1060,6 +1540,47 @@ ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_event_multi_accept(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_event_conf_t  *ecf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (ecf->multi_accept != NGX_CONF_UNSET) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ecf->accept_batch = 0;
+
+    if (ngx_strcasecmp(value[1].data, (u_char *) "on") == 0) {
+        ecf->multi_accept = 1;
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcasecmp(value[1].data, (u_char *) "off") == 0) {
+        ecf->multi_accept = 0;
+        return NGX_CONF_OK;
+    }
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\", it must be \"on\", "
+                           "\"off\" or a number", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    ecf->multi_accept = 1;
+    ecf->accept_batch = n;
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_event_use(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -1227,8 +1748,11 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->connections = NGX_CONF_UNSET_UINT;
     ecf->use = NGX_CONF_UNSET_UINT;
     ecf->multi_accept = NGX_CONF_UNSET;
+    ecf->accept_batch = NGX_CONF_UNSET_UINT;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->timer_method = NGX_CONF_UNSET_UINT;
+    ecf->reuseport_steering = NGX_CONF_UNSET;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1326,8 +1850,22 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_ptr_value(ecf->name, event_module->name->data);
 
     ngx_conf_init_value(ecf->multi_accept, 0);
+    ngx_conf_init_uint_value(ecf->accept_batch, 0);
     ngx_conf_init_value(ecf->accept_mutex, 1);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_uint_value(ecf->timer_method, NGX_EVENT_TIMER_RBTREE);
+    ngx_conf_init_value(ecf->reuseport_steering, 0);
+
+#if !(NGX_HAVE_REUSEPORT_EBPF)
+
+    if (ecf->reuseport_steering) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"reuseport_cpu_steering\" is not supported "
+                      "on this platform, ignored");
+        ecf->reuseport_steering = 0;
+    }
+
+#endif
 
     return NGX_CONF_OK;
 }
@@ -492,6 +492,8 @@ typedef struct
     ngx_uint_t    use;					
 	//־λΪ1ʱʾ¼ģ֪ͨʱܵضԱεпͻ˷TCP󶼽(accept)
     ngx_flag_t    multi_accept;	
+	//multi_acceptʱÿ¼֪ͨaccept0ʾ
+    ngx_uint_t    accept_batch;
 	/* uses accept mutex to serialize accept() syscalls*/
 	//־λΪ1ʱʾøؾ
 	//öworkerءлµĿͻ˽TCPӡ
@@ -501,6 +503,10 @@ typedef struct
     ngx_flag_t    accept_mutex;
 	//ؾʹЩworkeròʱӳaccept_mutex_delay»ȡؾ
     ngx_msec_t    accept_mutex_delay;
+	//ʱʵַʽNGX_EVENT_TIMER_RBTREENGX_EVENT_TIMER_WHEEL
+    ngx_uint_t    timer_method;
+	//־λΪ1ʱݰCPUreuseport˿ϵӷڸCPUϵworker
+    ngx_flag_t    reuseport_steering;
 	//ѡõ¼ģ֣useԱƥ
     u_char       *name;					
 	
@@ -547,6 +553,35 @@ extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
 extern ngx_atomic_t  *ngx_stat_waiting;
 
+/* HTTP/2 streams promised to clients and those reset by clients */
+extern ngx_atomic_t  *ngx_stat_http2_pushes;
+extern ngx_atomic_t  *ngx_stat_http2_push_cancels;
+
+/* SSL handshakes offloaded to a thread pool and those finished */
+extern ngx_atomic_t  *ngx_stat_ssl_handshakes_queued;
+extern ngx_atomic_t  *ngx_stat_ssl_handshakes_completed;
+
+#define NGX_EVENT_LISTENING_STATS  64
+
+/* accept counters of a listening address, shared by all workers */
+typedef struct {
+    ngx_atomic_t   accepted;
+    ngx_atomic_t   batches;     /* events that accepted a connection */
+    ngx_atomic_t   limited;     /* batches stopped by multi_accept number */
+    ngx_atomic_t   eagain;      /* batches that drained the queue */
+    socklen_t      socklen;     /* 0 - the slot is free */
+    u_char         sockaddr[NGX_SOCKADDRLEN];
+} ngx_event_listening_stat_t;
+
+extern ngx_event_listening_stat_t  *ngx_stat_listening;
+
+/* per worker and per CPU accept counters of reuseport listening sockets */
+extern ngx_uint_t     ngx_stat_workers;
+extern ngx_atomic_t  *ngx_stat_worker_accepted;
+extern ngx_atomic_t  *ngx_stat_worker_local;
+extern ngx_uint_t     ngx_stat_cpus;
+extern ngx_atomic_t  *ngx_stat_cpu_accepted;
+
 #endif
 
 
@@ -590,6 +625,7 @@ ngx_int_t ngx_send_lowat(ngx_connection_t *c, size_t lowat);
 
 #include <ngx_event_timer.h>
 #include <ngx_event_posted.h>
+#include <ngx_event_udp.h>
 
 #if (NGX_WIN32)
 #include <ngx_iocp_module.h>
@@ -13,6 +13,9 @@
 static ngx_int_t ngx_enable_accept_events(ngx_cycle_t *cycle);
 static ngx_int_t ngx_disable_accept_events(ngx_cycle_t *cycle, ngx_uint_t all);
 static void ngx_close_accepted_connection(ngx_connection_t *c);
+#if (NGX_STAT_STUB && NGX_HAVE_INCOMING_CPU && NGX_HAVE_REUSEPORT_EBPF)
+static void ngx_event_accept_cpu_stat(ngx_socket_t s);
+#endif
 
 
 void
@@ -22,11 +25,15 @@ ngx_event_accept(ngx_event_t *ev)
     ngx_err_t          err;
     ngx_log_t         *log;
     ngx_uint_t         level;
+    ngx_uint_t         n;
     ngx_socket_t       s;
     ngx_event_t       *rev, *wev;
     ngx_listening_t   *ls;
     ngx_connection_t  *c, *lc;
     ngx_event_conf_t  *ecf;
+#if (NGX_STAT_STUB)
+    ngx_event_listening_stat_t  *st;
+#endif
     u_char             sa[NGX_SOCKADDRLEN];
 #if (NGX_HAVE_ACCEPT4)
     static ngx_uint_t  use_accept4 = 1;
@@ -52,23 +59,39 @@ ngx_event_accept(ngx_event_t *ev)
     ls = lc->listening;
     ev->ready = 0;
 
+#if (NGX_STAT_STUB)
+    st = ls->accept_stat;
+#endif
+
+    /* the number of connections accepted on this event */
+    n = 0;
+
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0, "accept on %V, ready: %d", &ls->addr_text, ev->available);
 
     do 
 	{
         socklen = NGX_SOCKADDRLEN;
 
+        /* the event module may accept the connections itself */
+
+        if (ngx_io.accept)
+        {
+            s = ngx_io.accept(lc, (struct sockaddr *) sa, &socklen);
+        }
 #if (NGX_HAVE_ACCEPT4)
-        if (use_accept4)
+        else if (use_accept4)
 		{
-            s = accept4(lc->fd, (struct sockaddr *) sa, &socklen, SOCK_NONBLOCK);
+            s = accept4(lc->fd, (struct sockaddr *) sa, &socklen, SOCK_NONBLOCK|SOCK_CLOEXEC);
         } 
 		else 
 		{
             s = accept(lc->fd, (struct sockaddr *) sa, &socklen);
         }
 #else
-        s = accept(lc->fd, (struct sockaddr *) sa, &socklen);
+        else
+        {
+            s = accept(lc->fd, (struct sockaddr *) sa, &socklen);
+        }
 #endif
 
         if (s == (ngx_socket_t) -1) 
@@ -78,6 +101,12 @@ ngx_event_accept(ngx_event_t *ev)
             if (err == NGX_EAGAIN) 
 			{
                 ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, err, "accept() not ready");
+
+#if (NGX_STAT_STUB)
+                if (st && n) {
+                    (void) ngx_atomic_fetch_add(&st->eagain, 1);
+                }
+#endif
                 return;
             }
 
@@ -144,8 +173,29 @@ ngx_event_accept(ngx_event_t *ev)
             return;
         }
 
+        n++;
+
 #if (NGX_STAT_STUB)
         (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+
+        if (st) {
+            (void) ngx_atomic_fetch_add(&st->accepted, 1);
+
+            if (n == 1) {
+                (void) ngx_atomic_fetch_add(&st->batches, 1);
+            }
+        }
+
+        if (ngx_worker < ngx_stat_workers) {
+            (void) ngx_atomic_fetch_add(&ngx_stat_worker_accepted[ngx_worker],
+                                        1);
+        }
+
+#if (NGX_HAVE_INCOMING_CPU && NGX_HAVE_REUSEPORT_EBPF)
+        if (ls->reuseport_steered) {
+            ngx_event_accept_cpu_stat(s);
+        }
+#endif
 #endif
 		
         ngx_accept_disabled = ngx_cycle->connection_n / 8 - ngx_cycle->free_connection_n;
@@ -216,6 +266,7 @@ ngx_event_accept(ngx_event_t *ev)
 
         *log = ls->log;
 
+        c->type = SOCK_STREAM;
         c->recv = ngx_recv;
         c->send = ngx_send;
         c->recv_chain = ngx_recv_chain;
@@ -384,6 +435,21 @@ ngx_event_accept(ngx_event_t *ev)
             ev->available--;
         }
 
+        /*
+         * the batch is over: yield to the posted and timer events,
+         * the listening socket is reported again while it has connections
+         */
+
+        if (ecf->accept_batch && n == ecf->accept_batch && ev->available)
+		{
+#if (NGX_STAT_STUB)
+            if (st) {
+                (void) ngx_atomic_fetch_add(&st->limited, 1);
+            }
+#endif
+            break;
+        }
+
     } 
 	while (ev->available);
 }
@@ -500,6 +566,39 @@ ngx_disable_accept_events(ngx_cycle_t *cycle, ngx_uint_t all)
 }
 
 
+#if (NGX_STAT_STUB && NGX_HAVE_INCOMING_CPU && NGX_HAVE_REUSEPORT_EBPF)
+
+/*
+ * Counts the connection on the CPU that received it, and as local
+ * when the worker runs on the same CPU.  This costs two system calls,
+ * so it is only done on the sockets of groups steered by the eBPF program.
+ */
+
+static void
+ngx_event_accept_cpu_stat(ngx_socket_t s)
+{
+    int        cpu;
+    socklen_t  len;
+
+    len = sizeof(int);
+
+    if (getsockopt(s, SOL_SOCKET, SO_INCOMING_CPU, (void *) &cpu, &len) == -1
+        || cpu < 0
+        || (ngx_uint_t) cpu >= ngx_stat_cpus)
+    {
+        return;
+    }
+
+    (void) ngx_atomic_fetch_add(&ngx_stat_cpu_accepted[cpu], 1);
+
+    if (cpu == sched_getcpu() && ngx_worker < ngx_stat_workers) {
+        (void) ngx_atomic_fetch_add(&ngx_stat_worker_local[ngx_worker], 1);
+    }
+}
+
+#endif
+
+
 static void
 ngx_close_accepted_connection(ngx_connection_t *c)
 {
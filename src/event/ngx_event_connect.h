@@ -63,6 +63,8 @@ struct ngx_peer_connection_s
     ngx_addr_t                      *local;			
 	//׽ֵĽջС
     int                              rcvbuf;		
+	//׽ͣΪ0ʱʹSOCK_STREAM
+    int                              type;
 	//¼־ngx_log_t
     ngx_log_t                       *log;			
 	//־λΪ 1ʱʾconnectionѾ
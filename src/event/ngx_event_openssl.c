@@ -8,6 +8,9 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_event.h>
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
 
 
 #define NGX_SSL_PASSWORD_BUFFER_SIZE  4096
@@ -19,15 +22,58 @@ typedef struct
 } ngx_openssl_conf_t;
 
 
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_connection_t  *connection;
+    int                n;
+    int                sslerr;
+    ngx_err_t          err;
+    ngx_uint_t         closed;     /* unsigned  closed:1; */
+    ngx_uint_t         buffer_set; /* unsigned  buffer_set:1; */
+} ngx_ssl_handshake_ctx_t;
+
+#endif
+
+
+typedef struct {
+    uint32_t                    hash;
+    u_char                      id_len;
+    u_char                      id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+    time_t                      expire;
+    ngx_atomic_uint_t           removals;
+    size_t                      len;
+    size_t                      size;
+    u_char                     *session;
+} ngx_ssl_session_worker_node_t;
+
+
+struct ngx_ssl_session_worker_cache_s {
+    ngx_atomic_t                     lock;
+    ngx_uint_t                       n;
+    ngx_ssl_session_worker_node_t   *nodes;
+};
+
+
 static int ngx_ssl_password_callback(char *buf, int size, int rwflag,
     void *userdata);
 static int ngx_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store);
 static void ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where,
     int ret);
+static ngx_uint_t ngx_ssl_handshake_buffer(const ngx_ssl_conn_t *ssl_conn);
 static void ngx_ssl_passwords_cleanup(void *data);
+static ngx_int_t ngx_ssl_handshake_result(ngx_connection_t *c, int n,
+    int sslerr);
 static void ngx_ssl_handshake_handler(ngx_event_t *ev);
+#if (NGX_THREADS)
+static ngx_int_t ngx_ssl_handshake_post(ngx_connection_t *c);
+static void ngx_ssl_handshake_thread_handler(void *data, ngx_log_t *log);
+static void ngx_ssl_handshake_thread_event_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_ssl_handle_recv(ngx_connection_t *c, int n);
 static void ngx_ssl_write_handler(ngx_event_t *wev);
+static ssize_t ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file,
+    size_t size);
 static void ngx_ssl_read_handler(ngx_event_t *rev);
 static void ngx_ssl_shutdown_handler(ngx_event_t *ev);
 static void ngx_ssl_connection_error(ngx_connection_t *c, int sslerr,
@@ -35,6 +81,12 @@ static void ngx_ssl_connection_error(ngx_connection_t *c, int sslerr,
 static void ngx_ssl_clear_error(ngx_log_t *log);
 
 static ngx_int_t ngx_ssl_session_id_context(ngx_ssl_t *ssl, ngx_str_t *sess_ctx);
+static size_t ngx_ssl_session_worker_get(ngx_ssl_session_cache_t *cache,
+    ngx_ssl_session_shctx_t *sh, uint32_t hash, u_char *id, size_t len,
+    u_char *buf);
+static void ngx_ssl_session_worker_put(ngx_ssl_session_cache_t *cache,
+    uint32_t hash, u_char *id, size_t len, u_char *buf, size_t size,
+    time_t expire, ngx_atomic_uint_t removals);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
 static int ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn,
     ngx_ssl_session_t *sess);
@@ -42,11 +94,13 @@ static ngx_ssl_session_t *ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
     u_char *id, int len, int *copy);
 static void ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
 static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n);
+    ngx_ssl_session_shctx_t *sh, ngx_uint_t n);
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+static ngx_int_t ngx_ssl_rotate_session_ticket_keys(
+    ngx_ssl_session_cache_t *cache, ngx_log_t *log);
 static int ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn,
     unsigned char *name, unsigned char *iv, EVP_CIPHER_CTX *ectx,
     HMAC_CTX *hctx, int enc);
@@ -210,6 +264,10 @@ ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data)
 
     ssl->buffer_size = NGX_SSL_BUFSIZE;
 
+#if (NGX_THREADS)
+    ssl->thread_pool = NULL;
+#endif
+
     /* client side options */
 
 #ifdef SSL_OP_MICROSOFT_SESS_ID_BUG
@@ -507,6 +565,11 @@ ngx_ssl_password_callback(char *buf, int size, int rwflag, void *userdata)
 {
     ngx_str_t *pwd = userdata;
 
+    if (pwd == NULL) {
+        /* do not prompt for a password on the terminal */
+        return 0;
+    }
+
     if (rwflag)
 	{
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "ngx_ssl_password_callback() is called for encryption");
@@ -528,6 +591,465 @@ ngx_ssl_password_callback(char *buf, int size, int rwflag, void *userdata)
 }
 
 
+#ifdef SSL_R_CERT_CB_ERROR
+
+/*
+ * Certificates selected with variables are loaded during handshakes.
+ * Parsed certificates and keys may be kept in a cache of each process:
+ * OpenSSL objects live in the process heap and cannot be placed into
+ * shared memory.  The least recently used entries are dropped when the
+ * cache is full, and entries older than "valid" are loaded from disk
+ * again.  Files are loaded outside of the cache lock, since handshakes
+ * may also run in the handshake threads.
+ */
+
+typedef struct {
+    ngx_str_node_t              sn;         /* "certificate\0key" */
+    ngx_queue_t                 queue;
+    X509                       *x509;
+    STACK_OF(X509)             *chain;
+    EVP_PKEY                   *pkey;
+    time_t                      created;
+} ngx_ssl_cert_cache_node_t;
+
+
+struct ngx_ssl_cert_cache_s {
+    ngx_rbtree_t                rbtree;
+    ngx_rbtree_node_t           sentinel;
+    ngx_queue_t                 queue;
+    ngx_uint_t                  current;
+    ngx_uint_t                  max;
+    time_t                      valid;
+    ngx_atomic_t                lock;
+};
+
+
+static ngx_int_t ngx_ssl_cert_load(ngx_log_t *log, ngx_str_t *cert,
+    ngx_str_t *key, ngx_array_t *passwords, X509 **x509,
+    STACK_OF(X509) **chain, EVP_PKEY **pkey);
+static ngx_int_t ngx_ssl_cert_use(ngx_connection_t *c, ngx_str_t *cert,
+    X509 *x509, STACK_OF(X509) *chain, EVP_PKEY *pkey);
+static void ngx_ssl_cert_free(X509 *x509, STACK_OF(X509) *chain,
+    EVP_PKEY *pkey);
+static void ngx_ssl_cert_cache_insert(ngx_ssl_cert_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, X509 *x509, STACK_OF(X509) *chain,
+    EVP_PKEY *pkey);
+static void ngx_ssl_cert_cache_cleanup(void *data);
+
+
+ngx_ssl_cert_cache_t *
+ngx_ssl_cert_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t valid)
+{
+    ngx_pool_cleanup_t    *cln;
+    ngx_ssl_cert_cache_t  *cache;
+
+    cache = ngx_palloc(pool, sizeof(ngx_ssl_cert_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    ngx_rbtree_init(&cache->rbtree, &cache->sentinel,
+                    ngx_str_rbtree_insert_value);
+
+    ngx_queue_init(&cache->queue);
+
+    cache->current = 0;
+    cache->max = max;
+    cache->valid = valid;
+    cache->lock = 0;
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_ssl_cert_cache_cleanup;
+    cln->data = cache;
+
+    return cache;
+}
+
+
+ngx_int_t
+ngx_ssl_connection_certificate(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords,
+    ngx_ssl_cert_cache_t *cache)
+{
+    u_char                     *p;
+    uint32_t                    hash;
+    ngx_int_t                   rc;
+    ngx_str_t                   name;
+    EVP_PKEY                   *pkey;
+    STACK_OF(X509)             *chain;
+    X509                       *x509;
+    ngx_ssl_cert_cache_node_t  *cn;
+
+    if (cert->len == 0 || key->len == 0) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "empty SSL certificate or key name");
+        return NGX_ERROR;
+    }
+
+    if (ngx_strncmp(key->data, "engine:", sizeof("engine:") - 1) == 0) {
+        ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                      "loading \"engine:...\" certificate keys "
+                      "is not supported with variables");
+        return NGX_ERROR;
+    }
+
+    if (ngx_get_full_name(pool, (ngx_str_t *) &ngx_cycle->conf_prefix, cert)
+        != NGX_OK
+        || ngx_get_full_name(pool, (ngx_str_t *) &ngx_cycle->conf_prefix, key)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (cache == NULL) {
+        if (ngx_ssl_cert_load(c->log, cert, key, passwords, &x509, &chain,
+                              &pkey)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        rc = ngx_ssl_cert_use(c, cert, x509, chain, pkey);
+
+        ngx_ssl_cert_free(x509, chain, pkey);
+
+        return rc;
+    }
+
+    name.len = cert->len + 1 + key->len;
+    name.data = ngx_pnalloc(pool, name.len);
+    if (name.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_cpymem(name.data, cert->data, cert->len);
+    *p++ = '\0';
+    ngx_memcpy(p, key->data, key->len);
+
+    hash = ngx_crc32_long(name.data, name.len);
+
+    ngx_spinlock(&cache->lock, 1, 2048);
+
+    cn = (ngx_ssl_cert_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->rbtree, &name, hash);
+
+    if (cn && ngx_time() - cn->created < cache->valid) {
+
+        ngx_queue_remove(&cn->queue);
+        ngx_queue_insert_head(&cache->queue, &cn->queue);
+
+        /* SSL_use_certificate() and friends take their own references */
+
+        rc = ngx_ssl_cert_use(c, cert, cn->x509, cn->chain, cn->pkey);
+
+        ngx_unlock(&cache->lock);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "ssl certificate cache hit: \"%V\" %i", cert, rc);
+
+        return rc;
+    }
+
+    ngx_unlock(&cache->lock);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "ssl certificate cache miss: \"%V\"", cert);
+
+    if (ngx_ssl_cert_load(c->log, cert, key, passwords, &x509, &chain, &pkey)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    rc = ngx_ssl_cert_use(c, cert, x509, chain, pkey);
+
+    if (rc != NGX_OK) {
+        ngx_ssl_cert_free(x509, chain, pkey);
+        return rc;
+    }
+
+    ngx_spinlock(&cache->lock, 1, 2048);
+
+    ngx_ssl_cert_cache_insert(cache, &name, hash, x509, chain, pkey);
+
+    ngx_unlock(&cache->lock);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_ssl_cert_load(ngx_log_t *log, ngx_str_t *cert, ngx_str_t *key,
+    ngx_array_t *passwords, X509 **x509, STACK_OF(X509) **chain,
+    EVP_PKEY **pkey)
+{
+    BIO         *bio;
+    X509        *x;
+    u_long       n;
+    ngx_str_t   *pwd;
+    ngx_uint_t   tries;
+
+    *x509 = NULL;
+    *chain = NULL;
+    *pkey = NULL;
+
+    bio = BIO_new_file((char *) cert->data, "r");
+    if (bio == NULL) {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "BIO_new_file(\"%s\") failed", cert->data);
+        return NGX_ERROR;
+    }
+
+    *x509 = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
+    if (*x509 == NULL) {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "PEM_read_bio_X509_AUX(\"%s\") failed", cert->data);
+        goto failed;
+    }
+
+    *chain = sk_X509_new_null();
+    if (*chain == NULL) {
+        goto failed;
+    }
+
+    /* read rest of the chain */
+
+    for ( ;; ) {
+
+        x = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+        if (x == NULL) {
+            n = ERR_peek_last_error();
+
+            if (ERR_GET_LIB(n) == ERR_LIB_PEM
+                && ERR_GET_REASON(n) == PEM_R_NO_START_LINE)
+            {
+                /* end of file */
+                ERR_clear_error();
+                break;
+            }
+
+            /* some real error */
+
+            ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                          "PEM_read_bio_X509(\"%s\") failed", cert->data);
+            goto failed;
+        }
+
+        if (sk_X509_push(*chain, x) == 0) {
+            X509_free(x);
+            goto failed;
+        }
+    }
+
+    BIO_free(bio);
+
+    bio = BIO_new_file((char *) key->data, "r");
+    if (bio == NULL) {
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "BIO_new_file(\"%s\") failed", key->data);
+        goto failed;
+    }
+
+    if (passwords) {
+        tries = passwords->nelts;
+        pwd = passwords->elts;
+
+    } else {
+        tries = 1;
+        pwd = NULL;
+    }
+
+    for ( ;; ) {
+
+        *pkey = PEM_read_bio_PrivateKey(bio, NULL, ngx_ssl_password_callback,
+                                        pwd);
+        if (*pkey) {
+            break;
+        }
+
+        if (--tries) {
+            ERR_clear_error();
+            (void) BIO_reset(bio);
+            pwd++;
+            continue;
+        }
+
+        ngx_ssl_error(NGX_LOG_ERR, log, 0,
+                      "PEM_read_bio_PrivateKey(\"%s\") failed", key->data);
+        goto failed;
+    }
+
+    BIO_free(bio);
+
+    return NGX_OK;
+
+failed:
+
+    if (bio) {
+        BIO_free(bio);
+    }
+
+    ngx_ssl_cert_free(*x509, *chain, *pkey);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_ssl_cert_use(ngx_connection_t *c, ngx_str_t *cert, X509 *x509,
+    STACK_OF(X509) *chain, EVP_PKEY *pkey)
+{
+    if (SSL_use_certificate(c->ssl->connection, x509) == 0) {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_use_certificate(\"%s\") failed", cert->data);
+        return NGX_ERROR;
+    }
+
+    if (SSL_set1_chain(c->ssl->connection, chain) == 0) {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_set1_chain(\"%s\") failed", cert->data);
+        return NGX_ERROR;
+    }
+
+    if (SSL_use_PrivateKey(c->ssl->connection, pkey) == 0) {
+        ngx_ssl_error(NGX_LOG_ERR, c->log, 0,
+                      "SSL_use_PrivateKey(\"%s\") failed", cert->data);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_cert_free(X509 *x509, STACK_OF(X509) *chain, EVP_PKEY *pkey)
+{
+    if (x509) {
+        X509_free(x509);
+    }
+
+    if (chain) {
+        sk_X509_pop_free(chain, X509_free);
+    }
+
+    if (pkey) {
+        EVP_PKEY_free(pkey);
+    }
+}
+
+
+static void
+ngx_ssl_cert_cache_insert(ngx_ssl_cert_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, X509 *x509, STACK_OF(X509) *chain, EVP_PKEY *pkey)
+{
+    ngx_queue_t                *q;
+    ngx_ssl_cert_cache_node_t  *cn;
+
+    cn = (ngx_ssl_cert_cache_node_t *)
+             ngx_str_rbtree_lookup(&cache->rbtree, name, hash);
+
+    if (cn) {
+
+        /* an outdated entry, or loaded by another thread meanwhile */
+
+        ngx_ssl_cert_free(cn->x509, cn->chain, cn->pkey);
+
+        ngx_queue_remove(&cn->queue);
+
+        goto found;
+    }
+
+    if (cache->current >= cache->max) {
+
+        /* drop the least recently used entry */
+
+        q = ngx_queue_last(&cache->queue);
+        cn = ngx_queue_data(q, ngx_ssl_cert_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->rbtree, &cn->sn.node);
+
+        ngx_ssl_cert_free(cn->x509, cn->chain, cn->pkey);
+        ngx_free(cn);
+
+        cache->current--;
+    }
+
+    cn = ngx_alloc(sizeof(ngx_ssl_cert_cache_node_t) + name->len,
+                   ngx_cycle->log);
+    if (cn == NULL) {
+        ngx_ssl_cert_free(x509, chain, pkey);
+        return;
+    }
+
+    cn->sn.node.key = hash;
+    cn->sn.str.len = name->len;
+    cn->sn.str.data = (u_char *) cn + sizeof(ngx_ssl_cert_cache_node_t);
+    ngx_memcpy(cn->sn.str.data, name->data, name->len);
+
+    ngx_rbtree_insert(&cache->rbtree, &cn->sn.node);
+
+    cache->current++;
+
+found:
+
+    cn->x509 = x509;
+    cn->chain = chain;
+    cn->pkey = pkey;
+    cn->created = ngx_time();
+
+    ngx_queue_insert_head(&cache->queue, &cn->queue);
+}
+
+
+static void
+ngx_ssl_cert_cache_cleanup(void *data)
+{
+    ngx_ssl_cert_cache_t  *cache = data;
+
+    ngx_queue_t                *q;
+    ngx_ssl_cert_cache_node_t  *cn;
+
+    while (!ngx_queue_empty(&cache->queue)) {
+        q = ngx_queue_head(&cache->queue);
+        cn = ngx_queue_data(q, ngx_ssl_cert_cache_node_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->rbtree, &cn->sn.node);
+
+        ngx_ssl_cert_free(cn->x509, cn->chain, cn->pkey);
+        ngx_free(cn);
+    }
+
+    cache->current = 0;
+}
+
+#else
+
+ngx_ssl_cert_cache_t *
+ngx_ssl_cert_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t valid)
+{
+    return NULL;
+}
+
+
+ngx_int_t
+ngx_ssl_connection_certificate(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords,
+    ngx_ssl_cert_cache_t *cache)
+{
+    ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                  "variables in SSL certificates are not supported");
+    return NGX_ERROR;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_ssl_client_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert, ngx_int_t depth)
 {
@@ -698,43 +1220,76 @@ ngx_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store)
 static void
 ngx_ssl_info_callback(const ngx_ssl_conn_t *ssl_conn, int where, int ret)
 {
-    BIO               *rbio, *wbio;
-    ngx_connection_t  *c;
+    ngx_connection_t         *c;
+#if (NGX_THREADS)
+    ngx_ssl_handshake_ctx_t  *ctx;
+#endif
+
+    c = ngx_ssl_get_connection((ngx_ssl_conn_t *) ssl_conn);
+
+#if (NGX_THREADS)
+
+    /*
+     * in a handshake task the connection is not touched, as the event loop
+     * updates it concurrently: the task only runs the initial handshake,
+     * so there is no renegotiation, and the buffer flag is kept in the task
+     */
+
+    if (c->ssl->handshake_posted) {
+        ctx = c->ssl->thread_task->ctx;
+
+        if ((where & SSL_CB_ACCEPT_LOOP) == SSL_CB_ACCEPT_LOOP
+            && !ctx->buffer_set)
+        {
+            ctx->buffer_set = ngx_ssl_handshake_buffer(ssl_conn);
+        }
+
+        return;
+    }
+
+#endif
 
     if (where & SSL_CB_HANDSHAKE_START)
 	{
-        c = ngx_ssl_get_connection((ngx_ssl_conn_t *) ssl_conn);
-
         if (c->ssl->handshaked) {
             c->ssl->renegotiation = 1;
             ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL renegotiation");
         }
     }
 
-    if ((where & SSL_CB_ACCEPT_LOOP) == SSL_CB_ACCEPT_LOOP) {
-        c = ngx_ssl_get_connection((ngx_ssl_conn_t *) ssl_conn);
+    if ((where & SSL_CB_ACCEPT_LOOP) == SSL_CB_ACCEPT_LOOP
+        && !c->ssl->handshake_buffer_set)
+    {
+        c->ssl->handshake_buffer_set = ngx_ssl_handshake_buffer(ssl_conn);
+    }
+}
 
-        if (!c->ssl->handshake_buffer_set) {
-            /*
-             * By default OpenSSL uses 4k buffer during a handshake,
-             * which is too low for long certificate chains and might
-             * result in extra round-trips.
-             *
-             * To adjust a buffer size we detect that buffering was added
-             * to write side of the connection by comparing rbio and wbio.
-             * If they are different, we assume that it's due to buffering
-             * added to wbio, and set buffer size.
-             */
 
-            rbio = SSL_get_rbio((ngx_ssl_conn_t *) ssl_conn);
-            wbio = SSL_get_wbio((ngx_ssl_conn_t *) ssl_conn);
+static ngx_uint_t
+ngx_ssl_handshake_buffer(const ngx_ssl_conn_t *ssl_conn)
+{
+    BIO  *rbio, *wbio;
 
-            if (rbio != wbio) {
-                (void) BIO_set_write_buffer_size(wbio, NGX_SSL_BUFSIZE);
-                c->ssl->handshake_buffer_set = 1;
-            }
-        }
+    /*
+     * By default OpenSSL uses 4k buffer during a handshake,
+     * which is too low for long certificate chains and might
+     * result in extra round-trips.
+     *
+     * To adjust a buffer size we detect that buffering was added
+     * to write side of the connection by comparing rbio and wbio.
+     * If they are different, we assume that it's due to buffering
+     * added to wbio, and set buffer size.
+     */
+
+    rbio = SSL_get_rbio((ngx_ssl_conn_t *) ssl_conn);
+    wbio = SSL_get_wbio((ngx_ssl_conn_t *) ssl_conn);
+
+    if (rbio != wbio) {
+        (void) BIO_set_write_buffer_size(wbio, NGX_SSL_BUFSIZE);
+        return 1;
     }
+
+    return 0;
 }
 
 
@@ -1040,6 +1595,10 @@ ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags)
     sc->buffer = ((flags & NGX_SSL_BUFFER) != 0);
     sc->buffer_size = ssl->buffer_size;
 
+#if (NGX_THREADS)
+    sc->thread_pool = ssl->thread_pool;
+#endif
+
     sc->session_ctx = ssl->ctx;
 
     sc->connection = SSL_new(ssl->ctx);
@@ -1098,6 +1657,13 @@ ngx_ssl_handshake(ngx_connection_t *c)
 {
     int        n, sslerr;
     ngx_err_t  err;
+    ngx_int_t  rc;
+
+#if (NGX_THREADS)
+    if (c->ssl->thread_pool && ngx_ssl_handshake_post(c) == NGX_OK) {
+        return NGX_AGAIN;
+    }
+#endif
 
     ngx_ssl_clear_error(c->log);
 
@@ -1105,6 +1671,47 @@ ngx_ssl_handshake(ngx_connection_t *c)
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_do_handshake: %d", n);
 
+    sslerr = 0;
+
+    if (n != 1) {
+        sslerr = SSL_get_error(c->ssl->connection, n);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "SSL_get_error: %d", sslerr);
+    }
+
+    rc = ngx_ssl_handshake_result(c, n, sslerr);
+
+    if (rc != NGX_DECLINED) {
+        return rc;
+    }
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    c->ssl->no_wait_shutdown = 1;
+    c->ssl->no_send_shutdown = 1;
+    c->read->eof = 1;
+
+    if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) 
+	{
+        ngx_connection_error(c, err, "peer closed connection in SSL handshake");
+
+        return NGX_ERROR;
+    }
+
+    c->read->error = 1;
+
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_do_handshake() failed");
+
+    return NGX_ERROR;
+}
+
+
+/* the result of SSL_do_handshake() unless it has failed */
+
+static ngx_int_t
+ngx_ssl_handshake_result(ngx_connection_t *c, int n, int sslerr)
+{
     if (n == 1) 
 	{
         if (ngx_handle_read_event(c->read, 0) != NGX_OK) 
@@ -1174,6 +1781,16 @@ ngx_ssl_handshake(ngx_connection_t *c)
         c->recv_chain = ngx_ssl_recv_chain;
         c->send_chain = ngx_ssl_send_chain;
 
+#ifdef BIO_get_ktls_send
+
+        if (BIO_get_ktls_send(SSL_get_wbio(c->ssl->connection)) == 1) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "BIO_get_ktls_send(): 1");
+            c->ssl->sendfile = 1;
+        }
+
+#endif
+
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 #ifdef SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS
 
@@ -1189,10 +1806,6 @@ ngx_ssl_handshake(ngx_connection_t *c)
         return NGX_OK;
     }
 
-    sslerr = SSL_get_error(c->ssl->connection, n);
-
-    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
-
     if (sslerr == SSL_ERROR_WANT_READ) 
 	{
         c->read->ready = 0;
@@ -1231,24 +1844,7 @@ ngx_ssl_handshake(ngx_connection_t *c)
         return NGX_AGAIN;
     }
 
-    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
-
-    c->ssl->no_wait_shutdown = 1;
-    c->ssl->no_send_shutdown = 1;
-    c->read->eof = 1;
-
-    if (sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) 
-	{
-        ngx_connection_error(c, err, "peer closed connection in SSL handshake");
-
-        return NGX_ERROR;
-    }
-
-    c->read->error = 1;
-
-    ngx_ssl_connection_error(c, sslerr, err, "SSL_do_handshake() failed");
-
-    return NGX_ERROR;
+    return NGX_DECLINED;
 }
 
 
@@ -1261,6 +1857,14 @@ ngx_ssl_handshake_handler(ngx_event_t *ev)
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL handshake handler: %d", ev->write);
 
+#if (NGX_THREADS)
+    if (c->ssl->handshake_posted) {
+        /* the handshake task will check the event when it completes */
+        c->ssl->handshake_event = 1;
+        return;
+    }
+#endif
+
     if (ev->timedout) 
 	{
         c->ssl->handler(c);
@@ -1276,6 +1880,194 @@ ngx_ssl_handshake_handler(ngx_event_t *ev)
 }
 
 
+#if (NGX_THREADS)
+
+/*
+ * SSL_do_handshake() runs in a thread pool, so the private key operations
+ * do not block the event loop; the events of the connection are ignored
+ * until the task completes
+ */
+
+static ngx_int_t
+ngx_ssl_handshake_post(ngx_connection_t *c)
+{
+    ngx_thread_task_t        *task;
+    ngx_ssl_handshake_ctx_t  *ctx;
+
+    task = c->ssl->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(c->pool, sizeof(ngx_ssl_handshake_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_ssl_handshake_thread_handler;
+        task->event.data = c;
+        task->event.handler = ngx_ssl_handshake_thread_event_handler;
+
+        ctx = task->ctx;
+        ctx->connection = c;
+
+        c->ssl->thread_task = task;
+    }
+
+    ctx = task->ctx;
+    ctx->buffer_set = c->ssl->handshake_buffer_set;
+
+    /* the flags are set before the task may start */
+
+    c->ssl->handshake_posted = 1;
+    c->ssl->handshake_event = 0;
+
+    if (ngx_thread_task_post(c->ssl->thread_pool, task) != NGX_OK) {
+        /* the queue is full, the handshake step is done inline */
+        c->ssl->handshake_posted = 0;
+        return NGX_DECLINED;
+    }
+
+    if (!c->ssl->handshake_queued) {
+        c->ssl->handshake_queued = 1;
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_ssl_handshakes_queued, 1);
+#endif
+    }
+
+    c->read->handler = ngx_ssl_handshake_handler;
+    c->write->handler = ngx_ssl_handshake_handler;
+
+    if (!(ngx_event_flags & NGX_USE_CLEAR_EVENT)) {
+
+        /* level-triggered events would be reported while the task runs */
+
+        if (c->read->active) {
+            if (ngx_del_event(c->read, NGX_READ_EVENT, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        if (c->write->active) {
+            if (ngx_del_event(c->write, NGX_WRITE_EVENT, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_ssl_handshake_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_ssl_handshake_ctx_t *ctx = data;
+
+    ngx_connection_t  *c;
+
+    c = ctx->connection;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, log, 0, "SSL handshake thread handler");
+
+    ngx_ssl_clear_error(c->log);
+
+    ctx->n = SSL_do_handshake(c->ssl->connection);
+    ctx->sslerr = 0;
+    ctx->err = 0;
+    ctx->closed = 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL_do_handshake: %d", ctx->n);
+
+    if (ctx->n == 1) {
+        return;
+    }
+
+    ctx->sslerr = SSL_get_error(c->ssl->connection, ctx->n);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL_get_error: %d", ctx->sslerr);
+
+    if (ctx->sslerr == SSL_ERROR_WANT_READ
+        || ctx->sslerr == SSL_ERROR_WANT_WRITE)
+    {
+        return;
+    }
+
+    /*
+     * the OpenSSL error queue is per thread,
+     * so the error is logged here
+     */
+
+    ctx->err = (ctx->sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    if (ctx->sslerr == SSL_ERROR_ZERO_RETURN || ERR_peek_error() == 0) {
+        ngx_connection_error(c, ctx->err,
+                             "peer closed connection in SSL handshake");
+        ctx->closed = 1;
+
+    } else {
+        ngx_ssl_connection_error(c, ctx->sslerr, ctx->err,
+                                 "SSL_do_handshake() failed");
+    }
+
+    ERR_clear_error();
+}
+
+
+static void
+ngx_ssl_handshake_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_int_t                 rc;
+    ngx_connection_t         *c;
+    ngx_ssl_handshake_ctx_t  *ctx;
+
+    c = ev->data;
+    ctx = c->ssl->thread_task->ctx;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL handshake thread event: %d", ctx->n);
+
+    c->ssl->handshake_posted = 0;
+    c->ssl->handshake_buffer_set = ctx->buffer_set;
+
+    if (c->read->timedout || c->write->timedout) {
+        goto done;
+    }
+
+    rc = ngx_ssl_handshake_result(c, ctx->n, ctx->sslerr);
+
+    if (rc == NGX_AGAIN) {
+
+        if (c->ssl->handshake_event) {
+            /* an event was reported while the task ran */
+            ngx_post_event(c->read, &ngx_posted_events);
+        }
+
+        return;
+    }
+
+    if (rc == NGX_DECLINED) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+        c->read->eof = 1;
+
+        if (!ctx->closed) {
+            c->read->error = 1;
+        }
+    }
+
+done:
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_ssl_handshakes_completed, 1);
+#endif
+
+    c->ssl->handler(c);
+}
+
+#endif
+
+
 ssize_t
 ngx_ssl_recv_chain(ngx_connection_t *c, ngx_chain_t *cl, off_t limit)
 {
@@ -1533,8 +2325,14 @@ ngx_ssl_write_handler(ngx_event_t *wev)
  *
  * Besides for protocols such as HTTP it is possible to always buffer
  * the output to decrease a SSL overhead some more.
+ *
+ * With kernel TLS file bufs bypass the buffer and go to SSL_sendfile().
  */
 
+#define ngx_ssl_sendfile_buf(c, b)                                           \
+    ((c)->ssl->sendfile && (b)->in_file && !ngx_buf_in_memory(b))
+
+
 ngx_chain_t *
 ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
@@ -1551,6 +2349,27 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+            if (ngx_ssl_sendfile_buf(c, in->buf)) {
+                n = ngx_ssl_sendfile(c, in->buf,
+                                   in->buf->file_last - in->buf->file_pos);
+
+                if (n == NGX_ERROR) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                if (n == NGX_AGAIN) {
+                    return in;
+                }
+
+                in->buf->file_pos += n;
+
+                if (in->buf->file_pos == in->buf->file_last) {
+                    in = in->next;
+                }
+
+                continue;
+            }
+
             n = ngx_ssl_write(c, in->buf->pos, in->buf->last - in->buf->pos);
 
             if (n == NGX_ERROR) {
@@ -1605,6 +2424,40 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
     for ( ;; ) {
 
+        if (in && buf->pos == buf->last && send < limit
+            && ngx_ssl_sendfile_buf(c, in->buf))
+        {
+            if (in->buf->last_buf || in->buf->flush) {
+                flush = 1;
+            }
+
+            size = (ssize_t) ngx_min(in->buf->file_last - in->buf->file_pos,
+                                     limit - send);
+
+            n = ngx_ssl_sendfile(c, in->buf, size);
+
+            if (n == NGX_ERROR) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            if (n == NGX_AGAIN) {
+                break;
+            }
+
+            in->buf->file_pos += n;
+            send += n;
+
+            if (in->buf->file_pos == in->buf->file_last) {
+                in = in->next;
+            }
+
+            if (n < size) {
+                break;
+            }
+
+            continue;
+        }
+
         while (in && buf->last < buf->end && send < limit) {
             if (in->buf->last_buf || in->buf->flush) {
                 flush = 1;
@@ -1615,6 +2468,12 @@ ngx_ssl_send_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
                 continue;
             }
 
+            if (ngx_ssl_sendfile_buf(c, in->buf)) {
+                /* flush the buffered data before the file */
+                flush = 1;
+                break;
+            }
+
             size = in->buf->last - in->buf->pos;
 
             if (size > buf->end - buf->last) {
@@ -1772,8 +2631,112 @@ ngx_ssl_write(ngx_connection_t *c, u_char *data, size_t size)
 }
 
 
-static void
-ngx_ssl_read_handler(ngx_event_t *rev)
+static ssize_t
+ngx_ssl_sendfile(ngx_connection_t *c, ngx_buf_t *file, size_t size)
+{
+#ifdef BIO_get_ktls_send
+
+    int        sslerr;
+    ssize_t    n;
+    ngx_err_t  err;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "SSL to sendfile: @%O %uz", file->file_pos, size);
+
+eintr:
+
+    ngx_ssl_clear_error(c->log);
+    ngx_set_errno(0);
+
+    n = SSL_sendfile(c->ssl->connection, file->file->fd, file->file_pos,
+                     size, 0);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_sendfile: %z", n);
+
+    if (n > 0) {
+
+        if (c->ssl->saved_read_handler) {
+
+            c->read->handler = c->ssl->saved_read_handler;
+            c->ssl->saved_read_handler = NULL;
+            c->read->ready = 1;
+
+            if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            ngx_post_event(c->read, &ngx_posted_events);
+        }
+
+        c->sent += n;
+
+        return n;
+    }
+
+    if (n == 0) {
+        ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                      "SSL_sendfile() reported that \"%s\" was truncated at %O",
+                      file->file->name.data, file->file_pos);
+        return NGX_ERROR;
+    }
+
+    sslerr = SSL_get_error(c->ssl->connection, n);
+
+    if (sslerr == SSL_ERROR_SSL
+        && ERR_GET_REASON(ERR_peek_error()) == SSL_R_UNINITIALIZED
+        && ngx_errno != 0)
+    {
+        /*
+         * OpenSSL reports a failed sendfile() as SSL_ERROR_SSL
+         * with the SSL_R_UNINITIALIZED reason
+         */
+
+        sslerr = SSL_ERROR_SYSCALL;
+    }
+
+    err = (sslerr == SSL_ERROR_SYSCALL) ? ngx_errno : 0;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0, "SSL_get_error: %d", sslerr);
+
+    if (sslerr == SSL_ERROR_WANT_WRITE) {
+
+        if (ngx_errno == NGX_EINTR) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, NGX_EINTR,
+                           "sendfile() was interrupted");
+            goto eintr;
+        }
+
+        c->write->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    if (sslerr == SSL_ERROR_SYSCALL && err == NGX_EINTR) {
+        goto eintr;
+    }
+
+    c->ssl->no_wait_shutdown = 1;
+    c->ssl->no_send_shutdown = 1;
+    c->write->error = 1;
+
+    ngx_ssl_connection_error(c, sslerr, err, "SSL_sendfile() failed");
+
+#else
+
+    ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                  "SSL_sendfile() not available");
+
+#endif
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_ssl_read_handler(ngx_event_t *rev)
 {
     ngx_connection_t  *c;
 
@@ -2194,18 +3157,21 @@ ngx_ssl_session_id_context(ngx_ssl_t *ssl, ngx_str_t *sess_ctx)
         goto failed;
     }
 
+    /* there is no certificate if it is selected with variables */
+
     cert = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_certificate_index);
 
-    if (X509_digest(cert, EVP_sha1(), buf, &len) == 0) 
-	{
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "X509_digest() failed");
-        goto failed;
-    }
+    if (cert) {
+        if (X509_digest(cert, EVP_sha1(), buf, &len) == 0) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "X509_digest() failed");
+            goto failed;
+        }
 
-    if (EVP_DigestUpdate(&md, buf, len) == 0) 
-	{
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "EVP_DigestUpdate() failed");
-        goto failed;
+        if (EVP_DigestUpdate(&md, buf, len) == 0) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "EVP_DigestUpdate() failed");
+            goto failed;
+        }
     }
 
     list = SSL_CTX_get_client_CA_list(ssl->ctx);
@@ -2256,37 +3222,233 @@ failed:
 }
 
 
+/*
+ * A cache with a single shard keeps its rbtree under the slab pool mutex,
+ * as before.  With several shards every shard has its own mutex, and
+ * memory is allocated with the pool mutex taken separately for a short
+ * time.  The slab pool mutex is always taken for allocations since
+ * sessions may be added from the handshake threads as well.
+ */
+
+static ngx_inline ngx_ssl_session_shctx_t *
+ngx_ssl_session_shard(ngx_ssl_session_cache_t *cache, uint32_t hash)
+{
+    return &cache->sh[hash % cache->shards];
+}
+
+
+static ngx_inline void
+ngx_ssl_session_lock(ngx_ssl_session_cache_t *cache,
+    ngx_ssl_session_shctx_t *sh)
+{
+    if (cache->shards == 1) {
+        ngx_slab_lock(cache->shpool);
+
+    } else {
+        ngx_slab_shard_lock(&sh->shard);
+    }
+}
+
+
+static ngx_inline void
+ngx_ssl_session_unlock(ngx_ssl_session_cache_t *cache,
+    ngx_ssl_session_shctx_t *sh)
+{
+    if (cache->shards == 1) {
+        ngx_slab_unlock(cache->shpool);
+
+    } else {
+        ngx_slab_shard_unlock(&sh->shard);
+    }
+}
+
+
+static void *
+ngx_ssl_session_alloc(ngx_ssl_session_cache_t *cache, size_t size)
+{
+    void  *p;
+
+    if (cache->shards == 1) {
+        return ngx_slab_alloc_locked(cache->shpool, size);
+    }
+
+    ngx_slab_lock(cache->shpool);
+    p = ngx_slab_alloc_locked(cache->shpool, size);
+    ngx_slab_unlock(cache->shpool);
+
+    return p;
+}
+
+
+static void
+ngx_ssl_session_free(ngx_ssl_session_cache_t *cache, void *p)
+{
+    if (cache->shards == 1) {
+        ngx_slab_free_locked(cache->shpool, p);
+        return;
+    }
+
+    ngx_slab_lock(cache->shpool);
+    ngx_slab_free_locked(cache->shpool, p);
+    ngx_slab_unlock(cache->shpool);
+}
+
+
+static void
+ngx_ssl_session_free_node(ngx_ssl_session_cache_t *cache,
+    ngx_ssl_sess_id_t *sess_id)
+{
+    if (cache->shards > 1) {
+        ngx_slab_lock(cache->shpool);
+    }
+
+    ngx_slab_free_locked(cache->shpool, sess_id->session);
+#if (NGX_PTR_SIZE == 4)
+    ngx_slab_free_locked(cache->shpool, sess_id->id);
+#endif
+    ngx_slab_free_locked(cache->shpool, sess_id);
+
+    if (cache->shards > 1) {
+        ngx_slab_unlock(cache->shpool);
+    }
+}
+
+
+ngx_int_t
+ngx_ssl_session_cache_create(ngx_conf_t *cf, ngx_shm_zone_t *shm_zone,
+    ngx_uint_t shards, ngx_uint_t worker_sessions, time_t ticket_rotation,
+    ngx_uint_t ticket_keys)
+{
+    ngx_ssl_session_cache_t         *cache;
+    ngx_ssl_session_worker_cache_t  *wc;
+
+    cache = shm_zone->data;
+
+    if (cache) {
+        if (cache->shards != shards
+            || (cache->worker ? cache->worker->n : 0) != worker_sessions
+            || cache->ticket_rotation != ticket_rotation
+            || (ticket_rotation
+                && cache->ticket_keys_previous != ticket_keys))
+        {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "SSL session cache \"%V\" is already defined "
+                               "with other parameters", &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_session_cache_t));
+    if (cache == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shards = shards;
+
+    if (worker_sessions) {
+        wc = ngx_pcalloc(cf->pool, sizeof(ngx_ssl_session_worker_cache_t));
+        if (wc == NULL) {
+            return NGX_ERROR;
+        }
+
+        wc->nodes = ngx_pcalloc(cf->pool,
+                         worker_sessions * sizeof(ngx_ssl_session_worker_node_t));
+        if (wc->nodes == NULL) {
+            return NGX_ERROR;
+        }
+
+        wc->n = worker_sessions;
+        cache->worker = wc;
+    }
+
+    if (ticket_rotation) {
+        cache->ticket_keys = ngx_array_create(cf->pool, ticket_keys + 2,
+                                         sizeof(ngx_ssl_session_ticket_key_t));
+        if (cache->ticket_keys == NULL) {
+            return NGX_ERROR;
+        }
+
+        cache->ticket_rotation = ticket_rotation;
+        cache->ticket_keys_previous = ticket_keys;
+    }
+
+    shm_zone->data = cache;
+    shm_zone->init = ngx_ssl_session_cache_init;
+
+    return NGX_OK;
+}
+
+
 ngx_int_t
 ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
-    size_t                    len;
-    ngx_slab_pool_t          *shpool;
-    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_cache_t  *ocache = data;
+
+    size_t                       len;
+    ngx_uint_t                   i;
+    ngx_slab_pool_t             *shpool;
+    ngx_ssl_session_cache_t     *cache;
+    ngx_ssl_session_shctx_t     *sh;
+    ngx_ssl_session_cache_sh_t  *shared;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        if (cache->shards != ocache->shards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "SSL session cache \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, cache->shards, ocache->shards);
+            return NGX_ERROR;
+        }
+
+        cache->shared = ocache->shared;
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
 
-    if (data) {
-        shm_zone->data = data;
         return NGX_OK;
     }
 
     shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    cache->shpool = shpool;
 
     if (shm_zone->shm.exists) {
-        shm_zone->data = shpool->data;
+        cache->shared = shpool->data;
+        cache->sh = cache->shared->shards;
         return NGX_OK;
     }
 
-    cache = ngx_slab_alloc(shpool, sizeof(ngx_ssl_session_cache_t));
-    if (cache == NULL) {
+    shared = ngx_slab_calloc(shpool, sizeof(ngx_ssl_session_cache_sh_t));
+    if (shared == NULL) {
         return NGX_ERROR;
     }
 
-    shpool->data = cache;
-    shm_zone->data = cache;
+    sh = ngx_slab_calloc(shpool, cache->shards * sizeof(ngx_ssl_session_shctx_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shared->shards = sh;
+    shpool->data = shared;
 
-    ngx_rbtree_init(&cache->session_rbtree, &cache->sentinel,
-                    ngx_ssl_session_rbtree_insert_value);
+    cache->shared = shared;
+    cache->sh = sh;
 
-    ngx_queue_init(&cache->expire_queue);
+    for (i = 0; i < cache->shards; i++) {
+        ngx_rbtree_init(&sh[i].session_rbtree, &sh[i].sentinel,
+                        ngx_ssl_session_rbtree_insert_value);
+
+        ngx_queue_init(&sh[i].expire_queue);
+    }
+
+    if (cache->shards > 1
+        && ngx_slab_shards_init(shpool, sh, sizeof(ngx_ssl_session_shctx_t),
+                                cache->shards) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
 
     len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
 
@@ -2304,6 +3466,103 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 }
 
 
+/*
+ * The worker cache is a small direct mapped table of recently resumed
+ * sessions kept in the process memory, so repeated resumptions of a hot
+ * session do not touch the shared memory at all.  An entry is valid until
+ * the session expires or until any session is explicitly removed from
+ * the same shard, which is tracked by the shard "removals" counter.
+ * The table is guarded by a spinlock which is only tried: if a handshake
+ * thread holds it, the shared cache is used instead.
+ */
+
+static size_t
+ngx_ssl_session_worker_get(ngx_ssl_session_cache_t *cache,
+    ngx_ssl_session_shctx_t *sh, uint32_t hash, u_char *id, size_t len,
+    u_char *buf)
+{
+    size_t                           size;
+    ngx_ssl_session_worker_node_t   *wn;
+    ngx_ssl_session_worker_cache_t  *wc;
+
+    wc = cache->worker;
+
+    if (wc == NULL || !ngx_trylock(&wc->lock)) {
+        return 0;
+    }
+
+    wn = &wc->nodes[hash % wc->n];
+
+    size = 0;
+
+    if (wn->hash == hash
+        && wn->id_len == len
+        && ngx_memcmp(wn->id, id, len) == 0
+        && wn->expire > ngx_time()
+        && wn->removals == sh->removals)
+    {
+        size = wn->len;
+        ngx_memcpy(buf, wn->session, size);
+    }
+
+    ngx_unlock(&wc->lock);
+
+    if (size) {
+        (void) ngx_atomic_fetch_add(&sh->worker_hits, 1);
+    }
+
+    return size;
+}
+
+
+static void
+ngx_ssl_session_worker_put(ngx_ssl_session_cache_t *cache, uint32_t hash,
+    u_char *id, size_t len, u_char *buf, size_t size, time_t expire,
+    ngx_atomic_uint_t removals)
+{
+    u_char                          *p;
+    ngx_ssl_session_worker_node_t   *wn;
+    ngx_ssl_session_worker_cache_t  *wc;
+
+    wc = cache->worker;
+
+    if (wc == NULL || len > SSL_MAX_SSL_SESSION_ID_LENGTH
+        || !ngx_trylock(&wc->lock))
+    {
+        return;
+    }
+
+    wn = &wc->nodes[hash % wc->n];
+
+    if (wn->size < size) {
+        p = ngx_alloc(size, ngx_cycle->log);
+        if (p == NULL) {
+            goto done;
+        }
+
+        if (wn->session) {
+            ngx_free(wn->session);
+        }
+
+        wn->session = p;
+        wn->size = size;
+    }
+
+    ngx_memcpy(wn->session, buf, size);
+    ngx_memcpy(wn->id, id, len);
+
+    wn->hash = hash;
+    wn->id_len = (u_char) len;
+    wn->len = size;
+    wn->expire = expire;
+    wn->removals = removals;
+
+done:
+
+    ngx_unlock(&wc->lock);
+}
+
+
 /*
  * The length of the session id is 16 bytes for SSLv2 sessions and
  * between 1 and 32 bytes for SSLv3/TLSv1, typically 32 bytes.
@@ -2331,9 +3590,9 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     unsigned int              session_id_length;
     ngx_shm_zone_t           *shm_zone;
     ngx_connection_t         *c;
-    ngx_slab_pool_t          *shpool;
     ngx_ssl_sess_id_t        *sess_id;
     ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shctx_t  *sh;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
 
     len = i2d_SSL_SESSION(sess, NULL);
@@ -2354,22 +3613,36 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
 
     cache = shm_zone->data;
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
-    ngx_shmtx_lock(&shpool->mutex);
+#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
+
+    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
+
+#else
+
+    session_id = sess->session_id;
+    session_id_length = sess->session_id_length;
+
+#endif
+
+    hash = ngx_crc32_short(session_id, session_id_length);
+
+    sh = ngx_ssl_session_shard(cache, hash);
+
+    ngx_ssl_session_lock(cache, sh);
 
     /* drop one or two expired sessions */
-    ngx_ssl_expire_sessions(cache, shpool, 1);
+    ngx_ssl_expire_sessions(cache, sh, 1);
 
-    cached_sess = ngx_slab_alloc_locked(shpool, len);
+    cached_sess = ngx_ssl_session_alloc(cache, len);
 
     if (cached_sess == NULL) {
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(cache, sh, 0);
 
-        cached_sess = ngx_slab_alloc_locked(shpool, len);
+        cached_sess = ngx_ssl_session_alloc(cache, len);
 
         if (cached_sess == NULL) {
             sess_id = NULL;
@@ -2377,47 +3650,36 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
         }
     }
 
-    sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
+    sess_id = ngx_ssl_session_alloc(cache, sizeof(ngx_ssl_sess_id_t));
 
     if (sess_id == NULL) {
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(cache, sh, 0);
 
-        sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
+        sess_id = ngx_ssl_session_alloc(cache, sizeof(ngx_ssl_sess_id_t));
 
         if (sess_id == NULL) {
             goto failed;
         }
     }
 
-#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
-
-    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
-
-#else
-
-    session_id = sess->session_id;
-    session_id_length = sess->session_id_length;
-
-#endif
-
 #if (NGX_PTR_SIZE == 8)
 
     id = sess_id->sess_id;
 
 #else
 
-    id = ngx_slab_alloc_locked(shpool, session_id_length);
+    id = ngx_ssl_session_alloc(cache, session_id_length);
 
     if (id == NULL) {
 
         /* drop the oldest non-expired session and try once more */
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+        ngx_ssl_expire_sessions(cache, sh, 0);
 
-        id = ngx_slab_alloc_locked(shpool, session_id_length);
+        id = ngx_ssl_session_alloc(cache, session_id_length);
 
         if (id == NULL) {
             goto failed;
@@ -2430,8 +3692,6 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     ngx_memcpy(id, session_id, session_id_length);
 
-    hash = ngx_crc32_short(session_id, session_id_length);
-
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "ssl new session: %08XD:%ud:%d",
                    hash, session_id_length, len);
@@ -2444,28 +3704,28 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     sess_id->expire = ngx_time() + SSL_CTX_get_timeout(ssl_ctx);
 
-    ngx_queue_insert_head(&cache->expire_queue, &sess_id->queue);
+    ngx_queue_insert_head(&sh->expire_queue, &sess_id->queue);
 
-    ngx_rbtree_insert(&cache->session_rbtree, &sess_id->node);
+    ngx_rbtree_insert(&sh->session_rbtree, &sess_id->node);
 
-    ngx_shmtx_unlock(&shpool->mutex);
+    ngx_ssl_session_unlock(cache, sh);
 
     return 0;
 
 failed:
 
     if (cached_sess) {
-        ngx_slab_free_locked(shpool, cached_sess);
+        ngx_ssl_session_free(cache, cached_sess);
     }
 
     if (sess_id) {
-        ngx_slab_free_locked(shpool, sess_id);
+        ngx_ssl_session_free(cache, sess_id);
     }
 
-    ngx_shmtx_unlock(&shpool->mutex);
+    ngx_ssl_session_unlock(cache, sh);
 
     ngx_log_error(NGX_LOG_ALERT, c->log, 0,
-                  "could not allocate new session%s", shpool->log_ctx);
+                  "could not allocate new session%s", cache->shpool->log_ctx);
 
     return 0;
 }
@@ -2478,14 +3738,16 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len, int *c
     const
 #endif
     u_char                   *p;
+    size_t                    size;
+    time_t                    expire;
     uint32_t                  hash;
     ngx_int_t                 rc;
     ngx_shm_zone_t           *shm_zone;
-    ngx_slab_pool_t          *shpool;
+    ngx_atomic_uint_t         removals;
     ngx_rbtree_node_t        *node, *sentinel;
-    ngx_ssl_session_t        *sess;
     ngx_ssl_sess_id_t        *sess_id;
     ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shctx_t  *sh;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
     ngx_connection_t         *c;
 
@@ -2502,14 +3764,19 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len, int *c
 
     cache = shm_zone->data;
 
-    sess = NULL;
+    sh = ngx_ssl_session_shard(cache, hash);
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    size = ngx_ssl_session_worker_get(cache, sh, hash, id, (size_t) len, buf);
+
+    if (size) {
+        p = buf;
+        return d2i_SSL_SESSION(NULL, &p, size);
+    }
 
-    ngx_shmtx_lock(&shpool->mutex);
+    ngx_ssl_session_lock(cache, sh);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = sh->session_rbtree.root;
+    sentinel = sh->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2532,27 +3799,28 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len, int *c
         if (rc == 0) {
 
             if (sess_id->expire > ngx_time()) {
-                ngx_memcpy(buf, sess_id->session, sess_id->len);
+                size = sess_id->len;
+                expire = sess_id->expire;
+                removals = sh->removals;
 
-                ngx_shmtx_unlock(&shpool->mutex);
+                ngx_memcpy(buf, sess_id->session, size);
 
-                p = buf;
-                sess = d2i_SSL_SESSION(NULL, &p, sess_id->len);
+                sh->hits++;
+
+                ngx_ssl_session_unlock(cache, sh);
 
-                return sess;
+                ngx_ssl_session_worker_put(cache, hash, id, (size_t) len,
+                                           buf, size, expire, removals);
+
+                p = buf;
+                return d2i_SSL_SESSION(NULL, &p, size);
             }
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
-
-            ngx_slab_free_locked(shpool, sess_id->session);
-#if (NGX_PTR_SIZE == 4)
-            ngx_slab_free_locked(shpool, sess_id->id);
-#endif
-            ngx_slab_free_locked(shpool, sess_id);
+            ngx_rbtree_delete(&sh->session_rbtree, node);
 
-            sess = NULL;
+            ngx_ssl_session_free_node(cache, sess_id);
 
             goto done;
         }
@@ -2562,9 +3830,11 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn, u_char *id, int len, int *c
 
 done:
 
-    ngx_shmtx_unlock(&shpool->mutex);
+    sh->misses++;
+
+    ngx_ssl_session_unlock(cache, sh);
 
-    return sess;
+    return NULL;
 }
 
 
@@ -2585,10 +3855,10 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_int_t                 rc;
     unsigned int              len;
     ngx_shm_zone_t           *shm_zone;
-    ngx_slab_pool_t          *shpool;
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_sess_id_t        *sess_id;
     ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shctx_t  *sh;
 
     shm_zone = SSL_CTX_get_ex_data(ssl, ngx_ssl_session_cache_index);
 
@@ -2614,12 +3884,12 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                    "ssl remove session: %08XD:%ud", hash, len);
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    sh = ngx_ssl_session_shard(cache, hash);
 
-    ngx_shmtx_lock(&shpool->mutex);
+    ngx_ssl_session_lock(cache, sh);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = sh->session_rbtree.root;
+    sentinel = sh->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -2643,13 +3913,13 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&sh->session_rbtree, node);
 
-            ngx_slab_free_locked(shpool, sess_id->session);
-#if (NGX_PTR_SIZE == 4)
-            ngx_slab_free_locked(shpool, sess_id->id);
-#endif
-            ngx_slab_free_locked(shpool, sess_id);
+            ngx_ssl_session_free_node(cache, sess_id);
+
+            /* invalidate copies of the session in the worker caches */
+
+            (void) ngx_atomic_fetch_add(&sh->removals, 1);
 
             goto done;
         }
@@ -2659,13 +3929,13 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
 done:
 
-    ngx_shmtx_unlock(&shpool->mutex);
+    ngx_ssl_session_unlock(cache, sh);
 }
 
 
 static void
 ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
-    ngx_slab_pool_t *shpool, ngx_uint_t n)
+    ngx_ssl_session_shctx_t *sh, ngx_uint_t n)
 {
     time_t              now;
     ngx_queue_t        *q;
@@ -2675,11 +3945,11 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&cache->expire_queue)) {
+        if (ngx_queue_empty(&sh->expire_queue)) {
             return;
         }
 
-        q = ngx_queue_last(&cache->expire_queue);
+        q = ngx_queue_last(&sh->expire_queue);
 
         sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
 
@@ -2687,18 +3957,18 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
             return;
         }
 
+        if (sess_id->expire > now) {
+            sh->evictions++;
+        }
+
         ngx_queue_remove(q);
 
         ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                        "expire session: %08Xi", sess_id->node.key);
 
-        ngx_rbtree_delete(&cache->session_rbtree, &sess_id->node);
+        ngx_rbtree_delete(&sh->session_rbtree, &sess_id->node);
 
-        ngx_slab_free_locked(shpool, sess_id->session);
-#if (NGX_PTR_SIZE == 4)
-        ngx_slab_free_locked(shpool, sess_id->id);
-#endif
-        ngx_slab_free_locked(shpool, sess_id);
+        ngx_ssl_session_free_node(cache, sess_id);
     }
 }
 
@@ -2757,10 +4027,29 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
     ngx_uint_t                     i;
     ngx_array_t                   *keys;
     ngx_file_info_t                fi;
+    ngx_shm_zone_t                *shm_zone;
+    ngx_ssl_session_cache_t       *cache;
     ngx_ssl_session_ticket_key_t  *key;
 
     if (paths == NULL) {
-        return NGX_OK;
+
+        /* keys rotated in the shared session cache, if configured */
+
+        shm_zone = SSL_CTX_get_ex_data(ssl->ctx, ngx_ssl_session_cache_index);
+
+        if (shm_zone == NULL) {
+            return NGX_OK;
+        }
+
+        cache = shm_zone->data;
+
+        if (cache->ticket_keys == NULL) {
+            return NGX_OK;
+        }
+
+        keys = cache->ticket_keys;
+
+        goto set;
     }
 
     keys = ngx_array_create(cf->pool, paths->nelts, sizeof(ngx_ssl_session_ticket_key_t));
@@ -2830,6 +4119,8 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
         }
     }
 
+set:
+
     if (SSL_CTX_set_ex_data(ssl->ctx, ngx_ssl_session_ticket_keys_index, keys) == 0)
     {
         ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0, "SSL_CTX_set_ex_data() failed");
@@ -2862,6 +4153,105 @@ failed:
 #endif
 
 
+/*
+ * Rotated ticket keys are kept in the shared session cache: the current
+ * key encrypts new tickets, the next key is generated in advance so that
+ * workers which have not noticed a rotation yet still decrypt tickets
+ * issued by those which have, and the previous keys only decrypt.
+ * Each process keeps a copy of the keys and refreshes it from the shared
+ * memory when the current key expires.
+ */
+
+static ngx_int_t
+ngx_ssl_rotate_session_ticket_keys(ngx_ssl_session_cache_t *cache,
+    ngx_log_t *log)
+{
+    time_t                         now;
+    ngx_uint_t                     n, total;
+    ngx_ssl_session_cache_sh_t    *shared;
+    ngx_ssl_session_ticket_key_t  *key;
+
+    now = ngx_time();
+
+    shared = cache->shared;
+    key = shared->ticket_keys;
+    total = cache->ticket_keys_previous + 2;
+
+    ngx_slab_lock(cache->shpool);
+
+    n = shared->ticket_keys_n;
+
+    /*
+     * the keys survive reloads in the shared memory, and a new
+     * configuration may keep fewer previous keys: the oldest are dropped
+     */
+
+    if (n > total) {
+        n = total;
+    }
+
+    if (n == 0
+        || shared->ticket_keys_expire
+           + cache->ticket_rotation * (time_t) total <= now)
+    {
+        /* the first use, or all the keys are too old to be kept */
+
+        if (RAND_bytes((u_char *) key, 2 * sizeof(ngx_ssl_session_ticket_key_t))
+            != 1)
+        {
+            ngx_slab_unlock(cache->shpool);
+
+            ngx_ssl_error(NGX_LOG_ALERT, log, 0, "RAND_bytes() failed");
+            return NGX_ERROR;
+        }
+
+        n = 2;
+        shared->ticket_keys_expire = now + cache->ticket_rotation;
+    }
+
+    while (shared->ticket_keys_expire <= now) {
+
+        if (n < total) {
+            n++;
+        }
+
+        if (n > 2) {
+            /* the oldest key is dropped if there is no room for it */
+            ngx_memmove(&key[3], &key[2],
+                        (n - 3) * sizeof(ngx_ssl_session_ticket_key_t));
+            key[2] = key[0];
+        }
+
+        key[0] = key[1];
+
+        if (RAND_bytes((u_char *) &key[1], sizeof(ngx_ssl_session_ticket_key_t))
+            != 1)
+        {
+            /* the current key is used for one more period */
+            key[1] = key[0];
+            ngx_ssl_error(NGX_LOG_ALERT, log, 0, "RAND_bytes() failed");
+        }
+
+        shared->ticket_keys_expire += cache->ticket_rotation;
+    }
+
+    shared->ticket_keys_n = n;
+
+    ngx_memcpy(cache->ticket_keys->elts, key,
+               n * sizeof(ngx_ssl_session_ticket_key_t));
+    cache->ticket_keys->nelts = n;
+    cache->ticket_keys_expire = shared->ticket_keys_expire;
+
+    ngx_slab_unlock(cache->shpool);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "ssl session ticket keys: %ui, expire: %T",
+                   n, cache->ticket_keys_expire);
+
+    return NGX_OK;
+}
+
+
 static int
 ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn, unsigned char *name, 
 		unsigned char *iv, EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc)
@@ -2869,8 +4259,11 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn, unsigned char *nam
     SSL_CTX                       *ssl_ctx;
     ngx_uint_t                     i;
     ngx_array_t                   *keys;
+    ngx_atomic_t                  *lock;
+    ngx_shm_zone_t                *shm_zone;
     ngx_connection_t              *c;
-    ngx_ssl_session_ticket_key_t  *key;
+    ngx_ssl_session_cache_t       *cache;
+    ngx_ssl_session_ticket_key_t  *key, ticket_key;
 #if (NGX_DEBUG)
     u_char                         buf[32];
 #endif
@@ -2884,24 +4277,54 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn, unsigned char *nam
         return -1;
     }
 
+    lock = NULL;
+
+    shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
+
+    if (shm_zone) {
+        cache = shm_zone->data;
+
+        if (keys == cache->ticket_keys) {
+
+            /* the keys may be used by the handshake threads as well */
+
+            lock = &cache->ticket_keys_lock;
+            ngx_spinlock(lock, 1, 2048);
+
+            if (cache->ticket_keys_expire <= ngx_time()
+                && ngx_ssl_rotate_session_ticket_keys(cache, c->log) != NGX_OK
+                && keys->nelts == 0)
+            {
+                ngx_unlock(lock);
+                return -1;
+            }
+        }
+    }
+
     key = keys->elts;
 
     if (enc == 1) 
 	{
         /* encrypt session ticket */
 
+        ticket_key = key[0];
+
+        if (lock) {
+            ngx_unlock(lock);
+        }
+
         ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                        "ssl session ticket encrypt, key: \"%*s\" (%s session)",
-                       ngx_hex_dump(buf, key[0].name, 16) - buf, buf,
+                       ngx_hex_dump(buf, ticket_key.name, 16) - buf, buf,
                        SSL_session_reused(ssl_conn) ? "reused" : "new");
 
         RAND_bytes(iv, 16);
-        EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key[0].aes_key, iv);
-        HMAC_Init_ex(hctx, key[0].hmac_key, 16,
+        EVP_EncryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, ticket_key.aes_key, iv);
+        HMAC_Init_ex(hctx, ticket_key.hmac_key, 16,
                      ngx_ssl_session_ticket_md(), NULL);
-        ngx_memcpy(name, key[0].name, 16);
+        ngx_memcpy(name, ticket_key.name, 16);
 
-        return 0;
+        return 1;
 
     } 
 	else
@@ -2915,6 +4338,10 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn, unsigned char *nam
             }
         }
 
+        if (lock) {
+            ngx_unlock(lock);
+        }
+
         ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0, "ssl session ticket decrypt, key: \"%*s\" not found", 
 			ngx_hex_dump(buf, name, 16) - buf, buf);
 
@@ -2922,11 +4349,17 @@ ngx_ssl_session_ticket_key_callback(ngx_ssl_conn_t *ssl_conn, unsigned char *nam
 
     found:
 
+        ticket_key = key[i];
+
+        if (lock) {
+            ngx_unlock(lock);
+        }
+
         ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0, "ssl session ticket decrypt, key: \"%*s\"%s", 
-			ngx_hex_dump(buf, key[i].name, 16) - buf, buf, (i == 0) ? " (default)" : "");
+			ngx_hex_dump(buf, ticket_key.name, 16) - buf, buf, (i == 0) ? " (default)" : "");
 
-        HMAC_Init_ex(hctx, key[i].hmac_key, 16, ngx_ssl_session_ticket_md(), NULL);
-        EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, key[i].aes_key, iv);
+        HMAC_Init_ex(hctx, ticket_key.hmac_key, 16, ngx_ssl_session_ticket_md(), NULL);
+        EVP_DecryptInit_ex(ectx, EVP_aes_128_cbc(), NULL, ticket_key.aes_key, iv);
 
         return (i == 0) ? 1 : 2 /* renew */;
     }
@@ -2947,6 +4380,34 @@ ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths)
 #endif
 
 
+/*
+ * kernel TLS: OpenSSL installs the negotiated keys into the kernel TLS ULP
+ * after the handshake, and file bufs may then be sent with SSL_sendfile()
+ * without copying them through user space
+ */
+
+ngx_int_t
+ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable)
+{
+    if (!enable) {
+        return NGX_OK;
+    }
+
+#ifdef SSL_OP_ENABLE_KTLS
+
+    SSL_CTX_set_options(ssl->ctx, SSL_OP_ENABLE_KTLS);
+
+#else
+
+    ngx_log_error(NGX_LOG_WARN, ssl->log, 0,
+                  "\"ssl_ktls\" ignored, not supported");
+
+#endif
+
+    return NGX_OK;
+}
+
+
 void
 ngx_ssl_cleanup_ctx(void *data)
 {
@@ -42,6 +42,9 @@ typedef struct
     SSL_CTX                    *ctx;
     ngx_log_t                  *log;
     size_t                      buffer_size;
+#if (NGX_THREADS)
+    struct ngx_thread_pool_s   *thread_pool;
+#endif
 } ngx_ssl_t;
 
 
@@ -58,6 +61,18 @@ typedef struct
 
     ngx_event_handler_pt        saved_read_handler;
     ngx_event_handler_pt        saved_write_handler;
+
+#if (NGX_THREADS)
+    struct ngx_thread_pool_s   *thread_pool;
+    ngx_thread_task_t          *thread_task;
+
+	//߳ʱ¼ѭԻ޸Щ־̷߳ʵ
+	//־λһ֣Բʹλ
+    ngx_uint_t                  handshake_posted;
+    ngx_uint_t                  handshake_event;
+    ngx_uint_t                  handshake_queued;
+#endif
+
 	//־λΪ1ʾSSLǷɹ
     unsigned                    handshaked:1;		
     unsigned                    renegotiation:1;
@@ -65,6 +80,7 @@ typedef struct
     unsigned                    no_wait_shutdown:1;
     unsigned                    no_send_shutdown:1;
     unsigned                    handshake_buffer_set:1;
+    unsigned                    sendfile:1;
 } ngx_ssl_connection_t;
 
 
@@ -92,15 +108,20 @@ struct ngx_ssl_sess_id_s {
 };
 
 
-typedef struct 
-{
+typedef struct {
+    /* used when the cache has more than one shard */
+    ngx_slab_shard_t            shard;
     ngx_rbtree_t                session_rbtree;
     ngx_rbtree_node_t           sentinel;
     ngx_queue_t                 expire_queue;
-} ngx_ssl_session_cache_t;
-
+    /* updated under the shard lock */
+    ngx_uint_t                  hits;
+    ngx_uint_t                  misses;
+    ngx_uint_t                  evictions;
+    ngx_atomic_t                worker_hits;
+    ngx_atomic_t                removals;
+} ngx_ssl_session_shctx_t;
 
-#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
 
 typedef struct 
 {
@@ -109,7 +130,38 @@ typedef struct
     u_char                      hmac_key[16];
 } ngx_ssl_session_ticket_key_t;
 
-#endif
+
+#define NGX_SSL_TICKET_KEYS_MAX  16
+
+typedef struct {
+    ngx_ssl_session_shctx_t        *shards;
+    /* the expiration time of the current ticket key */
+    time_t                          ticket_keys_expire;
+    ngx_uint_t                      ticket_keys_n;
+    /* the current key, the next key, and then the previous keys */
+    ngx_ssl_session_ticket_key_t    ticket_keys[NGX_SSL_TICKET_KEYS_MAX + 2];
+} ngx_ssl_session_cache_sh_t;
+
+
+typedef struct ngx_ssl_session_worker_cache_s  ngx_ssl_session_worker_cache_t;
+typedef struct ngx_ssl_cert_cache_s  ngx_ssl_cert_cache_t;
+
+typedef struct 
+{
+    ngx_ssl_session_cache_sh_t      *shared;
+    ngx_ssl_session_shctx_t         *sh;     /* array of "shards" elements */
+    ngx_slab_pool_t                 *shpool;
+    ngx_uint_t                       shards;
+    /* process local, copied into each worker on fork */
+    ngx_ssl_session_worker_cache_t  *worker;
+
+    time_t                           ticket_rotation;
+    ngx_uint_t                       ticket_keys_previous;
+    /* process local copy of the rotated ticket keys */
+    ngx_array_t                     *ticket_keys;
+    time_t                           ticket_keys_expire;
+    ngx_atomic_t                     ticket_keys_lock;
+} ngx_ssl_session_cache_t;
 
 
 #define NGX_SSL_SSLv2    0x0002
@@ -127,6 +179,11 @@ typedef struct
 
 ngx_int_t ngx_ssl_init(ngx_log_t *log);
 ngx_int_t ngx_ssl_create(ngx_ssl_t *ssl, ngx_uint_t protocols, void *data);
+ngx_ssl_cert_cache_t *ngx_ssl_cert_cache_init(ngx_pool_t *pool, ngx_uint_t max,
+    time_t valid);
+ngx_int_t ngx_ssl_connection_certificate(ngx_connection_t *c, ngx_pool_t *pool,
+    ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords,
+    ngx_ssl_cert_cache_t *cache);
 ngx_int_t ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords);
 ngx_int_t ngx_ssl_client_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert, ngx_int_t depth);
@@ -143,6 +200,10 @@ ngx_int_t ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name);
 ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx, ssize_t builtin_session_cache, ngx_shm_zone_t *shm_zone, time_t timeout);
 ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_array_t *paths);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
+ngx_int_t ngx_ssl_session_cache_create(ngx_conf_t *cf, ngx_shm_zone_t *shm_zone,
+    ngx_uint_t shards, ngx_uint_t worker_sessions, time_t ticket_rotation,
+    ngx_uint_t ticket_keys);
+ngx_int_t ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable);
 ngx_int_t ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c, ngx_uint_t flags);
 
 void ngx_ssl_remove_cached_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
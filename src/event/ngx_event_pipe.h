@@ -35,6 +35,8 @@ struct ngx_event_pipe_s
     ngx_chain_t       *free;
     ngx_chain_t       *busy;
 
+    ngx_chain_t       *writing;					//̳ͨ߳дʱļĻ
+
     /*
      * the input filter i.e. that moves HTTP/1.1 chunks
      * from the raw bufs to an incoming chain
@@ -57,6 +59,7 @@ struct ngx_event_pipe_s
     unsigned           downstream_done:1;		//־λΪ1ʾѾر
     unsigned           downstream_error:1;		//־λΪ1ʾӳ
     unsigned           cyclic_temp_file:1;
+    unsigned           aio:1;					//־λΪ1ʾ̳߳дʱļδ
 
     ngx_int_t          allocated;				//ǰѾĽΰĻĸ
     ngx_bufs_t         bufs;					//ָܹĽΰĻĴС͸
@@ -86,6 +89,13 @@ struct ngx_event_pipe_s
 
     ngx_temp_file_t   *temp_file;
 
+#if (NGX_THREADS)
+    ngx_int_t        (*thread_handler)(ngx_thread_task_t *task,
+                                       ngx_file_t *file);
+    void              *thread_ctx;
+    ngx_thread_task_t *thread_task;
+#endif
+
     /* STUB */ int     num;
 };
 
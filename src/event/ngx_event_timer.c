@@ -10,9 +10,70 @@
 #include <ngx_event.h>
 
 
+/*
+ * The hierarchical timer wheel keeps timers in the lists of slots,
+ * one slot per millisecond for the nearest 256 milliseconds, and
+ * 4 levels of 64 coarser slots for the rest; the timers of a coarse
+ * slot are redistributed to the finer slots when the wheel reaches it.
+ *
+ * The wheel reuses the rbtree node embedded into ngx_event_t:
+ * the "left" and "right" fields are the previous and next list elements,
+ * and the "parent" field points to the head of the slot list.
+ */
+
+#define NGX_TIMER_WHEEL_ROOT_BITS   8
+#define NGX_TIMER_WHEEL_ROOT_SIZE   (1 << NGX_TIMER_WHEEL_ROOT_BITS)
+#define NGX_TIMER_WHEEL_ROOT_MASK   (NGX_TIMER_WHEEL_ROOT_SIZE - 1)
+
+#define NGX_TIMER_WHEEL_BITS        6
+#define NGX_TIMER_WHEEL_SIZE        (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK        (NGX_TIMER_WHEEL_SIZE - 1)
+
+#define NGX_TIMER_WHEEL_LEVELS      4
+
+#define NGX_TIMER_WHEEL_MAX         0xffffffff
+
+
+#define ngx_timer_wheel_shift(n)                                              \
+    (NGX_TIMER_WHEEL_ROOT_BITS + (n) * NGX_TIMER_WHEEL_BITS)
+
+#define ngx_timer_wheel_index(key, n)                                         \
+    (((key) >> ngx_timer_wheel_shift(n)) & NGX_TIMER_WHEEL_MASK)
+
+#define ngx_timer_wheel_list_init(head)                                       \
+    (head)->left = head;                                                      \
+    (head)->right = head
+
+#define ngx_timer_wheel_list_empty(head)                                      \
+    ((head) == (head)->right)
+
+
+typedef struct {
+    ngx_msec_t          base;
+    ngx_uint_t          timers;
+    ngx_uint_t          root_timers;
+    ngx_rbtree_node_t   root[NGX_TIMER_WHEEL_ROOT_SIZE];
+    ngx_rbtree_node_t   levels[NGX_TIMER_WHEEL_LEVELS][NGX_TIMER_WHEEL_SIZE];
+} ngx_event_timer_wheel_t;
+
+
+static void ngx_event_timer_wheel_link(ngx_rbtree_node_t *node);
+static ngx_uint_t ngx_event_timer_wheel_cascade(ngx_uint_t n);
+static void ngx_event_timer_wheel_move(ngx_rbtree_node_t *head,
+    ngx_rbtree_node_t *to);
+static ngx_msec_t ngx_event_find_timer_wheel(void);
+static void ngx_event_expire_timers_wheel(void);
+static void ngx_event_cancel_timers_wheel(void);
+
+
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
+ngx_uint_t                ngx_event_timer_method;
+
+static ngx_event_timer_wheel_t  ngx_event_timer_wheel;
+static ngx_rbtree_node_t        ngx_event_timer_work;
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -20,8 +81,32 @@ static ngx_rbtree_node_t  ngx_event_timer_sentinel;
  */
 
 ngx_int_t
-ngx_event_timer_init(ngx_log_t *log)
+ngx_event_timer_init(ngx_log_t *log, ngx_uint_t method)
 {
+    ngx_uint_t  i, n;
+
+    ngx_event_timer_method = method;
+
+    if (method == NGX_EVENT_TIMER_WHEEL) {
+        ngx_event_timer_wheel.base = ngx_current_msec;
+        ngx_event_timer_wheel.timers = 0;
+        ngx_event_timer_wheel.root_timers = 0;
+
+        for (i = 0; i < NGX_TIMER_WHEEL_ROOT_SIZE; i++) {
+            ngx_timer_wheel_list_init(&ngx_event_timer_wheel.root[i]);
+        }
+
+        for (n = 0; n < NGX_TIMER_WHEEL_LEVELS; n++) {
+            for (i = 0; i < NGX_TIMER_WHEEL_SIZE; i++) {
+                ngx_timer_wheel_list_init(&ngx_event_timer_wheel.levels[n][i]);
+            }
+        }
+
+        ngx_timer_wheel_list_init(&ngx_event_timer_work);
+
+        return NGX_OK;
+    }
+
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel, ngx_rbtree_insert_timer_value);
 
     return NGX_OK;
@@ -34,6 +119,10 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_method == NGX_EVENT_TIMER_WHEEL) {
+        return ngx_event_find_timer_wheel();
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -55,6 +144,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_method == NGX_EVENT_TIMER_WHEEL) {
+        ngx_event_expire_timers_wheel();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; )
@@ -102,6 +196,11 @@ ngx_event_cancel_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_method == NGX_EVENT_TIMER_WHEEL) {
+        ngx_event_cancel_timers_wheel();
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -136,3 +235,319 @@ ngx_event_cancel_timers(void)
         ev->handler(ev);
     }
 }
+
+
+ngx_int_t
+ngx_event_no_timers_left(void)
+{
+    if (ngx_event_timer_method == NGX_EVENT_TIMER_WHEEL) {
+        return ngx_event_timer_wheel.timers ? NGX_AGAIN : NGX_OK;
+    }
+
+    if (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel) {
+        return NGX_OK;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    if (ngx_event_timer_wheel.timers == 0) {
+        ngx_event_timer_wheel.base = ngx_current_msec;
+    }
+
+    ngx_event_timer_wheel_link(node);
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    if (node->parent >= &ngx_event_timer_wheel.root[0]
+        && node->parent < &ngx_event_timer_wheel.root[NGX_TIMER_WHEEL_ROOT_SIZE])
+    {
+        ngx_event_timer_wheel.root_timers--;
+    }
+
+    ngx_event_timer_wheel.timers--;
+
+#if (NGX_DEBUG)
+    node->left = NULL;
+    node->right = NULL;
+    node->parent = NULL;
+#endif
+}
+
+
+static void
+ngx_event_timer_wheel_link(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          n;
+    ngx_msec_t          key, base;
+    ngx_msec_int_t      diff;
+    ngx_rbtree_node_t  *head;
+
+    key = node->key;
+    base = ngx_event_timer_wheel.base;
+
+    diff = (ngx_msec_int_t) (key - base);
+
+    if (diff < 0) {
+
+        /* the timer has already expired, run it on the next tick */
+
+        head = &ngx_event_timer_wheel.root[base & NGX_TIMER_WHEEL_ROOT_MASK];
+
+    } else if (diff < NGX_TIMER_WHEEL_ROOT_SIZE) {
+        head = &ngx_event_timer_wheel.root[key & NGX_TIMER_WHEEL_ROOT_MASK];
+
+    } else {
+
+#if (NGX_PTR_SIZE == 8)
+        if ((ngx_msec_t) diff > NGX_TIMER_WHEEL_MAX) {
+
+            /*
+             * the slot is recalculated with the real key
+             * when the timer is cascaded
+             */
+
+            key = base + NGX_TIMER_WHEEL_MAX;
+        }
+#endif
+
+        for (n = 0; n < NGX_TIMER_WHEEL_LEVELS - 1; n++) {
+            if ((ngx_msec_t) diff < (ngx_msec_t) 1 << ngx_timer_wheel_shift(n + 1)) {
+                break;
+            }
+        }
+
+        head = &ngx_event_timer_wheel.levels[n][ngx_timer_wheel_index(key, n)];
+    }
+
+    node->parent = head;
+    node->right = head;
+    node->left = head->left;
+    head->left->right = node;
+    head->left = node;
+
+    if (head >= &ngx_event_timer_wheel.root[0]
+        && head < &ngx_event_timer_wheel.root[NGX_TIMER_WHEEL_ROOT_SIZE])
+    {
+        ngx_event_timer_wheel.root_timers++;
+    }
+
+    ngx_event_timer_wheel.timers++;
+}
+
+
+static ngx_uint_t
+ngx_event_timer_wheel_cascade(ngx_uint_t n)
+{
+    ngx_uint_t          index;
+    ngx_rbtree_node_t  *node, *head;
+
+    index = ngx_timer_wheel_index(ngx_event_timer_wheel.base, n);
+    head = &ngx_event_timer_wheel.levels[n][index];
+
+    while (!ngx_timer_wheel_list_empty(head)) {
+        node = head->right;
+
+        ngx_event_timer_wheel_delete(node);
+        ngx_event_timer_wheel_link(node);
+    }
+
+    return index;
+}
+
+
+static void
+ngx_event_timer_wheel_move(ngx_rbtree_node_t *head, ngx_rbtree_node_t *to)
+{
+    if (ngx_timer_wheel_list_empty(head)) {
+        return;
+    }
+
+    head->right->left = to->left;
+    head->left->right = to;
+    to->left->right = head->right;
+    to->left = head->left;
+
+    ngx_timer_wheel_list_init(head);
+}
+
+
+static ngx_msec_t
+ngx_event_find_timer_wheel(void)
+{
+    ngx_msec_t       base;
+    ngx_uint_t       i, n, level, index;
+    ngx_msec_int_t   timer;
+
+    if (ngx_event_timer_wheel.timers == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    base = ngx_event_timer_wheel.base;
+
+    /* the slots up to the next cascade */
+
+    n = NGX_TIMER_WHEEL_ROOT_SIZE - (base & NGX_TIMER_WHEEL_ROOT_MASK);
+
+    if (n == NGX_TIMER_WHEEL_ROOT_SIZE) {
+
+        /*
+         * the coarse slots reached at the base are cascaded only when
+         * the base slot is expired, and their timers may be due earlier
+         * than any of the root slots
+         */
+
+        for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+            index = ngx_timer_wheel_index(base, level);
+
+            if (!ngx_timer_wheel_list_empty(&ngx_event_timer_wheel.levels[level][index])) {
+                n = 0;
+                break;
+            }
+
+            if (index != 0) {
+                break;
+            }
+        }
+    }
+
+    if (ngx_event_timer_wheel.root_timers) {
+        for (i = 0; i < n; i++) {
+            if (!ngx_timer_wheel_list_empty(&ngx_event_timer_wheel.root[(base + i) & NGX_TIMER_WHEEL_ROOT_MASK])) {
+                break;
+            }
+        }
+
+    } else {
+        i = n;
+    }
+
+    timer = (ngx_msec_int_t) (base + i - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+static void
+ngx_event_expire_timers_wheel(void)
+{
+    ngx_uint_t          index;
+    ngx_msec_t          next;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node, *work;
+
+    work = &ngx_event_timer_work;
+
+    while ((ngx_msec_int_t) (ngx_current_msec - ngx_event_timer_wheel.base) >= 0) {
+
+        if (ngx_event_timer_wheel.timers == 0) {
+            ngx_event_timer_wheel.base = ngx_current_msec + 1;
+            return;
+        }
+
+        index = ngx_event_timer_wheel.base & NGX_TIMER_WHEEL_ROOT_MASK;
+
+        if (index == 0
+            && ngx_event_timer_wheel_cascade(0) == 0
+            && ngx_event_timer_wheel_cascade(1) == 0
+            && ngx_event_timer_wheel_cascade(2) == 0)
+        {
+            ngx_event_timer_wheel_cascade(3);
+        }
+
+        if (ngx_event_timer_wheel.root_timers == 0) {
+
+            /* skip the empty slots up to the next cascade */
+
+            next = (ngx_event_timer_wheel.base | NGX_TIMER_WHEEL_ROOT_MASK) + 1;
+
+            if ((ngx_msec_int_t) (next - ngx_current_msec) > 0) {
+                ngx_event_timer_wheel.base = ngx_current_msec + 1;
+                return;
+            }
+
+            ngx_event_timer_wheel.base = next;
+            continue;
+        }
+
+        ngx_event_timer_wheel.base++;
+
+        /*
+         * the timers are moved to the work list as the handlers may add
+         * the timers that have already expired to the next slot; yet
+         * the handlers may delete the other timers from the work list
+         */
+
+        ngx_event_timer_wheel_move(&ngx_event_timer_wheel.root[index], work);
+
+        while (!ngx_timer_wheel_list_empty(work)) {
+            node = work->right;
+
+            ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ngx_event_timer_wheel_delete(node);
+
+            ev->timer_set = 0;
+
+            ev->timedout = 1;
+
+            ev->handler(ev);
+        }
+    }
+}
+
+
+static void
+ngx_event_cancel_timers_wheel(void)
+{
+    ngx_uint_t          i, n;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node, *work;
+
+    work = &ngx_event_timer_work;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_ROOT_SIZE; i++) {
+        ngx_event_timer_wheel_move(&ngx_event_timer_wheel.root[i], work);
+    }
+
+    for (n = 0; n < NGX_TIMER_WHEEL_LEVELS; n++) {
+        for (i = 0; i < NGX_TIMER_WHEEL_SIZE; i++) {
+            ngx_event_timer_wheel_move(&ngx_event_timer_wheel.levels[n][i], work);
+        }
+    }
+
+    while (!ngx_timer_wheel_list_empty(work)) {
+        node = work->right;
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        ngx_event_timer_wheel_delete(node);
+
+        if (!ev->cancelable) {
+            ngx_event_timer_wheel_link(node);
+            continue;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer cancel: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ev->timer_set = 0;
+
+        ev->handler(ev);
+    }
+}
@@ -0,0 +1,840 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+#if !(NGX_WIN32)
+
+typedef union {
+    struct sockaddr           sockaddr;
+    u_char                    sockaddr_data[NGX_SOCKADDRLEN];
+} ngx_udp_sockaddr_t;
+
+
+typedef struct {
+    ngx_uint_t                n;
+#if (NGX_HAVE_MMSG)
+    struct mmsghdr            msgs[NGX_UDP_BATCH];
+#endif
+    struct iovec              iovs[NGX_UDP_BATCH];
+    ngx_udp_sockaddr_t        sockaddrs[NGX_UDP_BATCH];
+    socklen_t                 socklens[NGX_UDP_BATCH];
+    size_t                    lens[NGX_UDP_BATCH];
+    u_char                    buffers[NGX_UDP_BATCH][NGX_UDP_DATAGRAM_SIZE];
+} ngx_udp_batch_t;
+
+
+static ngx_int_t ngx_udp_recv_batch(ngx_connection_t *c, ngx_udp_batch_t *b,
+    ngx_uint_t max);
+static void ngx_event_udp_dispatch(ngx_event_t *ev, ngx_listening_t *ls,
+    struct sockaddr *sockaddr, socklen_t socklen, u_char *data, size_t len);
+static void ngx_close_udp_accepted_connection(ngx_connection_t *c);
+static uint32_t ngx_udp_hash(struct sockaddr *sa, socklen_t socklen);
+static ngx_int_t ngx_udp_cmp_sockaddr(struct sockaddr *sa1, socklen_t len1,
+    struct sockaddr *sa2, socklen_t len2);
+static ngx_connection_t *ngx_lookup_udp_connection(ngx_listening_t *ls,
+    struct sockaddr *sockaddr, socklen_t socklen);
+static void ngx_delete_udp_connection(void *data);
+
+
+/*
+ * the datagrams are delivered to the sessions synchronously, so a single
+ * batch per worker is enough for the listening sockets; the relay uses
+ * its own batch as it may be called while a listening batch is dispatched
+ */
+
+static ngx_udp_batch_t  ngx_udp_listen_batch;
+static ngx_udp_batch_t  ngx_udp_relay_batch;
+
+
+void
+ngx_event_recvmsg(ngx_event_t *ev)
+{
+    ngx_uint_t         i, n, max;
+    ngx_listening_t   *ls;
+    ngx_connection_t  *lc;
+    ngx_event_conf_t  *ecf;
+    ngx_udp_batch_t   *b;
+#if (NGX_STAT_STUB)
+    ngx_event_listening_stat_t  *st;
+#endif
+
+    ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
+
+    lc = ev->data;
+    ls = lc->listening;
+    ev->ready = 0;
+
+#if (NGX_STAT_STUB)
+    st = ls->accept_stat;
+#endif
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "recvmsg on %V", &ls->addr_text);
+
+    b = &ngx_udp_listen_batch;
+
+    /* the number of datagrams received on this event */
+    n = 0;
+
+    for ( ;; ) {
+
+        max = NGX_UDP_BATCH;
+
+        if (ecf->accept_batch && ecf->accept_batch - n < max) {
+            max = ecf->accept_batch - n;
+        }
+
+        if (ngx_udp_recv_batch(lc, b, max) != NGX_OK) {
+            return;
+        }
+
+#if (NGX_STAT_STUB)
+        if (st) {
+            (void) ngx_atomic_fetch_add(&st->batches, 1);
+        }
+#endif
+
+        for (i = 0; i < b->n; i++) {
+            ngx_event_udp_dispatch(ev, ls, &b->sockaddrs[i].sockaddr,
+                                   b->socklens[i], b->buffers[i], b->lens[i]);
+        }
+
+        n += b->n;
+
+        /*
+         * a short batch means the socket has been drained; otherwise
+         * the listening socket is reported again as it is level-triggered
+         */
+
+        if (b->n < max
+            || !ecf->multi_accept
+            || (ecf->accept_batch && n >= ecf->accept_batch))
+        {
+#if (NGX_STAT_STUB)
+            if (st && b->n == max) {
+                (void) ngx_atomic_fetch_add(&st->limited, 1);
+            }
+#endif
+            return;
+        }
+    }
+}
+
+
+static ngx_int_t
+ngx_udp_recv_batch(ngx_connection_t *c, ngx_udp_batch_t *b, ngx_uint_t max)
+{
+    ngx_err_t       err;
+    ngx_uint_t      i;
+#if (NGX_HAVE_MMSG)
+    int             n;
+    struct msghdr  *msg;
+#else
+    ssize_t         n;
+    socklen_t       socklen;
+#endif
+
+    b->n = 0;
+
+#if (NGX_HAVE_MMSG)
+
+    for (i = 0; i < max; i++) {
+        b->iovs[i].iov_base = b->buffers[i];
+        b->iovs[i].iov_len = NGX_UDP_DATAGRAM_SIZE;
+
+        msg = &b->msgs[i].msg_hdr;
+
+        ngx_memzero(msg, sizeof(struct msghdr));
+
+        msg->msg_name = &b->sockaddrs[i];
+        msg->msg_namelen = sizeof(ngx_udp_sockaddr_t);
+        msg->msg_iov = &b->iovs[i];
+        msg->msg_iovlen = 1;
+    }
+
+    for ( ;; ) {
+        n = recvmmsg(c->fd, b->msgs, max, 0, NULL);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "recvmmsg: fd:%d %d of %ui", c->fd, n, max);
+
+        if (n > 0) {
+            break;
+        }
+
+        err = (n == 0) ? NGX_EAGAIN : ngx_socket_errno;
+
+        if (err == NGX_EINTR) {
+            continue;
+        }
+
+        c->read->ready = 0;
+
+        if (err == NGX_EAGAIN) {
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "recvmmsg() not ready");
+            return NGX_AGAIN;
+        }
+
+        c->read->error = 1;
+        (void) ngx_connection_error(c, err, "recvmmsg() failed");
+
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < (ngx_uint_t) n; i++) {
+        b->socklens[i] = b->msgs[i].msg_hdr.msg_namelen;
+        b->lens[i] = b->msgs[i].msg_len;
+    }
+
+    b->n = n;
+
+    return NGX_OK;
+
+#else
+
+    while (b->n < max) {
+        i = b->n;
+        socklen = sizeof(ngx_udp_sockaddr_t);
+
+        n = recvfrom(c->fd, b->buffers[i], NGX_UDP_DATAGRAM_SIZE, 0,
+                     &b->sockaddrs[i].sockaddr, &socklen);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "recvfrom: fd:%d %z of %d",
+                       c->fd, n, NGX_UDP_DATAGRAM_SIZE);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            c->read->ready = 0;
+
+            if (err == NGX_EAGAIN || b->n) {
+                break;
+            }
+
+            c->read->error = 1;
+            (void) ngx_connection_error(c, err, "recvfrom() failed");
+
+            return NGX_ERROR;
+        }
+
+        b->socklens[i] = socklen;
+        b->lens[i] = n;
+        b->n++;
+    }
+
+    return b->n ? NGX_OK : NGX_AGAIN;
+
+#endif
+}
+
+
+static void
+ngx_event_udp_dispatch(ngx_event_t *ev, ngx_listening_t *ls,
+    struct sockaddr *sockaddr, socklen_t socklen, u_char *data, size_t len)
+{
+    ngx_buf_t              buf;
+    ngx_log_t             *log;
+    ngx_event_t           *rev, *wev;
+    ngx_connection_t      *c;
+    ngx_pool_cleanup_t    *cln;
+    ngx_udp_session_t     *udp;
+#if (NGX_STAT_STUB)
+    ngx_event_listening_stat_t  *st;
+#endif
+
+    ngx_memzero(&buf, sizeof(ngx_buf_t));
+
+    buf.pos = data;
+    buf.last = data + len;
+
+    c = ngx_lookup_udp_connection(ls, sockaddr, socklen);
+
+    if (c) {
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "*%uA recvmsg: %uz bytes", c->number, len);
+
+        rev = c->read;
+
+        c->udp->buffer = &buf;
+
+        rev->ready = 1;
+        rev->active = 0;
+
+        rev->handler(rev);
+
+        /* the session may be closed by the handler */
+
+        if (c->udp) {
+            c->udp->buffer = NULL;
+        }
+
+        rev->ready = 0;
+        rev->active = 1;
+
+        return;
+    }
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_accepted, 1);
+
+    st = ls->accept_stat;
+
+    if (st) {
+        (void) ngx_atomic_fetch_add(&st->accepted, 1);
+    }
+
+    if (ngx_worker < ngx_stat_workers) {
+        (void) ngx_atomic_fetch_add(&ngx_stat_worker_accepted[ngx_worker], 1);
+    }
+#endif
+
+    ngx_accept_disabled = ngx_cycle->connection_n / 8
+                          - ngx_cycle->free_connection_n;
+
+    c = ngx_get_connection(ls->connection->fd, ev->log);
+    if (c == NULL) {
+        return;
+    }
+
+    c->shared = 1;
+    c->type = SOCK_DGRAM;
+    c->socklen = socklen;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_active, 1);
+#endif
+
+    c->pool = ngx_create_pool(ls->pool_size, ev->log);
+    if (c->pool == NULL) {
+        ngx_close_udp_accepted_connection(c);
+        return;
+    }
+
+    c->sockaddr = ngx_palloc(c->pool, socklen);
+    if (c->sockaddr == NULL) {
+        ngx_close_udp_accepted_connection(c);
+        return;
+    }
+
+    ngx_memcpy(c->sockaddr, sockaddr, socklen);
+
+    log = ngx_palloc(c->pool, sizeof(ngx_log_t));
+    if (log == NULL) {
+        ngx_close_udp_accepted_connection(c);
+        return;
+    }
+
+    *log = ls->log;
+
+    c->recv = ngx_udp_shared_recv;
+    c->send = ngx_udp_shared_send;
+
+    c->log = log;
+    c->pool->log = log;
+
+    c->listening = ls;
+    c->local_sockaddr = ls->sockaddr;
+    c->local_socklen = ls->socklen;
+
+    udp = ngx_palloc(c->pool, sizeof(ngx_udp_session_t));
+    if (udp == NULL) {
+        ngx_close_udp_accepted_connection(c);
+        return;
+    }
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        ngx_close_udp_accepted_connection(c);
+        return;
+    }
+
+    udp->node.key = ngx_udp_hash(c->sockaddr, c->socklen);
+    udp->connection = c;
+    udp->buffer = NULL;
+
+    c->udp = udp;
+
+    cln->handler = ngx_delete_udp_connection;
+    cln->data = c;
+
+    ngx_rbtree_insert(&ls->rbtree, &udp->node);
+
+    rev = c->read;
+    wev = c->write;
+
+    /* the events of the shared socket are never added to the kernel */
+
+    wev->ready = 1;
+
+    rev->log = log;
+    wev->log = log;
+
+    c->number = ngx_atomic_fetch_add(ngx_connection_counter, 1);
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_handled, 1);
+#endif
+
+    if (ls->addr_ntop) {
+        c->addr_text.data = ngx_pnalloc(c->pool, ls->addr_text_max_len);
+        if (c->addr_text.data == NULL) {
+            ngx_close_udp_accepted_connection(c);
+            return;
+        }
+
+        c->addr_text.len = ngx_sock_ntop(c->sockaddr, c->socklen,
+                                         c->addr_text.data,
+                                         ls->addr_text_max_len, 0);
+        if (c->addr_text.len == 0) {
+            ngx_close_udp_accepted_connection(c);
+            return;
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "*%uA recvmsg: new session fd:%d %uz bytes",
+                   c->number, c->fd, len);
+
+    log->data = NULL;
+    log->handler = NULL;
+
+    udp->buffer = &buf;
+    rev->ready = 1;
+
+    ls->handler(c);
+
+    if (c->udp) {
+        c->udp->buffer = NULL;
+    }
+
+    rev->ready = 0;
+    rev->active = 1;
+}
+
+
+static void
+ngx_close_udp_accepted_connection(ngx_connection_t *c)
+{
+    ngx_close_connection(c);
+
+    if (c->pool) {
+        ngx_destroy_pool(c->pool);
+    }
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_active, -1);
+#endif
+}
+
+
+ssize_t
+ngx_udp_shared_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    size_t      n;
+    ngx_buf_t  *b;
+
+    if (c->udp == NULL || c->udp->buffer == NULL) {
+        c->read->ready = 0;
+        return NGX_AGAIN;
+    }
+
+    b = c->udp->buffer;
+
+    n = b->last - b->pos;
+
+    if (n > size) {
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "datagram of %uz bytes truncated to %uz", n, size);
+        n = size;
+    }
+
+    ngx_memcpy(buf, b->pos, n);
+
+    c->udp->buffer = NULL;
+
+    c->read->ready = 0;
+    c->read->active = 1;
+
+    return n;
+}
+
+
+ssize_t
+ngx_udp_shared_send(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ssize_t    n;
+    ngx_err_t  err;
+
+    for ( ;; ) {
+        n = sendto(c->fd, buf, size, 0, c->sockaddr, c->socklen);
+
+        ngx_log_debug4(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "sendto: fd:%d %z of %uz to \"%V\"",
+                       c->fd, n, size, &c->addr_text);
+
+        if (n != -1) {
+            break;
+        }
+
+        err = ngx_socket_errno;
+
+        if (err == NGX_EINTR) {
+            continue;
+        }
+
+        if (err == NGX_EAGAIN) {
+
+            /*
+             * the shared socket is never waited for writing,
+             * the datagram is left to the caller to drop
+             */
+
+            ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, err,
+                           "sendto() not ready");
+            return NGX_AGAIN;
+        }
+
+        c->write->error = 1;
+        (void) ngx_connection_error(c, err, "sendto() failed");
+
+        return NGX_ERROR;
+    }
+
+    if ((size_t) n != size) {
+        c->write->error = 1;
+        ngx_log_error(NGX_LOG_CRIT, c->log, 0,
+                      "sendto() incomplete, %z of %uz", n, size);
+        return NGX_ERROR;
+    }
+
+    c->sent += n;
+
+    return n;
+}
+
+
+/*
+ * moves up to "max" datagrams from the connected socket "src" to "dst",
+ * returns the number of datagrams received, NGX_AGAIN, or NGX_ERROR;
+ * the datagrams that cannot be sent right away are dropped
+ */
+
+ngx_int_t
+ngx_udp_relay(ngx_connection_t *src, ngx_connection_t *dst, ngx_uint_t max,
+    size_t *size)
+{
+    ngx_int_t         rc;
+    ngx_uint_t        i;
+    ngx_udp_batch_t  *b;
+#if (NGX_HAVE_MMSG)
+    int               n;
+    ngx_err_t         err;
+    ngx_uint_t        sent;
+    struct msghdr    *msg;
+#else
+    ssize_t           n;
+#endif
+
+    b = &ngx_udp_relay_batch;
+
+    if (max > NGX_UDP_BATCH) {
+        max = NGX_UDP_BATCH;
+    }
+
+    rc = ngx_udp_recv_batch(src, b, max);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    *size = 0;
+
+    for (i = 0; i < b->n; i++) {
+        *size += b->lens[i];
+    }
+
+#if (NGX_HAVE_MMSG)
+
+    for (i = 0; i < b->n; i++) {
+        b->iovs[i].iov_len = b->lens[i];
+
+        msg = &b->msgs[i].msg_hdr;
+
+        msg->msg_name = dst->shared ? dst->sockaddr : NULL;
+        msg->msg_namelen = dst->shared ? dst->socklen : 0;
+        msg->msg_flags = 0;
+    }
+
+    sent = 0;
+
+    while (sent < b->n) {
+        n = sendmmsg(dst->fd, &b->msgs[sent], b->n - sent, 0);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, dst->log, 0,
+                       "sendmmsg: fd:%d %d of %ui", dst->fd, n, b->n - sent);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err == NGX_EAGAIN) {
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, dst->log, err,
+                               "sendmmsg() not ready, %ui datagrams dropped",
+                               b->n - sent);
+                break;
+            }
+
+            dst->write->error = 1;
+            (void) ngx_connection_error(dst, err, "sendmmsg() failed");
+
+            return NGX_ERROR;
+        }
+
+        for (i = sent; i < sent + n; i++) {
+            dst->sent += b->lens[i];
+        }
+
+        sent += n;
+    }
+
+#else
+
+    for (i = 0; i < b->n; i++) {
+        n = dst->send(dst, b->buffers[i], b->lens[i]);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+    }
+
+#endif
+
+    return b->n;
+}
+
+
+void
+ngx_udp_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_int_t              rc;
+    ngx_connection_t      *c, *ct;
+    ngx_rbtree_node_t    **p;
+    ngx_udp_session_t     *udp, *udpt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            udp = (ngx_udp_session_t *) node;
+            c = udp->connection;
+
+            udpt = (ngx_udp_session_t *) temp;
+            ct = udpt->connection;
+
+            rc = ngx_udp_cmp_sockaddr(c->sockaddr, c->socklen,
+                                      ct->sockaddr, ct->socklen);
+
+            p = (rc < 0) ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static uint32_t
+ngx_udp_hash(struct sockaddr *sa, socklen_t socklen)
+{
+    uint32_t              hash;
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+
+    switch (sa->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) sa;
+
+        ngx_crc32_init(hash);
+        ngx_crc32_update(&hash, (u_char *) &sin6->sin6_addr, 16);
+        ngx_crc32_update(&hash, (u_char *) &sin6->sin6_port,
+                         sizeof(in_port_t));
+        ngx_crc32_final(hash);
+
+        return hash;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        return ngx_crc32_short((u_char *) sa, socklen);
+#endif
+
+    default: /* AF_INET */
+        sin = (struct sockaddr_in *) sa;
+
+        ngx_crc32_init(hash);
+        ngx_crc32_update(&hash, (u_char *) &sin->sin_addr, 4);
+        ngx_crc32_update(&hash, (u_char *) &sin->sin_port, sizeof(in_port_t));
+        ngx_crc32_final(hash);
+
+        return hash;
+    }
+}
+
+
+/* the flow label and the padding are not a part of the session key */
+
+static ngx_int_t
+ngx_udp_cmp_sockaddr(struct sockaddr *sa1, socklen_t len1,
+    struct sockaddr *sa2, socklen_t len2)
+{
+    struct sockaddr_in   *sin1, *sin2;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin61, *sin62;
+#endif
+
+    if (sa1->sa_family != sa2->sa_family) {
+        return (ngx_int_t) sa1->sa_family - (ngx_int_t) sa2->sa_family;
+    }
+
+    switch (sa1->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin61 = (struct sockaddr_in6 *) sa1;
+        sin62 = (struct sockaddr_in6 *) sa2;
+
+        if (sin61->sin6_port != sin62->sin6_port) {
+            return (ngx_int_t) sin61->sin6_port - (ngx_int_t) sin62->sin6_port;
+        }
+
+        return ngx_memcmp(&sin61->sin6_addr, &sin62->sin6_addr, 16);
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        return ngx_memn2cmp((u_char *) sa1, (u_char *) sa2, len1, len2);
+#endif
+
+    default: /* AF_INET */
+        sin1 = (struct sockaddr_in *) sa1;
+        sin2 = (struct sockaddr_in *) sa2;
+
+        if (sin1->sin_port != sin2->sin_port) {
+            return (ngx_int_t) sin1->sin_port - (ngx_int_t) sin2->sin_port;
+        }
+
+        if (sin1->sin_addr.s_addr == sin2->sin_addr.s_addr) {
+            return 0;
+        }
+
+        return (ntohl(sin1->sin_addr.s_addr) < ntohl(sin2->sin_addr.s_addr))
+               ? -1 : 1;
+    }
+}
+
+
+static ngx_connection_t *
+ngx_lookup_udp_connection(ngx_listening_t *ls, struct sockaddr *sockaddr,
+    socklen_t socklen)
+{
+    uint32_t               hash;
+    ngx_int_t              rc;
+    ngx_connection_t      *c;
+    ngx_rbtree_node_t     *node, *sentinel;
+    ngx_udp_session_t     *udp;
+
+    node = ls->rbtree.root;
+    sentinel = ls->rbtree.sentinel;
+
+    hash = ngx_udp_hash(sockaddr, socklen);
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        udp = (ngx_udp_session_t *) node;
+
+        c = udp->connection;
+
+        rc = ngx_udp_cmp_sockaddr(sockaddr, socklen, c->sockaddr, c->socklen);
+
+        if (rc == 0) {
+            return c;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_delete_udp_connection(void *data)
+{
+    ngx_connection_t  *c = data;
+
+    if (c->udp == NULL) {
+        return;
+    }
+
+    ngx_rbtree_delete(&c->listening->rbtree, &c->udp->node);
+
+    c->udp = NULL;
+}
+
+#endif
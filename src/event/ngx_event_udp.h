@@ -0,0 +1,41 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_UDP_H_INCLUDED_
+#define _NGX_EVENT_UDP_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#if !(NGX_WIN32)
+
+#define NGX_UDP_BATCH          32
+#define NGX_UDP_DATAGRAM_SIZE  65535
+
+
+struct ngx_udp_session_s {
+    ngx_rbtree_node_t   node;
+    ngx_connection_t   *connection;
+    ngx_buf_t          *buffer;
+};
+
+
+void ngx_event_recvmsg(ngx_event_t *ev);
+void ngx_udp_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+
+ssize_t ngx_udp_shared_recv(ngx_connection_t *c, u_char *buf, size_t size);
+ssize_t ngx_udp_shared_send(ngx_connection_t *c, u_char *buf, size_t size);
+ngx_int_t ngx_udp_relay(ngx_connection_t *src, ngx_connection_t *dst,
+    ngx_uint_t max, size_t *size);
+
+#endif
+
+
+#endif /* _NGX_EVENT_UDP_H_INCLUDED_ */
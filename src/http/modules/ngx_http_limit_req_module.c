@@ -24,6 +24,8 @@ typedef struct {
 
 
 typedef struct {
+    /* used when the zone has more than one shard */
+    ngx_slab_shard_t              shard;
     ngx_rbtree_t                  rbtree;
     ngx_rbtree_node_t             sentinel;
     ngx_queue_t                   queue;
@@ -32,8 +34,9 @@ typedef struct {
 
 typedef struct 
 {
-    ngx_http_limit_req_shctx_t  *sh;
+    ngx_http_limit_req_shctx_t  *sh;        /* array of "shards" elements */
     ngx_slab_pool_t             *shpool;
+    ngx_uint_t                   shards;
     /* integer value, 1 corresponds to 0.001 r/s */
     ngx_uint_t                   rate;
     ngx_http_complex_value_t     key;
@@ -59,11 +62,15 @@ typedef struct {
 
 static void ngx_http_limit_req_delay(ngx_http_request_t *r);
 static ngx_int_t ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
-    ngx_uint_t hash, ngx_str_t *key, ngx_uint_t *ep, ngx_uint_t account);
+    ngx_http_limit_req_shctx_t *sh, ngx_uint_t hash, ngx_str_t *key,
+    ngx_uint_t *ep, ngx_uint_t account);
 static ngx_msec_t ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n, ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
-    ngx_uint_t n);
+    ngx_http_limit_req_shctx_t *sh, ngx_uint_t n);
+static ngx_rbtree_node_t *ngx_http_limit_req_evict(
+    ngx_http_limit_req_ctx_t *ctx, ngx_http_limit_req_shctx_t *sh,
+    size_t size);
 
 static void *ngx_http_limit_req_create_conf(ngx_conf_t *cf);
 static char *ngx_http_limit_req_merge_conf(ngx_conf_t *cf, void *parent,
@@ -92,7 +99,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_req_status_bounds = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3|NGX_CONF_TAKE4,
       ngx_http_limit_req_zone,
       0,
       0,
@@ -155,6 +162,58 @@ ngx_module_t  ngx_http_limit_req_module =
 };
 
 
+/*
+ * A zone with a single shard keeps its rbtree under the slab pool mutex,
+ * as before.  With several shards every shard has its own mutex, and
+ * nodes are allocated with the pool mutex taken separately.
+ */
+
+static ngx_inline ngx_http_limit_req_shctx_t *
+ngx_http_limit_req_shard(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t hash)
+{
+    return &ctx->sh[hash % ctx->shards];
+}
+
+
+static ngx_inline void
+ngx_http_limit_req_lock(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shctx_t *sh)
+{
+    if (ctx->shards == 1) {
+        ngx_slab_lock(ctx->shpool);
+
+    } else {
+        ngx_slab_shard_lock(&sh->shard);
+    }
+}
+
+
+static ngx_inline void
+ngx_http_limit_req_unlock(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shctx_t *sh)
+{
+    if (ctx->shards == 1) {
+        ngx_slab_unlock(ctx->shpool);
+
+    } else {
+        ngx_slab_shard_unlock(&sh->shard);
+    }
+}
+
+
+static ngx_inline ngx_http_limit_req_shctx_t *
+ngx_http_limit_req_node_shard(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_node_t *lr)
+{
+    ngx_rbtree_node_t  *node;
+
+    node = (ngx_rbtree_node_t *)
+               ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
+
+    return ngx_http_limit_req_shard(ctx, node->key);
+}
+
+
 static ngx_int_t
 ngx_http_limit_req_handler(ngx_http_request_t *r)
 {
@@ -165,6 +224,7 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
     ngx_msec_t                   delay;
     ngx_http_limit_req_ctx_t    *ctx;
     ngx_http_limit_req_conf_t   *lrcf;
+    ngx_http_limit_req_shctx_t  *sh;
     ngx_http_limit_req_limit_t  *limit, *limits;
 
     if (r->main->limit_req_set) {
@@ -206,12 +266,14 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
 
         hash = ngx_crc32_short(key.data, key.len);
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        sh = ngx_http_limit_req_shard(ctx, hash);
+
+        ngx_http_limit_req_lock(ctx, sh);
 
-        rc = ngx_http_limit_req_lookup(limit, hash, &key, &excess,
+        rc = ngx_http_limit_req_lookup(limit, sh, hash, &key, &excess,
                                        (n == lrcf->limits.nelts - 1));
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_http_limit_req_unlock(ctx, sh);
 
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit_req[%ui]: %i %ui.%03ui",
@@ -244,11 +306,13 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
                 continue;
             }
 
-            ngx_shmtx_lock(&ctx->shpool->mutex);
+            sh = ngx_http_limit_req_node_shard(ctx, ctx->node);
+
+            ngx_http_limit_req_lock(ctx, sh);
 
             ctx->node->count--;
 
-            ngx_shmtx_unlock(&ctx->shpool->mutex);
+            ngx_http_limit_req_unlock(ctx, sh);
 
             ctx->node = NULL;
         }
@@ -359,8 +423,9 @@ ngx_http_limit_req_rbtree_insert_value(ngx_rbtree_node_t *temp,
 
 
 static ngx_int_t
-ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
-    ngx_str_t *key, ngx_uint_t *ep, ngx_uint_t account)
+ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit,
+    ngx_http_limit_req_shctx_t *sh, ngx_uint_t hash, ngx_str_t *key,
+    ngx_uint_t *ep, ngx_uint_t account)
 {
     size_t                      size;
     ngx_int_t                   rc, excess;
@@ -376,8 +441,8 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     ctx = limit->shm_zone->data;
 
-    node = ctx->sh->rbtree.root;
-    sentinel = ctx->sh->rbtree.sentinel;
+    node = sh->rbtree.root;
+    sentinel = sh->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -399,7 +464,7 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
         if (rc == 0) {
             ngx_queue_remove(&lr->queue);
-            ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+            ngx_queue_insert_head(&sh->queue, &lr->queue);
 
             ms = (ngx_msec_int_t) (now - lr->last);
 
@@ -437,14 +502,21 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
            + offsetof(ngx_http_limit_req_node_t, data)
            + key->len;
 
-    ngx_http_limit_req_expire(ctx, 1);
+    ngx_http_limit_req_expire(ctx, sh, 1);
 
-    node = ngx_slab_alloc_locked(ctx->shpool, size);
+    node = (ctx->shards == 1) ? ngx_slab_alloc_locked(ctx->shpool, size)
+                              : ngx_slab_alloc(ctx->shpool, size);
 
     if (node == NULL) {
-        ngx_http_limit_req_expire(ctx, 0);
+        ngx_http_limit_req_expire(ctx, sh, 0);
+
+        node = (ctx->shards == 1) ? ngx_slab_alloc_locked(ctx->shpool, size)
+                                  : ngx_slab_alloc(ctx->shpool, size);
+
+        if (node == NULL && ctx->shards > 1) {
+            node = ngx_http_limit_req_evict(ctx, sh, size);
+        }
 
-        node = ngx_slab_alloc_locked(ctx->shpool, size);
         if (node == NULL) {
             ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                           "could not allocate node%s", ctx->shpool->log_ctx);
@@ -461,9 +533,9 @@ ngx_http_limit_req_lookup(ngx_http_limit_req_limit_t *limit, ngx_uint_t hash,
 
     ngx_memcpy(lr->data, key->data, key->len);
 
-    ngx_rbtree_insert(&ctx->sh->rbtree, node);
+    ngx_rbtree_insert(&sh->rbtree, node);
 
-    ngx_queue_insert_head(&ctx->sh->queue, &lr->queue);
+    ngx_queue_insert_head(&sh->queue, &lr->queue);
 
     if (account) {
         lr->last = now;
@@ -490,6 +562,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
     ngx_msec_int_t              ms;
     ngx_http_limit_req_ctx_t   *ctx;
     ngx_http_limit_req_node_t  *lr;
+    ngx_http_limit_req_shctx_t *sh;
 
     excess = *ep;
 
@@ -509,7 +582,9 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
             continue;
         }
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        sh = ngx_http_limit_req_node_shard(ctx, lr);
+
+        ngx_http_limit_req_lock(ctx, sh);
 
         tp = ngx_timeofday();
 
@@ -526,7 +601,7 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
         lr->excess = excess;
         lr->count--;
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+        ngx_http_limit_req_unlock(ctx, sh);
 
         ctx->node = NULL;
 
@@ -548,7 +623,8 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
 
 
 static void
-ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
+ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shctx_t *sh, ngx_uint_t n)
 {
     ngx_int_t                   excess;
     ngx_time_t                 *tp;
@@ -570,11 +646,11 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&ctx->sh->queue)) {
+        if (ngx_queue_empty(&sh->queue)) {
             return;
         }
 
-        q = ngx_queue_last(&ctx->sh->queue);
+        q = ngx_queue_last(&sh->queue);
 
         lr = ngx_queue_data(q, ngx_http_limit_req_node_t, queue);
 
@@ -609,19 +685,64 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
         node = (ngx_rbtree_node_t *)
                    ((u_char *) lr - offsetof(ngx_rbtree_node_t, color));
 
-        ngx_rbtree_delete(&ctx->sh->rbtree, node);
+        ngx_rbtree_delete(&sh->rbtree, node);
 
-        ngx_slab_free_locked(ctx->shpool, node);
+        if (ctx->shards == 1) {
+            ngx_slab_free_locked(ctx->shpool, node);
+
+        } else {
+            ngx_slab_free(ctx->shpool, node);
+        }
     }
 }
 
 
+/*
+ * Without shards the oldest node of the whole zone is deleted when
+ * the zone is full.  With shards the oldest nodes of the other shards
+ * are deleted too, of those which are not locked at the moment: waiting
+ * for them while holding the lock of our shard could deadlock.
+ */
+
+static ngx_rbtree_node_t *
+ngx_http_limit_req_evict(ngx_http_limit_req_ctx_t *ctx,
+    ngx_http_limit_req_shctx_t *sh, size_t size)
+{
+    ngx_uint_t                   i, n;
+    ngx_rbtree_node_t           *node;
+    ngx_http_limit_req_shctx_t  *other;
+
+    n = sh - ctx->sh;
+
+    for (i = 1; i < ctx->shards; i++) {
+        other = &ctx->sh[(n + i) % ctx->shards];
+
+        if (!ngx_slab_shard_trylock(&other->shard)) {
+            continue;
+        }
+
+        ngx_http_limit_req_expire(ctx, other, 0);
+
+        ngx_slab_shard_unlock(&other->shard);
+
+        node = ngx_slab_alloc(ctx->shpool, size);
+
+        if (node) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+
 static ngx_int_t
 ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_limit_req_ctx_t  *octx = data;
 
     size_t                     len;
+    ngx_uint_t                 i;
     ngx_http_limit_req_ctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -639,6 +760,14 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (ctx->shards != octx->shards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses %ui shards "
+                          "while previously it used %ui shards",
+                          &shm_zone->shm.name, ctx->shards, octx->shards);
+            return NGX_ERROR;
+        }
+
         ctx->sh = octx->sh;
         ctx->shpool = octx->shpool;
 
@@ -654,7 +783,7 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
         return NGX_OK;
     }
 
-    ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_limit_req_shctx_t));
+    ctx->sh = ngx_slab_calloc(ctx->shpool, ctx->shards * sizeof(ngx_http_limit_req_shctx_t));
     if (ctx->sh == NULL) 
 	{
         return NGX_ERROR;
@@ -662,9 +791,18 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     ctx->shpool->data = ctx->sh;
 
-    ngx_rbtree_init(&ctx->sh->rbtree, &ctx->sh->sentinel, ngx_http_limit_req_rbtree_insert_value);
+    for (i = 0; i < ctx->shards; i++)
+    {
+        ngx_rbtree_init(&ctx->sh[i].rbtree, &ctx->sh[i].sentinel, ngx_http_limit_req_rbtree_insert_value);
 
-    ngx_queue_init(&ctx->sh->queue);
+        ngx_queue_init(&ctx->sh[i].queue);
+    }
+
+    if (ctx->shards > 1
+        && ngx_slab_shards_init(ctx->shpool, ctx->sh, sizeof(ngx_http_limit_req_shctx_t), ctx->shards) != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
 
     len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
 
@@ -735,7 +873,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size_t                             len;
     ssize_t                            size;
     ngx_str_t                         *value, name, s;
-    ngx_int_t                          rate, scale;
+    ngx_int_t                          rate, scale, shards;
     ngx_uint_t                         i;
     ngx_shm_zone_t                    *shm_zone;
     ngx_http_limit_req_ctx_t          *ctx;
@@ -763,6 +901,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     size = 0;
     rate = 1;
     scale = 1;
+    shards = 1;
     name.len = 0;
 
     for (i = 2; i < cf->args->nelts; i++) 
@@ -826,6 +965,27 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid shards \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+            if (shards > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" requires atomic operations",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+#endif
+
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
@@ -839,6 +999,7 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     ctx->rate = rate * 1000 / scale;
+    ctx->shards = shards;
 
     shm_zone = ngx_shared_memory_add(cf, &name, size, &ngx_http_limit_req_module);
     if (shm_zone == NULL)
@@ -94,6 +94,12 @@ typedef struct
 
     ngx_uint_t                     http_version;
 
+#if (NGX_HTTP_V2)
+    ngx_uint_t                     http2;
+    ngx_uint_t                     http2_max_streams;
+    ngx_msec_t                     http2_idle_timeout;
+#endif
+
     ngx_uint_t                     headers_hash_max_size;
     ngx_uint_t                     headers_hash_bucket_size;
 
@@ -111,6 +117,153 @@ typedef struct
 } ngx_http_proxy_loc_conf_t;
 
 
+#if (NGX_HTTP_V2)
+
+#define NGX_HTTP_PROXY_V2_MAX_STREAMS    128
+#define NGX_HTTP_PROXY_V2_BUFFER_SIZE    16384
+#define NGX_HTTP_PROXY_V2_QUEUE_SIZE     65536
+#define NGX_HTTP_PROXY_V2_IDLE_TIMEOUT   60000
+
+
+typedef struct ngx_http_proxy_v2_mux_s  ngx_http_proxy_v2_mux_t;
+
+
+/*
+ * a stream of a shared upstream connection, the upstream module sees it
+ * as a connection without a socket, hence the connection goes first
+ */
+
+typedef struct {
+    ngx_connection_t               connection;
+    ngx_event_t                    read;
+    ngx_event_t                    write;
+
+    ngx_http_proxy_v2_mux_t       *mux;
+    ngx_queue_t                    queue;
+
+    ngx_uint_t                     id;
+    ssize_t                        send_window;
+    size_t                         recv_window;
+    size_t                         unacked;
+
+    /* DATA received on the connection and DATA parsed by the request */
+    size_t                         received;
+    size_t                         consumed;
+
+    ngx_msec_t                     read_timeout;
+
+    /* the frames of the stream not yet read by the request */
+    ngx_chain_t                   *in;
+    ngx_chain_t                   *last;
+    ngx_chain_t                   *free;
+
+    /* the peer of the request, its SSL session is saved by the handshake */
+    ngx_peer_connection_t         *peer;
+    ngx_event_free_peer_pt         free_peer;
+
+    unsigned                       opened:1;
+    unsigned                       in_closed:1;
+    unsigned                       out_closed:1;
+    unsigned                       reset:1;
+    unsigned                       blocked:1;
+    unsigned                       queued:1;
+} ngx_http_proxy_v2_stream_t;
+
+
+struct ngx_http_proxy_v2_mux_s {
+    ngx_queue_t                    queue;
+
+    ngx_http_upstream_conf_t      *conf;
+    ngx_peer_connection_t          peer;
+    ngx_str_t                      name;
+    ngx_str_t                      ssl_name;
+    ngx_pool_t                    *pool;
+    ngx_log_t                      log;
+
+    ngx_queue_t                    streams;
+    ngx_uint_t                     nstreams;
+    ngx_uint_t                     max_streams;
+    ngx_uint_t                     streams_limit;
+    ngx_uint_t                     last_sid;
+    ngx_msec_t                     idle_timeout;
+
+    ssize_t                        send_window;
+    size_t                         init_window;
+    size_t                         frame_size;
+
+    /* the windows advertised for a stream and for the connection */
+    size_t                         window;
+    size_t                         conn_window;
+    size_t                         recv_window;
+    size_t                         unacked;
+
+    /* the frame parser state */
+    ngx_uint_t                     state;
+    ngx_uint_t                     type;
+    ngx_uint_t                     flags;
+    ngx_uint_t                     sid;
+    size_t                         rest;
+    u_char                         buffer[NGX_HTTP_V2_STATE_BUFFER_SIZE];
+    size_t                         used;
+    ngx_uint_t                     continuation;
+    ngx_http_proxy_v2_stream_t    *stream;
+
+    ngx_buf_t                     *in;
+
+    ngx_chain_t                   *out;
+    ngx_chain_t                   *last;
+    ngx_chain_t                   *free;
+    size_t                         queued;
+
+    unsigned                       ssl:1;
+    unsigned                       connected:1;
+    unsigned                       goaway:1;
+    unsigned                       error:1;
+};
+
+
+typedef struct {
+    /* the HPACK decoder, the dynamic table is disabled */
+    ngx_http_v2_connection_t      *connection;
+
+    ngx_http_proxy_v2_stream_t    *stream;
+    ngx_uint_t                     id;
+
+    /* the response frame parser state */
+    ngx_uint_t                     state;
+    ngx_uint_t                     type;
+    ngx_uint_t                     flags;
+    ngx_uint_t                     sid;
+    size_t                         rest;
+    size_t                         padding;
+    u_char                         buffer[NGX_HTTP_V2_STATE_BUFFER_SIZE];
+    size_t                         used;
+
+    ngx_buf_t                     *block;
+
+    /* the request body not yet sent in DATA frames */
+    ngx_chain_t                   *in;
+    ngx_buf_t                     *cur;
+    u_char                        *pos;
+
+    ngx_chain_t                   *busy;
+    ngx_chain_t                   *free;
+
+    unsigned                       ssl:1;
+    unsigned                       header_sent:1;
+    unsigned                       output_closed:1;
+    unsigned                       output_blocked:1;
+    unsigned                       request_sent:1;
+    unsigned                       continuation:1;
+    unsigned                       end_stream:1;
+    unsigned                       header_done:1;
+    unsigned                       done:1;
+    unsigned                       refused:1;
+} ngx_http_proxy_v2_t;
+
+#endif
+
+
 typedef struct 
 {
     ngx_http_status_t              status;
@@ -121,9 +274,14 @@ typedef struct
     ngx_chain_t                   *free;
     ngx_chain_t                   *busy;
 
+#if (NGX_HTTP_V2)
+    ngx_http_proxy_v2_t           *v2;
+#endif
+
     unsigned                       head:1;		/*HEAD 󷽷*/
     unsigned                       internal_chunked:1;
     unsigned                       header_sent:1;
+    unsigned                       http2:1;
 } ngx_http_proxy_ctx_t;
 
 
@@ -147,6 +305,95 @@ static ngx_int_t ngx_http_proxy_non_buffered_copy_filter(void *data,
     ssize_t bytes);
 static ngx_int_t ngx_http_proxy_non_buffered_chunked_filter(void *data,
     ssize_t bytes);
+
+#if (NGX_HTTP_V2)
+static ngx_int_t ngx_http_proxy_v2_init(ngx_http_request_t *r,
+    ngx_http_proxy_ctx_t *ctx);
+static ngx_int_t ngx_http_proxy_v2_create_request(ngx_http_request_t *r);
+static ngx_int_t ngx_http_proxy_v2_reinit_request(ngx_http_request_t *r);
+static ngx_int_t ngx_http_proxy_v2_connect_peer(ngx_http_request_t *r);
+static void ngx_http_proxy_v2_free_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static void ngx_http_proxy_v2_stream_close(
+    ngx_http_proxy_v2_stream_t *stream);
+static ssize_t ngx_http_proxy_v2_stream_recv(ngx_connection_t *c,
+    u_char *buf, size_t size);
+static ssize_t ngx_http_proxy_v2_stream_recv_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ssize_t ngx_http_proxy_v2_stream_send(ngx_connection_t *c,
+    u_char *buf, size_t size);
+static ngx_chain_t *ngx_http_proxy_v2_stream_send_chain(ngx_connection_t *c,
+    ngx_chain_t *in, off_t limit);
+static ngx_int_t ngx_http_proxy_v2_stream_append(
+    ngx_http_proxy_v2_stream_t *stream, u_char *data, size_t size);
+static ngx_int_t ngx_http_proxy_v2_mux_local(ngx_http_proxy_v2_mux_t *mux,
+    ngx_addr_t *local);
+static ngx_int_t ngx_http_proxy_v2_mux_create(ngx_http_request_t *r,
+    ngx_uint_t ssl, ngx_str_t *name, ngx_http_proxy_v2_mux_t **muxp);
+static void ngx_http_proxy_v2_mux_connect_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_proxy_v2_mux_test_connect(ngx_connection_t *c);
+#if (NGX_HTTP_SSL)
+static void ngx_http_proxy_v2_mux_ssl_handshake(ngx_connection_t *c);
+#endif
+static void ngx_http_proxy_v2_mux_connected(ngx_http_proxy_v2_mux_t *mux);
+static void ngx_http_proxy_v2_mux_read_handler(ngx_event_t *rev);
+static void ngx_http_proxy_v2_mux_write_handler(ngx_event_t *wev);
+static ngx_int_t ngx_http_proxy_v2_mux_parse(ngx_http_proxy_v2_mux_t *mux,
+    ngx_buf_t *b);
+static ngx_int_t ngx_http_proxy_v2_mux_gather(ngx_http_proxy_v2_mux_t *mux,
+    ngx_buf_t *b, size_t size);
+static ngx_int_t ngx_http_proxy_v2_mux_control(ngx_http_proxy_v2_mux_t *mux);
+static ngx_http_proxy_v2_stream_t *ngx_http_proxy_v2_mux_find(
+    ngx_http_proxy_v2_mux_t *mux, ngx_uint_t sid);
+static void ngx_http_proxy_v2_mux_credit(ngx_http_proxy_v2_mux_t *mux,
+    ngx_http_proxy_v2_stream_t *stream, size_t size);
+static void ngx_http_proxy_v2_mux_wake(ngx_http_proxy_v2_mux_t *mux);
+static ngx_buf_t *ngx_http_proxy_v2_mux_buf(ngx_http_proxy_v2_mux_t *mux,
+    size_t size);
+static u_char *ngx_http_proxy_v2_mux_frame(ngx_http_proxy_v2_mux_t *mux,
+    size_t length, ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_proxy_v2_mux_copy(ngx_http_proxy_v2_mux_t *mux,
+    ngx_buf_t *b);
+static ngx_int_t ngx_http_proxy_v2_mux_send(ngx_http_proxy_v2_mux_t *mux);
+static void ngx_http_proxy_v2_mux_post(ngx_http_proxy_v2_mux_t *mux);
+static void ngx_http_proxy_v2_mux_close(ngx_http_proxy_v2_mux_t *mux);
+static u_char *ngx_http_proxy_v2_log_error(ngx_log_t *log, u_char *buf,
+    size_t len);
+static ngx_int_t ngx_http_proxy_v2_body_output_filter(void *data,
+    ngx_chain_t *in);
+static ngx_chain_t *ngx_http_proxy_v2_get_buf(ngx_http_request_t *r,
+    ngx_http_proxy_v2_t *v2, size_t size);
+static u_char *ngx_http_proxy_v2_write_head(u_char *p, size_t length,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid);
+static ngx_int_t ngx_http_proxy_v2_send(ngx_http_request_t *r,
+    ngx_http_proxy_v2_t *v2, ngx_chain_t *out);
+static ngx_int_t ngx_http_proxy_v2_parse(ngx_http_request_t *r,
+    ngx_http_proxy_v2_t *v2, ngx_buf_t *b);
+static ngx_int_t ngx_http_proxy_v2_gather(ngx_http_proxy_v2_t *v2,
+    ngx_buf_t *b, size_t size);
+static ngx_int_t ngx_http_proxy_v2_parse_control(ngx_http_request_t *r,
+    ngx_http_proxy_v2_t *v2, ngx_buf_t *b);
+static ngx_int_t ngx_http_proxy_v2_parse_header_block(ngx_http_request_t *r,
+    ngx_http_proxy_v2_t *v2);
+static ngx_int_t ngx_http_proxy_v2_parse_int(u_char **pos, u_char *end,
+    ngx_uint_t prefix);
+static ngx_int_t ngx_http_proxy_v2_parse_string(ngx_http_request_t *r,
+    u_char **pos, u_char *end, ngx_str_t *s);
+static ngx_int_t ngx_http_proxy_v2_process_header_line(ngx_http_request_t *r,
+    ngx_str_t *name, ngx_str_t *value);
+static ngx_int_t ngx_http_proxy_v2_process_header(ngx_http_request_t *r);
+static ngx_int_t ngx_http_proxy_v2_input_filter_init(void *data);
+static ngx_int_t ngx_http_proxy_v2_filter(ngx_event_pipe_t *p,
+    ngx_buf_t *buf);
+static ngx_int_t ngx_http_proxy_v2_non_buffered_filter(void *data,
+    ssize_t bytes);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_proxy_v2_thread_handler(ngx_thread_task_t *task,
+    ngx_file_t *file);
+static void ngx_http_proxy_v2_thread_event_handler(ngx_event_t *ev);
+#endif
+#endif
+
 static void ngx_http_proxy_abort_request(ngx_http_request_t *r);
 static void ngx_http_proxy_finalize_request(ngx_http_request_t *r,
     ngx_int_t rc);
@@ -253,6 +500,15 @@ static ngx_conf_enum_t  ngx_http_proxy_http_version[] = {
 };
 
 
+#if (NGX_HTTP_V2)
+
+static ngx_conf_num_bounds_t  ngx_http_proxy_http2_max_streams_bounds = {
+    ngx_conf_check_num_bounds, 1, -1
+};
+
+#endif
+
+
 ngx_module_t  ngx_http_proxy_module;
 
 
@@ -995,6 +1251,24 @@ Sets a pause between iterations (1.7.12). By default, purger_sleep is set to 50
       offsetof(ngx_http_proxy_loc_conf_t, http_version),
       &ngx_http_proxy_http_version },
 
+#if (NGX_HTTP_V2)
+
+    { ngx_string("proxy_http2_max_streams"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, http2_max_streams),
+      &ngx_http_proxy_http2_max_streams_bounds },
+
+    { ngx_string("proxy_http2_idle_timeout"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, http2_idle_timeout),
+      NULL },
+
+#endif
+
 #if (NGX_HTTP_SSL)
 
     { 
@@ -1147,6 +1421,13 @@ ngx_module_t  ngx_http_proxy_module =
 static char  ngx_http_proxy_version[] = " HTTP/1.0" CRLF;
 static char  ngx_http_proxy_version_11[] = " HTTP/1.1" CRLF;
 
+#if (NGX_HTTP_V2)
+static char  ngx_http_proxy_v2_preface[] = "PRI * HTTP/2.0" CRLF CRLF "SM" CRLF CRLF;
+
+/* the shared upstream connections of the worker */
+static ngx_queue_t  ngx_http_proxy_v2_muxes;
+#endif
+
 
 static ngx_keyval_t  ngx_http_proxy_headers[] = 
 {
@@ -1269,6 +1550,9 @@ ngx_http_proxy_handler(ngx_http_request_t *r)
 #if (NGX_HTTP_SSL)
         u->ssl = (plcf->upstream.ssl != NULL);
 #endif
+#if (NGX_HTTP_V2)
+        ctx->http2 = plcf->http2;
+#endif
 
     } else {
         if (ngx_http_proxy_eval(r, ctx, plcf) != NGX_OK) {
@@ -1319,8 +1603,14 @@ ngx_http_proxy_handler(ngx_http_request_t *r)
 
     u->accel = 1;
 
+#if (NGX_HTTP_V2)
+    if (ctx->http2 && ngx_http_proxy_v2_init(r, ctx) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+#endif
+
     if (!plcf->upstream.request_buffering && plcf->body_values == NULL && plcf->upstream.pass_request_body
-        && (!r->headers_in.chunked || plcf->http_version == NGX_HTTP_VERSION_11)) {
+        && (!r->headers_in.chunked || plcf->http_version == NGX_HTTP_VERSION_11 || ctx->http2)) {
         r->request_body_no_buffering = 1;
     }
 
@@ -1367,6 +1657,28 @@ ngx_http_proxy_eval(ngx_http_request_t *r, ngx_http_proxy_ctx_t *ctx, ngx_http_p
         port = 443;
         r->upstream->ssl = 1;
 
+#endif
+
+#if (NGX_HTTP_V2)
+
+    }
+	else if (proxy.len > 6 && ngx_strncasecmp(proxy.data, (u_char *) "h2c://", 6) == 0)
+    {
+        add = 6;
+        port = 80;
+        ctx->http2 = 1;
+
+#if (NGX_HTTP_SSL)
+
+    }
+	else if (proxy.len > 5 && ngx_strncasecmp(proxy.data, (u_char *) "h2://", 5) == 0)
+    {
+        add = 5;
+        port = 443;
+        r->upstream->ssl = 1;
+        ctx->http2 = 1;
+
+#endif
 #endif
 
     } 
@@ -2761,174 +3073,4023 @@ ngx_http_proxy_non_buffered_chunked_filter(void *data, ssize_t bytes)
 }
 
 
-static void
-ngx_http_proxy_abort_request(ngx_http_request_t *r)
+#if (NGX_HTTP_V2)
+
+/*
+ * HTTP/2 to the upstream: requests are streams multiplexed over upstream
+ * connections shared by the worker.  The upstream module sees a stream as
+ * a connection without a socket which reads the frames of the stream only,
+ * while the shared connection handles the connection level frames and the
+ * flow control, see ngx_http_proxy_v2_connect_peer().
+ */
+
+static ngx_int_t
+ngx_http_proxy_v2_init(ngx_http_request_t *r, ngx_http_proxy_ctx_t *ctx)
 {
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                   "abort http proxy request");
+    ngx_http_upstream_t       *u;
+    ngx_http_v2_connection_t  *h2c;
+#if (NGX_THREADS)
+    ngx_http_core_loc_conf_t  *clcf;
+#endif
 
-    return;
-}
+    u = r->upstream;
 
+#if (NGX_HTTP_CACHE)
 
-static void
-ngx_http_proxy_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
-{
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "finalize http proxy request");
+    if (u->conf->cache) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "proxy_cache cannot be used with HTTP/2 upstreams");
+        return NGX_ERROR;
+    }
 
-    return;
-}
+#endif
+
+    /*
+     * the streams have no socket, ngx_handle_read_event() and
+     * ngx_handle_write_event() leave their active events alone only
+     * with the event methods that do not delete ready events
+     */
 
+    if ((ngx_event_flags & NGX_USE_LEVEL_EVENT)
+        && !(ngx_event_flags & NGX_USE_CLEAR_EVENT))
+    {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "HTTP/2 upstreams cannot be used with "
+                      "level-triggered event methods");
+        return NGX_ERROR;
+    }
 
-static ngx_int_t
-ngx_http_proxy_host_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
-{
-    ngx_http_proxy_ctx_t  *ctx;
+    ctx->v2 = ngx_pcalloc(r->pool, sizeof(ngx_http_proxy_v2_t));
+    if (ctx->v2 == NULL) {
+        return NGX_ERROR;
+    }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+    /* only the static table of the decoder is used */
 
-    if (ctx == NULL) {
-        v->not_found = 1;
-        return NGX_OK;
+    h2c = ngx_pcalloc(r->pool, sizeof(ngx_http_v2_connection_t));
+    if (h2c == NULL) {
+        return NGX_ERROR;
     }
 
-    v->len = ctx->vars.host_header.len;
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
-    v->data = ctx->vars.host_header.data;
+    h2c->connection = r->connection;
+    h2c->state.pool = r->pool;
 
-    return NGX_OK;
-}
+    ctx->v2->connection = h2c;
 
+#if (NGX_HTTP_SSL)
+    ctx->v2->ssl = u->ssl;
+#endif
 
-static ngx_int_t
-ngx_http_proxy_port_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
-{
-    ngx_http_proxy_ctx_t  *ctx;
+    u->create_request = ngx_http_proxy_v2_create_request;
+    u->reinit_request = ngx_http_proxy_v2_reinit_request;
+    u->connect_peer = ngx_http_proxy_v2_connect_peer;
+    u->process_header = ngx_http_proxy_v2_process_header;
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+    u->pipe->input_filter = ngx_http_proxy_v2_filter;
 
-    if (ctx == NULL) {
-        v->not_found = 1;
-        return NGX_OK;
+    u->input_filter_init = ngx_http_proxy_v2_input_filter_init;
+    u->input_filter = ngx_http_proxy_v2_non_buffered_filter;
+
+    /* the request body is copied to the shared connection from memory */
+
+    u->output.need_in_memory = 1;
+
+#if (NGX_THREADS)
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (clcf->aio == NGX_HTTP_AIO_THREADS) {
+        u->output.thread_handler = ngx_http_proxy_v2_thread_handler;
     }
 
-    v->len = ctx->vars.port.len;
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
-    v->data = ctx->vars.port.data;
+#endif
 
     return NGX_OK;
 }
 
 
 static ngx_int_t
-ngx_http_proxy_add_x_forwarded_for_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
+ngx_http_proxy_v2_create_request(ngx_http_request_t *r)
 {
-    size_t             len;
-    u_char            *p;
-    ngx_uint_t         i, n;
-    ngx_table_elt_t  **h;
-
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
+    u_char                     *p, *last, *end, *pos, *tmp;
+    size_t                      len, tmp_len;
+    ngx_buf_t                  *b, *hb;
+    ngx_str_t                   method, host;
+    ngx_uint_t                  i;
+    ngx_array_t                 headers;
+    ngx_chain_t                *cl;
+    ngx_http_upstream_t        *u;
+    ngx_http_v2_header_t       *h;
 
-    n = r->headers_in.x_forwarded_for.nelts;
-    h = r->headers_in.x_forwarded_for.elts;
+    if (ngx_http_proxy_create_request(r) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-    len = 0;
+    /* convert the HTTP/1.x request header to an HPACK header block */
 
-    for (i = 0; i < n; i++) {
-        len += h[i]->value.len + sizeof(", ") - 1;
-    }
+    u = r->upstream;
 
-    if (len == 0) {
-        v->len = r->connection->addr_text.len;
-        v->data = r->connection->addr_text.data;
-        return NGX_OK;
-    }
+    cl = u->request_bufs;
+    b = cl->buf;
 
-    len += r->connection->addr_text.len;
+    method.data = b->pos;
+    method.len = u->uri.data - 1 - b->pos;
 
-    p = ngx_pnalloc(r->pool, len);
+    p = ngx_strlchr(u->uri.data + u->uri.len, b->last, LF);
     if (p == NULL) {
         return NGX_ERROR;
     }
 
-    v->len = len;
-    v->data = p;
+    p++;
 
-    for (i = 0; i < n; i++) {
-        p = ngx_copy(p, h[i]->value.data, h[i]->value.len);
-        *p++ = ','; *p++ = ' ';
+    if (ngx_array_init(&headers, r->pool, 16, sizeof(ngx_http_v2_header_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
     }
 
-    ngx_memcpy(p, r->connection->addr_text.data, r->connection->addr_text.len);
+    ngx_str_null(&host);
 
-    return NGX_OK;
-}
+    len = 1 + NGX_HTTP_V2_INT_OCTETS + method.len
+          + 1
+          + 1 + NGX_HTTP_V2_INT_OCTETS + u->uri.len;
 
+    tmp_len = ngx_max(method.len, u->uri.len);
 
-static ngx_int_t
-ngx_http_proxy_internal_body_length_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
-{
-    ngx_http_proxy_ctx_t  *ctx;
+    for ( ;; ) {
+        last = ngx_strlchr(p, b->last, LF);
+        if (last == NULL) {
+            return NGX_ERROR;
+        }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+        end = (last > p && last[-1] == CR) ? last - 1 : last;
 
-    if (ctx == NULL || ctx->internal_body_length < 0) {
-        v->not_found = 1;
-        return NGX_OK;
-    }
+        if (end == p) {
+            p = last + 1;
+            break;
+        }
 
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
+        pos = ngx_strlchr(p, end, ':');
 
-    v->data = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+        if (pos == NULL || pos == p) {
+            p = last + 1;
+            continue;
+        }
 
-    if (v->data == NULL) {
-        return NGX_ERROR;
-    }
+        h = ngx_array_push(&headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
 
-    v->len = ngx_sprintf(v->data, "%O", ctx->internal_body_length) - v->data;
+        h->name.data = p;
+        h->name.len = pos - p;
+
+        for (pos++; pos < end && *pos == ' '; pos++) { /* void */ }
+
+        h->value.data = pos;
+        h->value.len = end - pos;
+
+        p = last + 1;
+
+        ngx_strlow(h->name.data, h->name.data, h->name.len);
+
+        /* connection-specific headers are not allowed in HTTP/2 */
+
+        if ((h->name.len == sizeof("connection") - 1
+             && ngx_strncmp(h->name.data, "connection", h->name.len) == 0)
+            || (h->name.len == sizeof("keep-alive") - 1
+                && ngx_strncmp(h->name.data, "keep-alive", h->name.len) == 0)
+            || (h->name.len == sizeof("proxy-connection") - 1
+                && ngx_strncmp(h->name.data, "proxy-connection",
+                               h->name.len) == 0)
+            || (h->name.len == sizeof("transfer-encoding") - 1
+                && ngx_strncmp(h->name.data, "transfer-encoding",
+                               h->name.len) == 0)
+            || (h->name.len == sizeof("upgrade") - 1
+                && ngx_strncmp(h->name.data, "upgrade", h->name.len) == 0)
+            || (h->name.len == sizeof("te") - 1
+                && ngx_strncmp(h->name.data, "te", h->name.len) == 0
+                && (h->value.len != sizeof("trailers") - 1
+                    || ngx_strncasecmp(h->value.data, (u_char *) "trailers",
+                                       h->value.len) != 0)))
+        {
+            headers.nelts--;
+            continue;
+        }
 
-    return NGX_OK;
-}
+        if (h->name.len == sizeof("host") - 1
+            && ngx_strncmp(h->name.data, "host", h->name.len) == 0)
+        {
+            headers.nelts--;
 
+            if (host.data == NULL) {
+                host = h->value;
 
-static ngx_int_t
-ngx_http_proxy_internal_chunked_variable(ngx_http_request_t *r,
-    ngx_http_variable_value_t *v, uintptr_t data)
-{
-    ngx_http_proxy_ctx_t  *ctx;
+                len += 1 + NGX_HTTP_V2_INT_OCTETS + host.len;
+                tmp_len = ngx_max(tmp_len, host.len);
+            }
 
-    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+            continue;
+        }
 
-    if (ctx == NULL || !ctx->internal_chunked) {
-        v->not_found = 1;
-        return NGX_OK;
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + h->name.len
+               + NGX_HTTP_V2_INT_OCTETS + h->value.len;
+
+        tmp_len = ngx_max(tmp_len, h->name.len);
+        tmp_len = ngx_max(tmp_len, h->value.len);
     }
 
-    v->valid = 1;
-    v->no_cacheable = 0;
-    v->not_found = 0;
+    hb = ngx_create_temp_buf(r->pool, len);
+    if (hb == NULL) {
+        return NGX_ERROR;
+    }
 
-    v->data = (u_char *) "chunked";
-    v->len = sizeof("chunked") - 1;
+    tmp = ngx_palloc(r->pool, tmp_len);
+    if (tmp == NULL) {
+        return NGX_ERROR;
+    }
 
-    return NGX_OK;
-}
+    pos = hb->last;
 
+    if (method.len == 3 && ngx_strncmp(method.data, "GET", 3) == 0) {
+        *pos++ = ngx_http_v2_indexed(NGX_HTTP_V2_METHOD_GET_INDEX);
 
-static ngx_int_t
+    } else if (method.len == 4 && ngx_strncmp(method.data, "POST", 4) == 0) {
+        *pos++ = ngx_http_v2_indexed(NGX_HTTP_V2_METHOD_POST_INDEX);
+
+    } else {
+        *pos = NGX_HTTP_V2_NOT_INDEXED;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4),
+                                    NGX_HTTP_V2_METHOD_GET_INDEX);
+        pos = ngx_http_v2_string_encode(pos, method.data, method.len, tmp);
+    }
+
+#if (NGX_HTTP_SSL)
+    if (u->ssl) {
+        *pos++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTPS_INDEX);
+
+    } else
+#endif
+    {
+        *pos++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
+    }
+
+    *pos = NGX_HTTP_V2_NOT_INDEXED;
+    pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4),
+                                NGX_HTTP_V2_PATH_INDEX);
+    pos = ngx_http_v2_string_encode(pos, u->uri.data, u->uri.len, tmp);
+
+    if (host.data) {
+        *pos = NGX_HTTP_V2_NOT_INDEXED;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4),
+                                    NGX_HTTP_V2_AUTHORITY_INDEX);
+        pos = ngx_http_v2_string_encode(pos, host.data, host.len, tmp);
+    }
+
+    h = headers.elts;
+
+    for (i = 0; i < headers.nelts; i++) {
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http proxy http2 header: \"%V: %V\"",
+                       &h[i].name, &h[i].value);
+
+        *pos++ = NGX_HTTP_V2_NOT_INDEXED;
+        pos = ngx_http_v2_string_encode(pos, h[i].name.data, h[i].name.len,
+                                        tmp);
+        pos = ngx_http_v2_string_encode(pos, h[i].value.data, h[i].value.len,
+                                        tmp);
+    }
+
+    hb->last = pos;
+
+    cl->buf = hb;
+
+    if (p != b->last) {
+
+        /* the body set by proxy_set_body */
+
+        last = b->last;
+
+        cl->next = ngx_alloc_chain_link(r->pool);
+        if (cl->next == NULL) {
+            return NGX_ERROR;
+        }
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->memory = 1;
+        b->start = p;
+        b->pos = p;
+        b->last = last;
+        b->end = last;
+
+        cl->next->buf = b;
+        cl->next->next = NULL;
+    }
+
+    if (r->request_body_no_buffering) {
+
+        if (!r->reading_body && r->request_body->bufs == NULL) {
+            hb->last_buf = 1;
+        }
+
+    } else {
+
+        for (cl = u->request_bufs; cl->next; cl = cl->next) {
+            cl->buf->last_buf = 0;
+        }
+
+        cl->buf->last_buf = 1;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy http2 header block: %uz of %uz, body:%d",
+                   hb->last - hb->pos, len, !hb->last_buf);
+
+    u->output.output_filter = ngx_http_proxy_v2_body_output_filter;
+    u->output.filter_ctx = r;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_reinit_request(ngx_http_request_t *r)
+{
+    ngx_http_proxy_v2_t   *v2;
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        return NGX_OK;
+    }
+
+    v2 = ctx->v2;
+
+    v2->stream = NULL;
+
+    v2->state = 0;
+    v2->rest = 0;
+    v2->padding = 0;
+    v2->used = 0;
+
+    v2->in = NULL;
+    v2->cur = NULL;
+    v2->busy = NULL;
+
+    v2->header_sent = 0;
+    v2->output_closed = 0;
+    v2->output_blocked = 0;
+    v2->request_sent = 0;
+    v2->continuation = 0;
+    v2->end_stream = 0;
+    v2->header_done = 0;
+    v2->done = 0;
+    v2->refused = 0;
+
+    r->upstream->process_header = ngx_http_proxy_v2_process_header;
+    r->upstream->pipe->input_filter = ngx_http_proxy_v2_filter;
+    r->upstream->input_filter = ngx_http_proxy_v2_non_buffered_filter;
+
+    return NGX_OK;
+}
+
+
+/*
+ * a request gets a new stream on a shared connection to the peer chosen
+ * by the balancer, the stream replaces the upstream connection, and the
+ * stream is closed by the pc->free() wrapper before the peer is released
+ */
+
+static ngx_int_t
+ngx_http_proxy_v2_connect_peer(ngx_http_request_t *r)
+{
+    ngx_int_t                    rc;
+    ngx_str_t                    name;
+    ngx_queue_t                 *q;
+    ngx_connection_t            *c, *fc;
+    ngx_peer_connection_t       *pc;
+    ngx_http_upstream_t         *u;
+    ngx_http_proxy_v2_t         *v2;
+    ngx_http_proxy_ctx_t        *ctx;
+    ngx_http_proxy_v2_mux_t     *mux;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    u = r->upstream;
+    pc = &u->peer;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+    v2 = ctx->v2;
+
+    if (ngx_http_proxy_v2_muxes.next == NULL) {
+        ngx_queue_init(&ngx_http_proxy_v2_muxes);
+    }
+
+    stream = ngx_pcalloc(r->pool, sizeof(ngx_http_proxy_v2_stream_t));
+    if (stream == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = pc->get(pc, pc->data);
+
+    if (rc == NGX_DONE) {
+
+        /* a connection cached by HTTP/1.x proxying is not used by streams */
+
+        c = pc->connection;
+
+        pc->connection = NULL;
+        pc->cached = 0;
+
+#if (NGX_HTTP_SSL)
+
+        if (c->ssl) {
+            c->ssl->no_wait_shutdown = 1;
+            c->ssl->no_send_shutdown = 1;
+
+            (void) ngx_ssl_shutdown(c);
+        }
+
+#endif
+
+        if (c->pool) {
+            ngx_destroy_pool(c->pool);
+        }
+
+        ngx_close_connection(c);
+
+    } else if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ngx_str_null(&name);
+
+#if (NGX_HTTP_SSL)
+
+    if (v2->ssl && (u->conf->ssl_server_name || u->conf->ssl_verify)) {
+
+        if (u->conf->ssl_name) {
+            if (ngx_http_complex_value(r, u->conf->ssl_name, &name) != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+        } else {
+            name = u->ssl_name;
+        }
+    }
+
+#endif
+
+    mux = NULL;
+
+    for (q = ngx_queue_head(&ngx_http_proxy_v2_muxes);
+         q != ngx_queue_sentinel(&ngx_http_proxy_v2_muxes);
+         q = ngx_queue_next(q))
+    {
+        mux = ngx_queue_data(q, ngx_http_proxy_v2_mux_t, queue);
+
+        if (mux->conf == u->conf
+            && mux->ssl == v2->ssl
+            && !mux->goaway
+            && !mux->error
+            && mux->nstreams < mux->max_streams
+            && ngx_cmp_sockaddr(mux->peer.sockaddr, mux->peer.socklen,
+                                pc->sockaddr, pc->socklen, 1)
+               == NGX_OK
+            && ngx_http_proxy_v2_mux_local(mux, pc->local) == NGX_OK
+            && mux->name.len == name.len
+            && ngx_strncmp(mux->name.data, name.data, name.len) == 0)
+        {
+            break;
+        }
+
+        mux = NULL;
+    }
+
+    if (mux == NULL) {
+        rc = ngx_http_proxy_v2_mux_create(r, v2->ssl, &name, &mux);
+
+        if (rc != NGX_OK) {
+            return rc;
+        }
+    }
+
+    fc = &stream->connection;
+
+    fc->fd = (ngx_socket_t) -1;
+    fc->read = &stream->read;
+    fc->write = &stream->write;
+    fc->pool = r->pool;
+    fc->log = r->connection->log;
+
+    fc->recv = ngx_http_proxy_v2_stream_recv;
+    fc->send = ngx_http_proxy_v2_stream_send;
+    fc->recv_chain = ngx_http_proxy_v2_stream_recv_chain;
+    fc->send_chain = ngx_http_proxy_v2_stream_send_chain;
+
+    fc->tcp_nodelay = NGX_TCP_NODELAY_DISABLED;
+    fc->tcp_nopush = NGX_TCP_NOPUSH_DISABLED;
+
+    /* proxy_send_lowat is not applied to a stream */
+    fc->sndlowat = 1;
+
+    /*
+     * the events are posted by the shared connection, as they are active
+     * they are never added to the event method
+     */
+
+    fc->read->data = fc;
+    fc->read->log = fc->log;
+    fc->read->active = 1;
+
+    fc->write->data = fc;
+    fc->write->log = fc->log;
+    fc->write->write = 1;
+    fc->write->active = 1;
+    fc->write->ready = 1;
+
+    stream->mux = mux;
+    stream->id = mux->last_sid ? mux->last_sid + 2 : 1;
+    stream->send_window = mux->init_window;
+    stream->recv_window = mux->window;
+    stream->read_timeout = u->conf->read_timeout;
+
+    mux->last_sid = stream->id;
+
+    if (mux->last_sid >= 0x7fffffff - 2) {
+        mux->goaway = 1;
+    }
+
+    ngx_queue_insert_tail(&mux->streams, &stream->queue);
+    mux->nstreams++;
+
+    c = mux->peer.connection;
+
+    if (c->idle) {
+        c->idle = 0;
+
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+    }
+
+    stream->peer = pc;
+    stream->free_peer = pc->free;
+    pc->free = ngx_http_proxy_v2_free_peer;
+    pc->connection = fc;
+
+    v2->stream = stream;
+    v2->id = stream->id;
+
+#if (NGX_HTTP_SSL)
+    /* the shared connection does the SSL */
+    u->ssl = 0;
+#endif
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy http2 stream:%ui of %ui on *%uA",
+                   stream->id, mux->nstreams, c->number);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_proxy_v2_free_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    stream = (ngx_http_proxy_v2_stream_t *) pc->connection;
+
+    pc->free = stream->free_peer;
+    pc->connection = NULL;
+
+    ngx_http_proxy_v2_stream_close(stream);
+
+    pc->free(pc, data, state);
+}
+
+
+static void
+ngx_http_proxy_v2_stream_close(ngx_http_proxy_v2_stream_t *stream)
+{
+    u_char                   *p;
+    ngx_uint_t                error;
+    ngx_connection_t         *c;
+    ngx_http_proxy_v2_mux_t  *mux;
+
+    if (stream->read.timer_set) {
+        ngx_del_timer(&stream->read);
+    }
+
+    if (stream->read.posted) {
+        ngx_delete_posted_event(&stream->read);
+    }
+
+    if (stream->write.timer_set) {
+        ngx_del_timer(&stream->write);
+    }
+
+    if (stream->write.posted) {
+        ngx_delete_posted_event(&stream->write);
+    }
+
+    mux = stream->mux;
+
+    if (mux == NULL) {
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &mux->log, 0,
+                   "http proxy http2 close stream:%ui in:%d",
+                   stream->id, stream->in_closed);
+
+    stream->mux = NULL;
+
+    ngx_queue_remove(&stream->queue);
+    mux->nstreams--;
+
+    if (mux->stream == stream) {
+        /* the rest of the frame is skipped */
+        mux->stream = NULL;
+    }
+
+    if (stream->opened && !stream->reset
+        && !(stream->in_closed && stream->out_closed))
+    {
+        error = stream->in_closed ? NGX_HTTP_V2_NO_ERROR : NGX_HTTP_V2_CANCEL;
+
+        p = ngx_http_proxy_v2_mux_frame(mux, NGX_HTTP_V2_RST_STREAM_SIZE,
+                                        NGX_HTTP_V2_RST_STREAM_FRAME,
+                                        NGX_HTTP_V2_NO_FLAG, stream->id);
+        if (p) {
+            ngx_http_v2_write_uint32(p, error);
+        }
+    }
+
+    /* DATA not parsed by the request is returned to the connection window */
+
+    if (stream->received > stream->consumed) {
+        ngx_http_proxy_v2_mux_credit(mux, NULL,
+                                     stream->received - stream->consumed);
+    }
+
+    if (mux->nstreams) {
+        return;
+    }
+
+    if (mux->goaway || ngx_exiting || ngx_terminate) {
+        /* the write handler closes the connection */
+        mux->error = 1;
+        ngx_http_proxy_v2_mux_post(mux);
+        return;
+    }
+
+    c = mux->peer.connection;
+
+    c->idle = 1;
+    ngx_add_timer(c->read, mux->idle_timeout);
+}
+
+
+static ssize_t
+ngx_http_proxy_v2_stream_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    u_char                      *p;
+    size_t                       n;
+    ngx_buf_t                   *b;
+    ngx_chain_t                 *cl;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    stream = (ngx_http_proxy_v2_stream_t *) c;
+
+    p = buf;
+
+    while (stream->in && size) {
+        cl = stream->in;
+        b = cl->buf;
+
+        n = ngx_min(size, (size_t) (b->last - b->pos));
+
+        p = ngx_cpymem(p, b->pos, n);
+
+        b->pos += n;
+        size -= n;
+
+        if (b->pos == b->last) {
+            stream->in = cl->next;
+
+            if (stream->in == NULL) {
+                stream->last = NULL;
+            }
+
+            cl->next = stream->free;
+            stream->free = cl;
+        }
+    }
+
+    if (p != buf) {
+
+        if (stream->in == NULL && stream->mux) {
+            c->read->ready = 0;
+        }
+
+        return p - buf;
+    }
+
+    c->read->ready = 0;
+
+    if (stream->mux == NULL) {
+        /* the shared connection is closed */
+        c->read->eof = 1;
+        return 0;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ssize_t
+ngx_http_proxy_v2_stream_recv_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    size_t                       size;
+    ssize_t                      n, total;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    stream = (ngx_http_proxy_v2_stream_t *) c;
+
+    n = NGX_AGAIN;
+    total = 0;
+
+    for ( /* void */ ; in; in = in->next) {
+        size = in->buf->end - in->buf->last;
+
+        if (limit) {
+            if (total >= limit) {
+                break;
+            }
+
+            size = ngx_min(size, (size_t) (limit - total));
+        }
+
+        n = ngx_http_proxy_v2_stream_recv(c, in->buf->last, size);
+
+        if (n <= 0) {
+            break;
+        }
+
+        total += n;
+
+        if ((size_t) n < size) {
+            break;
+        }
+    }
+
+    /* ngx_event_pipe() sets no read timer on a connection without socket */
+
+    if (c->read->ready || c->read->eof) {
+        if (c->read->timer_set) {
+            ngx_del_timer(c->read);
+        }
+
+    } else {
+        ngx_add_timer(c->read, stream->read_timeout);
+    }
+
+    return total ? total : n;
+}
+
+
+static ssize_t
+ngx_http_proxy_v2_stream_send(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ngx_buf_t     b;
+    ngx_chain_t   cl, *rc;
+
+    ngx_memzero(&b, sizeof(ngx_buf_t));
+
+    b.temporary = 1;
+    b.pos = buf;
+    b.last = buf + size;
+
+    cl.buf = &b;
+    cl.next = NULL;
+
+    rc = ngx_http_proxy_v2_stream_send_chain(c, &cl, 0);
+
+    if (rc == NGX_CHAIN_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return rc ? NGX_AGAIN : (ssize_t) size;
+}
+
+
+/*
+ * the frames are copied to the shared connection as a whole, a stream
+ * waits while too much output is queued, except for its HEADERS: the
+ * streams must be opened in the order of their ids
+ */
+
+static ngx_chain_t *
+ngx_http_proxy_v2_stream_send_chain(ngx_connection_t *c, ngx_chain_t *in,
+    off_t limit)
+{
+    u_char                      *last;
+    size_t                       queued;
+    ngx_buf_t                   *b;
+    ngx_chain_t                 *cl, *ln, *tail;
+    ngx_http_proxy_v2_mux_t     *mux;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    stream = (ngx_http_proxy_v2_stream_t *) c;
+    mux = stream->mux;
+
+    if (mux == NULL || mux->error) {
+        c->write->error = 1;
+        return NGX_CHAIN_ERROR;
+    }
+
+    if (stream->opened && mux->queued >= NGX_HTTP_PROXY_V2_QUEUE_SIZE) {
+        stream->queued = 1;
+        c->write->ready = 0;
+        return in;
+    }
+
+    tail = mux->last;
+    last = tail ? tail->buf->last : NULL;
+    queued = mux->queued;
+
+    for (cl = in; cl; cl = cl->next) {
+        if (ngx_http_proxy_v2_mux_copy(mux, cl->buf) != NGX_OK) {
+            goto failed;
+        }
+    }
+
+    for (cl = in; cl; cl = cl->next) {
+        b = cl->buf;
+
+        c->sent += ngx_buf_size(b);
+
+        if (ngx_buf_in_memory(b)) {
+            b->pos = b->last;
+        }
+    }
+
+    stream->opened = 1;
+
+    ngx_http_proxy_v2_mux_post(mux);
+
+    return NULL;
+
+failed:
+
+    /* the frames copied so far are dropped */
+
+    if (tail) {
+        cl = tail->next;
+        tail->next = NULL;
+        tail->buf->last = last;
+
+    } else {
+        cl = mux->out;
+        mux->out = NULL;
+    }
+
+    mux->last = tail;
+    mux->queued = queued;
+
+    while (cl) {
+        ln = cl->next;
+        cl->next = mux->free;
+        mux->free = cl;
+        cl = ln;
+    }
+
+    return NGX_CHAIN_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_stream_append(ngx_http_proxy_v2_stream_t *stream,
+    u_char *data, size_t size)
+{
+    size_t        n;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    while (size) {
+        cl = stream->last;
+
+        if (cl == NULL || cl->buf->last == cl->buf->end) {
+            cl = ngx_chain_get_free_buf(stream->connection.pool,
+                                        &stream->free);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            b = cl->buf;
+
+            if (b->start == NULL) {
+                b->start = ngx_palloc(stream->connection.pool, ngx_pagesize);
+                if (b->start == NULL) {
+                    return NGX_ERROR;
+                }
+
+                b->end = b->start + ngx_pagesize;
+                b->temporary = 1;
+            }
+
+            b->pos = b->start;
+            b->last = b->start;
+
+            if (stream->last) {
+                stream->last->next = cl;
+
+            } else {
+                stream->in = cl;
+            }
+
+            stream->last = cl;
+        }
+
+        b = cl->buf;
+
+        n = ngx_min(size, (size_t) (b->end - b->last));
+
+        b->last = ngx_cpymem(b->last, data, n);
+
+        data += n;
+        size -= n;
+    }
+
+    stream->read.ready = 1;
+    ngx_post_event(&stream->read, &ngx_posted_events);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_body_output_filter(void *data, ngx_chain_t *in)
+{
+    ngx_http_request_t  *r = data;
+
+    off_t                        size, n, window;
+    u_char                      *p;
+    ngx_int_t                    rc;
+    ngx_buf_t                   *b, *hb;
+    ngx_uint_t                   type, flags;
+    ngx_chain_t                 *out, *cl, *ln, **ll;
+    ngx_http_proxy_v2_t         *v2;
+    ngx_http_proxy_ctx_t        *ctx;
+    ngx_http_proxy_v2_mux_t     *mux;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "proxy http2 output filter");
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+    v2 = ctx->v2;
+
+    stream = v2->stream;
+    mux = stream->mux;
+
+    if (mux == NULL) {
+        return NGX_ERROR;
+    }
+
+    out = NULL;
+    ll = &out;
+
+    if (!v2->header_sent) {
+
+        /* the first buffer contains the header block */
+
+        v2->header_sent = 1;
+
+        hb = in->buf;
+        size = hb->last - hb->pos;
+
+        n = size ? (size + mux->frame_size - 1) / mux->frame_size : 1;
+
+        cl = ngx_http_proxy_v2_get_buf(r, v2, size
+                                       + n * NGX_HTTP_V2_FRAME_HEADER_SIZE);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        p = cl->buf->last;
+
+        type = NGX_HTTP_V2_HEADERS_FRAME;
+        flags = hb->last_buf ? NGX_HTTP_V2_END_STREAM_FLAG
+                             : NGX_HTTP_V2_NO_FLAG;
+
+        for ( ;; ) {
+            n = ngx_min(size, (off_t) mux->frame_size);
+            size -= n;
+
+            if (size == 0) {
+                flags |= NGX_HTTP_V2_END_HEADERS_FLAG;
+            }
+
+            p = ngx_http_proxy_v2_write_head(p, n, type, flags, v2->id);
+            p = ngx_cpymem(p, hb->pos, n);
+
+            hb->pos += n;
+
+            if (size == 0) {
+                break;
+            }
+
+            type = NGX_HTTP_V2_CONTINUATION_FRAME;
+            flags = NGX_HTTP_V2_NO_FLAG;
+        }
+
+        cl->buf->last = p;
+
+        *ll = cl;
+        ll = &cl->next;
+
+        if (hb->last_buf) {
+            v2->output_closed = 1;
+            stream->out_closed = 1;
+        }
+
+        in = in->next;
+    }
+
+    /* queue the request body, it is sent as the flow control permits */
+
+    for (cl = v2->in, ln = NULL; cl; cl = cl->next) {
+        ln = cl;
+    }
+
+    for ( /* void */ ; in; in = in->next) {
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = in->buf;
+        cl->next = NULL;
+
+        if (ln) {
+            ln->next = cl;
+
+        } else {
+            v2->in = cl;
+        }
+
+        ln = cl;
+    }
+
+    while (v2->in && !v2->output_closed) {
+        b = v2->in->buf;
+
+        if (v2->cur != b) {
+            v2->cur = b;
+            v2->pos = b->pos;
+        }
+
+        if (ngx_buf_in_memory(b)) {
+            size = b->last - v2->pos;
+
+        } else {
+            size = 0;
+        }
+
+        if (size == 0 && !b->last_buf) {
+            v2->in = v2->in->next;
+            v2->cur = NULL;
+            continue;
+        }
+
+        window = ngx_min(stream->send_window, (off_t) mux->send_window);
+
+        if (size && window <= 0) {
+            v2->output_blocked = 1;
+            break;
+        }
+
+        n = ngx_min(size, window);
+        n = ngx_min(n, (off_t) mux->frame_size);
+
+        flags = (n == size && b->last_buf) ? NGX_HTTP_V2_END_STREAM_FLAG
+                                           : NGX_HTTP_V2_NO_FLAG;
+
+        cl = ngx_http_proxy_v2_get_buf(r, v2, NGX_HTTP_V2_FRAME_HEADER_SIZE);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf->last = ngx_http_proxy_v2_write_head(cl->buf->last, n,
+                                                     NGX_HTTP_V2_DATA_FRAME,
+                                                     flags, v2->id);
+        *ll = cl;
+        ll = &cl->next;
+
+        if (n) {
+            cl = ngx_http_proxy_v2_get_buf(r, v2, 0);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            cl->buf->shadow = b;
+            cl->buf->memory = 1;
+            cl->buf->pos = v2->pos;
+            cl->buf->last = v2->pos + n;
+
+            v2->pos += n;
+
+            *ll = cl;
+            ll = &cl->next;
+
+            stream->send_window -= n;
+            mux->send_window -= n;
+        }
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "proxy http2 DATA frame: %O of %O, fin:%ui",
+                       n, size, flags);
+
+        if (flags & NGX_HTTP_V2_END_STREAM_FLAG) {
+            v2->output_closed = 1;
+            stream->out_closed = 1;
+        }
+
+        if (n == size) {
+            v2->in = v2->in->next;
+            v2->cur = NULL;
+        }
+    }
+
+    rc = ngx_http_proxy_v2_send(r, v2, out);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (v2->output_blocked) {
+
+        /*
+         * a WINDOW_UPDATE wakes the stream, see ngx_http_proxy_v2_mux_wake(),
+         * the upstream module sets the send timer
+         */
+
+        v2->output_blocked = 0;
+
+        stream->blocked = 1;
+        stream->connection.write->ready = 0;
+
+        return NGX_AGAIN;
+    }
+
+    if (rc == NGX_OK && v2->in == NULL) {
+
+        if (v2->output_closed) {
+            v2->request_sent = 1;
+        }
+
+        return NGX_OK;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_chain_t *
+ngx_http_proxy_v2_get_buf(ngx_http_request_t *r, ngx_http_proxy_v2_t *v2,
+    size_t size)
+{
+    u_char       *start, *end;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    cl = ngx_chain_get_free_buf(r->pool, &v2->free);
+    if (cl == NULL) {
+        return NULL;
+    }
+
+    b = cl->buf;
+
+    start = b->start;
+    end = b->end;
+
+    ngx_memzero(b, sizeof(ngx_buf_t));
+
+    if (size) {
+        if (start == NULL || (size_t) (end - start) < size) {
+            start = ngx_palloc(r->pool, size);
+            if (start == NULL) {
+                return NULL;
+            }
+
+            end = start + size;
+        }
+
+        b->start = start;
+        b->pos = start;
+        b->last = start;
+        b->end = end;
+        b->temporary = 1;
+    }
+
+    b->tag = (ngx_buf_tag_t) &ngx_http_proxy_v2_body_output_filter;
+
+    return cl;
+}
+
+
+static u_char *
+ngx_http_proxy_v2_write_head(u_char *p, size_t length, ngx_uint_t type,
+    ngx_uint_t flags, ngx_uint_t sid)
+{
+    p = ngx_http_v2_write_uint32(p, length << 8 | type);
+    *p++ = (u_char) flags;
+
+    return ngx_http_v2_write_sid(p, sid);
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_send(ngx_http_request_t *r, ngx_http_proxy_v2_t *v2,
+    ngx_chain_t *out)
+{
+    ngx_int_t     rc;
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl, **ll;
+
+    for (ll = &v2->busy; *ll; ll = &(*ll)->next) { /* void */ }
+
+    *ll = out;
+
+    rc = ngx_chain_writer(&r->upstream->writer, out);
+
+    /* the body is sent through shadow buffers, update the originals */
+
+    while (v2->busy) {
+        cl = v2->busy;
+        b = cl->buf;
+
+        if (b->shadow) {
+            b->shadow->pos = b->pos;
+        }
+
+        if (ngx_buf_size(b) != 0) {
+            break;
+        }
+
+        if (b->shadow) {
+            ngx_memzero(b, sizeof(ngx_buf_t));
+        }
+
+        v2->busy = cl->next;
+
+        cl->next = v2->free;
+        v2->free = cl;
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_parse(ngx_http_request_t *r, ngx_http_proxy_v2_t *v2,
+    ngx_buf_t *b)
+{
+    u_char                      *p;
+    size_t                       n;
+    uint32_t                     head;
+    ngx_int_t                    rc;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    enum {
+        sw_head = 0,
+        sw_pad_length,
+        sw_priority,
+        sw_data,
+        sw_block,
+        sw_padding,
+        sw_control,
+        sw_skip
+    };
+
+    stream = v2->stream;
+
+    for ( ;; ) {
+
+        switch (v2->state) {
+
+        case sw_head:
+
+            if (ngx_http_proxy_v2_gather(v2, b, NGX_HTTP_V2_FRAME_HEADER_SIZE)
+                == NGX_AGAIN)
+            {
+                return NGX_AGAIN;
+            }
+
+            p = v2->buffer;
+
+            head = ngx_http_v2_parse_uint32(p);
+
+            v2->rest = ngx_http_v2_parse_length(head);
+            v2->type = ngx_http_v2_parse_type(head);
+            v2->flags = p[4];
+            v2->sid = ngx_http_v2_parse_sid(&p[5]);
+            v2->padding = 0;
+
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "proxy http2 frame type:%ui f:%Xi l:%uz sid:%ui",
+                           v2->type, v2->flags, v2->rest, v2->sid);
+
+            if (v2->rest > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent too large http2 frame: %uz",
+                              v2->rest);
+                return NGX_ERROR;
+            }
+
+            if (v2->continuation
+                && (v2->type != NGX_HTTP_V2_CONTINUATION_FRAME
+                    || v2->sid != v2->id))
+            {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent frame type %ui "
+                              "instead of CONTINUATION", v2->type);
+                return NGX_ERROR;
+            }
+
+            switch (v2->type) {
+
+            case NGX_HTTP_V2_DATA_FRAME:
+
+                if (v2->sid != v2->id || !v2->header_done || v2->done) {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent unexpected DATA frame "
+                                  "for stream %ui", v2->sid);
+                    return NGX_ERROR;
+                }
+
+                /*
+                 * the frame is consumed by the request, the window is
+                 * opened again as the proxy buffers are read
+                 */
+
+                stream->consumed += v2->rest;
+
+                if (stream->mux) {
+                    ngx_http_proxy_v2_mux_credit(stream->mux, stream,
+                                                 v2->rest);
+                }
+
+                v2->end_stream = (v2->flags & NGX_HTTP_V2_END_STREAM_FLAG)
+                                 ? 1 : 0;
+
+                v2->state = (v2->flags & NGX_HTTP_V2_PADDED_FLAG)
+                            ? sw_pad_length : sw_data;
+                break;
+
+            case NGX_HTTP_V2_HEADERS_FRAME:
+
+                if (v2->sid != v2->id || v2->done) {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent unexpected HEADERS frame "
+                                  "for stream %ui", v2->sid);
+                    return NGX_ERROR;
+                }
+
+                if (v2->block == NULL) {
+                    v2->block = ngx_create_temp_buf(r->pool,
+                                                    r->upstream->conf
+                                                               ->buffer_size);
+                    if (v2->block == NULL) {
+                        return NGX_ERROR;
+                    }
+                }
+
+                v2->block->pos = v2->block->start;
+                v2->block->last = v2->block->start;
+
+                v2->end_stream = (v2->flags & NGX_HTTP_V2_END_STREAM_FLAG)
+                                 ? 1 : 0;
+                v2->continuation = (v2->flags & NGX_HTTP_V2_END_HEADERS_FLAG)
+                                   ? 0 : 1;
+
+                if (v2->flags & NGX_HTTP_V2_PADDED_FLAG) {
+                    v2->state = sw_pad_length;
+
+                } else if (v2->flags & NGX_HTTP_V2_PRIORITY_FLAG) {
+                    v2->state = sw_priority;
+
+                } else {
+                    v2->state = sw_block;
+                }
+
+                break;
+
+            case NGX_HTTP_V2_CONTINUATION_FRAME:
+
+                if (!v2->continuation) {
+                    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                                  "upstream sent unexpected CONTINUATION "
+                                  "frame");
+                    return NGX_ERROR;
+                }
+
+                v2->continuation = (v2->flags & NGX_HTTP_V2_END_HEADERS_FLAG)
+                                   ? 0 : 1;
+
+                /* the HEADERS frame type terminates the header block */
+
+                v2->type = NGX_HTTP_V2_HEADERS_FRAME;
+                v2->flags = 0;
+
+                v2->state = sw_block;
+                break;
+
+            case NGX_HTTP_V2_PUSH_PROMISE_FRAME:
+
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent PUSH_PROMISE frame "
+                              "while push is disabled");
+                return NGX_ERROR;
+
+            case NGX_HTTP_V2_RST_STREAM_FRAME:
+
+                v2->state = sw_control;
+                break;
+
+            default:
+
+                /* the shared connection passes the frames of the stream only */
+
+                v2->state = sw_skip;
+            }
+
+            break;
+
+        case sw_pad_length:
+
+            if (v2->rest < 1) {
+                goto invalid;
+            }
+
+            if (ngx_http_proxy_v2_gather(v2, b, 1) == NGX_AGAIN) {
+                return NGX_AGAIN;
+            }
+
+            v2->rest--;
+            v2->padding = v2->buffer[0];
+
+            if (v2->padding > v2->rest) {
+                goto invalid;
+            }
+
+            v2->rest -= v2->padding;
+
+            if (v2->type == NGX_HTTP_V2_DATA_FRAME) {
+                v2->state = sw_data;
+
+            } else if (v2->flags & NGX_HTTP_V2_PRIORITY_FLAG) {
+                v2->state = sw_priority;
+
+            } else {
+                v2->state = sw_block;
+            }
+
+            break;
+
+        case sw_priority:
+
+            if (v2->rest < NGX_HTTP_V2_PRIORITY_SIZE) {
+                goto invalid;
+            }
+
+            if (ngx_http_proxy_v2_gather(v2, b, NGX_HTTP_V2_PRIORITY_SIZE)
+                == NGX_AGAIN)
+            {
+                return NGX_AGAIN;
+            }
+
+            v2->rest -= NGX_HTTP_V2_PRIORITY_SIZE;
+            v2->state = sw_block;
+            break;
+
+        case sw_data:
+
+            if (v2->rest == 0) {
+                v2->state = sw_padding;
+                break;
+            }
+
+            if (b->pos == b->last) {
+                return NGX_AGAIN;
+            }
+
+            /* the caller consumes up to v2->rest bytes of the payload */
+
+            return NGX_OK;
+
+        case sw_block:
+
+            n = ngx_min(v2->rest, (size_t) (b->last - b->pos));
+
+            if (n > (size_t) (v2->block->end - v2->block->last)) {
+                ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                              "upstream sent too big http2 header block");
+                return NGX_ERROR;
+            }
+
+            v2->block->last = ngx_cpymem(v2->block->last, b->pos, n);
+
+            b->pos += n;
+            v2->rest -= n;
+
+            if (v2->rest) {
+                return NGX_AGAIN;
+            }
+
+            v2->state = sw_padding;
+            break;
+
+        case sw_padding:
+
+            n = ngx_min(v2->padding, (size_t) (b->last - b->pos));
+
+            b->pos += n;
+            v2->padding -= n;
+
+            if (v2->padding) {
+                return NGX_AGAIN;
+            }
+
+            v2->state = sw_head;
+
+            if (v2->type == NGX_HTTP_V2_DATA_FRAME) {
+
+                if (v2->end_stream) {
+                    v2->done = 1;
+                    return NGX_DONE;
+                }
+
+                break;
+            }
+
+            if (v2->continuation) {
+                break;
+            }
+
+            rc = ngx_http_proxy_v2_parse_header_block(r, v2);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (rc == NGX_AGAIN) {
+                /* an interim 1xx response */
+                break;
+            }
+
+            if (v2->end_stream) {
+                v2->done = 1;
+            }
+
+            return (rc == NGX_DONE) ? NGX_DONE : NGX_DECLINED;
+
+        case sw_control:
+
+            rc = ngx_http_proxy_v2_parse_control(r, v2, b);
+
+            if (rc != NGX_OK) {
+                return rc;
+            }
+
+            v2->state = sw_head;
+            break;
+
+        case sw_skip:
+
+            n = ngx_min(v2->rest, (size_t) (b->last - b->pos));
+
+            b->pos += n;
+            v2->rest -= n;
+
+            if (v2->rest) {
+                return NGX_AGAIN;
+            }
+
+            v2->state = sw_head;
+            break;
+        }
+    }
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "upstream sent http2 frame with invalid padding");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_gather(ngx_http_proxy_v2_t *v2, ngx_buf_t *b, size_t size)
+{
+    size_t  n;
+
+    n = ngx_min((size_t) (b->last - b->pos), size - v2->used);
+
+    ngx_memcpy(v2->buffer + v2->used, b->pos, n);
+
+    b->pos += n;
+    v2->used += n;
+
+    if (v2->used < size) {
+        return NGX_AGAIN;
+    }
+
+    v2->used = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_parse_control(ngx_http_request_t *r,
+    ngx_http_proxy_v2_t *v2, ngx_buf_t *b)
+{
+    ngx_uint_t  error;
+
+    /* RST_STREAM, the only control frame of a stream */
+
+    if (v2->rest != NGX_HTTP_V2_RST_STREAM_SIZE) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "upstream sent invalid http2 RST_STREAM frame");
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_proxy_v2_gather(v2, b, NGX_HTTP_V2_RST_STREAM_SIZE)
+        == NGX_AGAIN)
+    {
+        return NGX_AGAIN;
+    }
+
+    v2->rest = 0;
+
+    error = ngx_http_v2_parse_uint32(v2->buffer);
+
+    if (error == NGX_HTTP_V2_REFUSED_STREAM && !v2->header_done) {
+        v2->refused = 1;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "upstream reset http2 stream with error %ui", error);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_parse_header_block(ngx_http_request_t *r,
+    ngx_http_proxy_v2_t *v2)
+{
+    u_char                    *p, *end, ch;
+    ngx_int_t                  value, status;
+    ngx_uint_t                 indexed, size_update, prefix, trailers;
+    ngx_http_upstream_t       *u;
+    ngx_http_v2_header_t       header;
+    ngx_http_v2_connection_t  *h2c;
+
+    u = r->upstream;
+    h2c = v2->connection;
+
+    trailers = v2->header_done;
+    status = 0;
+
+    p = v2->block->pos;
+    end = v2->block->last;
+
+    while (p < end) {
+
+        indexed = 0;
+        size_update = 0;
+
+        ch = *p;
+
+        if (ch >= (1 << 7)) {
+            /* indexed header field */
+            indexed = 1;
+            prefix = ngx_http_v2_prefix(7);
+
+        } else if (ch >= (1 << 6)) {
+            /*
+             * literal header field with incremental indexing,
+             * nothing is added to the table of size 0
+             */
+            prefix = ngx_http_v2_prefix(6);
+
+        } else if (ch >= (1 << 5)) {
+            /* dynamic table size update */
+            size_update = 1;
+            prefix = ngx_http_v2_prefix(5);
+
+        } else {
+            /* literal header field without indexing or never indexed */
+            prefix = ngx_http_v2_prefix(4);
+        }
+
+        value = ngx_http_proxy_v2_parse_int(&p, end, prefix);
+
+        if (value < 0) {
+            goto invalid;
+        }
+
+        if (size_update) {
+
+            /* the table size is limited to 0 by the connection SETTINGS */
+
+            if (value != 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (indexed) {
+            if (ngx_http_v2_get_indexed_header(h2c, value, 0) != NGX_OK) {
+                goto invalid;
+            }
+
+            header = h2c->state.header;
+
+        } else {
+
+            if (value == 0) {
+                if (ngx_http_proxy_v2_parse_string(r, &p, end, &header.name)
+                    != NGX_OK)
+                {
+                    goto invalid;
+                }
+
+            } else {
+                if (ngx_http_v2_get_indexed_header(h2c, value, 1) != NGX_OK) {
+                    goto invalid;
+                }
+
+                header.name = h2c->state.header.name;
+            }
+
+            if (ngx_http_proxy_v2_parse_string(r, &p, end, &header.value)
+                != NGX_OK)
+            {
+                goto invalid;
+            }
+        }
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "proxy http2 %s: \"%V: %V\"",
+                       trailers ? "trailer" : "header",
+                       &header.name, &header.value);
+
+        if (trailers) {
+            /* trailers are not passed to the client */
+            continue;
+        }
+
+        if (header.name.len && header.name.data[0] == ':') {
+
+            if (status == 0
+                && header.name.len == sizeof(":status") - 1
+                && ngx_strncmp(header.name.data, ":status",
+                               sizeof(":status") - 1) == 0
+                && header.value.len == 3)
+            {
+                status = ngx_atoi(header.value.data, 3);
+
+                if (status != NGX_ERROR && status >= 100) {
+                    continue;
+                }
+            }
+
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "upstream sent invalid pseudo-header \"%V: %V\"",
+                          &header.name, &header.value);
+            return NGX_ERROR;
+        }
+
+        if (status == 0) {
+            goto no_status;
+        }
+
+        if (status < NGX_HTTP_OK) {
+            /* headers of an interim response are ignored */
+            continue;
+        }
+
+        if (ngx_http_proxy_v2_process_header_line(r, &header.name,
+                                                  &header.value)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    if (trailers) {
+
+        if (!v2->end_stream) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "upstream sent trailers without END_STREAM flag");
+            return NGX_ERROR;
+        }
+
+        return NGX_DONE;
+    }
+
+    if (status == 0) {
+        goto no_status;
+    }
+
+    if (status < NGX_HTTP_OK) {
+
+        if (status == NGX_HTTP_SWITCHING_PROTOCOLS || v2->end_stream) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "upstream sent unexpected status %i", status);
+            return NGX_ERROR;
+        }
+
+        return NGX_AGAIN;
+    }
+
+    u->headers_in.status_n = status;
+
+    if (u->state && u->state->status == 0) {
+        u->state->status = status;
+    }
+
+    v2->header_done = 1;
+
+    return NGX_OK;
+
+no_status:
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "upstream sent response without :status");
+
+    return NGX_ERROR;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "upstream sent invalid http2 header block");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_parse_int(u_char **pos, u_char *end, ngx_uint_t prefix)
+{
+    u_char      *start, *p;
+    ngx_uint_t   value, octet, shift;
+
+    start = *pos;
+    p = start;
+
+    value = *p++ & prefix;
+
+    if (value != prefix) {
+        *pos = p;
+        return value;
+    }
+
+    if (end - start > NGX_HTTP_V2_INT_OCTETS) {
+        end = start + NGX_HTTP_V2_INT_OCTETS;
+    }
+
+    for (shift = 0; p != end; shift += 7) {
+        octet = *p++;
+
+        value += (octet & 0x7f) << shift;
+
+        if (octet < 128) {
+            *pos = p;
+            return value;
+        }
+    }
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_parse_string(ngx_http_request_t *r, u_char **pos,
+    u_char *end, ngx_str_t *s)
+{
+    u_char      *p, *dst, state;
+    ngx_int_t    len;
+    ngx_uint_t   huff;
+
+    p = *pos;
+
+    if (p == end) {
+        return NGX_ERROR;
+    }
+
+    huff = *p >> 7;
+
+    len = ngx_http_proxy_v2_parse_int(&p, end, ngx_http_v2_prefix(7));
+
+    if (len < 0 || len > end - p) {
+        return NGX_ERROR;
+    }
+
+    if (huff) {
+        s->data = ngx_pnalloc(r->pool, len * 8 / 5 + 1);
+        if (s->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        state = 0;
+        dst = s->data;
+
+        if (ngx_http_v2_huff_decode(&state, p, len, &dst, 1,
+                                    r->connection->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        s->len = dst - s->data;
+
+    } else {
+        s->data = ngx_pnalloc(r->pool, len + 1);
+        if (s->data == NULL) {
+            return NGX_ERROR;
+        }
+
+        s->len = len;
+        ngx_memcpy(s->data, p, len);
+    }
+
+    s->data[s->len] = '\0';
+
+    *pos = p + len;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_process_header_line(ngx_http_request_t *r, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    u_char                          ch;
+    ngx_uint_t                      i;
+    ngx_table_elt_t                *h;
+    ngx_http_upstream_header_t     *hh;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    if (name->len == 0) {
+        goto invalid;
+    }
+
+    for (i = 0; i < name->len; i++) {
+        ch = name->data[i];
+
+        if ((ch >= 'A' && ch <= 'Z') || ch <= 0x20 || ch == ':' || ch >= 0x7f)
+        {
+            goto invalid;
+        }
+    }
+
+    for (i = 0; i < value->len; i++) {
+        ch = value->data[i];
+
+        if (ch == '\0' || ch == CR || ch == LF) {
+            goto invalid;
+        }
+    }
+
+    h = ngx_list_push(&r->upstream->headers_in.headers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    h->key = *name;
+    h->value = *value;
+    h->lowcase_key = name->data;
+    h->hash = ngx_hash_key(name->data, name->len);
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    hh = ngx_hash_find(&umcf->headers_in_hash, h->hash,
+                       h->lowcase_key, h->key.len);
+
+    if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                  "upstream sent invalid header \"%V: %V\"", name, value);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_process_header(ngx_http_request_t *r)
+{
+    ngx_int_t              rc;
+    ngx_buf_t             *b;
+    ngx_table_elt_t       *h;
+    ngx_http_upstream_t   *u;
+    ngx_http_proxy_v2_t   *v2;
+    ngx_http_proxy_ctx_t  *ctx;
+
+    u = r->upstream;
+    b = &u->buffer;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+    v2 = ctx->v2;
+
+    rc = ngx_http_proxy_v2_parse(r, v2, b);
+
+    if (rc == NGX_AGAIN) {
+
+        /* the parser state is kept in ngx_http_proxy_v2_t */
+
+        b->pos = b->start;
+        b->last = b->start;
+
+        return NGX_AGAIN;
+    }
+
+    if (rc != NGX_DECLINED) {
+
+        if (v2->refused) {
+            return NGX_HTTP_UPSTREAM_REFUSED;
+        }
+
+        return NGX_HTTP_UPSTREAM_INVALID_HEADER;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy http2 header done");
+
+    /*
+     * if no "Server" and "Date" in header line,
+     * then add the special empty headers
+     */
+
+    if (u->headers_in.server == NULL) {
+        h = ngx_list_push(&u->headers_in.headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = ngx_hash(ngx_hash(ngx_hash(ngx_hash(
+                            ngx_hash('s', 'e'), 'r'), 'v'), 'e'), 'r');
+
+        ngx_str_set(&h->key, "Server");
+        ngx_str_null(&h->value);
+        h->lowcase_key = (u_char *) "server";
+    }
+
+    if (u->headers_in.date == NULL) {
+        h = ngx_list_push(&u->headers_in.headers);
+        if (h == NULL) {
+            return NGX_ERROR;
+        }
+
+        h->hash = ngx_hash(ngx_hash(ngx_hash('d', 'a'), 't'), 'e');
+
+        ngx_str_set(&h->key, "Date");
+        ngx_str_null(&h->value);
+        h->lowcase_key = (u_char *) "date";
+    }
+
+    /* the response length is defined by the END_STREAM flag */
+
+    u->headers_in.chunked = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_input_filter_init(void *data)
+{
+    ngx_http_request_t    *r = data;
+    ngx_http_upstream_t   *u;
+    ngx_http_proxy_ctx_t  *ctx;
+
+    u = r->upstream;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy http2 filter init s:%d d:%d",
+                   u->headers_in.status_n, ctx->v2->done);
+
+    if (ctx->v2->done) {
+        u->pipe->length = 0;
+        u->length = 0;
+
+    } else {
+        u->pipe->length = 1;
+        u->length = 1;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_filter(ngx_event_pipe_t *p, ngx_buf_t *buf)
+{
+    size_t                 n;
+    ngx_int_t              rc;
+    ngx_buf_t             *b, **prev;
+    ngx_chain_t           *cl;
+    ngx_http_request_t    *r;
+    ngx_http_proxy_v2_t   *v2;
+    ngx_http_proxy_ctx_t  *ctx;
+
+    if (buf->pos == buf->last) {
+        return NGX_OK;
+    }
+
+    r = p->input_ctx;
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    v2 = ctx->v2;
+
+    b = NULL;
+    prev = &buf->shadow;
+
+    for ( ;; ) {
+
+        rc = ngx_http_proxy_v2_parse(r, v2, buf);
+
+        if (rc == NGX_OK) {
+
+            /* a part of DATA frame payload */
+
+            cl = ngx_chain_get_free_buf(p->pool, &p->free);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            b = cl->buf;
+
+            ngx_memzero(b, sizeof(ngx_buf_t));
+
+            b->pos = buf->pos;
+            b->start = buf->start;
+            b->end = buf->end;
+            b->tag = p->tag;
+            b->temporary = 1;
+            b->recycled = 1;
+
+            *prev = b;
+            prev = &b->shadow;
+
+            if (p->in) {
+                *p->last_in = cl;
+            } else {
+                p->in = cl;
+            }
+            p->last_in = &cl->next;
+
+            /* STUB */ b->num = buf->num;
+
+            n = ngx_min(v2->rest, (size_t) (buf->last - buf->pos));
+
+            buf->pos += n;
+            b->last = buf->pos;
+            v2->rest -= n;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                           "input buf #%d %p", b->num, b->pos);
+
+            continue;
+        }
+
+        if (rc == NGX_DONE) {
+            p->upstream_done = 1;
+            break;
+        }
+
+        if (rc == NGX_AGAIN) {
+            break;
+        }
+
+        /* invalid response */
+
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "upstream sent invalid http2 response body");
+
+        return NGX_ERROR;
+    }
+
+    if (b) {
+        b->shadow = buf;
+        b->last_shadow = 1;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                       "input buf %p %z", b->pos, b->last - b->pos);
+
+        return NGX_OK;
+    }
+
+    /* there is no data record in the buf, add it to free chain */
+
+    if (ngx_event_pipe_add_free_buf(p, buf) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_non_buffered_filter(void *data, ssize_t bytes)
+{
+    ngx_http_request_t   *r = data;
+
+    size_t                 n;
+    ngx_int_t              rc;
+    ngx_buf_t             *b, *buf;
+    ngx_chain_t           *cl, **ll;
+    ngx_http_upstream_t   *u;
+    ngx_http_proxy_v2_t   *v2;
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    v2 = ctx->v2;
+
+    u = r->upstream;
+    buf = &u->buffer;
+
+    buf->pos = buf->last;
+    buf->last += bytes;
+
+    for (cl = u->out_bufs, ll = &u->out_bufs; cl; cl = cl->next) {
+        ll = &cl->next;
+    }
+
+    for ( ;; ) {
+
+        rc = ngx_http_proxy_v2_parse(r, v2, buf);
+
+        if (rc == NGX_OK) {
+
+            /* a part of DATA frame payload */
+
+            cl = ngx_chain_get_free_buf(r->pool, &u->free_bufs);
+            if (cl == NULL) {
+                return NGX_ERROR;
+            }
+
+            *ll = cl;
+            ll = &cl->next;
+
+            b = cl->buf;
+
+            b->flush = 1;
+            b->memory = 1;
+
+            b->pos = buf->pos;
+            b->tag = u->output.tag;
+
+            n = ngx_min(v2->rest, (size_t) (buf->last - buf->pos));
+
+            buf->pos += n;
+            b->last = buf->pos;
+            v2->rest -= n;
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http proxy out buf %p %z",
+                           b->pos, b->last - b->pos);
+
+            continue;
+        }
+
+        if (rc == NGX_DONE) {
+            u->length = 0;
+            break;
+        }
+
+        if (rc == NGX_AGAIN) {
+            break;
+        }
+
+        /* invalid response */
+
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "upstream sent invalid http2 response body");
+
+        return NGX_ERROR;
+    }
+
+    /* provide continuous buffer for subrequests in memory */
+
+    if (r->subrequest_in_memory) {
+
+        cl = u->out_bufs;
+
+        if (cl) {
+            buf->pos = cl->buf->pos;
+        }
+
+        buf->last = buf->pos;
+
+        for (cl = u->out_bufs; cl; cl = cl->next) {
+            ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http proxy in memory %p-%p %uz",
+                           cl->buf->pos, cl->buf->last, ngx_buf_size(cl->buf));
+
+            if (buf->last == cl->buf->pos) {
+                buf->last = cl->buf->last;
+                continue;
+            }
+
+            buf->last = ngx_movemem(buf->last, cl->buf->pos,
+                                    cl->buf->last - cl->buf->pos);
+
+            cl->buf->pos = buf->last - (cl->buf->last - cl->buf->pos);
+            cl->buf->last = buf->last;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+/* a connection is shared only by requests bound to the same address */
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_local(ngx_http_proxy_v2_mux_t *mux, ngx_addr_t *local)
+{
+    if (mux->peer.local == NULL || local == NULL) {
+        return (mux->peer.local == local) ? NGX_OK : NGX_DECLINED;
+    }
+
+    return ngx_cmp_sockaddr(mux->peer.local->sockaddr,
+                            mux->peer.local->socklen,
+                            local->sockaddr, local->socklen, 1);
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_create(ngx_http_request_t *r, ngx_uint_t ssl,
+    ngx_str_t *name, ngx_http_proxy_v2_mux_t **muxp)
+{
+    u_char                   *p;
+    size_t                    window;
+    ngx_int_t                 rc;
+    ngx_buf_t                *b;
+    ngx_pool_t               *pool;
+    ngx_connection_t         *c;
+    ngx_http_upstream_t        *u;
+    ngx_http_proxy_v2_mux_t    *mux;
+    ngx_http_proxy_loc_conf_t  *plcf;
+#if (NGX_HTTP_SSL)
+    ngx_str_t                   ssl_name;
+#endif
+
+    u = r->upstream;
+
+    plcf = ngx_http_get_module_loc_conf(r, ngx_http_proxy_module);
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    mux = ngx_pcalloc(pool, sizeof(ngx_http_proxy_v2_mux_t));
+    if (mux == NULL) {
+        goto failed;
+    }
+
+    mux->pool = pool;
+    mux->conf = u->conf;
+    mux->ssl = ssl;
+
+    mux->log = *r->connection->log;
+    mux->log.handler = ngx_http_proxy_v2_log_error;
+    mux->log.data = mux;
+    mux->log.action = "connecting to upstream";
+
+    pool->log = &mux->log;
+
+    mux->peer.sockaddr = ngx_palloc(pool, u->peer.socklen);
+    mux->peer.name = ngx_palloc(pool, sizeof(ngx_str_t));
+    mux->name.data = ngx_pnalloc(pool, name->len);
+
+    if (mux->peer.sockaddr == NULL
+        || mux->peer.name == NULL
+        || mux->name.data == NULL)
+    {
+        goto failed;
+    }
+
+    ngx_memcpy(mux->peer.sockaddr, u->peer.sockaddr, u->peer.socklen);
+    mux->peer.socklen = u->peer.socklen;
+
+    mux->peer.name->len = u->peer.name->len;
+    mux->peer.name->data = ngx_pstrdup(pool, u->peer.name);
+    if (mux->peer.name->data == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(mux->name.data, name->data, name->len);
+    mux->name.len = name->len;
+
+    if (u->peer.local) {
+        mux->peer.local = ngx_palloc(pool, sizeof(ngx_addr_t));
+        if (mux->peer.local == NULL) {
+            goto failed;
+        }
+
+        *mux->peer.local = *u->peer.local;
+
+        mux->peer.local->sockaddr = ngx_palloc(pool, u->peer.local->socklen);
+        if (mux->peer.local->sockaddr == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy(mux->peer.local->sockaddr, u->peer.local->sockaddr,
+                   u->peer.local->socklen);
+    }
+
+    mux->peer.get = ngx_event_get_peer;
+    mux->peer.log = &mux->log;
+    mux->peer.log_error = u->peer.log_error;
+    mux->peer.rcvbuf = u->peer.rcvbuf;
+
+    ngx_queue_init(&mux->streams);
+
+    mux->max_streams = plcf->http2_max_streams;
+    mux->streams_limit = plcf->http2_max_streams;
+    mux->idle_timeout = plcf->http2_idle_timeout;
+    mux->send_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    mux->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
+    mux->frame_size = NGX_HTTP_V2_DEFAULT_FRAME_SIZE;
+
+    /*
+     * a stream may send as much as the proxy buffers hold, the data is
+     * credited back as the request reads it
+     */
+
+    window = u->conf->buffer_size + u->conf->bufs.num * u->conf->bufs.size;
+    window = ngx_max(window, NGX_HTTP_V2_DEFAULT_WINDOW);
+    window = ngx_min(window, NGX_HTTP_V2_MAX_WINDOW);
+
+    mux->window = window;
+
+    if (window > NGX_HTTP_V2_MAX_WINDOW / mux->streams_limit) {
+        mux->conn_window = NGX_HTTP_V2_MAX_WINDOW;
+
+    } else {
+        mux->conn_window = window * mux->streams_limit;
+    }
+
+    mux->recv_window = mux->conn_window;
+
+    mux->in = ngx_create_temp_buf(pool, NGX_HTTP_PROXY_V2_BUFFER_SIZE);
+    if (mux->in == NULL) {
+        goto failed;
+    }
+
+    b = ngx_http_proxy_v2_mux_buf(mux, sizeof(ngx_http_proxy_v2_preface) - 1
+                                       + NGX_HTTP_V2_FRAME_HEADER_SIZE
+                                       + 3 * NGX_HTTP_V2_SETTINGS_PARAM_SIZE
+                                       + NGX_HTTP_V2_FRAME_HEADER_SIZE
+                                       + NGX_HTTP_V2_WINDOW_UPDATE_SIZE);
+    if (b == NULL) {
+        goto failed;
+    }
+
+    p = ngx_cpymem(b->last, ngx_http_proxy_v2_preface,
+                   sizeof(ngx_http_proxy_v2_preface) - 1);
+
+    p = ngx_http_proxy_v2_write_head(p, 3 * NGX_HTTP_V2_SETTINGS_PARAM_SIZE,
+                                     NGX_HTTP_V2_SETTINGS_FRAME,
+                                     NGX_HTTP_V2_NO_FLAG, 0);
+
+    p = ngx_http_v2_write_uint16(p, NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING);
+    p = ngx_http_v2_write_uint32(p, 0);
+
+    p = ngx_http_v2_write_uint16(p, NGX_HTTP_V2_ENABLE_PUSH_SETTING);
+    p = ngx_http_v2_write_uint32(p, 0);
+
+    p = ngx_http_v2_write_uint16(p, NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING);
+    p = ngx_http_v2_write_uint32(p, mux->window);
+
+    p = ngx_http_proxy_v2_write_head(p, NGX_HTTP_V2_WINDOW_UPDATE_SIZE,
+                                     NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                     NGX_HTTP_V2_NO_FLAG, 0);
+
+    p = ngx_http_v2_write_uint32(p, mux->conn_window
+                                    - NGX_HTTP_V2_DEFAULT_WINDOW);
+
+    mux->queued = p - b->last;
+    b->last = p;
+
+    rc = ngx_event_connect_peer(&mux->peer);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http proxy http2 connect: %i", rc);
+
+    if (rc != NGX_OK && rc != NGX_AGAIN) {
+        ngx_destroy_pool(pool);
+        return rc;
+    }
+
+    c = mux->peer.connection;
+
+    c->data = mux;
+    c->pool = pool;
+
+    c->read->handler = ngx_http_proxy_v2_mux_connect_handler;
+    c->write->handler = ngx_http_proxy_v2_mux_connect_handler;
+
+    mux->log.connection = c->number;
+
+#if (NGX_HTTP_SSL)
+
+    if (ssl) {
+        if (ngx_ssl_create_connection(u->conf->ssl, c,
+                                      NGX_SSL_BUFFER|NGX_SSL_CLIENT)
+            != NGX_OK)
+        {
+            goto close;
+        }
+
+        if (u->conf->ssl_server_name || u->conf->ssl_verify) {
+
+            /* the name is kept for the verification of the certificate */
+
+            ssl_name = u->ssl_name;
+
+            if (ngx_http_upstream_ssl_name(r, u, c) != NGX_OK) {
+                u->ssl_name = ssl_name;
+                goto close;
+            }
+
+            mux->ssl_name.len = u->ssl_name.len;
+            mux->ssl_name.data = ngx_pstrdup(pool, &u->ssl_name);
+
+            u->ssl_name = ssl_name;
+
+            if (mux->ssl_name.data == NULL) {
+                goto close;
+            }
+        }
+
+        if (u->conf->ssl_session_reuse) {
+
+            /* the session is set by the balancer of the creating request */
+
+            u->peer.connection = c;
+
+            if (u->peer.set_session(&u->peer, u->peer.data) != NGX_OK) {
+                u->peer.connection = NULL;
+                goto close;
+            }
+
+            u->peer.connection = NULL;
+        }
+    }
+
+#endif
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, u->conf->connect_timeout);
+
+    } else {
+        ngx_post_event(c->write, &ngx_posted_events);
+    }
+
+    ngx_queue_insert_tail(&ngx_http_proxy_v2_muxes, &mux->queue);
+
+    *muxp = mux;
+
+    return NGX_OK;
+
+#if (NGX_HTTP_SSL)
+
+close:
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        (void) ngx_ssl_shutdown(c);
+    }
+
+    ngx_close_connection(c);
+
+#endif
+
+failed:
+
+    ngx_destroy_pool(pool);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_proxy_v2_mux_connect_handler(ngx_event_t *ev)
+{
+    ngx_connection_t         *c;
+    ngx_http_proxy_v2_mux_t  *mux;
+#if (NGX_HTTP_SSL)
+    ngx_int_t                 rc;
+#endif
+
+    c = ev->data;
+    mux = c->data;
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT, "upstream timed out");
+        ngx_http_proxy_v2_mux_close(mux);
+        return;
+    }
+
+    if (ngx_http_proxy_v2_mux_test_connect(c) != NGX_OK) {
+        ngx_http_proxy_v2_mux_close(mux);
+        return;
+    }
+
+#if (NGX_HTTP_SSL)
+
+    if (mux->ssl) {
+        mux->log.action = "SSL handshaking to upstream";
+
+        rc = ngx_ssl_handshake(c);
+
+        if (rc == NGX_AGAIN) {
+            c->ssl->handler = ngx_http_proxy_v2_mux_ssl_handshake;
+            return;
+        }
+
+        ngx_http_proxy_v2_mux_ssl_handshake(c);
+        return;
+    }
+
+#endif
+
+    ngx_http_proxy_v2_mux_connected(mux);
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        /*
+         * BSDs and Linux return 0 and set a pending error in err
+         * Solaris returns -1 and sets errno
+         */
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HTTP_SSL)
+
+static void
+ngx_http_proxy_v2_mux_ssl_handshake(ngx_connection_t *c)
+{
+    long                         rc;
+    ngx_queue_t                 *q;
+    ngx_connection_t            *fc;
+    ngx_peer_connection_t       *pc;
+    ngx_http_proxy_v2_mux_t     *mux;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    mux = c->data;
+
+    if (!c->ssl->handshaked) {
+        ngx_http_proxy_v2_mux_close(mux);
+        return;
+    }
+
+    if (mux->conf->ssl_verify) {
+        rc = SSL_get_verify_result(c->ssl->connection);
+
+        if (rc != X509_V_OK) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream SSL certificate verify error: (%l:%s)",
+                          rc, X509_verify_cert_error_string(rc));
+            ngx_http_proxy_v2_mux_close(mux);
+            return;
+        }
+
+        if (ngx_ssl_check_host(c, &mux->ssl_name) != NGX_OK) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "upstream SSL certificate does not match \"%V\"",
+                          &mux->ssl_name);
+            ngx_http_proxy_v2_mux_close(mux);
+            return;
+        }
+    }
+
+    if (mux->conf->ssl_session_reuse && !ngx_queue_empty(&mux->streams)) {
+
+        /* the session is saved to the peer of a waiting request */
+
+        q = ngx_queue_head(&mux->streams);
+        stream = ngx_queue_data(q, ngx_http_proxy_v2_stream_t, queue);
+
+        pc = stream->peer;
+
+        fc = pc->connection;
+        pc->connection = c;
+
+        pc->save_session(pc, pc->data);
+
+        pc->connection = fc;
+    }
+
+    ngx_http_proxy_v2_mux_connected(mux);
+}
+
+#endif
+
+
+static void
+ngx_http_proxy_v2_mux_connected(ngx_http_proxy_v2_mux_t *mux)
+{
+    ngx_connection_t  *c;
+
+    c = mux->peer.connection;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http proxy http2 connected");
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    mux->connected = 1;
+    mux->log.action = NULL;
+
+    c->read->handler = ngx_http_proxy_v2_mux_read_handler;
+    c->write->handler = ngx_http_proxy_v2_mux_write_handler;
+
+    /* the preface and the queued frames are sent, the data may be pending */
+
+    ngx_post_event(c->write, &ngx_posted_events);
+    ngx_post_event(c->read, &ngx_posted_events);
+}
+
+
+static void
+ngx_http_proxy_v2_mux_read_handler(ngx_event_t *rev)
+{
+    ssize_t                   n;
+    ngx_buf_t                *b;
+    ngx_connection_t         *c;
+    ngx_http_proxy_v2_mux_t  *mux;
+
+    c = rev->data;
+    mux = c->data;
+
+    if (rev->timedout || c->close) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http proxy http2 idle connection");
+        ngx_http_proxy_v2_mux_close(mux);
+        return;
+    }
+
+    b = mux->in;
+
+    do {
+        n = c->recv(c, b->start, b->end - b->start);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == 0 || n == NGX_ERROR) {
+
+            if (n == 0 && mux->nstreams) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "upstream closed http2 connection");
+            }
+
+            ngx_http_proxy_v2_mux_close(mux);
+            return;
+        }
+
+        b->pos = b->start;
+        b->last = b->start + n;
+
+        if (ngx_http_proxy_v2_mux_parse(mux, b) == NGX_ERROR) {
+            ngx_http_proxy_v2_mux_close(mux);
+            return;
+        }
+
+    } while (rev->ready);
+
+    if (mux->error) {
+        ngx_http_proxy_v2_mux_close(mux);
+        return;
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_http_proxy_v2_mux_close(mux);
+    }
+}
+
+
+static void
+ngx_http_proxy_v2_mux_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t         *c;
+    ngx_http_proxy_v2_mux_t  *mux;
+
+    c = wev->data;
+    mux = c->data;
+
+    if (mux->error || ngx_http_proxy_v2_mux_send(mux) != NGX_OK) {
+        ngx_http_proxy_v2_mux_close(mux);
+    }
+}
+
+
+/*
+ * the connection level frames are handled here, the frames of a stream
+ * are passed to the request as they are
+ */
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_parse(ngx_http_proxy_v2_mux_t *mux, ngx_buf_t *b)
+{
+    u_char                      *p;
+    size_t                       n, size;
+    uint32_t                     head;
+    ngx_uint_t                   id, value;
+    ngx_queue_t                 *q;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    enum {
+        sw_head = 0,
+        sw_stream,
+        sw_settings,
+        sw_control,
+        sw_skip
+    };
+
+    for ( ;; ) {
+
+        switch (mux->state) {
+
+        case sw_head:
+
+            if (ngx_http_proxy_v2_mux_gather(mux, b,
+                                             NGX_HTTP_V2_FRAME_HEADER_SIZE)
+                == NGX_AGAIN)
+            {
+                return NGX_AGAIN;
+            }
+
+            p = mux->buffer;
+
+            head = ngx_http_v2_parse_uint32(p);
+
+            mux->rest = ngx_http_v2_parse_length(head);
+            mux->type = ngx_http_v2_parse_type(head);
+            mux->flags = p[4];
+            mux->sid = ngx_http_v2_parse_sid(&p[5]);
+
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, &mux->log, 0,
+                           "proxy http2 frame type:%ui f:%Xi l:%uz sid:%ui",
+                           mux->type, mux->flags, mux->rest, mux->sid);
+
+            if (mux->rest > NGX_HTTP_V2_DEFAULT_FRAME_SIZE) {
+                ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                              "upstream sent too large http2 frame: %uz",
+                              mux->rest);
+                return NGX_ERROR;
+            }
+
+            if (mux->continuation
+                && (mux->type != NGX_HTTP_V2_CONTINUATION_FRAME
+                    || mux->sid != mux->continuation))
+            {
+                ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                              "upstream sent frame type %ui "
+                              "instead of CONTINUATION", mux->type);
+                return NGX_ERROR;
+            }
+
+            stream = NULL;
+            mux->state = sw_skip;
+
+            switch (mux->type) {
+
+            case NGX_HTTP_V2_DATA_FRAME:
+
+                if (mux->sid == 0) {
+                    goto invalid;
+                }
+
+                if (mux->rest > mux->recv_window) {
+                    goto flow_control;
+                }
+
+                mux->recv_window -= mux->rest;
+
+                stream = ngx_http_proxy_v2_mux_find(mux, mux->sid);
+
+                if (stream == NULL) {
+                    /* a closed stream, the window is opened at once */
+                    ngx_http_proxy_v2_mux_credit(mux, NULL, mux->rest);
+                    break;
+                }
+
+                if (mux->rest > stream->recv_window) {
+                    goto flow_control;
+                }
+
+                stream->recv_window -= mux->rest;
+                stream->received += mux->rest;
+
+                break;
+
+            case NGX_HTTP_V2_HEADERS_FRAME:
+
+                if (mux->sid == 0) {
+                    goto invalid;
+                }
+
+                if (!(mux->flags & NGX_HTTP_V2_END_HEADERS_FLAG)) {
+                    mux->continuation = mux->sid;
+                }
+
+                stream = ngx_http_proxy_v2_mux_find(mux, mux->sid);
+                break;
+
+            case NGX_HTTP_V2_CONTINUATION_FRAME:
+
+                if (mux->continuation == 0) {
+                    goto invalid;
+                }
+
+                if (mux->flags & NGX_HTTP_V2_END_HEADERS_FLAG) {
+                    mux->continuation = 0;
+                }
+
+                stream = ngx_http_proxy_v2_mux_find(mux, mux->sid);
+                break;
+
+            case NGX_HTTP_V2_RST_STREAM_FRAME:
+
+                if (mux->sid == 0
+                    || mux->rest != NGX_HTTP_V2_RST_STREAM_SIZE)
+                {
+                    goto invalid;
+                }
+
+                stream = ngx_http_proxy_v2_mux_find(mux, mux->sid);
+
+                if (stream) {
+                    stream->in_closed = 1;
+                    stream->reset = 1;
+                }
+
+                break;
+
+            case NGX_HTTP_V2_SETTINGS_FRAME:
+
+                if (mux->sid
+                    || mux->rest % NGX_HTTP_V2_SETTINGS_PARAM_SIZE
+                    || (mux->flags & NGX_HTTP_V2_ACK_FLAG && mux->rest))
+                {
+                    goto invalid;
+                }
+
+                if (!(mux->flags & NGX_HTTP_V2_ACK_FLAG)) {
+                    mux->state = sw_settings;
+                }
+
+                break;
+
+            case NGX_HTTP_V2_PING_FRAME:
+
+                if (mux->sid || mux->rest != NGX_HTTP_V2_PING_SIZE) {
+                    goto invalid;
+                }
+
+                mux->state = sw_control;
+                break;
+
+            case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+
+                if (mux->rest != NGX_HTTP_V2_WINDOW_UPDATE_SIZE) {
+                    goto invalid;
+                }
+
+                mux->state = sw_control;
+                break;
+
+            case NGX_HTTP_V2_GOAWAY_FRAME:
+
+                if (mux->sid || mux->rest < NGX_HTTP_V2_GOAWAY_SIZE) {
+                    goto invalid;
+                }
+
+                mux->state = sw_control;
+                break;
+
+            case NGX_HTTP_V2_PUSH_PROMISE_FRAME:
+
+                ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                              "upstream sent PUSH_PROMISE frame "
+                              "while push is disabled");
+                return NGX_ERROR;
+
+            default:
+
+                /* PRIORITY and unknown frames are ignored */
+
+                break;
+            }
+
+            if (stream) {
+
+                if (mux->flags & NGX_HTTP_V2_END_STREAM_FLAG
+                    && (mux->type == NGX_HTTP_V2_DATA_FRAME
+                        || mux->type == NGX_HTTP_V2_HEADERS_FRAME))
+                {
+                    stream->in_closed = 1;
+                }
+
+                if (ngx_http_proxy_v2_stream_append(stream, mux->buffer,
+                                                NGX_HTTP_V2_FRAME_HEADER_SIZE)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+
+                mux->stream = stream;
+                mux->state = sw_stream;
+            }
+
+            break;
+
+        case sw_stream:
+
+            n = ngx_min(mux->rest, (size_t) (b->last - b->pos));
+
+            /* the stream may be closed in the middle of the frame */
+
+            if (n && mux->stream
+                && ngx_http_proxy_v2_stream_append(mux->stream, b->pos, n)
+                   != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            b->pos += n;
+            mux->rest -= n;
+
+            if (mux->rest) {
+                return NGX_AGAIN;
+            }
+
+            mux->stream = NULL;
+            mux->state = sw_head;
+            break;
+
+        case sw_settings:
+
+            if (mux->rest == 0) {
+                (void) ngx_http_proxy_v2_mux_frame(mux, 0,
+                                                   NGX_HTTP_V2_SETTINGS_FRAME,
+                                                   NGX_HTTP_V2_ACK_FLAG, 0);
+                ngx_http_proxy_v2_mux_wake(mux);
+
+                mux->state = sw_head;
+                break;
+            }
+
+            if (ngx_http_proxy_v2_mux_gather(mux, b,
+                                             NGX_HTTP_V2_SETTINGS_PARAM_SIZE)
+                == NGX_AGAIN)
+            {
+                return NGX_AGAIN;
+            }
+
+            mux->rest -= NGX_HTTP_V2_SETTINGS_PARAM_SIZE;
+
+            id = ngx_http_v2_parse_uint16(mux->buffer);
+            value = ngx_http_v2_parse_uint32(&mux->buffer[2]);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &mux->log, 0,
+                           "proxy http2 setting %ui:%ui", id, value);
+
+            switch (id) {
+
+            case NGX_HTTP_V2_MAX_STREAMS_SETTING:
+
+                mux->max_streams = ngx_min(value, mux->streams_limit);
+                break;
+
+            case NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING:
+
+                if (value > NGX_HTTP_V2_MAX_WINDOW) {
+                    goto flow_control;
+                }
+
+                for (q = ngx_queue_head(&mux->streams);
+                     q != ngx_queue_sentinel(&mux->streams);
+                     q = ngx_queue_next(q))
+                {
+                    stream = ngx_queue_data(q, ngx_http_proxy_v2_stream_t,
+                                            queue);
+
+                    stream->send_window += (ssize_t) value
+                                           - (ssize_t) mux->init_window;
+                }
+
+                mux->init_window = value;
+                break;
+
+            case NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING:
+
+                if (value > NGX_HTTP_V2_MAX_FRAME_SIZE
+                    || value < NGX_HTTP_V2_DEFAULT_FRAME_SIZE)
+                {
+                    goto invalid;
+                }
+
+                mux->frame_size = value;
+                break;
+
+            default:
+                break;
+            }
+
+            break;
+
+        case sw_control:
+
+            size = (mux->type == NGX_HTTP_V2_WINDOW_UPDATE_FRAME)
+                   ? NGX_HTTP_V2_WINDOW_UPDATE_SIZE
+                   : NGX_HTTP_V2_PING_SIZE;
+
+            if (ngx_http_proxy_v2_mux_gather(mux, b, size) == NGX_AGAIN) {
+                return NGX_AGAIN;
+            }
+
+            mux->rest -= size;
+
+            if (ngx_http_proxy_v2_mux_control(mux) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            /* the GOAWAY debug data is skipped */
+
+            mux->state = sw_skip;
+            break;
+
+        case sw_skip:
+
+            n = ngx_min(mux->rest, (size_t) (b->last - b->pos));
+
+            b->pos += n;
+            mux->rest -= n;
+
+            if (mux->rest) {
+                return NGX_AGAIN;
+            }
+
+            mux->state = sw_head;
+            break;
+        }
+    }
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                  "upstream sent invalid http2 frame type %ui", mux->type);
+
+    return NGX_ERROR;
+
+flow_control:
+
+    ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                  "upstream violated http2 flow control");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_gather(ngx_http_proxy_v2_mux_t *mux, ngx_buf_t *b,
+    size_t size)
+{
+    size_t  n;
+
+    n = ngx_min((size_t) (b->last - b->pos), size - mux->used);
+
+    ngx_memcpy(mux->buffer + mux->used, b->pos, n);
+
+    b->pos += n;
+    mux->used += n;
+
+    if (mux->used < size) {
+        return NGX_AGAIN;
+    }
+
+    mux->used = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_control(ngx_http_proxy_v2_mux_t *mux)
+{
+    u_char                       *p;
+    size_t                        window;
+    ngx_uint_t                    id, error;
+    ngx_queue_t                  *q;
+    ngx_http_proxy_v2_stream_t   *stream;
+    u_char                        rst[NGX_HTTP_V2_FRAME_HEADER_SIZE
+                                      + NGX_HTTP_V2_RST_STREAM_SIZE];
+
+    switch (mux->type) {
+
+    case NGX_HTTP_V2_PING_FRAME:
+
+        if (mux->flags & NGX_HTTP_V2_ACK_FLAG) {
+            return NGX_OK;
+        }
+
+        p = ngx_http_proxy_v2_mux_frame(mux, NGX_HTTP_V2_PING_SIZE,
+                                        NGX_HTTP_V2_PING_FRAME,
+                                        NGX_HTTP_V2_ACK_FLAG, 0);
+        if (p) {
+            ngx_memcpy(p, mux->buffer, NGX_HTTP_V2_PING_SIZE);
+        }
+
+        return NGX_OK;
+
+    case NGX_HTTP_V2_WINDOW_UPDATE_FRAME:
+
+        window = ngx_http_v2_parse_window(mux->buffer);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &mux->log, 0,
+                       "proxy http2 WINDOW_UPDATE sid:%ui window:%uz",
+                       mux->sid, window);
+
+        if (window == 0) {
+            break;
+        }
+
+        if (mux->sid == 0) {
+
+            if ((ssize_t) window > NGX_HTTP_V2_MAX_WINDOW - mux->send_window) {
+                break;
+            }
+
+            mux->send_window += window;
+
+        } else {
+            stream = ngx_http_proxy_v2_mux_find(mux, mux->sid);
+
+            if (stream == NULL) {
+                return NGX_OK;
+            }
+
+            if ((ssize_t) window > NGX_HTTP_V2_MAX_WINDOW - stream->send_window)
+            {
+                break;
+            }
+
+            stream->send_window += window;
+        }
+
+        ngx_http_proxy_v2_mux_wake(mux);
+
+        return NGX_OK;
+
+    case NGX_HTTP_V2_GOAWAY_FRAME:
+
+        id = ngx_http_v2_parse_sid(mux->buffer);
+        error = ngx_http_v2_parse_uint32(&mux->buffer[4]);
+
+        ngx_log_error(NGX_LOG_INFO, &mux->log, 0,
+                      "upstream sent GOAWAY with error %ui, last stream %ui",
+                      error, id);
+
+        mux->goaway = 1;
+
+        /* the streams not processed are refused and may be retried */
+
+        for (q = ngx_queue_head(&mux->streams);
+             q != ngx_queue_sentinel(&mux->streams);
+             q = ngx_queue_next(q))
+        {
+            stream = ngx_queue_data(q, ngx_http_proxy_v2_stream_t, queue);
+
+            if (stream->id <= id || stream->reset) {
+                continue;
+            }
+
+            stream->in_closed = 1;
+            stream->reset = 1;
+
+            p = ngx_http_proxy_v2_write_head(rst, NGX_HTTP_V2_RST_STREAM_SIZE,
+                                             NGX_HTTP_V2_RST_STREAM_FRAME,
+                                             NGX_HTTP_V2_NO_FLAG, stream->id);
+            ngx_http_v2_write_uint32(p, NGX_HTTP_V2_REFUSED_STREAM);
+
+            if (ngx_http_proxy_v2_stream_append(stream, rst, sizeof(rst))
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_ERR, &mux->log, 0,
+                  "upstream sent invalid http2 WINDOW_UPDATE frame");
+
+    return NGX_ERROR;
+}
+
+
+static ngx_http_proxy_v2_stream_t *
+ngx_http_proxy_v2_mux_find(ngx_http_proxy_v2_mux_t *mux, ngx_uint_t sid)
+{
+    ngx_queue_t                 *q;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    for (q = ngx_queue_head(&mux->streams);
+         q != ngx_queue_sentinel(&mux->streams);
+         q = ngx_queue_next(q))
+    {
+        stream = ngx_queue_data(q, ngx_http_proxy_v2_stream_t, queue);
+
+        if (stream->id == sid) {
+            return stream;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * the windows are opened by the DATA consumed, the WINDOW_UPDATE frames
+ * are sent once half of a window is consumed
+ */
+
+static void
+ngx_http_proxy_v2_mux_credit(ngx_http_proxy_v2_mux_t *mux,
+    ngx_http_proxy_v2_stream_t *stream, size_t size)
+{
+    u_char  *p;
+
+    mux->unacked += size;
+
+    if (mux->unacked >= mux->conn_window / 2) {
+        p = ngx_http_proxy_v2_mux_frame(mux, NGX_HTTP_V2_WINDOW_UPDATE_SIZE,
+                                        NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                        NGX_HTTP_V2_NO_FLAG, 0);
+        if (p == NULL) {
+            return;
+        }
+
+        ngx_http_v2_write_uint32(p, mux->unacked);
+
+        mux->recv_window += mux->unacked;
+        mux->unacked = 0;
+    }
+
+    if (stream == NULL || stream->in_closed) {
+        return;
+    }
+
+    stream->unacked += size;
+
+    if (stream->unacked >= mux->window / 2) {
+        p = ngx_http_proxy_v2_mux_frame(mux, NGX_HTTP_V2_WINDOW_UPDATE_SIZE,
+                                        NGX_HTTP_V2_WINDOW_UPDATE_FRAME,
+                                        NGX_HTTP_V2_NO_FLAG, stream->id);
+        if (p == NULL) {
+            return;
+        }
+
+        ngx_http_v2_write_uint32(p, stream->unacked);
+
+        stream->recv_window += stream->unacked;
+        stream->unacked = 0;
+    }
+}
+
+
+static void
+ngx_http_proxy_v2_mux_wake(ngx_http_proxy_v2_mux_t *mux)
+{
+    ngx_uint_t                   wake;
+    ngx_queue_t                 *q;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    for (q = ngx_queue_head(&mux->streams);
+         q != ngx_queue_sentinel(&mux->streams);
+         q = ngx_queue_next(q))
+    {
+        stream = ngx_queue_data(q, ngx_http_proxy_v2_stream_t, queue);
+
+        wake = 0;
+
+        if (stream->blocked
+            && stream->send_window > 0
+            && mux->send_window > 0)
+        {
+            stream->blocked = 0;
+            wake = 1;
+        }
+
+        if (stream->queued && mux->queued < NGX_HTTP_PROXY_V2_QUEUE_SIZE) {
+            stream->queued = 0;
+            wake = 1;
+        }
+
+        if (wake) {
+            stream->write.ready = 1;
+            ngx_post_event(&stream->write, &ngx_posted_events);
+        }
+    }
+}
+
+
+static ngx_buf_t *
+ngx_http_proxy_v2_mux_buf(ngx_http_proxy_v2_mux_t *mux, size_t size)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
+    if (mux->last) {
+        b = mux->last->buf;
+
+        if ((size_t) (b->end - b->last) >= size) {
+            return b;
+        }
+    }
+
+    cl = ngx_chain_get_free_buf(mux->pool, &mux->free);
+    if (cl == NULL) {
+        return NULL;
+    }
+
+    b = cl->buf;
+
+    if (b->start == NULL) {
+        b->start = ngx_palloc(mux->pool, NGX_HTTP_PROXY_V2_BUFFER_SIZE);
+        if (b->start == NULL) {
+            return NULL;
+        }
+
+        b->end = b->start + NGX_HTTP_PROXY_V2_BUFFER_SIZE;
+        b->temporary = 1;
+    }
+
+    b->pos = b->start;
+    b->last = b->start;
+    b->flush = 0;
+
+    if (mux->last) {
+        mux->last->next = cl;
+
+    } else {
+        mux->out = cl;
+    }
+
+    mux->last = cl;
+
+    return b;
+}
+
+
+static u_char *
+ngx_http_proxy_v2_mux_frame(ngx_http_proxy_v2_mux_t *mux, size_t length,
+    ngx_uint_t type, ngx_uint_t flags, ngx_uint_t sid)
+{
+    u_char     *p;
+    ngx_buf_t  *b;
+
+    b = ngx_http_proxy_v2_mux_buf(mux, NGX_HTTP_V2_FRAME_HEADER_SIZE + length);
+
+    if (b == NULL) {
+        /* the write handler closes the connection */
+        mux->error = 1;
+        ngx_http_proxy_v2_mux_post(mux);
+        return NULL;
+    }
+
+    p = ngx_http_proxy_v2_write_head(b->last, length, type, flags, sid);
+
+    b->last = p + length;
+    mux->queued += NGX_HTTP_V2_FRAME_HEADER_SIZE + length;
+
+    ngx_http_proxy_v2_mux_post(mux);
+
+    return p;
+}
+
+
+/*
+ * the request body is read from a file by ngx_output_chain(), so that
+ * aio threads are used, only the buffers in memory are copied here
+ */
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_copy(ngx_http_proxy_v2_mux_t *mux, ngx_buf_t *buf)
+{
+    size_t      size;
+    u_char     *p;
+    ngx_buf_t  *b;
+
+    if (!ngx_buf_in_memory(buf)) {
+        return NGX_OK;
+    }
+
+    p = buf->pos;
+
+    while (p < buf->last) {
+        b = ngx_http_proxy_v2_mux_buf(mux, 1);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        size = ngx_min((size_t) (b->end - b->last), (size_t) (buf->last - p));
+
+        b->last = ngx_cpymem(b->last, p, size);
+
+        p += size;
+        mux->queued += size;
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_proxy_v2_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_str_t                  name;
+    ngx_thread_pool_t         *tp;
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    r = file->thread_ctx;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    tp = clcf->thread_pool;
+
+    if (tp == NULL) {
+        if (ngx_http_complex_value(r, clcf->thread_pool_value, &name)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        tp = ngx_thread_pool_get((ngx_cycle_t *) ngx_cycle, &name);
+
+        if (tp == NULL) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "thread pool \"%V\" not found", &name);
+            return NGX_ERROR;
+        }
+    }
+
+    task->event.data = r;
+    task->event.handler = ngx_http_proxy_v2_thread_event_handler;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /* ngx_output_chain() sets u->output.aio */
+
+    r->main->blocked++;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_proxy_v2_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t     *c, *pc;
+    ngx_http_request_t   *r;
+    ngx_http_upstream_t  *u;
+
+    r = ev->data;
+    c = r->connection;
+    u = r->upstream;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "proxy http2 thread: \"%V?%V\"", &r->uri, &r->args);
+
+    r->main->blocked--;
+    u->output.aio = 0;
+
+    pc = u->peer.connection;
+
+    if (pc) {
+        /* the stream goes on sending the request body */
+        pc->write->handler(pc->write);
+        return;
+    }
+
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_proxy_v2_mux_send(ngx_http_proxy_v2_mux_t *mux)
+{
+    off_t              sent;
+    ngx_chain_t       *cl, *ln, *out;
+    ngx_connection_t  *c;
+
+    c = mux->peer.connection;
+
+    if (mux->out) {
+        sent = c->sent;
+
+        /* the SSL buffer is flushed with the last frame queued */
+
+        mux->last->buf->flush = 1;
+
+        out = c->send_chain(c, mux->out, 0);
+
+        if (out == NGX_CHAIN_ERROR) {
+            c->error = 1;
+            return NGX_ERROR;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http proxy http2 sent %O of %uz",
+                       c->sent - sent, mux->queued);
+
+        mux->queued -= c->sent - sent;
+
+        /* the buffers sent are reused */
+
+        for (cl = mux->out; cl != out; cl = ln) {
+            ln = cl->next;
+            cl->next = mux->free;
+            mux->free = cl;
+        }
+
+        mux->out = out;
+
+        if (out == NULL) {
+            mux->last = NULL;
+        }
+    }
+
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_http_proxy_v2_mux_wake(mux);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_proxy_v2_mux_post(ngx_http_proxy_v2_mux_t *mux)
+{
+    /* the output is sent once the connection is established */
+
+    if (mux->connected || mux->error) {
+        ngx_post_event(mux->peer.connection->write, &ngx_posted_events);
+    }
+}
+
+
+static void
+ngx_http_proxy_v2_mux_close(ngx_http_proxy_v2_mux_t *mux)
+{
+    ngx_queue_t                 *q;
+    ngx_connection_t            *c;
+    ngx_http_proxy_v2_stream_t  *stream;
+
+    c = mux->peer.connection;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "close http proxy http2 connection, streams:%ui",
+                   mux->nstreams);
+
+    ngx_queue_remove(&mux->queue);
+
+    /* the streams read the frames buffered and then see the end of file */
+
+    while (!ngx_queue_empty(&mux->streams)) {
+        q = ngx_queue_head(&mux->streams);
+        ngx_queue_remove(q);
+
+        stream = ngx_queue_data(q, ngx_http_proxy_v2_stream_t, queue);
+
+        stream->mux = NULL;
+
+        stream->read.ready = 1;
+        ngx_post_event(&stream->read, &ngx_posted_events);
+
+        stream->write.ready = 1;
+        ngx_post_event(&stream->write, &ngx_posted_events);
+    }
+
+#if (NGX_HTTP_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        (void) ngx_ssl_shutdown(c);
+    }
+
+#endif
+
+    ngx_close_connection(c);
+
+    ngx_destroy_pool(mux->pool);
+}
+
+
+static u_char *
+ngx_http_proxy_v2_log_error(ngx_log_t *log, u_char *buf, size_t len)
+{
+    u_char                   *p;
+    ngx_http_proxy_v2_mux_t  *mux;
+
+    p = buf;
+
+    if (log->action) {
+        p = ngx_snprintf(buf, len, " while %s", log->action);
+        len -= p - buf;
+        buf = p;
+    }
+
+    mux = log->data;
+
+    return ngx_snprintf(buf, len, ", upstream: \"%V\"", mux->peer.name);
+}
+
+#endif
+
+
+static void
+ngx_http_proxy_abort_request(ngx_http_request_t *r)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "abort http proxy request");
+
+    return;
+}
+
+
+static void
+ngx_http_proxy_finalize_request(ngx_http_request_t *r, ngx_int_t rc)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "finalize http proxy request");
+
+    return;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_host_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = ctx->vars.host_header.len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = ctx->vars.host_header.data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_port_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = ctx->vars.port.len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = ctx->vars.port.data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_add_x_forwarded_for_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    size_t             len;
+    u_char            *p;
+    ngx_uint_t         i, n;
+    ngx_table_elt_t  **h;
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    n = r->headers_in.x_forwarded_for.nelts;
+    h = r->headers_in.x_forwarded_for.elts;
+
+    len = 0;
+
+    for (i = 0; i < n; i++) {
+        len += h[i]->value.len + sizeof(", ") - 1;
+    }
+
+    if (len == 0) {
+        v->len = r->connection->addr_text.len;
+        v->data = r->connection->addr_text.data;
+        return NGX_OK;
+    }
+
+    len += r->connection->addr_text.len;
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = len;
+    v->data = p;
+
+    for (i = 0; i < n; i++) {
+        p = ngx_copy(p, h[i]->value.data, h[i]->value.len);
+        *p++ = ','; *p++ = ' ';
+    }
+
+    ngx_memcpy(p, r->connection->addr_text.data, r->connection->addr_text.len);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_internal_body_length_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL || ctx->internal_body_length < 0) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    v->data = ngx_pnalloc(r->pool, NGX_OFF_T_LEN);
+
+    if (v->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    v->len = ngx_sprintf(v->data, "%O", ctx->internal_body_length) - v->data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_proxy_internal_chunked_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data)
+{
+    ngx_http_proxy_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_proxy_module);
+
+    if (ctx == NULL || !ctx->internal_chunked) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    v->data = (u_char *) "chunked";
+    v->len = sizeof("chunked") - 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
 ngx_http_proxy_rewrite_redirect(ngx_http_request_t *r, ngx_table_elt_t *h,
     size_t prefix)
 {
@@ -3318,6 +7479,11 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
 
     conf->http_version = NGX_CONF_UNSET_UINT;
 
+#if (NGX_HTTP_V2)
+    conf->http2_max_streams = NGX_CONF_UNSET_UINT;
+    conf->http2_idle_timeout = NGX_CONF_UNSET_MSEC;
+#endif
+
     conf->headers_hash_max_size = NGX_CONF_UNSET_UINT;
     conf->headers_hash_bucket_size = NGX_CONF_UNSET_UINT;
 
@@ -3671,6 +7837,16 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->http_version, prev->http_version,
                               NGX_HTTP_VERSION_10);
 
+#if (NGX_HTTP_V2)
+    ngx_conf_merge_uint_value(conf->http2_max_streams,
+                              prev->http2_max_streams,
+                              NGX_HTTP_PROXY_V2_MAX_STREAMS);
+
+    ngx_conf_merge_msec_value(conf->http2_idle_timeout,
+                              prev->http2_idle_timeout,
+                              NGX_HTTP_PROXY_V2_IDLE_TIMEOUT);
+#endif
+
     ngx_conf_merge_uint_value(conf->headers_hash_max_size,
                               prev->headers_hash_max_size, 512);
 
@@ -3696,6 +7872,9 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         conf->upstream.upstream = prev->upstream.upstream;
         conf->location = prev->location;
         conf->vars = prev->vars;
+#if (NGX_HTTP_V2)
+        conf->http2 = prev->http2;
+#endif
 
         conf->proxy_lengths = prev->proxy_lengths;
         conf->proxy_values = prev->proxy_values;
@@ -3709,6 +7888,16 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         clcf->handler = ngx_http_proxy_handler;
     }
 
+#if (NGX_HTTP_V2 && NGX_HTTP_CACHE)
+
+    if (conf->http2 && conf->upstream.cache) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"proxy_cache\" cannot be used with HTTP/2 upstreams");
+        return NGX_CONF_ERROR;
+    }
+
+#endif
+
     if (conf->body_source.data == NULL) {
         conf->body_flushes = prev->body_flushes;
         conf->body_source = prev->body_source;
@@ -4073,6 +8262,33 @@ ngx_http_proxy_pass(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
 #endif
 
+    } 
+	else if (ngx_strncasecmp(url->data, (u_char *) "h2c://", 6) == 0) {
+
+#if (NGX_HTTP_V2)
+        plcf->http2 = 1;
+
+        add = 6;
+        port = 80;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "h2c protocol requires HTTP/2 support");
+        return NGX_CONF_ERROR;
+#endif
+
+    } 
+	else if (ngx_strncasecmp(url->data, (u_char *) "h2://", 5) == 0) {
+
+#if (NGX_HTTP_V2 && NGX_HTTP_SSL)
+        plcf->http2 = 1;
+        plcf->ssl = 1;
+
+        add = 5;
+        port = 443;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "h2 protocol requires HTTP/2 and SSL support");
+        return NGX_CONF_ERROR;
+#endif
+
     } 
 	else {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid URL prefix");
@@ -4762,6 +8978,23 @@ ngx_http_proxy_set_ssl(ngx_conf_t *cf, ngx_http_proxy_loc_conf_t *plcf)
         }
     }
 
+#if (NGX_HTTP_V2)
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+
+    if (plcf->http2
+        && SSL_CTX_set_alpn_protos(plcf->upstream.ssl->ctx,
+                                   (u_char *) NGX_HTTP_V2_ALPN_ADVERTISE,
+                                   sizeof(NGX_HTTP_V2_ALPN_ADVERTISE) - 1)
+           != 0)
+    {
+        ngx_ssl_error(NGX_LOG_EMERG, cf->log, 0,
+                      "SSL_CTX_set_alpn_protos() failed");
+        return NGX_ERROR;
+    }
+
+#endif
+#endif
+
     return NGX_OK;
 }
 
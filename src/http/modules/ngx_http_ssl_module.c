@@ -45,6 +45,13 @@ static char *ngx_http_ssl_password_file(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_ssl_async_handshake(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_ssl_certificate_cache(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+#ifdef SSL_R_CERT_CB_ERROR
+static int ngx_http_ssl_certificate(ngx_ssl_conn_t *ssl_conn, void *arg);
+#endif
 
 static ngx_int_t ngx_http_ssl_init(ngx_conf_t *cf);
 
@@ -99,6 +106,13 @@ static ngx_command_t  ngx_http_ssl_commands[] =
 		NULL 
     },
 
+    { ngx_string("ssl_certificate_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE12,
+      ngx_http_ssl_certificate_cache,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("ssl_password_file"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_http_ssl_password_file,
@@ -181,7 +195,7 @@ static ngx_command_t  ngx_http_ssl_commands[] =
       NULL },
 
     { ngx_string("ssl_session_cache"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_1MORE,
       ngx_http_ssl_session_cache,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
@@ -194,6 +208,20 @@ static ngx_command_t  ngx_http_ssl_commands[] =
       offsetof(ngx_http_ssl_srv_conf_t, session_tickets),
       NULL },
 
+    { ngx_string("ssl_ktls"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_ssl_srv_conf_t, ktls),
+      NULL },
+
+    { ngx_string("ssl_async_handshake"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_http_ssl_async_handshake,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
     { ngx_string("ssl_session_ticket_key"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_array_slot,
@@ -531,6 +559,8 @@ ngx_http_ssl_create_srv_conf(ngx_conf_t *cf)
      *     sscf->protocols = 0;
      *     sscf->certificate = { 0, NULL };
      *     sscf->certificate_key = { 0, NULL };
+     *     sscf->certificate_value = NULL;
+     *     sscf->certificate_key_value = NULL;
      *     sscf->dhparam = { 0, NULL };
      *     sscf->ecdh_curve = { 0, NULL };
      *     sscf->client_certificate = { 0, NULL };
@@ -548,10 +578,15 @@ ngx_http_ssl_create_srv_conf(ngx_conf_t *cf)
     sscf->verify = NGX_CONF_UNSET_UINT;
     sscf->verify_depth = NGX_CONF_UNSET_UINT;
     sscf->passwords = NGX_CONF_UNSET_PTR;
+    sscf->certificate_cache = NGX_CONF_UNSET_PTR;
     sscf->builtin_session_cache = NGX_CONF_UNSET;
     sscf->session_timeout = NGX_CONF_UNSET;
     sscf->session_tickets = NGX_CONF_UNSET;
     sscf->session_ticket_keys = NGX_CONF_UNSET_PTR;
+    sscf->ktls = NGX_CONF_UNSET;
+#if (NGX_THREADS)
+    sscf->handshake_pool = NGX_CONF_UNSET_PTR;
+#endif
     sscf->stapling = NGX_CONF_UNSET;
     sscf->stapling_verify = NGX_CONF_UNSET;
 
@@ -565,7 +600,10 @@ ngx_http_ssl_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_ssl_srv_conf_t *prev = parent;
     ngx_http_ssl_srv_conf_t *conf = child;
 
-    ngx_pool_cleanup_t  *cln;
+    ngx_pool_cleanup_t                *cln;
+#ifdef SSL_R_CERT_CB_ERROR
+    ngx_http_compile_complex_value_t   ccv;
+#endif
 
     if (conf->enable == NGX_CONF_UNSET) 
 	{
@@ -598,6 +636,9 @@ ngx_http_ssl_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
 
     ngx_conf_merge_ptr_value(conf->passwords, prev->passwords, NULL);
 
+    ngx_conf_merge_ptr_value(conf->certificate_cache, prev->certificate_cache,
+                             NULL);
+
     ngx_conf_merge_str_value(conf->dhparam, prev->dhparam, "");
 
     ngx_conf_merge_str_value(conf->client_certificate, prev->client_certificate, "");
@@ -675,9 +716,56 @@ ngx_http_ssl_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     cln->handler = ngx_ssl_cleanup_ctx;
     cln->data = &conf->ssl;
 
-    if (ngx_ssl_certificate(cf, &conf->ssl, &conf->certificate, &conf->certificate_key, conf->passwords) != NGX_OK)
+    if (ngx_http_script_variables_count(&conf->certificate) == 0
+        && ngx_http_script_variables_count(&conf->certificate_key) == 0)
     {
+        if (ngx_ssl_certificate(cf, &conf->ssl, &conf->certificate, &conf->certificate_key, conf->passwords) != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+    } else {
+
+#ifdef SSL_R_CERT_CB_ERROR
+
+        /* the certificate is loaded while handshaking, see ngx_http_ssl_certificate() */
+
+        conf->certificate_value = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+        conf->certificate_key_value = ngx_palloc(cf->pool, sizeof(ngx_http_complex_value_t));
+
+        if (conf->certificate_value == NULL || conf->certificate_key_value == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+        ccv.cf = cf;
+        ccv.value = &conf->certificate;
+        ccv.complex_value = conf->certificate_value;
+        ccv.zero = 1;
+
+        if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        ccv.value = &conf->certificate_key;
+        ccv.complex_value = conf->certificate_key_value;
+
+        if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        SSL_CTX_set_cert_cb(conf->ssl.ctx, ngx_http_ssl_certificate, conf);
+
+#else
+
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "variables in \"ssl_certificate\" and "
+                      "\"ssl_certificate_key\" are not supported "
+                      "by this OpenSSL library");
         return NGX_CONF_ERROR;
+
+#endif
     }
 
     if (SSL_CTX_set_cipher_list(conf->ssl.ctx, (const char *) conf->ciphers.data) == 0)
@@ -760,7 +848,25 @@ ngx_http_ssl_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
         return NGX_CONF_ERROR;
     }
 
-    if (conf->stapling) 
+    ngx_conf_merge_value(conf->ktls, prev->ktls, 0);
+
+    if (ngx_ssl_ktls(cf, &conf->ssl, conf->ktls) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+#if (NGX_THREADS)
+    ngx_conf_merge_ptr_value(conf->handshake_pool, prev->handshake_pool,
+                             NULL);
+
+    conf->ssl.thread_pool = conf->handshake_pool;
+#endif
+
+    if (conf->stapling && conf->certificate_value) {
+        ngx_log_error(NGX_LOG_WARN, cf->log, 0,
+                      "\"ssl_stapling\" ignored, not supported "
+                      "with certificates selected by variables");
+
+    } else if (conf->stapling) 
 	{
         if (ngx_ssl_stapling(cf, &conf->ssl, &conf->stapling_file, &conf->stapling_responder, conf->stapling_verify) != NGX_OK)
         {
@@ -825,11 +931,18 @@ ngx_http_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     size_t       len;
     ngx_str_t   *value, name, size;
-    ngx_int_t    n;
+    time_t       ticket_rotation;
+    ngx_str_t    s;
+    ngx_int_t    n, shards, worker_sessions, ticket_keys;
     ngx_uint_t   i, j;
 
     value = cf->args->elts;
 
+    shards = 1;
+    worker_sessions = 0;
+    ticket_rotation = 0;
+    ticket_keys = 2;
+
     for (i = 1; i < cf->args->nelts; i++)
 	{
 
@@ -908,7 +1021,59 @@ ngx_http_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 return NGX_CONF_ERROR;
             }
 
-            sscf->shm_zone->init = ngx_ssl_session_cache_init;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards <= 0) {
+                goto invalid;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+            if (shards > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" requires atomic operations",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+#endif
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "worker_cache=", 13) == 0) {
+
+            worker_sessions = ngx_atoi(value[i].data + 13, value[i].len - 13);
+            if (worker_sessions == NGX_ERROR) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ticket_rotation=", 16) == 0) {
+
+            s.len = value[i].len - 16;
+            s.data = value[i].data + 16;
+
+            ticket_rotation = ngx_parse_time(&s, 1);
+            if (ticket_rotation == (time_t) NGX_ERROR || ticket_rotation == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "ticket_keys=", 12) == 0) {
+
+            ticket_keys = ngx_atoi(value[i].data + 12, value[i].len - 12);
+            if (ticket_keys == NGX_ERROR
+                || ticket_keys > NGX_SSL_TICKET_KEYS_MAX)
+            {
+                goto invalid;
+            }
 
             continue;
         }
@@ -916,7 +1081,28 @@ ngx_http_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         goto invalid;
     }
 
-    if (sscf->shm_zone && sscf->builtin_session_cache == NGX_CONF_UNSET) 
+    if (sscf->shm_zone == NULL) {
+
+        if (shards != 1 || worker_sessions != 0 || ticket_rotation != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"shards\", \"worker_cache\", and "
+                               "\"ticket_rotation\" require "
+                               "a shared session cache");
+            return NGX_CONF_ERROR;
+        }
+
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_ssl_session_cache_create(cf, sscf->shm_zone, shards,
+                                     worker_sessions, ticket_rotation,
+                                     ticket_keys)
+        != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+    if (sscf->builtin_session_cache == NGX_CONF_UNSET) 
 	{
         sscf->builtin_session_cache = NGX_SSL_NO_BUILTIN_SCACHE;
     }
@@ -932,6 +1118,218 @@ invalid:
 }
 
 
+/*
+ * the handshake runs before the server name is known,
+ * so the pool of the default server of a listen socket is used
+ */
+
+static char *
+ngx_http_ssl_async_handshake(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+#if (NGX_THREADS)
+    ngx_http_ssl_srv_conf_t *sscf = conf;
+
+    ngx_str_t           name;
+    ngx_thread_pool_t  *tp;
+#endif
+    ngx_str_t          *value;
+
+    value = cf->args->elts;
+
+#if (NGX_THREADS)
+
+    if (sscf->handshake_pool != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        sscf->handshake_pool = NULL;
+        return NGX_CONF_OK;
+    }
+
+#else
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        return NGX_CONF_OK;
+    }
+
+#endif
+
+    if (ngx_strncmp(value[1].data, "threads", 7) == 0
+        && (value[1].len == 7 || value[1].data[7] == '='))
+    {
+#if (NGX_THREADS)
+        if (value[1].len >= 8) {
+            name.len = value[1].len - 8;
+            name.data = value[1].data + 8;
+
+            tp = ngx_thread_pool_add(cf, &name);
+
+        } else {
+            tp = ngx_thread_pool_add(cf, NULL);
+        }
+
+        if (tp == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        sscf->handshake_pool = tp;
+
+        return NGX_CONF_OK;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"ssl_async_handshake threads\" "
+                           "is unsupported on this platform");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
+    return "invalid value";
+}
+
+
+static char *
+ngx_http_ssl_certificate_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_ssl_srv_conf_t *sscf = conf;
+
+    time_t       valid;
+    ngx_str_t   *value, s;
+    ngx_int_t    max;
+    ngx_uint_t   i;
+
+    if (sscf->certificate_cache != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    max = 0;
+    valid = 60;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "max=", 4) == 0) {
+
+            max = ngx_atoi(value[i].data + 4, value[i].len - 4);
+            if (max <= 0) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            valid = ngx_parse_time(&s, 1);
+            if (valid == (time_t) NGX_ERROR) {
+                goto failed;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "off") == 0) {
+            sscf->certificate_cache = NULL;
+            continue;
+        }
+
+    failed:
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid \"ssl_certificate_cache\" parameter \"%V\"",
+                           &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (sscf->certificate_cache == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    if (max == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"ssl_certificate_cache\" must have "
+                           "the \"max\" parameter");
+        return NGX_CONF_ERROR;
+    }
+
+#ifndef SSL_R_CERT_CB_ERROR
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "\"ssl_certificate_cache\" is not supported "
+                       "by this OpenSSL library");
+    return NGX_CONF_ERROR;
+#else
+
+    sscf->certificate_cache = ngx_ssl_cert_cache_init(cf->pool, max, valid);
+    if (sscf->certificate_cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+#endif
+}
+
+
+#ifdef SSL_R_CERT_CB_ERROR
+
+static int
+ngx_http_ssl_certificate(ngx_ssl_conn_t *ssl_conn, void *arg)
+{
+    ngx_http_ssl_srv_conf_t *sscf = arg;
+
+    ngx_int_t             rc;
+    ngx_str_t             cert, key;
+    ngx_connection_t     *c;
+    ngx_http_log_ctx_t   *ctx;
+    ngx_http_request_t   *r;
+
+    c = ngx_ssl_get_connection(ssl_conn);
+
+    if (c->ssl->handshaked) {
+        /* renegotiation, the certificate is already set */
+        return 1;
+    }
+
+    /* a temporary request to evaluate variables, such as $ssl_server_name */
+
+    r = ngx_http_alloc_request(c);
+    if (r == NULL) {
+        return 0;
+    }
+
+    rc = NGX_ERROR;
+
+    if (ngx_http_complex_value(r, sscf->certificate_value, &cert) != NGX_OK
+        || ngx_http_complex_value(r, sscf->certificate_key_value, &key)
+           != NGX_OK)
+    {
+        goto done;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "ssl certificate: \"%V\", key: \"%V\"", &cert, &key);
+
+    rc = ngx_ssl_connection_certificate(c, r->pool, &cert, &key,
+                                        sscf->passwords,
+                                        sscf->certificate_cache);
+
+done:
+
+    ctx = c->log->data;
+    ctx->request = NULL;
+    ctx->current_request = NULL;
+
+    ngx_destroy_pool(r->pool);
+
+    return (rc == NGX_OK) ? 1 : 0;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_ssl_init(ngx_conf_t *cf)
 {
@@ -36,6 +36,10 @@ typedef struct
 	/*֤ļ·*/
     ngx_str_t                       certificate;			
     ngx_str_t                       certificate_key;
+    /* set if the certificate is selected with variables */
+    ngx_http_complex_value_t       *certificate_value;
+    ngx_http_complex_value_t       *certificate_key_value;
+    ngx_ssl_cert_cache_t           *certificate_cache;
     ngx_str_t                       dhparam;
     ngx_str_t                       ecdh_curve;
     ngx_str_t                       client_certificate;
@@ -53,6 +57,12 @@ typedef struct
     ngx_flag_t                      session_tickets;
     ngx_array_t                    *session_ticket_keys;
 
+    ngx_flag_t                      ktls;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t              *handshake_pool;
+#endif
+
 	//ǷOCSP stapling
     ngx_flag_t                      stapling;
     ngx_flag_t                      stapling_verify;
@@ -10,20 +10,73 @@
 #include <ngx_http.h>
 
 
+typedef ngx_int_t (*ngx_http_stub_status_report_pt)(ngx_http_request_t *r,
+    ngx_chain_t *out);
+
+
+typedef struct {
+    ngx_str_t                        name;
+    ngx_http_stub_status_report_pt   handler;
+} ngx_http_stub_status_report_t;
+
+
+typedef struct {
+    ngx_http_stub_status_report_pt   report;
+} ngx_http_stub_status_loc_conf_t;
+
+
 static ngx_int_t ngx_http_stub_status_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_stub_status_basic(ngx_http_request_t *r,
+    ngx_chain_t *out);
+static ngx_int_t ngx_http_stub_status_zones(ngx_http_request_t *r,
+    ngx_chain_t *out);
+static ngx_int_t ngx_http_stub_status_accepts(ngx_http_request_t *r,
+    ngx_chain_t *out);
+static ngx_int_t ngx_http_stub_status_listeners(ngx_http_request_t *r,
+    ngx_chain_t *out);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_stub_status_thread_pools(ngx_http_request_t *r,
+    ngx_chain_t *out);
+#endif
+#if (NGX_HTTP_V2)
+static ngx_int_t ngx_http_stub_status_http2(ngx_http_request_t *r,
+    ngx_chain_t *out);
+#endif
+#if (NGX_HTTP_SSL)
+static ngx_int_t ngx_http_stub_status_ssl(ngx_http_request_t *r,
+    ngx_chain_t *out);
+#endif
 static ngx_int_t ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_stub_status_add_variables(ngx_conf_t *cf);
+static void *ngx_http_stub_status_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 
 
+static ngx_http_stub_status_report_t  ngx_http_stub_status_reports[] = {
+    { ngx_string("zones"), ngx_http_stub_status_zones },
+    { ngx_string("accepts"), ngx_http_stub_status_accepts },
+    { ngx_string("listeners"), ngx_http_stub_status_listeners },
+#if (NGX_THREADS)
+    { ngx_string("thread_pools"), ngx_http_stub_status_thread_pools },
+#endif
+#if (NGX_HTTP_V2)
+    { ngx_string("http2"), ngx_http_stub_status_http2 },
+#endif
+#if (NGX_HTTP_SSL)
+    { ngx_string("ssl"), ngx_http_stub_status_ssl },
+#endif
+    { ngx_null_string, NULL }
+};
+
+
 static ngx_command_t  ngx_http_status_commands[] = {
 
     { ngx_string("stub_status"),
       NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
       ngx_http_set_stub_status,
-      0,
+      NGX_HTTP_LOC_CONF_OFFSET,
       0,
       NULL },
 
@@ -41,7 +94,7 @@ static ngx_http_module_t  ngx_http_stub_status_module_ctx = {
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
 
-    NULL,                                  /* create location configuration */
+    ngx_http_stub_status_create_loc_conf,  /* create location configuration */
     NULL                                   /* merge location configuration */
 };
 
@@ -83,11 +136,9 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
 static ngx_int_t
 ngx_http_stub_status_handler(ngx_http_request_t *r)
 {
-    size_t             size;
-    ngx_int_t          rc;
-    ngx_buf_t         *b;
-    ngx_chain_t        out;
-    ngx_atomic_int_t   ap, hn, ac, rq, rd, wr, wa;
+    ngx_int_t                         rc;
+    ngx_chain_t                       out;
+    ngx_http_stub_status_loc_conf_t  *sslcf;
 
     if (r->method != NGX_HTTP_GET && r->method != NGX_HTTP_HEAD) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -113,6 +164,35 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
         }
     }
 
+    sslcf = ngx_http_get_module_loc_conf(r, ngx_http_stub_status_module);
+
+    if (sslcf->report(r, &out) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = out.buf->last - out.buf->pos;
+
+    out.buf->last_buf = (r == r->main) ? 1 : 0;
+    out.buf->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_basic(ngx_http_request_t *r, ngx_chain_t *out)
+{
+    size_t             size;
+    ngx_buf_t         *b;
+    ngx_atomic_int_t   ap, hn, ac, rq, rd, wr, wa;
+
     size = sizeof("Active connections:  \n") + NGX_ATOMIC_T_LEN
            + sizeof("server accepts handled requests\n") - 1
            + 6 + 3 * NGX_ATOMIC_T_LEN
@@ -120,11 +200,11 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
 
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        return NGX_ERROR;
     }
 
-    out.buf = b;
-    out.next = NULL;
+    out->buf = b;
+    out->next = NULL;
 
     ap = *ngx_stat_accepted;
     hn = *ngx_stat_handled;
@@ -144,21 +224,429 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, wa);
 
-    r->headers_out.status = NGX_HTTP_OK;
-    r->headers_out.content_length_n = b->last - b->pos;
+    return NGX_OK;
+}
 
-    b->last_buf = (r == r->main) ? 1 : 0;
-    b->last_in_chain = 1;
 
-    rc = ngx_http_send_header(r);
+static ngx_int_t
+ngx_http_stub_status_zones(ngx_http_request_t *r, ngx_chain_t *out)
+{
+    size_t             size;
+    ngx_buf_t         *b;
+    ngx_uint_t         i, n;
+    ngx_shm_zone_t    *shm_zone;
+    ngx_slab_pool_t   *sp;
+    ngx_list_part_t   *part;
+    ngx_slab_shard_t  *shard;
+
+    size = sizeof("zone size locks contended refills drains\n") - 1
+           + sizeof("zone shard locks contended\n") - 1;
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
 
-    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        return rc;
+        size += shm_zone[i].shm.name.len + sizeof("      \n") - 1
+                + 5 * NGX_ATOMIC_T_LEN;
+
+        sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        if (sp && sp->shards) {
+            size += sp->nshards * (shm_zone[i].shm.name.len
+                                   + sizeof("    \n") - 1
+                                   + 3 * NGX_ATOMIC_T_LEN);
+        }
     }
 
-    return ngx_http_output_filter(r, &out);
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    out->buf = b;
+    out->next = NULL;
+
+    b->last = ngx_cpymem(b->last, "zone size locks contended refills drains\n",
+                         sizeof("zone size locks contended refills drains\n")
+                         - 1);
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        if (sp == NULL) {
+            continue;
+        }
+
+        /* the counters are read without the lock, approximate values */
+
+        b->last = ngx_sprintf(b->last, "%V %uz %ui %ui %ui %ui \n",
+                              &shm_zone[i].shm.name, shm_zone[i].shm.size,
+                              sp->locks, sp->contended, sp->refills,
+                              sp->drains);
+    }
+
+    /* zones partitioned by key have a lock in every shard */
+
+    b->last = ngx_cpymem(b->last, "zone shard locks contended\n",
+                         sizeof("zone shard locks contended\n") - 1);
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        sp = (ngx_slab_pool_t *) shm_zone[i].shm.addr;
+
+        if (sp == NULL || sp->shards == NULL) {
+            continue;
+        }
+
+        for (n = 0; n < sp->nshards; n++) {
+            shard = (ngx_slab_shard_t *) (sp->shards + n * sp->shard_size);
+
+            b->last = ngx_sprintf(b->last, "%V %ui %ui %ui \n",
+                                  &shm_zone[i].shm.name, n, shard->locks,
+                                  shard->contended);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_accepts(ngx_http_request_t *r, ngx_chain_t *out)
+{
+    size_t            size;
+    ngx_buf_t        *b;
+    ngx_uint_t        i, n;
+    ngx_core_conf_t  *ccf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_core_module);
+
+    n = ngx_min((ngx_uint_t) ccf->worker_processes, ngx_stat_workers);
+
+    size = sizeof("worker accepts local\n") - 1
+           + n * (sizeof("    \n") - 1 + NGX_INT_T_LEN + 2 * NGX_ATOMIC_T_LEN)
+           + sizeof("cpu accepts\n") - 1
+           + ngx_stat_cpus * (sizeof("   \n") - 1 + NGX_INT_T_LEN
+                              + NGX_ATOMIC_T_LEN);
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    out->buf = b;
+    out->next = NULL;
+
+    b->last = ngx_cpymem(b->last, "worker accepts local\n",
+                         sizeof("worker accepts local\n") - 1);
+
+    for (i = 0; i < n; i++) {
+        b->last = ngx_sprintf(b->last, " %ui %uA %uA \n", i,
+                              ngx_stat_worker_accepted[i],
+                              ngx_stat_worker_local[i]);
+    }
+
+    b->last = ngx_cpymem(b->last, "cpu accepts\n",
+                         sizeof("cpu accepts\n") - 1);
+
+    for (i = 0; i < ngx_stat_cpus; i++) {
+        b->last = ngx_sprintf(b->last, " %ui %uA \n", i,
+                              ngx_stat_cpu_accepted[i]);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_listeners(ngx_http_request_t *r, ngx_chain_t *out)
+{
+    size_t                       size;
+    ngx_buf_t                   *b;
+    ngx_uint_t                   i;
+    ngx_event_listening_stat_t  *st;
+
+    size = sizeof("listen accepted batches limited eagain\n") - 1
+           + NGX_EVENT_LISTENING_STATS
+             * (sizeof("      \n") - 1 + NGX_SOCKADDR_STRLEN
+                + 4 * NGX_ATOMIC_T_LEN);
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    out->buf = b;
+    out->next = NULL;
+
+    b->last = ngx_cpymem(b->last, "listen accepted batches limited eagain\n",
+                         sizeof("listen accepted batches limited eagain\n")
+                         - 1);
+
+    for (i = 0; i < NGX_EVENT_LISTENING_STATS; i++) {
+        st = &ngx_stat_listening[i];
+
+        if (st->socklen == 0) {
+            break;
+        }
+
+        *b->last++ = ' ';
+        b->last += ngx_sock_ntop((struct sockaddr *) st->sockaddr, st->socklen,
+                                 b->last, NGX_SOCKADDR_STRLEN, 1);
+
+        b->last = ngx_sprintf(b->last, " %uA %uA %uA %uA \n",
+                              st->accepted, st->batches, st->limited,
+                              st->eagain);
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_stub_status_thread_pools(ngx_http_request_t *r, ngx_chain_t *out)
+{
+    size_t                   size;
+    ngx_buf_t               *b;
+    ngx_uint_t               i;
+    ngx_atomic_uint_t        tasks;
+    ngx_thread_pool_stat_t  *st;
+
+    size = sizeof("pool depth tasks steals overflows wait service\n") - 1
+           + NGX_THREAD_POOL_STATS
+             * (sizeof("        \n") - 1 + NGX_THREAD_POOL_NAME_LEN
+                + 6 * NGX_ATOMIC_T_LEN);
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    out->buf = b;
+    out->next = NULL;
+
+    b->last = ngx_cpymem(b->last,
+                         "pool depth tasks steals overflows wait service\n",
+                         sizeof("pool depth tasks steals overflows wait "
+                                "service\n") - 1);
+
+    /* the wait and service times are averages in microseconds */
+
+    for (i = 0; i < NGX_THREAD_POOL_STATS; i++) {
+        st = &ngx_stat_thread_pools[i];
+
+        if (st->len == 0) {
+            break;
+        }
+
+        tasks = st->tasks;
+
+        b->last = ngx_sprintf(b->last, " %*s %A %uA %uA %uA %uA %uA \n",
+                              st->len, st->name,
+                              (ngx_atomic_int_t) st->depth, tasks,
+                              st->steals, st->overflows,
+                              tasks ? st->wait / tasks : 0,
+                              tasks ? st->service / tasks : 0);
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+#if (NGX_HTTP_V2)
+
+static ngx_int_t
+ngx_http_stub_status_http2(ngx_http_request_t *r, ngx_chain_t *out)
+{
+    size_t      size;
+    ngx_buf_t  *b;
+
+    size = sizeof("pushes cancelled\n") - 1
+           + sizeof("   \n") - 1 + 2 * NGX_ATOMIC_T_LEN;
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    out->buf = b;
+    out->next = NULL;
+
+    b->last = ngx_cpymem(b->last, "pushes cancelled\n",
+                         sizeof("pushes cancelled\n") - 1);
+
+    b->last = ngx_sprintf(b->last, " %uA %uA \n",
+                          *ngx_stat_http2_pushes,
+                          *ngx_stat_http2_push_cancels);
+
+    return NGX_OK;
+}
+
+#endif
+
+
+#if (NGX_HTTP_SSL)
+
+static ngx_int_t
+ngx_http_stub_status_ssl(ngx_http_request_t *r, ngx_chain_t *out)
+{
+    size_t                    size;
+    ngx_buf_t                *b;
+    ngx_uint_t                i, n, hits, misses, evictions, locks, contended,
+                              worker_hits;
+    ngx_shm_zone_t           *shm_zone;
+    ngx_list_part_t          *part;
+    ngx_ssl_session_cache_t  *cache;
+    ngx_ssl_session_shctx_t  *sh;
+
+    size = sizeof("handshakes queued completed\n") - 1
+           + sizeof("   \n") - 1 + 2 * NGX_ATOMIC_T_LEN
+           + sizeof("session_cache shards hits worker_hits misses evictions "
+                    "locks contended\n") - 1;
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].init == ngx_ssl_session_cache_init) {
+            size += shm_zone[i].shm.name.len + sizeof("        \n") - 1
+                    + 7 * NGX_ATOMIC_T_LEN;
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    out->buf = b;
+    out->next = NULL;
+
+    b->last = ngx_cpymem(b->last, "handshakes queued completed\n",
+                         sizeof("handshakes queued completed\n") - 1);
+
+    b->last = ngx_sprintf(b->last, " %uA %uA \n",
+                          *ngx_stat_ssl_handshakes_queued,
+                          *ngx_stat_ssl_handshakes_completed);
+
+    b->last = ngx_cpymem(b->last, "session_cache shards hits worker_hits "
+                         "misses evictions locks contended\n",
+                         sizeof("session_cache shards hits worker_hits "
+                                "misses evictions locks contended\n") - 1);
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].init != ngx_ssl_session_cache_init) {
+            continue;
+        }
+
+        cache = shm_zone[i].data;
+
+        if (cache == NULL || cache->sh == NULL) {
+            continue;
+        }
+
+        hits = 0;
+        worker_hits = 0;
+        misses = 0;
+        evictions = 0;
+        locks = 0;
+        contended = 0;
+
+        /* the counters are read without the locks, approximate values */
+
+        for (n = 0; n < cache->shards; n++) {
+            sh = &cache->sh[n];
+
+            hits += sh->hits;
+            worker_hits += sh->worker_hits;
+            misses += sh->misses;
+            evictions += sh->evictions;
+            locks += sh->shard.locks;
+            contended += sh->shard.contended;
+        }
+
+        if (cache->shards == 1) {
+
+            /* a single shard is locked with the slab pool mutex */
+
+            locks = cache->shpool->locks;
+            contended = cache->shpool->contended;
+        }
+
+        b->last = ngx_sprintf(b->last, "%V %ui %ui %ui %ui %ui %ui %ui \n",
+                              &shm_zone[i].shm.name, cache->shards, hits,
+                              worker_hits, misses, evictions, locks,
+                              contended);
+    }
+
+    return NGX_OK;
 }
 
+#endif
+
 
 static ngx_int_t
 ngx_http_stub_status_variable(ngx_http_request_t *r,
@@ -224,10 +712,59 @@ ngx_http_stub_status_add_variables(ngx_conf_t *cf)
 }
 
 
+static void *
+ngx_http_stub_status_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_stub_status_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_stub_status_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->report = NULL;
+     */
+
+    return conf;
+}
+
+
 static char *
 ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_http_stub_status_loc_conf_t *sslcf = conf;
+
+    ngx_str_t                       *value;
+    ngx_http_core_loc_conf_t        *clcf;
+    ngx_http_stub_status_report_t   *report;
+
+    if (sslcf->report) {
+        return "is duplicate";
+    }
+
+    sslcf->report = ngx_http_stub_status_basic;
+
+    /* "stub_status" used to ignore its argument, keep accepting e.g. "on" */
+
+    if (cf->args->nelts == 2) {
+        value = cf->args->elts;
+
+        for (report = ngx_http_stub_status_reports;
+             report->name.len;
+             report++)
+        {
+            if (report->name.len == value[1].len
+                && ngx_strncmp(report->name.data, value[1].data,
+                               value[1].len) == 0)
+            {
+                sslcf->report = report->handler;
+                break;
+            }
+        }
+    }
 
     clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
     clcf->handler = ngx_http_stub_status_handler;
@@ -0,0 +1,923 @@
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_CONF_LIST    0
+#define NGX_HTTP_UPSTREAM_CONF_ADD     1
+#define NGX_HTTP_UPSTREAM_CONF_REMOVE  2
+#define NGX_HTTP_UPSTREAM_CONF_EDIT    3
+
+
+#define NGX_HTTP_UPSTREAM_CONF_LINE                                           \
+    (sizeof("server  weight= max_fails= fail_timeout=s backup drain down;"    \
+            " # id=, conns=, unhealthy, host=\n") - 1 + 5 * NGX_INT_T_LEN)
+
+#define NGX_HTTP_UPSTREAM_CONF_STATS                                          \
+    (sizeof("# connects=, reused=\n") - 1 + 2 * NGX_ATOMIC_T_LEN)
+
+
+typedef struct {
+    ngx_uint_t                      op;
+
+    ngx_str_t                       upstream;
+    ngx_int_t                       id;
+    ngx_url_t                       url;
+
+    ngx_int_t                       weight;
+    ngx_int_t                       max_fails;
+    time_t                          fail_timeout;
+    ngx_uint_t                      down;
+    ngx_uint_t                      drain;
+    ngx_uint_t                      backup;
+
+    char                           *err;
+} ngx_http_upstream_conf_args_t;
+
+
+static ngx_int_t ngx_http_upstream_conf_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_upstream_conf_parse(ngx_http_request_t *r,
+    ngx_http_upstream_conf_args_t *args);
+static ngx_int_t ngx_http_upstream_conf_arg(ngx_http_request_t *r,
+    char *name, ngx_str_t *value);
+static ngx_int_t ngx_http_upstream_conf_process(ngx_http_request_t *r,
+    ngx_http_upstream_conf_args_t *args, ngx_buf_t **bp);
+static ngx_int_t ngx_http_upstream_conf_modify(ngx_http_request_t *r,
+    ngx_http_upstream_conf_args_t *args, ngx_http_upstream_srv_conf_t *uscf,
+    ngx_http_upstream_rr_peer_t **peerp);
+static ngx_int_t ngx_http_upstream_conf_add(
+    ngx_http_upstream_conf_args_t *args, ngx_http_upstream_srv_conf_t *uscf,
+    ngx_http_upstream_rr_peer_t **peerp);
+static ngx_http_upstream_rr_peer_t *ngx_http_upstream_conf_find(
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t id,
+    ngx_http_upstream_rr_peers_t **list);
+static ngx_buf_t *ngx_http_upstream_conf_list(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *one);
+static u_char *ngx_http_upstream_conf_print(u_char *p,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t backup);
+static char *ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_conf_commands[] = {
+
+    { ngx_string("upstream_conf"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_conf,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_conf_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_conf_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_conf_module_ctx,    /* module context */
+    ngx_http_upstream_conf_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_conf_handler(ngx_http_request_t *r)
+{
+    size_t                          len;
+    ngx_int_t                       rc;
+    ngx_buf_t                      *b;
+    ngx_chain_t                     out;
+    ngx_http_upstream_conf_args_t   args;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD|NGX_HTTP_POST))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    ngx_memzero(&args, sizeof(ngx_http_upstream_conf_args_t));
+
+    b = NULL;
+
+    rc = ngx_http_upstream_conf_parse(r, &args);
+
+    /*
+     * the arguments are always taken from the query string, but changes
+     * are only made by POST requests, so that a link followed by a browser
+     * or a crawler cannot change the upstream
+     */
+
+    if (rc == NGX_OK) {
+        if (args.op == NGX_HTTP_UPSTREAM_CONF_LIST) {
+            if (r->method == NGX_HTTP_POST) {
+                args.err = "listing requires the GET method";
+                rc = NGX_HTTP_NOT_ALLOWED;
+            }
+
+        } else if (r->method != NGX_HTTP_POST) {
+            args.err = "changes require the POST method";
+            rc = NGX_HTTP_NOT_ALLOWED;
+        }
+    }
+
+    if (rc == NGX_OK) {
+        rc = ngx_http_upstream_conf_process(r, &args, &b);
+    }
+
+    if (rc == NGX_ERROR) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (rc != NGX_HTTP_OK) {
+        len = ngx_strlen(args.err);
+
+        b = ngx_create_temp_buf(r->pool, len + 1);
+        if (b == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        b->last = ngx_cpymem(b->last, args.err, len);
+        *b->last++ = LF;
+    }
+
+    r->headers_out.status = rc;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (b->last == b->pos) {
+        r->header_only = 1;
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_parse(ngx_http_request_t *r,
+    ngx_http_upstream_conf_args_t *args)
+{
+    ngx_int_t   rc, n;
+    ngx_str_t   value;
+
+    args->id = NGX_CONF_UNSET;
+    args->weight = NGX_CONF_UNSET;
+    args->max_fails = NGX_CONF_UNSET;
+    args->fail_timeout = NGX_CONF_UNSET;
+    args->down = NGX_CONF_UNSET_UINT;
+
+    rc = ngx_http_upstream_conf_arg(r, "upstream", &args->upstream);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_DECLINED || args->upstream.len == 0) {
+        args->err = "upstream argument is required";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    rc = ngx_http_upstream_conf_arg(r, "id", &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        args->id = ngx_atoi(value.data, value.len);
+
+        if (args->id == NGX_ERROR) {
+            args->err = "invalid id";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+    }
+
+    rc = ngx_http_upstream_conf_arg(r, "weight", &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        args->weight = ngx_atoi(value.data, value.len);
+
+        if (args->weight == NGX_ERROR || args->weight == 0) {
+            args->err = "invalid weight";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+    }
+
+    rc = ngx_http_upstream_conf_arg(r, "max_fails", &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        args->max_fails = ngx_atoi(value.data, value.len);
+
+        if (args->max_fails == NGX_ERROR) {
+            args->err = "invalid max_fails";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+    }
+
+    rc = ngx_http_upstream_conf_arg(r, "fail_timeout", &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        args->fail_timeout = ngx_parse_time(&value, 1);
+
+        if (args->fail_timeout == (time_t) NGX_ERROR) {
+            args->err = "invalid fail_timeout";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+    }
+
+    n = 0;
+
+    rc = ngx_http_upstream_conf_arg(r, "down", &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        args->down = 1;
+        n++;
+    }
+
+    rc = ngx_http_upstream_conf_arg(r, "up", &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        args->down = 0;
+        n++;
+    }
+
+    rc = ngx_http_upstream_conf_arg(r, "drain", &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        args->drain = 1;
+        n++;
+    }
+
+    if (n > 1) {
+        args->err = "only one of \"down\", \"up\" and \"drain\" is allowed";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    rc = ngx_http_upstream_conf_arg(r, "backup", &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    args->backup = (rc == NGX_OK);
+
+    /* operation */
+
+    n = 0;
+
+    rc = ngx_http_upstream_conf_arg(r, "add", &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        args->op = NGX_HTTP_UPSTREAM_CONF_ADD;
+        n++;
+    }
+
+    rc = ngx_http_upstream_conf_arg(r, "remove", &value);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_OK) {
+        args->op = NGX_HTTP_UPSTREAM_CONF_REMOVE;
+        n++;
+    }
+
+    if (n > 1) {
+        args->err = "only one of \"add\" and \"remove\" is allowed";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if (n == 0
+        && (args->weight != NGX_CONF_UNSET
+            || args->max_fails != NGX_CONF_UNSET
+            || args->fail_timeout != NGX_CONF_UNSET
+            || args->down != NGX_CONF_UNSET_UINT
+            || args->drain))
+    {
+        args->op = NGX_HTTP_UPSTREAM_CONF_EDIT;
+    }
+
+    switch (args->op) {
+
+    case NGX_HTTP_UPSTREAM_CONF_ADD:
+
+        if (args->id != NGX_CONF_UNSET) {
+            args->err = "id is not allowed when adding a server";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        rc = ngx_http_upstream_conf_arg(r, "server", &args->url.url);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (rc == NGX_DECLINED || args->url.url.len == 0) {
+            args->err = "server argument is required";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        /* names are not resolved here, as that would block the worker */
+
+        args->url.default_port = 80;
+        args->url.no_resolve = 1;
+
+        if (ngx_parse_url(r->pool, &args->url) != NGX_OK) {
+            if (args->url.err == NULL) {
+                return NGX_ERROR;
+            }
+
+            args->err = args->url.err;
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        if (args->url.naddrs == 0) {
+            args->err = "server address must be an IP address";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        if (args->url.uri.len) {
+            args->err = "server address must not contain uri";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        break;
+
+    case NGX_HTTP_UPSTREAM_CONF_REMOVE:
+    case NGX_HTTP_UPSTREAM_CONF_EDIT:
+
+        if (args->id == NGX_CONF_UNSET) {
+            args->err = "id argument is required";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        break;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_arg(ngx_http_request_t *r, char *name,
+    ngx_str_t *value)
+{
+    u_char     *dst, *src;
+    ngx_str_t   arg;
+
+    if (ngx_http_arg(r, (u_char *) name, ngx_strlen(name), &arg) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    dst = ngx_pnalloc(r->pool, arg.len);
+    if (dst == NULL) {
+        return NGX_ERROR;
+    }
+
+    value->data = dst;
+    src = arg.data;
+
+    ngx_unescape_uri(&dst, &src, arg.len, 0);
+
+    value->len = dst - value->data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_process(ngx_http_request_t *r,
+    ngx_http_upstream_conf_args_t *args, ngx_buf_t **bp)
+{
+    ngx_int_t                        rc;
+    ngx_uint_t                       i;
+    ngx_http_upstream_rr_peer_t     *peer;
+    ngx_http_upstream_rr_peers_t    *peers, *backup;
+    ngx_http_upstream_srv_conf_t    *uscf, **uscfp;
+    ngx_http_upstream_main_conf_t   *umcf;
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    uscf = NULL;
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->host.len != args->upstream.len
+            || ngx_strncasecmp(uscfp[i]->host.data, args->upstream.data,
+                               args->upstream.len)
+               != 0)
+        {
+            continue;
+        }
+
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone) {
+            break;
+        }
+    }
+
+    if (uscf == NULL) {
+        args->err = "upstream not found";
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    if (uscf->shm_zone == NULL
+        || !(uscf->flags & NGX_HTTP_UPSTREAM_MODIFY))
+    {
+        args->err = "upstream is not in shared memory";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    peers = uscf->peer.data;
+
+    if (args->op == NGX_HTTP_UPSTREAM_CONF_LIST) {
+
+        ngx_http_upstream_rr_peers_rlock(peers);
+
+        backup = peers->next;
+
+        if (backup) {
+            ngx_http_upstream_rr_peers_rlock(backup);
+        }
+
+        peer = NULL;
+        rc = NGX_HTTP_OK;
+
+        if (args->id != NGX_CONF_UNSET) {
+            peer = ngx_http_upstream_conf_find(peers, args->id, NULL);
+
+            if (peer == NULL) {
+                args->err = "server not found";
+                rc = NGX_HTTP_NOT_FOUND;
+            }
+        }
+
+        if (rc == NGX_HTTP_OK) {
+            *bp = ngx_http_upstream_conf_list(r, peers, peer);
+
+            if (*bp == NULL) {
+                rc = NGX_ERROR;
+            }
+        }
+
+        if (backup) {
+            ngx_http_upstream_rr_peers_unlock(backup);
+        }
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        return rc;
+    }
+
+    /*
+     * changes of either list are made under write locks of both,
+     * the primary list first
+     */
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    backup = peers->next;
+
+    if (backup) {
+        ngx_http_upstream_rr_peers_wlock(backup);
+    }
+
+    peer = NULL;
+
+    rc = ngx_http_upstream_conf_modify(r, args, uscf, &peer);
+
+    if (rc == NGX_HTTP_OK) {
+        *bp = ngx_http_upstream_conf_list(r, peers, peer);
+
+        if (*bp == NULL) {
+            rc = NGX_ERROR;
+        }
+    }
+
+    if (backup) {
+        ngx_http_upstream_rr_peers_unlock(backup);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_modify(ngx_http_request_t *r,
+    ngx_http_upstream_conf_args_t *args, ngx_http_upstream_srv_conf_t *uscf,
+    ngx_http_upstream_rr_peer_t **peerp)
+{
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers, *list;
+
+    if (args->weight != NGX_CONF_UNSET
+        && !(uscf->flags & NGX_HTTP_UPSTREAM_WEIGHT))
+    {
+        args->err = "balancing method does not support parameter \"weight\"";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if (args->max_fails != NGX_CONF_UNSET
+        && !(uscf->flags & NGX_HTTP_UPSTREAM_MAX_FAILS))
+    {
+        args->err = "balancing method does not support "
+                    "parameter \"max_fails\"";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if (args->fail_timeout != NGX_CONF_UNSET
+        && !(uscf->flags & NGX_HTTP_UPSTREAM_FAIL_TIMEOUT))
+    {
+        args->err = "balancing method does not support "
+                    "parameter \"fail_timeout\"";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if ((args->down != NGX_CONF_UNSET_UINT || args->drain)
+        && !(uscf->flags & NGX_HTTP_UPSTREAM_DOWN))
+    {
+        args->err = "balancing method does not support parameter \"down\"";
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if (args->op == NGX_HTTP_UPSTREAM_CONF_ADD) {
+        return ngx_http_upstream_conf_add(args, uscf, peerp);
+    }
+
+    peers = uscf->peer.data;
+
+    peer = ngx_http_upstream_conf_find(peers, args->id, &list);
+
+    if (peer == NULL) {
+        args->err = "server not found";
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    if (args->op == NGX_HTTP_UPSTREAM_CONF_REMOVE) {
+
+        /* peers of a resolved name would come back with the next answer */
+
+        if (peer->host) {
+            args->err = "server is resolved from a name and "
+                        "cannot be removed";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                      "upstream \"%V\": removed server %V",
+                      &uscf->host, &peer->name);
+
+        ngx_http_upstream_zone_remove_peer(list, peer);
+
+        return NGX_HTTP_OK;
+    }
+
+    /* NGX_HTTP_UPSTREAM_CONF_EDIT */
+
+    if (args->weight != NGX_CONF_UNSET) {
+        list->total_weight += args->weight - peer->weight;
+        list->weighted = (list->total_weight != list->number);
+
+        peer->weight = args->weight;
+        peer->effective_weight = args->weight;
+        peer->current_weight = 0;
+
+        /* balancers keep data derived from weights */
+
+        (*list->config)++;
+    }
+
+    if (args->max_fails != NGX_CONF_UNSET) {
+        peer->max_fails = args->max_fails;
+    }
+
+    if (args->fail_timeout != NGX_CONF_UNSET) {
+        peer->fail_timeout = args->fail_timeout;
+    }
+
+    /* the state set by health checks is kept */
+
+    if (args->down != NGX_CONF_UNSET_UINT) {
+        peer->down &= ~NGX_HTTP_UPSTREAM_PEER_DOWN;
+        peer->down |= args->down ? NGX_HTTP_UPSTREAM_PEER_DOWN : 0;
+        peer->drain = 0;
+    }
+
+    if (args->drain) {
+
+        /* requests in progress complete, new ones go elsewhere */
+
+        peer->down |= NGX_HTTP_UPSTREAM_PEER_DOWN;
+        peer->drain = 1;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, r->connection->log, 0,
+                  "upstream \"%V\": modified server %V",
+                  &uscf->host, &peer->name);
+
+    *peerp = peer;
+
+    return NGX_HTTP_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_conf_add(ngx_http_upstream_conf_args_t *args,
+    ngx_http_upstream_srv_conf_t *uscf, ngx_http_upstream_rr_peer_t **peerp)
+{
+    ngx_slab_pool_t               *shpool;
+    ngx_http_upstream_rr_peer_t    tmp, *peer;
+    ngx_http_upstream_rr_peers_t  *peers, *list;
+
+    peers = uscf->peer.data;
+    list = peers;
+
+    if (args->backup) {
+
+        if (!(uscf->flags & NGX_HTTP_UPSTREAM_BACKUP)) {
+            args->err = "balancing method does not support "
+                        "parameter \"backup\"";
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        if (peers->next == NULL) {
+
+            /* the list is not yet reachable and needs no lock */
+
+            shpool = peers->shpool;
+
+            list = ngx_slab_calloc(shpool,
+                                   sizeof(ngx_http_upstream_rr_peers_t));
+            if (list == NULL) {
+                args->err = "no memory in upstream zone";
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            list->shpool = shpool;
+            list->config = peers->config;
+            list->name = peers->name;
+
+            peers->next = list;
+
+        } else {
+            list = peers->next;
+        }
+    }
+
+    ngx_memzero(&tmp, sizeof(ngx_http_upstream_rr_peer_t));
+
+    tmp.sockaddr = args->url.addrs[0].sockaddr;
+    tmp.socklen = args->url.addrs[0].socklen;
+    tmp.name = args->url.addrs[0].name;
+    tmp.server = args->url.url;
+
+    tmp.weight = (args->weight != NGX_CONF_UNSET) ? args->weight : 1;
+    tmp.max_fails = (args->max_fails != NGX_CONF_UNSET) ? args->max_fails : 1;
+    tmp.fail_timeout = (args->fail_timeout != NGX_CONF_UNSET)
+                       ? args->fail_timeout : 10;
+
+    if (args->down != NGX_CONF_UNSET_UINT && args->down) {
+        tmp.down = NGX_HTTP_UPSTREAM_PEER_DOWN;
+    }
+
+    if (args->drain) {
+        tmp.down = NGX_HTTP_UPSTREAM_PEER_DOWN;
+        tmp.drain = 1;
+    }
+
+    peer = ngx_http_upstream_zone_add_peer(list, &tmp);
+
+    if (peer == NULL) {
+        args->err = "no memory in upstream zone";
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "upstream \"%V\": added server %V",
+                  &uscf->host, &peer->name);
+
+    *peerp = peer;
+
+    return NGX_HTTP_OK;
+}
+
+
+static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_conf_find(ngx_http_upstream_rr_peers_t *peers,
+    ngx_uint_t id, ngx_http_upstream_rr_peers_t **list)
+{
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    for ( /* void */ ; peers; peers = peers->next) {
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+
+            if (peer->id == id) {
+                if (list) {
+                    *list = peers;
+                }
+
+                return peer;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+static ngx_buf_t *
+ngx_http_upstream_conf_list(ngx_http_request_t *r,
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *one)
+{
+    size_t                         size;
+    ngx_buf_t                     *b;
+    ngx_uint_t                     backup;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *list;
+
+    size = one ? 0 : NGX_HTTP_UPSTREAM_CONF_STATS;
+
+    for (list = peers; list; list = list->next) {
+        for (peer = list->peer; peer; peer = peer->next) {
+
+            if (one && peer != one) {
+                continue;
+            }
+
+            size += NGX_HTTP_UPSTREAM_CONF_LINE + peer->name.len;
+
+            if (peer->host) {
+                size += peer->host->name.len;
+            }
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool, size ? size : 1);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    backup = 0;
+
+    for (list = peers; list; list = list->next, backup = 1) {
+        for (peer = list->peer; peer; peer = peer->next) {
+
+            if (one && peer != one) {
+                continue;
+            }
+
+            b->last = ngx_http_upstream_conf_print(b->last, peer, backup);
+        }
+    }
+
+    /* connections counted by the keepalive module */
+
+    if (one == NULL && (peers->connects || peers->reused)) {
+        b->last = ngx_sprintf(b->last, "# connects=%uA, reused=%uA\n",
+                              peers->connects, peers->reused);
+    }
+
+    return b;
+}
+
+
+static u_char *
+ngx_http_upstream_conf_print(u_char *p, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t backup)
+{
+    p = ngx_sprintf(p, "server %V", &peer->name);
+
+    if (peer->weight != 1) {
+        p = ngx_sprintf(p, " weight=%i", peer->weight);
+    }
+
+    if (peer->max_fails != 1) {
+        p = ngx_sprintf(p, " max_fails=%ui", peer->max_fails);
+    }
+
+    if (peer->fail_timeout != 10) {
+        p = ngx_sprintf(p, " fail_timeout=%Ts", peer->fail_timeout);
+    }
+
+    if (backup) {
+        p = ngx_cpymem(p, " backup", sizeof(" backup") - 1);
+    }
+
+    if (peer->drain) {
+        p = ngx_cpymem(p, " drain", sizeof(" drain") - 1);
+
+    } else if (peer->down & NGX_HTTP_UPSTREAM_PEER_DOWN) {
+        p = ngx_cpymem(p, " down", sizeof(" down") - 1);
+    }
+
+    p = ngx_sprintf(p, "; # id=%ui, conns=%ui", peer->id, peer->conns);
+
+    if (peer->down & NGX_HTTP_UPSTREAM_PEER_UNHEALTHY) {
+        p = ngx_cpymem(p, ", unhealthy", sizeof(", unhealthy") - 1);
+    }
+
+    if (peer->host) {
+        p = ngx_sprintf(p, ", host=%V", &peer->host->name);
+    }
+
+    *p++ = LF;
+
+    return p;
+}
+
+
+static char *
+ngx_http_upstream_conf(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    if (clcf->handler == ngx_http_upstream_conf_handler) {
+        return "is duplicate";
+    }
+
+    clcf->handler = ngx_http_upstream_conf_handler;
+
+    return NGX_CONF_OK;
+}
@@ -25,6 +25,11 @@ typedef struct {
 typedef struct {
     ngx_http_complex_value_t            key;
     ngx_http_upstream_chash_points_t   *points;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                          npoints;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_uint_t                          config;
+#endif
 } ngx_http_upstream_hash_srv_conf_t;
 
 
@@ -49,6 +54,12 @@ static ngx_int_t ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc,
 
 static ngx_int_t ngx_http_upstream_init_chash(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_update_chash(ngx_pool_t *pool,
+    ngx_http_upstream_hash_srv_conf_t *hcf,
+    ngx_http_upstream_rr_peers_t *peers);
+static void ngx_http_upstream_chash_add_points(
+    ngx_http_upstream_chash_points_t *points,
+    ngx_http_upstream_rr_peer_t *peer);
 static int ngx_libc_cdecl
     ngx_http_upstream_chash_cmp_points(const void *one, const void *two);
 static ngx_uint_t ngx_http_upstream_find_chash_point(
@@ -179,7 +190,17 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single) {
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (hp->rrp.peers->config && hp->rrp.config != *hp->rrp.peers->config) {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+#endif
+
+    if (hp->tries > 20
+        || hp->rrp.peers->single
+        || hp->rrp.peers->number == 0)
+    {
         ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
@@ -276,19 +297,7 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 static ngx_int_t
 ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 {
-    u_char                             *host, *port, c;
-    size_t                              host_len, port_len, size;
-    uint32_t                            hash, base_hash;
-    ngx_str_t                          *server;
-    ngx_uint_t                          npoints, i, j;
-    ngx_http_upstream_rr_peer_t        *peer;
-    ngx_http_upstream_rr_peers_t       *peers;
-    ngx_http_upstream_chash_points_t   *points;
     ngx_http_upstream_hash_srv_conf_t  *hcf;
-    union {
-        uint32_t                        value;
-        u_char                          byte[4];
-    } prev_hash;
 
     if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
         return NGX_ERROR;
@@ -296,106 +305,191 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 
     us->peer.init = ngx_http_upstream_init_chash_peer;
 
-    peers = us->peer.data;
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+
+    return ngx_http_upstream_update_chash(cf->pool, hcf, us->peer.data);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_update_chash(ngx_pool_t *pool,
+    ngx_http_upstream_hash_srv_conf_t *hcf,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    size_t                              size;
+    ngx_uint_t                          npoints, i, j;
+    ngx_http_upstream_rr_peer_t        *peer;
+    ngx_http_upstream_chash_points_t   *points;
+
     npoints = peers->total_weight * 160;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /*
+     * servers resolved at run time are placed on the points of their
+     * names, so that the points do not change when the addresses do
+     */
+
+    for (peer = peers->resolve; peer; peer = peer->next) {
+        npoints += peer->weight * 160;
+    }
+
+#endif
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /* the points are rebuilt in place while the peers fit */
+
+    if (hcf->points && npoints <= hcf->npoints) {
+        points = hcf->points;
+        goto rebuild;
+    }
+
+    npoints = ngx_max(npoints, hcf->npoints * 2);
+    hcf->npoints = npoints;
+
+#endif
+
     size = sizeof(ngx_http_upstream_chash_points_t)
            + sizeof(ngx_http_upstream_chash_point_t) * (npoints - 1);
 
-    points = ngx_palloc(cf->pool, size);
+    points = ngx_palloc(pool, size);
     if (points == NULL) {
         return NGX_ERROR;
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+rebuild:
+#endif
+
     points->number = 0;
 
     for (peer = peers->peer; peer; peer = peer->next) {
-        server = &peer->server;
-
-        /*
-         * Hash expression is compatible with Cache::Memcached::Fast:
-         * crc32(HOST \0 PORT PREV_HASH).
-         */
 
-        if (server->len >= 5
-            && ngx_strncasecmp(server->data, (u_char *) "unix:", 5) == 0)
-        {
-            host = server->data + 5;
-            host_len = server->len - 5;
-            port = NULL;
-            port_len = 0;
-            goto done;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (peer->host) {
+            continue;
         }
+#endif
 
-        for (j = 0; j < server->len; j++) {
-            c = server->data[server->len - j - 1];
+        ngx_http_upstream_chash_add_points(points, peer);
+    }
 
-            if (c == ':') {
-                host = server->data;
-                host_len = server->len - j - 1;
-                port = server->data + server->len - j;
-                port_len = j;
-                goto done;
-            }
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    for (peer = peers->resolve; peer; peer = peer->next) {
+        ngx_http_upstream_chash_add_points(points, peer);
+    }
+
+#endif
+
+    ngx_qsort(points->point,
+              points->number,
+              sizeof(ngx_http_upstream_chash_point_t),
+              ngx_http_upstream_chash_cmp_points);
 
-            if (c < '0' || c > '9') {
-                break;
+    if (points->number) {
+        for (i = 0, j = 1; j < points->number; j++) {
+            if (points->point[i].hash != points->point[j].hash) {
+                points->point[++i] = points->point[j];
             }
         }
 
-        host = server->data;
-        host_len = server->len;
-        port = NULL;
-        port_len = 0;
+        points->number = i + 1;
+    }
 
-    done:
+    hcf->points = points;
 
-        ngx_crc32_init(base_hash);
-        ngx_crc32_update(&base_hash, host, host_len);
-        ngx_crc32_update(&base_hash, (u_char *) "", 1);
-        ngx_crc32_update(&base_hash, port, port_len);
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    hcf->peers = peers;
+    hcf->config = peers->config ? *peers->config : 0;
+#endif
 
-        prev_hash.value = 0;
-        npoints = peer->weight * 160;
+    return NGX_OK;
+}
 
-        for (j = 0; j < npoints; j++) {
-            hash = base_hash;
 
-            ngx_crc32_update(&hash, prev_hash.byte, 4);
-            ngx_crc32_final(hash);
+static void
+ngx_http_upstream_chash_add_points(ngx_http_upstream_chash_points_t *points,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    u_char       *host, *port, c;
+    size_t        host_len, port_len;
+    uint32_t      hash, base_hash;
+    ngx_str_t    *server;
+    ngx_uint_t    npoints, j;
+    union {
+        uint32_t  value;
+        u_char    byte[4];
+    } prev_hash;
 
-            points->point[points->number].hash = hash;
-            points->point[points->number].server = server;
-            points->number++;
+    server = &peer->server;
 
-#if (NGX_HAVE_LITTLE_ENDIAN)
-            prev_hash.value = hash;
-#else
-            prev_hash.byte[0] = (u_char) (hash & 0xff);
-            prev_hash.byte[1] = (u_char) ((hash >> 8) & 0xff);
-            prev_hash.byte[2] = (u_char) ((hash >> 16) & 0xff);
-            prev_hash.byte[3] = (u_char) ((hash >> 24) & 0xff);
-#endif
-        }
+    /*
+     * Hash expression is compatible with Cache::Memcached::Fast:
+     * crc32(HOST \0 PORT PREV_HASH).
+     */
+
+    if (server->len >= 5
+        && ngx_strncasecmp(server->data, (u_char *) "unix:", 5) == 0)
+    {
+        host = server->data + 5;
+        host_len = server->len - 5;
+        port = NULL;
+        port_len = 0;
+        goto done;
     }
 
-    ngx_qsort(points->point,
-              points->number,
-              sizeof(ngx_http_upstream_chash_point_t),
-              ngx_http_upstream_chash_cmp_points);
+    for (j = 0; j < server->len; j++) {
+        c = server->data[server->len - j - 1];
 
-    for (i = 0, j = 1; j < points->number; j++) {
-        if (points->point[i].hash != points->point[j].hash) {
-            points->point[++i] = points->point[j];
+        if (c == ':') {
+            host = server->data;
+            host_len = server->len - j - 1;
+            port = server->data + server->len - j;
+            port_len = j;
+            goto done;
+        }
+
+        if (c < '0' || c > '9') {
+            break;
         }
     }
 
-    points->number = i + 1;
+    host = server->data;
+    host_len = server->len;
+    port = NULL;
+    port_len = 0;
 
-    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
-    hcf->points = points;
+done:
 
-    return NGX_OK;
+    ngx_crc32_init(base_hash);
+    ngx_crc32_update(&base_hash, host, host_len);
+    ngx_crc32_update(&base_hash, (u_char *) "", 1);
+    ngx_crc32_update(&base_hash, port, port_len);
+
+    prev_hash.value = 0;
+    npoints = peer->weight * 160;
+
+    for (j = 0; j < npoints; j++) {
+        hash = base_hash;
+
+        ngx_crc32_update(&hash, prev_hash.byte, 4);
+        ngx_crc32_final(hash);
+
+        points->point[points->number].hash = hash;
+        points->point[points->number].server = server;
+        points->number++;
+
+#if (NGX_HAVE_LITTLE_ENDIAN)
+        prev_hash.value = hash;
+#else
+        prev_hash.byte[0] = (u_char) (hash & 0xff);
+        prev_hash.byte[1] = (u_char) ((hash >> 8) & 0xff);
+        prev_hash.byte[2] = (u_char) ((hash >> 16) & 0xff);
+        prev_hash.byte[3] = (u_char) ((hash >> 24) & 0xff);
+#endif
+    }
 }
 
 
@@ -472,6 +566,27 @@ ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
 
     ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /*
+     * the points refer to server names of the peers in use, and
+     * are rebuilt after the zone copy and after each change of the list
+     */
+
+    if (hcf->peers != hp->rrp.peers
+        || (hp->rrp.peers->config && hcf->config != *hp->rrp.peers->config))
+    {
+        if (ngx_http_upstream_update_chash(ngx_cycle->pool, hcf,
+                                           hp->rrp.peers)
+            != NGX_OK)
+        {
+            ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
     hp->hash = ngx_http_upstream_find_chash_point(hcf->points, hash);
 
     ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
@@ -500,6 +615,13 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (hp->rrp.peers->config && hp->rrp.config != *hp->rrp.peers->config) {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+#endif
+
     pc->cached = 0;
     pc->connection = NULL;
 
@@ -509,6 +631,11 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
     points = hcf->points;
     point = &points->point[0];
 
+    if (points->number == 0) {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return NGX_BUSY;
+    }
+
     for ( ;; ) {
         server = point[hp->hash % points->number].server;
 
@@ -614,6 +741,12 @@ ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
 
     conf->points = NULL;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    conf->npoints = 0;
+    conf->peers = NULL;
+    conf->config = 0;
+#endif
+
     return conf;
 }
 
@@ -14,6 +14,12 @@ typedef struct
 {
 	//ܹngx_connection_tĿ(ͬʱҲǷngx_http_upstream_keepalive_cache_t)
     ngx_uint_t                         max_cached;
+	//keepaliveָper_serverÿ˷໺0ʾ
+    ngx_uint_t                         max_per_server;
+	//keepalive_requestsָһ෢͵ﵽٻ棬0ʾ
+    ngx_uint_t                         requests;
+	//keepalive_timeoutָӵĿгʱʱ䣬ʱرӣ0ʾ
+    ngx_msec_t                         timeout;
 	//ӶУcacheΪӳأfreeΪӳءʼʱkeepalive
 	//ָĲʼfreeУӹfree
 	//ȡӣ󽫳ӻ浽cacheУӱϿʱٴcache
@@ -52,6 +58,11 @@ typedef struct
 
     ngx_http_upstream_t               *upstream;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+	//ͳ½͸иؾģpeer.dataǸýṹ
+    ngx_http_upstream_rr_peers_t      *peers;
+#endif
+
     void                              *data;
     ngx_event_get_peer_pt              original_get_peer;
     ngx_event_free_peer_pt             original_free_peer;
@@ -85,13 +96,31 @@ static ngx_command_t  ngx_http_upstream_keepalive_commands[] =
 {
     { 
 		ngx_string("keepalive"),
-		NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+		NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
 		ngx_http_upstream_keepalive,
 		NGX_HTTP_SRV_CONF_OFFSET,
 		0,
 		NULL 
     },
 
+    { 
+		ngx_string("keepalive_timeout"),
+		NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+		ngx_conf_set_msec_slot,
+		NGX_HTTP_SRV_CONF_OFFSET,
+		offsetof(ngx_http_upstream_keepalive_srv_conf_t, timeout),
+		NULL 
+    },
+
+    { 
+		ngx_string("keepalive_requests"),
+		NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+		ngx_conf_set_num_slot,
+		NGX_HTTP_SRV_CONF_OFFSET,
+		offsetof(ngx_http_upstream_keepalive_srv_conf_t, requests),
+		NULL 
+    },
+
     ngx_null_command
 };
 
@@ -140,6 +169,12 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *u
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0, "init keepalive");
 
     kcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_keepalive_module);
+
+    /* without the directives connections are cached as before */
+
+    ngx_conf_init_msec_value(kcf->timeout, 0);
+    ngx_conf_init_uint_value(kcf->requests, 0);
+
 	//ִԭʼʼupstreamngx_http_upstream_init_round_robinú
 	//õĺ˵ַsocketַӺˣus->peer.init
 	//Ϊngx_http_upstream_init_round_robin_peer
@@ -200,6 +235,9 @@ ngx_http_upstream_init_keepalive_peer(ngx_http_request_t *r, ngx_http_upstream_s
 	// keepaliveģ򱣴ԭʼӣʹµĸ๳ӸǾɹ
     kp->conf = kcf;
     kp->upstream = r->upstream;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    kp->peers = us->peer.data;
+#endif
     kp->data = r->upstream->peer.data;
     kp->original_get_peer = r->upstream->peer.get;
     kp->original_free_peer = r->upstream->peer.free;
@@ -258,10 +296,24 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
         }
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    (void) ngx_atomic_fetch_add(&kp->peers->connects, 1);
+#endif
+
     return NGX_OK;
 
 found:
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    (void) ngx_atomic_fetch_add(&kp->peers->reused, 1);
+#endif
+
+	//ɾгʱʱ
+    if (c->read->timer_set) 
+	{
+        ngx_del_timer(c->read);
+    }
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0, "get keepalive peer: using connection %p", c);
 
     c->idle = 0;
@@ -284,7 +336,8 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data, ngx
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
     ngx_http_upstream_keepalive_cache_t      *item;
 
-    ngx_queue_t          *q;
+    ngx_uint_t            n;
+    ngx_queue_t          *q, *last, *cache;
     ngx_connection_t     *c;
     ngx_http_upstream_t  *u;
 
@@ -311,6 +364,11 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data, ngx
         goto invalid;
     }
 
+    if (kp->conf->requests && c->requests >= kp->conf->requests) 
+	{
+        goto invalid;
+    }
+
     if (ngx_terminate || ngx_exiting) 
 	{
         goto invalid;
@@ -324,6 +382,39 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data, ngx
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0, "free keepalive peer: saving connection %p", c);
 
+    cache = &kp->conf->cache;
+
+	//ÿ˷Ļʱ÷ĻӴﵽޣر
+	//ʹõӣcacheԽԽδãitem浱ǰ
+    if (kp->conf->max_per_server) 
+	{
+        n = 0;
+        last = NULL;
+
+        for (q = ngx_queue_head(cache); q != ngx_queue_sentinel(cache); q = ngx_queue_next(q))
+        {
+            item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+            if (ngx_memn2cmp((u_char *) &item->sockaddr, (u_char *) pc->sockaddr, item->socklen, pc->socklen) == 0)
+            {
+                n++;
+                last = q;
+            }
+        }
+
+        if (n >= kp->conf->max_per_server) 
+		{
+            q = last;
+            ngx_queue_remove(q);
+
+            item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
+
+            ngx_http_upstream_keepalive_close(item->connection);
+
+            goto save;
+        }
+    }
+
 	//freeпcache itemsΪգcacheȡһʹitem
 	//itemӦǸӹرգitemڱ浱ǰҪͷŵ
     if (ngx_queue_empty(&kp->conf->free)) 
@@ -345,7 +436,9 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data, ngx
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
     }
 
-    ngx_queue_insert_head(&kp->conf->cache, q);
+save:
+
+    ngx_queue_insert_head(cache, q);
 
 	//浱ǰӣitemcacheУȻpc->connectionÿգֹϲ
 	//ngx_http_upstream_finalize_requestرոӣú
@@ -373,6 +466,11 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data, ngx
     c->write->log = ngx_cycle->log;
     c->pool->log = ngx_cycle->log;
 
+	//гkeepalive_timeoutĻɶʱر
+    if (kp->conf->timeout) {
+        ngx_add_timer(c->read, kp->conf->timeout);
+    }
+
 	// socketַϢͨͬsocketַø
     item->socklen = pc->socklen;
     ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
@@ -409,12 +507,28 @@ ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
 
     c = ev->data;
 
-    if (c->close)
+    if (c->close || c->read->timedout)
 	{
         goto close;
     }
 
-    n = recv(c->fd, buf, 1, MSG_PEEK);
+    if ((ngx_io.flags & NGX_IO_ASYNC_RECV) && c->recv == ngx_recv) {
+
+        /*
+         * the data may be already received from the socket by the event
+         * method, any data close the connection anyway
+         */
+
+        n = c->recv(c, (u_char *) buf, 1);
+
+        if (n == NGX_AGAIN) {
+            n = -1;
+            ngx_set_socket_errno(NGX_EAGAIN);
+        }
+
+    } else {
+        n = recv(c->fd, buf, 1, MSG_PEEK);
+    }
 
     if (n == -1 && ngx_socket_errno == NGX_EAGAIN) 
 	{
@@ -505,8 +619,12 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
      *     conf->original_init_upstream = NULL;
      *     conf->original_init_peer = NULL;
      *     conf->max_cached = 0;
+     *     conf->max_per_server = 0;
      */
 
+    conf->timeout = NGX_CONF_UNSET_MSEC;
+    conf->requests = NGX_CONF_UNSET_UINT;
+
     return conf;
 }
 
@@ -519,6 +637,7 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ngx_int_t    n;
     ngx_str_t   *value;
+    ngx_uint_t   i;
 
     if (kcf->max_cached) 
 	{
@@ -538,6 +657,25 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     kcf->max_cached = n;
+
+    for (i = 2; i < cf->args->nelts; i++) 
+	{
+        if (ngx_strncmp(value[i].data, "per_server=", 11) == 0) 
+		{
+            n = ngx_atoi(&value[i].data[11], value[i].len - 11);
+
+            if (n == NGX_ERROR || n == 0) 
+			{
+                goto invalid;
+            }
+
+            kcf->max_per_server = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
 	
 	// ȡupstreamģserver conf
     uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
@@ -548,4 +686,10 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     uscf->peer.init_upstream = ngx_http_upstream_init_keepalive;
 
     return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
 }
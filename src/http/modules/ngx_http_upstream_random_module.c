@@ -0,0 +1,664 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_RANDOM_LEAST_CONN  1
+#define NGX_HTTP_UPSTREAM_RANDOM_LEAST_TIME  2
+
+#define NGX_HTTP_UPSTREAM_RANDOM_TRIES       20
+
+/* response time added to each peer's average, in microseconds */
+#define NGX_HTTP_UPSTREAM_RANDOM_TIME_BASE   1000
+
+
+typedef struct {
+    ngx_http_upstream_rr_peer_t          *peer;
+    ngx_uint_t                            range;
+} ngx_http_upstream_random_range_t;
+
+
+typedef struct {
+    ngx_http_upstream_random_range_t     *ranges;
+    ngx_uint_t                            nranges;
+    ngx_http_upstream_rr_peers_t         *peers;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                            config;
+#endif
+    ngx_uint_t                            method;
+    unsigned                              two:1;
+} ngx_http_upstream_random_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t      rrp;
+
+    ngx_http_upstream_random_srv_conf_t  *conf;
+    ngx_msec_t                            start;
+    ngx_uint_t                            tries;
+} ngx_http_upstream_random_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_random(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_update_random(ngx_pool_t *pool,
+    ngx_http_upstream_random_srv_conf_t *rcf,
+    ngx_http_upstream_rr_peers_t *peers);
+static ngx_int_t ngx_http_upstream_init_random_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_random_peer(ngx_peer_connection_t *pc,
+    void *data);
+static ngx_int_t ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc,
+    void *data);
+static ngx_uint_t ngx_http_upstream_peek_random_peer(
+    ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_random_srv_conf_t *rcf);
+static ngx_int_t ngx_http_upstream_random_peer_usable(
+    ngx_http_upstream_rr_peer_data_t *rrp, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t i, time_t now);
+static ngx_int_t ngx_http_upstream_random_compare(ngx_uint_t method,
+    ngx_http_upstream_rr_peer_t *a, ngx_http_upstream_rr_peer_t *b);
+static void ngx_http_upstream_free_random_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static void *ngx_http_upstream_random_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_random(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_random_commands[] = {
+
+    { ngx_string("random"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE12,
+      ngx_http_upstream_random,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_random_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_random_create_conf,  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_random_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_random_module_ctx,  /* module context */
+    ngx_http_upstream_random_commands,     /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_random(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_random_srv_conf_t  *rcf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0, "init random");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_random_peer;
+
+    rcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_random_module);
+
+    return ngx_http_upstream_update_random(cf->pool, rcf, us->peer.data);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_update_random(ngx_pool_t *pool,
+    ngx_http_upstream_random_srv_conf_t *rcf,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t                         n, total_weight;
+    ngx_http_upstream_rr_peer_t       *peer;
+    ngx_http_upstream_random_range_t  *range;
+
+    if (peers->number > rcf->nranges) {
+
+        /* peers resolved at run time may grow the list */
+
+        n = ngx_max(peers->number, rcf->nranges * 2);
+
+        range = ngx_palloc(pool, n * sizeof(ngx_http_upstream_random_range_t));
+        if (range == NULL) {
+            return NGX_ERROR;
+        }
+
+        rcf->ranges = range;
+        rcf->nranges = n;
+    }
+
+    /*
+     * the ranges are cumulative weights in peer list order, so that
+     * a random number below total_weight maps to a peer with a binary search
+     */
+
+    range = rcf->ranges;
+    total_weight = 0;
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+        total_weight += peer->weight;
+        range->peer = peer;
+        range->range = total_weight;
+        range++;
+    }
+
+    rcf->peers = peers;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    rcf->config = peers->config ? *peers->config : 0;
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_random_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_random_srv_conf_t   *rcf;
+    ngx_http_upstream_random_peer_data_t  *rp;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_int_t                              rc;
+    ngx_http_upstream_rr_peers_t          *peers;
+#endif
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init random peer");
+
+    rcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_random_module);
+
+    rp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_random_peer_data_t));
+    if (rp == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &rp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /*
+     * the upstream zone replaces configured peers with a shared copy,
+     * and the list changes as names are resolved at run time
+     */
+
+    peers = rp->rrp.peers;
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    if (rcf->peers != peers
+        || (peers->config && rcf->config != *peers->config))
+    {
+        rc = ngx_http_upstream_update_random(ngx_cycle->pool, rcf, peers);
+
+        if (rc != NGX_OK) {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+#endif
+
+    r->upstream->peer.get = rcf->two ? ngx_http_upstream_get_random2_peer
+                                     : ngx_http_upstream_get_random_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_random_peer;
+
+    rp->conf = rcf;
+    rp->start = 0;
+    rp->tries = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_random_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_random_peer_data_t  *rp = data;
+
+    time_t                             now;
+    uintptr_t                          m;
+    ngx_uint_t                         i, n;
+    ngx_http_upstream_rr_peer_t       *peer;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_rr_peer_data_t  *rrp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get random peer, try: %ui", pc->tries);
+
+    rrp = &rp->rrp;
+    peers = rrp->peers;
+
+    rp->start = ngx_current_msec;
+
+    if (rp->tries > NGX_HTTP_UPSTREAM_RANDOM_TRIES || peers->single) {
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config && rrp->config != *peers->config) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+#endif
+
+    if (peers->number == 0) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    for ( ;; ) {
+
+        i = ngx_http_upstream_peek_random_peer(peers, rp->conf);
+
+        peer = rp->conf->ranges[i].peer;
+
+        if (ngx_http_upstream_random_peer_usable(rrp, peer, i, now)) {
+            break;
+        }
+
+        if (++rp->tries > NGX_HTTP_UPSTREAM_RANDOM_TRIES) {
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+        }
+    }
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    peer->conns++;
+
+    rrp->current = peer;
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    rrp->tried[n] |= m;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_random2_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_random_peer_data_t  *rp = data;
+
+    time_t                             now;
+    uintptr_t                          m;
+    ngx_uint_t                         i, j, n;
+    ngx_http_upstream_rr_peer_t       *peer, *prev;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_rr_peer_data_t  *rrp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get random2 peer, try: %ui", pc->tries);
+
+    rrp = &rp->rrp;
+    peers = rrp->peers;
+
+    rp->start = ngx_current_msec;
+
+    if (rp->tries > NGX_HTTP_UPSTREAM_RANDOM_TRIES || peers->single) {
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config && rrp->config != *peers->config) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+#endif
+
+    if (peers->number == 0) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    /*
+     * pick two distinct usable peers at random and use the one with
+     * the lower load, as estimated by the configured method
+     */
+
+    prev = NULL;
+
+#if (NGX_SUPPRESS_WARN)
+    j = 0;
+#endif
+
+    for ( ;; ) {
+
+        i = ngx_http_upstream_peek_random_peer(peers, rp->conf);
+
+        peer = rp->conf->ranges[i].peer;
+
+        if (peer != prev
+            && ngx_http_upstream_random_peer_usable(rrp, peer, i, now))
+        {
+            if (prev) {
+                break;
+            }
+
+            prev = peer;
+            j = i;
+            continue;
+        }
+
+        if (++rp->tries > NGX_HTTP_UPSTREAM_RANDOM_TRIES) {
+
+            if (prev) {
+                peer = prev;
+                i = j;
+                goto found;
+            }
+
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+        }
+    }
+
+    if (ngx_http_upstream_random_compare(rp->conf->method, prev, peer) <= 0) {
+        peer = prev;
+        i = j;
+    }
+
+found:
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    peer->conns++;
+
+    rrp->current = peer;
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    rrp->tried[n] |= m;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_peek_random_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_random_srv_conf_t *rcf)
+{
+    ngx_uint_t  i, j, k, x;
+
+    x = ngx_random() % peers->total_weight;
+
+    i = 0;
+    j = peers->number - 1;
+
+    while (i < j) {
+        k = (i + j) / 2;
+
+        if (x < rcf->ranges[k].range) {
+            j = k;
+
+        } else {
+            i = k + 1;
+        }
+    }
+
+    return i;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_random_peer_usable(ngx_http_upstream_rr_peer_data_t *rrp,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t i, time_t now)
+{
+    uintptr_t   m;
+    ngx_uint_t  n;
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    if (rrp->tried[n] & m) {
+        return 0;
+    }
+
+    if (peer->down) {
+        return 0;
+    }
+
+    if (peer->max_fails
+        && peer->fails >= peer->max_fails
+        && now - peer->checked <= peer->fail_timeout)
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_random_compare(ngx_uint_t method,
+    ngx_http_upstream_rr_peer_t *a, ngx_http_upstream_rr_peer_t *b)
+{
+    uint64_t  la, lb;
+
+    if (method == NGX_HTTP_UPSTREAM_RANDOM_LEAST_TIME) {
+
+        /*
+         * the expected time to serve a request is the average response
+         * time multiplied by the number of requests already in flight;
+         * the base time keeps the number of connections significant
+         * while the averages of fast peers are still close to zero
+         */
+
+        la = (uint64_t) (a->response_time + NGX_HTTP_UPSTREAM_RANDOM_TIME_BASE)
+             * (a->conns + 1) * b->weight;
+        lb = (uint64_t) (b->response_time + NGX_HTTP_UPSTREAM_RANDOM_TIME_BASE)
+             * (b->conns + 1) * a->weight;
+
+    } else {
+        la = (uint64_t) a->conns * b->weight;
+        lb = (uint64_t) b->conns * a->weight;
+    }
+
+    if (la < lb) {
+        return -1;
+    }
+
+    return (la > lb);
+}
+
+
+static void
+ngx_http_upstream_free_random_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_random_peer_data_t  *rp = data;
+
+    ngx_uint_t                     rt;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free random peer %ui", state);
+
+    peer = rp->rrp.current;
+    peers = rp->rrp.peers;
+
+    if (rp->conf->method == NGX_HTTP_UPSTREAM_RANDOM_LEAST_TIME
+        && peer
+        && !(state & NGX_PEER_FAILED))
+    {
+        rt = (ngx_uint_t) (ngx_current_msec - rp->start) * 1000;
+
+        ngx_http_upstream_rr_peers_rlock(peers);
+        ngx_http_upstream_rr_peer_lock(peers, peer);
+
+        /* exponentially weighted moving average with a weight of 1/8 */
+
+        if (peer->response_time == 0) {
+            peer->response_time = rt;
+
+        } else {
+            peer->response_time = (peer->response_time * 7 + rt) / 8;
+        }
+
+        ngx_http_upstream_rr_peer_unlock(peers, peer);
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "free random peer time: %ui, average: %ui",
+                       rt, peer->response_time);
+    }
+
+    ngx_http_upstream_free_round_robin_peer(pc, &rp->rrp, state);
+}
+
+
+static void *
+ngx_http_upstream_random_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_random_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_random_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->ranges = NULL;
+     *     conf->nranges = 0;
+     *     conf->peers = NULL;
+     *     conf->method = 0;
+     *     conf->two = 0;
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_random(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_random_srv_conf_t  *rcf = conf;
+
+    ngx_str_t                     *value;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_random;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN;
+
+    if (cf->args->nelts == 1) {
+        return NGX_CONF_OK;
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "two") != 0) {
+        goto invalid;
+    }
+
+    rcf->two = 1;
+    rcf->method = NGX_HTTP_UPSTREAM_RANDOM_LEAST_CONN;
+
+    if (cf->args->nelts == 2) {
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcmp(value[2].data, "least_conn") == 0) {
+        return NGX_CONF_OK;
+    }
+
+    if (ngx_strcmp(value[2].data, "least_time") == 0) {
+        rcf->method = NGX_HTTP_UPSTREAM_RANDOM_LEAST_TIME;
+        return NGX_CONF_OK;
+    }
+
+    value++;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[1]);
+
+    return NGX_CONF_ERROR;
+}
@@ -10,12 +10,40 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_event_t                     event;
+    ngx_str_t                       name;
+    ngx_http_upstream_rr_peer_t    *template;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t   *uscf;
+} ngx_http_upstream_zone_resolve_t;
+
+
 static char *ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
     void *data);
 static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf);
+static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_list(
+    ngx_slab_pool_t *shpool, ngx_http_upstream_rr_peers_t *src,
+    ngx_uint_t *config);
+static ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_peer(
+    ngx_slab_pool_t *shpool, ngx_http_upstream_rr_peer_t *src);
+static void ngx_http_upstream_zone_free_peer_locked(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peer_t *peer);
+
+static char *ngx_http_upstream_zone_resolver(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static char *ngx_http_upstream_zone_resolver_timeout(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_http_upstream_zone_postconfiguration(ngx_conf_t *cf);
+static ngx_int_t ngx_http_upstream_zone_init_process(ngx_cycle_t *cycle);
+static void ngx_http_upstream_zone_resolve_timer(ngx_event_t *ev);
+static void ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx);
+static void ngx_http_upstream_zone_update_peers(
+    ngx_http_upstream_zone_resolve_t *zr, ngx_addr_t *addrs,
+    ngx_uint_t naddrs);
 
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
@@ -27,13 +55,27 @@ static ngx_command_t  ngx_http_upstream_zone_commands[] = {
       0,
       NULL },
 
+    { ngx_string("resolver"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_1MORE,
+      ngx_http_upstream_zone_resolver,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("resolver_timeout"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_zone_resolver_timeout,
+      0,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
 
 static ngx_http_module_t  ngx_http_upstream_zone_module_ctx = {
     NULL,                                  /* preconfiguration */
-    NULL,                                  /* postconfiguration */
+    ngx_http_upstream_zone_postconfiguration, /* postconfiguration */
 
     NULL,                                  /* create main configuration */
     NULL,                                  /* init main configuration */
@@ -53,7 +95,7 @@ ngx_module_t  ngx_http_upstream_zone_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_zone_init_process,   /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -185,62 +227,680 @@ static ngx_http_upstream_rr_peers_t *
 ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     ngx_http_upstream_srv_conf_t *uscf)
 {
-    ngx_http_upstream_rr_peer_t   *peer, **peerp;
+    ngx_uint_t                    *config;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
 
+    config = NULL;
+
+    if (uscf->flags & NGX_HTTP_UPSTREAM_MODIFY) {
+
+        /*
+         * shared by primary and backup peers, bumped on every change;
+         * it also numbers peers, starting after the configured ones
+         */
+
+        config = ngx_slab_calloc(shpool, sizeof(ngx_uint_t));
+        if (config == NULL) {
+            return NULL;
+        }
+    }
+
+    peers = ngx_http_upstream_zone_copy_list(shpool, uscf->peer.data, config);
+    if (peers == NULL) {
+        return NULL;
+    }
+
+    if (peers->next) {
+        backup = ngx_http_upstream_zone_copy_list(shpool, peers->next, config);
+        if (backup == NULL) {
+            return NULL;
+        }
+
+        peers->next = backup;
+    }
+
+    uscf->peer.data = peers;
+
+    return peers;
+}
+
+
+static ngx_http_upstream_rr_peers_t *
+ngx_http_upstream_zone_copy_list(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peers_t *src, ngx_uint_t *config)
+{
+    ngx_http_upstream_host_t      *host;
+    ngx_http_upstream_rr_peer_t   *peer, *template, *orig, **peerp;
+    ngx_http_upstream_rr_peers_t  *peers;
+
     peers = ngx_slab_alloc(shpool, sizeof(ngx_http_upstream_rr_peers_t));
     if (peers == NULL) {
         return NULL;
     }
 
-    ngx_memcpy(peers, uscf->peer.data, sizeof(ngx_http_upstream_rr_peers_t));
+    ngx_memcpy(peers, src, sizeof(ngx_http_upstream_rr_peers_t));
 
     peers->shpool = shpool;
+    peers->config = config;
 
-    for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
-        /* pool is unlocked */
-        peer = ngx_slab_calloc_locked(shpool,
-                                      sizeof(ngx_http_upstream_rr_peer_t));
+    /* pool is unlocked */
+
+    for (peerp = &peers->resolve; *peerp; peerp = &peer->next) {
+        peer = ngx_http_upstream_zone_copy_peer(shpool, *peerp);
         if (peer == NULL) {
             return NULL;
         }
 
-        ngx_memcpy(peer, *peerp, sizeof(ngx_http_upstream_rr_peer_t));
+        host = ngx_slab_alloc_locked(shpool, sizeof(ngx_http_upstream_host_t));
+        if (host == NULL) {
+            return NULL;
+        }
+
+        host->name.data = ngx_slab_alloc_locked(shpool, peer->host->name.len);
+        if (host->name.data == NULL) {
+            return NULL;
+        }
+
+        ngx_memcpy(host->name.data, peer->host->name.data,
+                   peer->host->name.len);
+        host->name.len = peer->host->name.len;
+        host->port = peer->host->port;
+
+        peer->host = host;
 
         *peerp = peer;
     }
 
-    if (peers->next == NULL) {
-        goto done;
+    for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
+        peer = ngx_http_upstream_zone_copy_peer(shpool, *peerp);
+        if (peer == NULL) {
+            return NULL;
+        }
+
+        if (config) {
+            peer->id = (*config)++;
+        }
+
+        /* addresses resolved at configuration time belong to their name */
+
+        if (peer->host) {
+            for (template = peers->resolve, orig = src->resolve;
+                 template;
+                 template = template->next, orig = orig->next)
+            {
+                if (peer->host == orig->host) {
+                    peer->host = template->host;
+                    break;
+                }
+            }
+        }
+
+        *peerp = peer;
     }
 
-    backup = ngx_slab_alloc(shpool, sizeof(ngx_http_upstream_rr_peers_t));
-    if (backup == NULL) {
+    return peers;
+}
+
+
+static ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_zone_copy_peer(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peer_t *src)
+{
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    /* the caller holds the pool mutex, if needed */
+
+    peer = ngx_slab_alloc_locked(shpool, sizeof(ngx_http_upstream_rr_peer_t));
+    if (peer == NULL) {
         return NULL;
     }
 
-    ngx_memcpy(backup, peers->next, sizeof(ngx_http_upstream_rr_peers_t));
+    ngx_memcpy(peer, src, sizeof(ngx_http_upstream_rr_peer_t));
+
+    peer->sockaddr = NULL;
+    ngx_str_null(&peer->name);
+    ngx_str_null(&peer->server);
+
+#if (NGX_HTTP_SSL)
+    peer->ssl_session = NULL;
+    peer->ssl_session_len = 0;
+#endif
+
+    if (src->sockaddr) {
+        peer->sockaddr = ngx_slab_alloc_locked(shpool, src->socklen);
+        if (peer->sockaddr == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy(peer->sockaddr, src->sockaddr, src->socklen);
+    }
+
+    if (src->name.len) {
+        peer->name.data = ngx_slab_alloc_locked(shpool, src->name.len);
+        if (peer->name.data == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy(peer->name.data, src->name.data, src->name.len);
+        peer->name.len = src->name.len;
+    }
+
+    if (src->server.len) {
+        peer->server.data = ngx_slab_alloc_locked(shpool, src->server.len);
+        if (peer->server.data == NULL) {
+            goto failed;
+        }
+
+        ngx_memcpy(peer->server.data, src->server.data, src->server.len);
+        peer->server.len = src->server.len;
+    }
+
+    return peer;
+
+failed:
+
+    ngx_http_upstream_zone_free_peer_locked(shpool, peer);
+
+    return NULL;
+}
+
+
+void
+ngx_http_upstream_zone_free_peer(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_slab_lock(shpool);
+    ngx_http_upstream_zone_free_peer_locked(shpool, peer);
+    ngx_slab_unlock(shpool);
+}
+
+
+static void
+ngx_http_upstream_zone_free_peer_locked(ngx_slab_pool_t *shpool,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    if (peer->sockaddr) {
+        ngx_slab_free_locked(shpool, peer->sockaddr);
+    }
+
+    if (peer->name.data) {
+        ngx_slab_free_locked(shpool, peer->name.data);
+    }
 
-    backup->shpool = shpool;
+    if (peer->server.data) {
+        ngx_slab_free_locked(shpool, peer->server.data);
+    }
+
+#if (NGX_HTTP_SSL)
+    if (peer->ssl_session) {
+        ngx_slab_free_locked(shpool, peer->ssl_session);
+    }
+#endif
+
+    ngx_slab_free_locked(shpool, peer);
+}
+
+
+static char *
+ngx_http_upstream_zone_resolver(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_str_t                     *value;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->resolver) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    uscf->resolver = ngx_resolver_create(cf, &value[1], cf->args->nelts - 1);
+    if (uscf->resolver == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_upstream_zone_resolver_timeout(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_str_t                     *value;
+    ngx_msec_t                     timeout;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->resolver_timeout != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    timeout = ngx_parse_time(&value[1], 0);
+    if (timeout == (ngx_msec_t) NGX_ERROR) {
+        return "invalid value";
+    }
+
+    uscf->resolver_timeout = timeout;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_postconfiguration(ngx_conf_t *cf)
+{
+    ngx_uint_t                      i;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (!(uscfp[i]->flags & NGX_HTTP_UPSTREAM_MODIFY)) {
+            continue;
+        }
+
+        peers = uscfp[i]->peer.data;
+
+        if (peers->resolve == NULL
+            && (peers->next == NULL || peers->next->resolve == NULL))
+        {
+            continue;
+        }
+
+        /* the resolver of the http block is used unless set in upstream */
+
+        if (uscfp[i]->resolver == NULL) {
+            uscfp[i]->resolver = clcf->resolver;
+        }
+
+        if (uscfp[i]->resolver_timeout == NGX_CONF_UNSET_MSEC) {
+            uscfp[i]->resolver_timeout =
+                             (clcf->resolver_timeout == NGX_CONF_UNSET_MSEC)
+                             ? 30000 : clcf->resolver_timeout;
+        }
+
+        if (uscfp[i]->resolver == NULL
+            || uscfp[i]->resolver->udp_connections.nelts == 0)
+        {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "no resolver defined to resolve names "
+                          "at run time in upstream \"%V\" in %s:%ui",
+                          &uscfp[i]->host, uscfp[i]->file_name,
+                          uscfp[i]->line);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                         i, n;
+    ngx_core_conf_t                   *ccf;
+    ngx_http_upstream_rr_peer_t       *template;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_srv_conf_t     **uscfp;
+    ngx_http_upstream_main_conf_t     *umcf;
+    ngx_http_upstream_zone_resolve_t  *zr;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    /* each name is resolved by a single worker */
+
+    n = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (!(uscfp[i]->flags & NGX_HTTP_UPSTREAM_MODIFY)) {
+            continue;
+        }
+
+        for (peers = uscfp[i]->peer.data; peers; peers = peers->next) {
+
+            for (template = peers->resolve;
+                 template;
+                 template = template->next, n++)
+            {
+                if (ngx_process == NGX_PROCESS_WORKER
+                    && n % ccf->worker_processes != ngx_worker)
+                {
+                    continue;
+                }
+
+                zr = ngx_pcalloc(cycle->pool,
+                                 sizeof(ngx_http_upstream_zone_resolve_t));
+                if (zr == NULL) {
+                    return NGX_ERROR;
+                }
+
+                /* the resolver lowercases the name in place */
+
+                zr->name.len = template->host->name.len;
+                zr->name.data = ngx_pstrdup(cycle->pool, &template->host->name);
+                if (zr->name.data == NULL) {
+                    return NGX_ERROR;
+                }
+
+                zr->template = template;
+                zr->peers = peers;
+                zr->uscf = uscfp[i];
+
+                zr->event.handler = ngx_http_upstream_zone_resolve_timer;
+                zr->event.data = zr;
+                zr->event.log = cycle->log;
+                zr->event.cancelable = 1;
+
+                ngx_add_timer(&zr->event, 1);
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_timer(ngx_event_t *ev)
+{
+    ngx_resolver_ctx_t                *ctx;
+    ngx_http_upstream_zone_resolve_t  *zr;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    zr = ev->data;
+
+    ctx = ngx_resolve_start(zr->uscf->resolver, NULL);
+    if (ctx == NULL) {
+        goto failed;
+    }
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, 0,
+                      "no resolver defined to resolve %V", &zr->name);
+        goto failed;
+    }
+
+    ctx->name = zr->name;
+    ctx->handler = ngx_http_upstream_zone_resolve_handler;
+    ctx->data = zr;
+    ctx->timeout = zr->uscf->resolver_timeout;
+
+    if (ngx_resolve_name(ctx) != NGX_OK) {
+        goto failed;
+    }
+
+    return;
+
+failed:
+
+    ngx_add_timer(ev, 10000);
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    time_t                             valid;
+    ngx_http_upstream_zone_resolve_t  *zr;
+
+    zr = ctx->data;
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, zr->event.log, 0,
+                      "upstream \"%V\": %V could not be resolved (%i: %s)",
+                      &zr->uscf->host, &ctx->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state));
+
+        /* keep the last known addresses unless the name is gone */
+
+        if (ctx->state == NGX_RESOLVE_NXDOMAIN) {
+            ngx_http_upstream_zone_update_peers(zr, NULL, 0);
+        }
+
+        ngx_resolve_name_done(ctx);
+
+        if (!ngx_exiting) {
+            ngx_add_timer(&zr->event, 10000);
+        }
+
+        return;
+    }
+
+    ngx_http_upstream_zone_update_peers(zr, ctx->addrs, ctx->naddrs);
+
+    valid = ctx->valid - ngx_time();
+
+    ngx_resolve_name_done(ctx);
+
+    if (!ngx_exiting) {
+        ngx_add_timer(&zr->event, (ngx_msec_t) ngx_max(valid, 1) * 1000);
+    }
+}
+
+
+static void
+ngx_http_upstream_zone_update_peers(ngx_http_upstream_zone_resolve_t *zr,
+    ngx_addr_t *addrs, ngx_uint_t naddrs)
+{
+    size_t                         len;
+    in_port_t                      port;
+    ngx_uint_t                     i;
+    struct sockaddr               *sa;
+    ngx_http_upstream_host_t      *host;
+    ngx_http_upstream_rr_peer_t   *peer, *template, tmp, **peerp;
+    ngx_http_upstream_rr_peers_t  *peers, *primary;
+    u_char                         sockaddr[NGX_SOCKADDRLEN];
+    u_char                         text[NGX_SOCKADDR_STRLEN];
+
+    peers = zr->peers;
+    primary = zr->uscf->peer.data;
+    template = zr->template;
+    host = template->host;
+
+    ngx_http_upstream_rr_peers_wlock(primary);
+
+    if (peers != primary) {
+        ngx_http_upstream_rr_peers_wlock(peers);
+    }
+
+    /* remove peers whose addresses are gone */
+
+    for (peerp = &peers->peer; *peerp; /* void */) {
+        peer = *peerp;
+
+        if (peer->host != host) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        for (i = 0; i < naddrs; i++) {
+            if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                 addrs[i].sockaddr, addrs[i].socklen, 0)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (i < naddrs) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, zr->event.log, 0,
+                      "upstream \"%V\": removed server %V of %V",
+                      &zr->uscf->host, &peer->name, &host->name);
+
+        ngx_http_upstream_zone_remove_peer(peers, peer);
+    }
+
+    /* add new addresses after the existing peers */
+
+    port = htons(host->port);
+
+    for (i = 0; i < naddrs; i++) {
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+            if (peer->host == host
+                && ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                    addrs[i].sockaddr, addrs[i].socklen, 0)
+                   == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (peer) {
+            continue;
+        }
+
+        sa = (struct sockaddr *) sockaddr;
+        ngx_memcpy(sa, addrs[i].sockaddr, addrs[i].socklen);
+
+        switch (sa->sa_family) {
+
+#if (NGX_HAVE_INET6)
+        case AF_INET6:
+            ((struct sockaddr_in6 *) sa)->sin6_port = port;
+            break;
+#endif
+
+        default: /* AF_INET */
+            ((struct sockaddr_in *) sa)->sin_port = port;
+        }
+
+        len = ngx_sock_ntop(sa, addrs[i].socklen, text, NGX_SOCKADDR_STRLEN,
+                            1);
+
+        tmp = *template;
+        tmp.sockaddr = sa;
+        tmp.socklen = addrs[i].socklen;
+        tmp.name.len = len;
+        tmp.name.data = text;
+
+        peer = ngx_http_upstream_zone_add_peer(peers, &tmp);
 
-    for (peerp = &backup->peer; *peerp; peerp = &peer->next) {
-        /* pool is unlocked */
-        peer = ngx_slab_calloc_locked(shpool,
-                                      sizeof(ngx_http_upstream_rr_peer_t));
         if (peer == NULL) {
-            return NULL;
+            ngx_log_error(NGX_LOG_ERR, zr->event.log, 0,
+                          "upstream \"%V\": could not add server %*s of %V",
+                          &zr->uscf->host, len, text, &host->name);
+            continue;
         }
 
-        ngx_memcpy(peer, *peerp, sizeof(ngx_http_upstream_rr_peer_t));
+        ngx_log_error(NGX_LOG_NOTICE, zr->event.log, 0,
+                      "upstream \"%V\": added server %V of %V",
+                      &zr->uscf->host, &peer->name, &host->name);
+    }
 
-        *peerp = peer;
+    if (peers != primary) {
+        ngx_http_upstream_rr_peers_unlock(peers);
     }
 
-    peers->next = backup;
+    ngx_http_upstream_rr_peers_unlock(primary);
+}
 
-done:
 
-    uscf->peer.data = peers;
+ngx_http_upstream_rr_peer_t *
+ngx_http_upstream_zone_add_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *src)
+{
+    ngx_http_upstream_rr_peer_t  *peer, **peerp;
 
-    return peers;
+    /*
+     * the caller holds write locks of the list and of the primary list,
+     * as request data sized by both lists relies on the change counter
+     */
+
+    ngx_slab_lock(peers->shpool);
+    peer = ngx_http_upstream_zone_copy_peer(peers->shpool, src);
+    ngx_slab_unlock(peers->shpool);
+
+    if (peer == NULL) {
+        return NULL;
+    }
+
+    peer->current_weight = 0;
+    peer->effective_weight = peer->weight;
+    peer->conns = 0;
+    peer->fails = 0;
+    peer->accessed = 0;
+    peer->checked = 0;
+    peer->zombie = 0;
+    peer->next = NULL;
+
+    /* ids are taken from the change counter and thus never reused */
+
+    peer->id = (*peers->config)++;
+
+    for (peerp = &peers->peer; *peerp; peerp = &(*peerp)->next) {
+        /* void */
+    }
+
+    *peerp = peer;
+
+    peers->number++;
+    peers->total_weight += peer->weight;
+    peers->weighted = (peers->total_weight != peers->number);
+
+    return peer;
+}
+
+
+void
+ngx_http_upstream_zone_remove_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_http_upstream_rr_peer_t  **peerp;
+
+    for (peerp = &peers->peer; *peerp != peer; peerp = &(*peerp)->next) {
+        /* void */
+    }
+
+    *peerp = peer->next;
+
+    peers->number--;
+    peers->total_weight -= peer->weight;
+    peers->weighted = (peers->total_weight != peers->number);
+
+    (*peers->config)++;
+
+    /* a peer still in use is freed by its last user */
+
+    if (peer->conns) {
+        peer->zombie = 1;
+
+    } else {
+        ngx_http_upstream_zone_free_peer(peers->shpool, peer);
+    }
 }
@@ -556,6 +556,21 @@ static ngx_command_t  ngx_http_core_commands[] =
 		NULL 
     },
 
+#if (NGX_THREADS)
+	//﷨: aio_write on | off;
+	//Ĭ: aio_write off;
+	//"aio threads"ʱǷҲ̳ͨ߳д뻺Ӧʱļͻļ
+	//ٴϵд̵¼ѭ
+    { 
+		ngx_string("aio_write"),
+		NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+		ngx_conf_set_flag_slot,
+		NGX_HTTP_LOC_CONF_OFFSET,
+		offsetof(ngx_http_core_loc_conf_t, aio_write),
+		NULL 
+    },
+#endif
+
     { ngx_string("read_ahead"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -3998,6 +4013,7 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
 #if (NGX_THREADS)
     clcf->thread_pool = NGX_CONF_UNSET_PTR;
     clcf->thread_pool_value = NGX_CONF_UNSET_PTR;
+    clcf->aio_write = NGX_CONF_UNSET;
 #endif
     clcf->read_ahead = NGX_CONF_UNSET_SIZE;
     clcf->directio = NGX_CONF_UNSET;
@@ -4217,6 +4233,7 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
     ngx_conf_merge_ptr_value(conf->thread_pool_value, prev->thread_pool_value,
                              NULL);
+    ngx_conf_merge_value(conf->aio_write, prev->aio_write, 0);
 #endif
     ngx_conf_merge_size_value(conf->read_ahead, prev->read_ahead, 0);
     ngx_conf_merge_off_value(conf->directio, prev->directio,
@@ -594,6 +594,8 @@ struct ngx_http_core_loc_conf_s
 #if (NGX_THREADS)
     ngx_thread_pool_t         *thread_pool;
     ngx_http_complex_value_t  *thread_pool_value;
+	//Ƿ"aio threads"ʱ̳ͨ߳дӦʱļͻļ
+    ngx_flag_t                 aio_write;
 #endif
 
 #if (NGX_HAVE_OPENAT)
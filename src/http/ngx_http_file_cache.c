@@ -392,7 +392,7 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     cache = c->file_cache;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_slab_lock(cache->shpool);
 
     timer = c->node->lock_time - now;
 
@@ -403,7 +403,7 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->lock_time = c->node->lock_time;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_slab_unlock(cache->shpool);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http file cache lock u:%d wt:%M", c->updating, c->wait_time);
 
@@ -474,7 +474,7 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
     cache = c->file_cache;
     wait = 0;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_slab_lock(cache->shpool);
 
     timer = c->node->lock_time - now;
 
@@ -482,7 +482,7 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
         wait = 1;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_slab_unlock(cache->shpool);
 
     if (wait) {
         ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
@@ -579,7 +579,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     if (cache->sh->cold) {
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_slab_lock(cache->shpool);
 
         if (!c->node->exists) {
             c->node->uses = 1;
@@ -591,14 +591,14 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             cache->sh->size += c->fs_size;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_slab_unlock(cache->shpool);
     }
 
     now = ngx_time();
 
     if (c->valid_sec < now) {
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_slab_lock(cache->shpool);
 
         if (c->node->updating) {
             rc = NGX_HTTP_CACHE_UPDATING;
@@ -610,7 +610,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             rc = NGX_HTTP_CACHE_STALE;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_slab_unlock(cache->shpool);
 
         ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http file cache expired: %i %T %T",
@@ -780,7 +780,7 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
     ngx_int_t                    rc;
     ngx_http_file_cache_node_t  *fcn;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_slab_lock(cache->shpool);
 
     fcn = c->node;
 
@@ -830,11 +830,11 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 	///ûҵc->keyӦĻļ, ʼµĻļڵ㣬ͬʱNGX_DECLINED
     fcn = ngx_slab_calloc_locked(cache->shpool, sizeof(ngx_http_file_cache_node_t));  //ӹڴзһ file cache node
     if (fcn == NULL) {	//ʧܣǿƼʱٴγԷ
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_slab_unlock(cache->shpool);
 
         (void) ngx_http_file_cache_forced_expire(cache);  //ǿɾüΪ0Ľ
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_slab_lock(cache->shpool);
 
         fcn = ngx_slab_calloc_locked(cache->shpool, sizeof(ngx_http_file_cache_node_t));
         if (fcn == NULL) {
@@ -876,7 +876,7 @@ done:
 
 failed:
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_slab_unlock(cache->shpool);
 
     return rc;
 }
@@ -1157,12 +1157,12 @@ ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     cache = c->file_cache;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_slab_lock(cache->shpool);
 
     c->node->count--;
     c->node = NULL;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_slab_unlock(cache->shpool);
 
     c->secondary = 1;
     c->file.name.len = 0;
@@ -1259,13 +1259,13 @@ ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http file cache main key");
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_slab_lock(cache->shpool);
 
     c->node->count--;
     c->node->updating = 0;
     c->node = NULL;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_slab_unlock(cache->shpool);
 
     c->file.name.len = 0;
 
@@ -1334,7 +1334,7 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
         }
     }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_slab_lock(cache->shpool);
 
     c->node->count--;
     c->node->uniq = uniq;
@@ -1349,7 +1349,7 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     c->node->updating = 0;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_slab_unlock(cache->shpool);
 }
 
 
@@ -1540,7 +1540,7 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0, "http file cache free, fd: %d", c->file.fd);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_slab_lock(cache->shpool);
 
     fcn = c->node;
     fcn->count--;
@@ -1564,7 +1564,7 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
         c->node = NULL;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_slab_unlock(cache->shpool);
 
     c->updated = 1;
     c->updating = 0;
@@ -1632,7 +1632,7 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
     wait = 10;
     tries = 20;  //ೢ20
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_slab_lock(cache->shpool);
 
 	//LRUβʼ׸üΪ0Ľڵ㲢ɾ
     for (q = ngx_queue_last(&cache->sh->queue); q != ngx_queue_sentinel(&cache->sh->queue); q = ngx_queue_prev(q)) {
@@ -1656,7 +1656,7 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
         break;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_slab_unlock(cache->shpool);
 
     ngx_free(name);
 
@@ -1689,7 +1689,7 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
     now = ngx_time();
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_slab_lock(cache->shpool);
 
     for ( ;; ) {
 
@@ -1748,7 +1748,7 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0, "ignore long locked inactive cache entry %*s, count:%d", 2 * NGX_HTTP_CACHE_KEY_LEN, key, fcn->count);
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_slab_unlock(cache->shpool);
 
     ngx_free(name);
 
@@ -1788,7 +1788,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q, u_char
 		//ͷŹڴ
         fcn->count++;			
         fcn->deleting = 1;		
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_slab_unlock(cache->shpool);
 
 		//ļľ·еĿ¼ֵname
         len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
@@ -1801,7 +1801,7 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q, u_char
             ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno, ngx_delete_file_n " \"%s\" failed", name);
         }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_slab_lock(cache->shpool);
         fcn->count--;
         fcn->deleting = 0;
     }
@@ -1828,11 +1828,11 @@ ngx_http_file_cache_manager(void *data)
     cache->files = 0;
 
     for ( ;; ) {
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_slab_lock(cache->shpool);
 
         size = cache->sh->size;		  //ȡеĴС
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_slab_unlock(cache->shpool);
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0, "http file cache size: %O", size);
 
@@ -2009,7 +2009,7 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
     ngx_http_file_cache_node_t  *fcn;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_slab_lock(cache->shpool);
 
     fcn = ngx_http_file_cache_lookup(cache, c->key);
 
@@ -2017,7 +2017,7 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
         fcn = ngx_slab_calloc_locked(cache->shpool, sizeof(ngx_http_file_cache_node_t));
         if (fcn == NULL) {
-            ngx_shmtx_unlock(&cache->shpool->mutex);
+            ngx_slab_unlock(cache->shpool);
             return NGX_ERROR;
         }
 
@@ -2041,7 +2041,7 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
     ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);	//ӵLURͷ
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_slab_unlock(cache->shpool);
 
     return NGX_OK;
 }
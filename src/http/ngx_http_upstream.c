@@ -65,6 +65,11 @@ static void ngx_http_upstream_process_downstream(ngx_http_request_t *r);
 static void ngx_http_upstream_process_upstream(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_process_request(ngx_http_request_t *r, ngx_http_upstream_t *u);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_upstream_thread_handler(ngx_thread_task_t *task,
+    ngx_file_t *file);
+static void ngx_http_upstream_thread_event_handler(ngx_event_t *ev);
+#endif
 static void ngx_http_upstream_store(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
 static void ngx_http_upstream_dummy_handler(ngx_http_request_t *r,
@@ -147,7 +152,6 @@ static char *ngx_http_upstream_init_main_conf(ngx_conf_t *cf, void *conf);
 #if (NGX_HTTP_SSL)
 static void ngx_http_upstream_ssl_init_connection(ngx_http_request_t *, ngx_http_upstream_t *u, ngx_connection_t *c);
 static void ngx_http_upstream_ssl_handshake(ngx_connection_t *c);
-static ngx_int_t ngx_http_upstream_ssl_name(ngx_http_request_t *r, ngx_http_upstream_t *u, ngx_connection_t *c);
 #endif
 
 
@@ -1370,7 +1374,12 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
     u->state->header_time = (ngx_msec_t) -1;
 
 	 /* ηҪעǸ÷ѾӦ׽עᵽepoll¼д¼ */
-    rc = ngx_event_connect_peer(&u->peer);
+    if (u->connect_peer) {
+        rc = u->connect_peer(r);
+
+    } else {
+        rc = ngx_event_connect_peer(&u->peer);
+    }
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, "http upstream connect: %i", rc);
 
@@ -1384,6 +1393,35 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     u->state->peer = u->peer.name;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /*
+     * peers of a modifiable upstream may be freed while the request
+     * still logs its address, so the name is copied to the request pool
+     */
+
+    if (u->conf->upstream
+        && (u->conf->upstream->flags & NGX_HTTP_UPSTREAM_MODIFY)
+        && rc != NGX_BUSY)
+    {
+        u->state->peer = ngx_palloc(r->pool,
+                                    sizeof(ngx_str_t) + u->peer.name->len);
+        if (u->state->peer == NULL) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        u->state->peer->len = u->peer.name->len;
+        u->state->peer->data = (u_char *) (u->state->peer + 1);
+        ngx_memcpy(u->state->peer->data, u->peer.name->data,
+                   u->peer.name->len);
+
+        u->peer.name = u->state->peer;
+    }
+
+#endif
+
 	 /*
      * rc = NGX_BUSYʾǰηԾngx_http_upstream_nextη·ӣ
      * ʵϣ÷ջǵngx_http_upstream_connect, returnӵǰأ
@@ -1407,6 +1445,8 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     c = u->peer.connection;
 
+    c->requests++;
+
     c->data = r;
 
 	/* õǰngx_connection_t ϶д¼Ļص */
@@ -1646,7 +1686,7 @@ failed:
 }
 
 
-static ngx_int_t
+ngx_int_t
 ngx_http_upstream_ssl_name(ngx_http_request_t *r, ngx_http_upstream_t *u, ngx_connection_t *c)
 {
     u_char     *p, *last;
@@ -1847,7 +1887,9 @@ ngx_http_upstream_send_request(ngx_http_request_t *r, ngx_http_upstream_t *u, ng
      * طNGX_OK־ǰδηɹӣҪngx_http_upstream_nextһηӣ
      * returnӵǰأ
      */
-    if (!u->request_sent && ngx_http_upstream_test_connect(c) != NGX_OK) {
+    if (!u->request_sent && u->connect_peer == NULL
+        && ngx_http_upstream_test_connect(c) != NGX_OK)
+    {
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
         return;
     }
@@ -2176,7 +2218,9 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
      * Ҫngx_http_upstream_nextһηӣ
      * returnӵǰأ
      */
-    if (!u->request_sent && ngx_http_upstream_test_connect(c) != NGX_OK) {
+    if (!u->request_sent && u->connect_peer == NULL
+        && ngx_http_upstream_test_connect(c) != NGX_OK)
+    {
 		//ûзηյεӦupstreamƳ
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
         return;
@@ -2298,6 +2342,13 @@ ngx_http_upstream_process_header(ngx_http_request_t *r, ngx_http_upstream_t *u)
         return;
     }
 
+    /* the request was not processed by the upstream and can be retried */
+
+    if (rc == NGX_HTTP_UPSTREAM_REFUSED) {
+        ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_ERROR);
+        return;
+    }
+
 	// rc = NGX_ERRORʾӳʱ ngx_http_upstream_finalize_request 󣬲 return ӵǰ
     if (rc == NGX_ERROR) {
         ngx_http_upstream_finalize_request(r, u, NGX_HTTP_INTERNAL_SERVER_ERROR);
@@ -3142,6 +3193,14 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     p->max_temp_file_size = u->conf->max_temp_file_size;
     p->temp_file_write_size = u->conf->temp_file_write_size;
+
+#if (NGX_THREADS)
+	/* ̳ͨ߳ؽӦдʱļ򻺴ļ */
+    if (clcf->aio == NGX_HTTP_AIO_THREADS && clcf->aio_write) {
+        p->thread_handler = ngx_http_upstream_thread_handler;
+        p->thread_ctx = r;
+    }
+#endif
 	
 	/* ʼԤpreread_bufs */
     p->preread_bufs = ngx_alloc_chain_link(r->pool);
@@ -3960,6 +4019,29 @@ ngx_http_upstream_process_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     p = u->pipe;
 
+#if (NGX_THREADS)
+
+    if (p->writing && !p->aio) {
+
+        /*
+         * make sure to call ngx_event_pipe()
+         * if there is an incomplete aio write
+         */
+
+        if (ngx_event_pipe(p, 1) == NGX_ABORT) {
+            ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+            return;
+        }
+    }
+
+    /* the temporary file is incomplete until the write is done */
+
+    if (p->writing) {
+        return;
+    }
+
+#endif
+
     if (u->peer.connection) {
 
         if (u->store) {
@@ -4029,6 +4111,80 @@ ngx_http_upstream_process_request(ngx_http_request_t *r, ngx_http_upstream_t *u)
 }
 
 
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_upstream_thread_handler(ngx_thread_task_t *task, ngx_file_t *file)
+{
+    ngx_str_t                  name;
+    ngx_event_pipe_t          *p;
+    ngx_thread_pool_t         *tp;
+    ngx_http_request_t        *r;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    r = file->thread_ctx;
+    p = r->upstream->pipe;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    tp = clcf->thread_pool;
+
+    if (tp == NULL) {
+        if (ngx_http_complex_value(r, clcf->thread_pool_value, &name)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        tp = ngx_thread_pool_get((ngx_cycle_t *) ngx_cycle, &name);
+
+        if (tp == NULL) {
+            ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                          "thread pool \"%V\" not found", &name);
+            return NGX_ERROR;
+        }
+    }
+
+    task->event.data = r;
+    task->event.handler = ngx_http_upstream_thread_event_handler;
+
+    if (ngx_thread_task_post(tp, task) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /* r->aio is not set: it marks the output reads in the copy filter */
+
+    r->main->blocked++;
+    p->aio = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream thread: \"%V?%V\"", &r->uri, &r->args);
+
+    r->main->blocked--;
+    r->upstream->pipe->aio = 0;
+
+    r->write_event_handler(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+#endif
+
+
 static void
 ngx_http_upstream_store(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
@@ -5740,6 +5896,9 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_int_t                    weight, max_fails;
     ngx_uint_t                   i;
     ngx_http_upstream_server_t  *us;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                   resolve;
+#endif
 
     us = ngx_array_push(uscf->servers);
     if (us == NULL) 
@@ -5754,6 +5913,9 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     weight = 1;
     max_fails = 1;
     fail_timeout = 10;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    resolve = 0;
+#endif
 
     for (i = 2; i < cf->args->nelts; i++)
 	{
@@ -5839,6 +6001,14 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (ngx_strcmp(value[i].data, "resolve") == 0)
+		{
+            resolve = 1;
+            continue;
+        }
+#endif
+
         goto invalid;
     }
 
@@ -5846,6 +6016,9 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     u.url = value[1];
     u.default_port = 80;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    u.no_resolve = resolve;
+#endif
 
     if (ngx_parse_url(cf->pool, &u) != NGX_OK) 
 	{
@@ -5857,6 +6030,28 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+	//ʱһΣʱresolverԵظ£ʱҲ
+    if (resolve && u.naddrs == 0)
+	{
+        if (ngx_inet_resolve_host(cf->pool, &u) != NGX_OK)
+		{
+            if (u.err == NULL)
+			{
+                return NGX_CONF_ERROR;
+            }
+
+            ngx_conf_log_error(NGX_LOG_WARN, cf, 0, "%s in upstream \"%V\", will be resolved at run time", u.err, &u.url);
+        }
+
+        us->resolve = 1;
+        us->host = u.host;
+        us->port = u.port;
+    }
+
+#endif
+
     us->name = u.url;
     us->addrs = u.addrs;
     us->naddrs = u.naddrs;
@@ -5966,6 +6161,9 @@ ngx_http_upstream_add(ngx_conf_t *cf, ngx_url_t *u, ngx_uint_t flags)
     uscf->port = u->port;
     uscf->default_port = u->default_port;
     uscf->no_port = u->no_port;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    uscf->resolver_timeout = NGX_CONF_UNSET_MSEC;
+#endif
 
     if (u->naddrs == 1 && (u->port || u->family == AF_UNIX)) 
 	{
@@ -41,6 +41,7 @@
 
 //ʾͷϷ
 #define NGX_HTTP_UPSTREAM_INVALID_HEADER     40
+#define NGX_HTTP_UPSTREAM_REFUSED            41
 
 
 #define NGX_HTTP_UPSTREAM_IGN_XA_REDIRECT    0x00000002
@@ -102,6 +103,13 @@ typedef struct
 
     unsigned                         down:1;
     unsigned                         backup:1;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    unsigned                         resolve:1;	//ʱͨresolverԽhost
+
+    ngx_str_t                        host;
+    in_port_t                        port;
+#endif
 } ngx_http_upstream_server_t;
 
 
@@ -111,6 +119,7 @@ typedef struct
 #define NGX_HTTP_UPSTREAM_FAIL_TIMEOUT  0x0008
 #define NGX_HTTP_UPSTREAM_DOWN          0x0010
 #define NGX_HTTP_UPSTREAM_BACKUP        0x0020
+#define NGX_HTTP_UPSTREAM_MODIFY        0x0040
 
 
 struct ngx_http_upstream_srv_conf_s 
@@ -130,6 +139,8 @@ struct ngx_http_upstream_srv_conf_s
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_shm_zone_t                  *shm_zone;
+    ngx_resolver_t                  *resolver;	//resolveserverõresolver
+    ngx_msec_t                       resolver_timeout;
 #endif
 };
 
@@ -405,6 +416,9 @@ struct ngx_http_upstream_s
 	//ĳ̨˷nginx᳢һ̨˷ nginxѡµķԺ
 	//ȵô˺³ʼ upstreamģĹ״̬Ȼٴνupstreamӡ
     ngx_int_t                      (*reinit_request)(ngx_http_request_t *r);
+	//úngx_event_connect_peerȡӣΪһҵеĹϣ
+	//ȡõѾupstreamټconnect()Ľ
+    ngx_int_t                      (*connect_peer)(ngx_http_request_t *r);
 	//˷صϢͷνͷupstream server ͨŵЭ涨ģ
 	//HTTPЭheader֣memcached ЭӦ״̬֡
 	//յηӦͻصprocess_header process_headerNGX_AGAIN ôڸ
@@ -486,6 +500,9 @@ char *ngx_http_upstream_bind_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *
 char *ngx_http_upstream_param_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 ngx_int_t ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf, ngx_http_upstream_conf_t *conf, ngx_http_upstream_conf_t *prev,
     ngx_str_t *default_hide_headers, ngx_hash_init_t *hash);
+#if (NGX_HTTP_SSL)
+ngx_int_t ngx_http_upstream_ssl_name(ngx_http_request_t *r, ngx_http_upstream_t *u, ngx_connection_t *c);
+#endif
 
 
 #define ngx_http_conf_upstream_srv_conf(uscf, module)   uscf->srv_conf[module.ctx_index]
@@ -15,6 +15,13 @@
 
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t ngx_http_upstream_init_resolve(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us,
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t backup);
+
+#endif
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t ngx_http_upstream_empty_set_session(ngx_peer_connection_t *pc, void *data);
@@ -27,7 +34,7 @@ ngx_int_t
 ngx_http_upstream_init_round_robin(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 {
     ngx_url_t                      u;
-    ngx_uint_t                     i, j, n, w;
+    ngx_uint_t                     i, j, n, r, w;
     ngx_http_upstream_server_t    *server;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
@@ -39,8 +46,9 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t
         server = us->servers->elts;
 
         n = 0;
+        r = 0;
         w = 0;
-		//ͳηĸ(n)ȨشС(w)
+		//ͳηĸ(n)ȨشС(w)Լresolveserverĸ(r)
         for (i = 0; i < us->servers->nelts; i++)
 		{
             if (server[i].backup) 
@@ -50,9 +58,12 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t
 
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+            r += server[i].resolve;
+#endif
         }
 
-        if (n == 0) 
+        if (n == 0 && r == 0) 
 		{
             ngx_log_error(NGX_LOG_EMERG, cf->log, 0, "no servers in upstream \"%V\" in %s:%ui", &us->host, us->file_name, us->line);
             return NGX_ERROR;
@@ -70,7 +81,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t
             return NGX_ERROR;
         }
 
-        peers->single = (n == 1);
+        peers->single = (n == 1 && r == 0);
         peers->number = n;
         peers->weighted = (w != n);
         peers->total_weight = w;
@@ -107,9 +118,24 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t
 
         us->peer.data = peers;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+		//ڴеķбʱɾ
+        if (us->shm_zone)
+		{
+            us->flags |= NGX_HTTP_UPSTREAM_MODIFY;
+            peers->single = 0;
+        }
+
+        if (r && ngx_http_upstream_init_resolve(cf, us, peers, 0) != NGX_OK)
+		{
+            return NGX_ERROR;
+        }
+#endif
+
         /* backup servers */
 
         n = 0;
+        r = 0;
         w = 0;
 
         for (i = 0; i < us->servers->nelts; i++) 
@@ -121,9 +147,12 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t
 
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+            r += server[i].resolve;
+#endif
         }
 
-        if (n == 0) 
+        if (n == 0 && r == 0) 
 		{
             return NGX_OK;
         }
@@ -178,6 +207,13 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t
 
         peers->next = backup;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (r && ngx_http_upstream_init_resolve(cf, us, backup, 1) != NGX_OK)
+		{
+            return NGX_ERROR;
+        }
+#endif
+
         return NGX_OK;
     }
 
@@ -248,6 +284,86 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t
     return NGX_OK;
 }
 
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+//Ϊresolveserverģ壬ʱõĵַģб
+//ʱѾõĵַҲڸʱᱻ滻
+static ngx_int_t
+ngx_http_upstream_init_resolve(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us,
+    ngx_http_upstream_rr_peers_t *peers, ngx_uint_t backup)
+{
+    ngx_uint_t                     i, j;
+    ngx_http_upstream_host_t      *host;
+    ngx_http_upstream_server_t    *server;
+    ngx_http_upstream_rr_peer_t   *peer, *rpeer, **rpeerp;
+
+    if (us->shm_zone == NULL)
+	{
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0, "resolving names at run time requires upstream \"%V\" in %s:%ui to be in shared memory", &us->host, us->file_name, us->line);
+        return NGX_ERROR;
+    }
+
+    server = us->servers->elts;
+    peer = peers->peer;
+    rpeerp = &peers->resolve;
+
+    for (i = 0; i < us->servers->nelts; i++)
+	{
+        if (server[i].backup != backup)
+		{
+            continue;
+        }
+
+        if (!server[i].resolve)
+		{
+            for (j = 0; j < server[i].naddrs; j++)
+			{
+                peer = peer->next;
+            }
+
+            continue;
+        }
+
+        host = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_host_t));
+        if (host == NULL)
+		{
+            return NGX_ERROR;
+        }
+
+        host->name = server[i].host;
+        host->port = server[i].port;
+
+        rpeer = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_rr_peer_t));
+        if (rpeer == NULL)
+		{
+            return NGX_ERROR;
+        }
+
+        rpeer->name = server[i].name;
+        rpeer->server = server[i].name;
+        rpeer->weight = server[i].weight;
+        rpeer->effective_weight = server[i].weight;
+        rpeer->max_fails = server[i].max_fails;
+        rpeer->fail_timeout = server[i].fail_timeout;
+        rpeer->down = server[i].down;
+        rpeer->host = host;
+
+        *rpeerp = rpeer;
+        rpeerp = &rpeer->next;
+
+        for (j = 0; j < server[i].naddrs; j++)
+		{
+            peer->host = host;
+            peer = peer->next;
+        }
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
 //ܣÿѡ˷ǰһЩʼ  
 ngx_int_t
 ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r, ngx_http_upstream_srv_conf_t *us)
@@ -271,6 +387,14 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r, ngx_http_upstream
     rrp->peers = us->peer.data;
     rrp->current = NULL;
 
+    ngx_http_upstream_rr_peers_rlock(rrp->peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+	//¼бİ汾ţб仯λͼͷٶӦ
+    rrp->config = rrp->peers->config ? *rrp->peers->config : 0;
+    rrp->pool = r->pool;
+#endif
+
 	//ȡǱηĿͱηĿĽϴֵ
     n = rrp->peers->number;
 
@@ -279,6 +403,10 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r, ngx_http_upstream
         n = rrp->peers->next->number;
     }
 
+    r->upstream->peer.tries = ngx_http_upstream_tries(rrp->peers);
+
+    ngx_http_upstream_rr_peers_unlock(rrp->peers);
+
 	//λͼ
 	//nСһָܱʾķΧ, ֱʹеָ͵dataλͼtriedλͼʶһѡУ˷ǷѾѡ    
 	//ڴռ 
@@ -302,7 +430,6 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r, ngx_http_upstream
 	//ص 
     r->upstream->peer.get = ngx_http_upstream_get_round_robin_peer;
     r->upstream->peer.free = ngx_http_upstream_free_round_robin_peer;
-    r->upstream->peer.tries = ngx_http_upstream_tries(rrp->peers);
 #if (NGX_HTTP_SSL)
     r->upstream->peer.set_session = ngx_http_upstream_set_round_robin_peer_session;
     r->upstream->peer.save_session = ngx_http_upstream_save_round_robin_peer_session;
@@ -417,6 +544,10 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r, ngx_http_upstre
 
     rrp->peers = peers;
     rrp->current = NULL;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    rrp->config = 0;
+    rrp->pool = r->pool;
+#endif
 
     if (rrp->peers->number <= 8 * sizeof(uintptr_t))
 	{
@@ -464,6 +595,18 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     peers = rrp->peers;
     ngx_http_upstream_rr_peers_wlock(peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+	//бʼ֮˱仯ǰбؽѳԷλͼ
+    if (peers->config && rrp->config != *peers->config)
+	{
+        if (ngx_http_upstream_update_round_robin_peer(rrp) != NGX_OK)
+		{
+            ngx_http_upstream_rr_peers_unlock(peers);
+            return NGX_ERROR;
+        }
+    }
+#endif
+
 	 //ֻһ̨˷Nginxֱѡ񲢷  
 	 //ж̨˷,ո̨ĵǰȨֵѡ  
     if (peers->single) 
@@ -546,6 +689,69 @@ failed:
     return NGX_BUSY;
 }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+/*
+ * The list was changed by the API, the resolver or the health checks
+ * after the request was initialized, and positions in the bitmap no
+ * longer match the peers.  The bitmap is rebuilt for the current list,
+ * with the peer tried last still marked if it remains in the list.
+ * Called with the list locked.
+ */
+
+ngx_int_t
+ngx_http_upstream_update_round_robin_peer(ngx_http_upstream_rr_peer_data_t *rrp)
+{
+    uintptr_t                     *tried;
+    ngx_uint_t                     i, n;
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    peers = rrp->peers;
+
+    n = peers->number;
+
+    if (peers->next && peers->next->number > n)
+	{
+        n = peers->next->number;
+    }
+
+    if (n <= 8 * sizeof(uintptr_t))
+	{
+        tried = &rrp->data;
+        rrp->data = 0;
+
+    }
+	else
+	{
+        n = (n + (8 * sizeof(uintptr_t) - 1)) / (8 * sizeof(uintptr_t));
+
+        tried = ngx_pcalloc(rrp->pool, n * sizeof(uintptr_t));
+        if (tried == NULL)
+		{
+            return NGX_ERROR;
+        }
+    }
+
+	//ֻȽָ룬ɾķѱͷ
+    for (peer = peers->peer, i = 0; peer; peer = peer->next, i++)
+	{
+        if (peer == rrp->current)
+		{
+            tried[i / (8 * sizeof(uintptr_t))] |= (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+            break;
+        }
+    }
+
+    rrp->tried = tried;
+    rrp->config = *peers->config;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 //effective_weightǳʼΪеweightֵcurrent_weightʼΪ0.
 //бĹУÿһ񣬻ڸ÷current_weightϼӦeffective_weightۼӡͳһķбһѯôǰcurrent_weightĻ֮ټeffective_weight
 //total¼һбһѯѯзeffective_weightܺ͡ÿһԷбѯ֮ǰΪΪ0.
@@ -638,6 +844,9 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data, n
 
     time_t                       now;
     ngx_http_upstream_rr_peer_t  *peer;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                   zombie;
+#endif
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0, "free rr peer %ui %ui", pc->tries, state);
 
@@ -706,9 +915,21 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data, n
 
     peer->conns--;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+	//Ѵбɾһʹͷ
+    zombie = (peer->zombie && peer->conns == 0);
+#endif
+
     ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
     ngx_http_upstream_rr_peers_unlock(rrp->peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (zombie)
+	{
+        ngx_http_upstream_zone_free_peer(rrp->peers->shpool, peer);
+    }
+#endif
+
     if (pc->tries)
 	{
         pc->tries--;
@@ -831,7 +1052,7 @@ ngx_http_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc, void
 
         if (len > peer->ssl_session_len)
 		{
-            ngx_shmtx_lock(&peers->shpool->mutex);
+            ngx_slab_lock(peers->shpool);
 
             if (peer->ssl_session) {
                 ngx_slab_free_locked(peers->shpool, peer->ssl_session);
@@ -839,7 +1060,7 @@ ngx_http_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc, void
 
             peer->ssl_session = ngx_slab_alloc_locked(peers->shpool, len);
 
-            ngx_shmtx_unlock(&peers->shpool->mutex);
+            ngx_slab_unlock(peers->shpool);
 
             if (peer->ssl_session == NULL) {
                 peer->ssl_session_len = 0;
@@ -16,6 +16,22 @@
 
 typedef struct ngx_http_upstream_rr_peer_s   ngx_http_upstream_rr_peer_t;
 
+
+//ûӿΪdown
+#define NGX_HTTP_UPSTREAM_PEER_DOWN       0x01
+//ΪãиؾⷽdownΪ0ķ
+#define NGX_HTTP_UPSTREAM_PEER_UNHEALTHY  0x02
+
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+typedef struct {
+    ngx_str_t                       name;		//ҪԽ
+    in_port_t                       port;
+} ngx_http_upstream_host_t;
+
+#endif
+
 struct ngx_http_upstream_rr_peer_s 
 {
     struct sockaddr                *sockaddr;
@@ -36,7 +52,9 @@ struct ngx_http_upstream_rr_peer_s
     ngx_uint_t                      max_fails;		//ʧܴ  
     time_t                          fail_timeout;
 
-    ngx_uint_t                      down;          /* unsigned  down:1; */
+    ngx_uint_t                      down;		//NGX_HTTP_UPSTREAM_PEER_DOWNNGX_HTTP_UPSTREAM_PEER_UNHEALTHYλ
+
+    ngx_uint_t                      response_time;	//ӦʱָȨƶƽֵλΪ΢
 
 #if (NGX_HTTP_SSL)
     void                           *ssl_session;
@@ -47,6 +65,12 @@ struct ngx_http_upstream_rr_peer_s
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_atomic_t                    lock;
+    ngx_http_upstream_host_t       *host;		//resolveserverõĵַָ
+    ngx_uint_t                      id;		//ʱӿеķ
+    ngx_uint_t                      drain;         /* unsigned  drain:1; */
+    ngx_uint_t                      check_fails;	//ʧܴ
+    ngx_uint_t                      check_passes;	//ɹ
+    ngx_uint_t                      zombie;        /* unsigned  zombie:1; */
 #endif
 };
 
@@ -62,6 +86,13 @@ struct ngx_http_upstream_rr_peers_s
     ngx_slab_pool_t                *shpool;
     ngx_atomic_t                    rwlock;
     ngx_http_upstream_rr_peers_t   *zone_next;
+	//бİ汾ţǱݺͱݷãб仯ʱһ
+    ngx_uint_t                     *config;
+	//resolveserverΪõķģ壬븺ؾ
+    ngx_http_upstream_rr_peer_t    *resolve;
+	//keepaliveģͳƵ½͸ûworker
+    ngx_atomic_t                    connects;
+    ngx_atomic_t                    reused;
 #endif
 	//ȨشС
     ngx_uint_t                      total_weight;
@@ -128,6 +159,10 @@ typedef struct
     ngx_http_upstream_rr_peer_t    *current;	//ָǰʹõη
     uintptr_t                      *tried;		//λͼڱʹĸη
     uintptr_t                       data;		//ηĿ(ǱݷĿͱݷĿ)8*sizeof(uintptr_t)ʱtriedָdataΪλͼҪ·ڴ
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                      config;	//ʼʱбİ汾
+    ngx_pool_t                     *pool;	//б仯·λͼõڴ
+#endif
 } ngx_http_upstream_rr_peer_data_t;
 
 
@@ -136,6 +171,15 @@ ngx_int_t ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r, ngx_htt
 ngx_int_t ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r, ngx_http_upstream_resolved_t *ur);
 ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data);
 void ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data, ngx_uint_t state);
+#if (NGX_HTTP_UPSTREAM_ZONE)
+ngx_int_t ngx_http_upstream_update_round_robin_peer(ngx_http_upstream_rr_peer_data_t *rrp);
+#endif
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_add_peer(ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *src);
+void ngx_http_upstream_zone_remove_peer(ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *peer);
+void ngx_http_upstream_zone_free_peer(ngx_slab_pool_t *shpool, ngx_http_upstream_rr_peer_t *peer);
+#endif
 
 #if (NGX_HTTP_SSL)
 ngx_int_t ngx_http_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc, void *data);
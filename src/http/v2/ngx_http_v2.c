@@ -11,52 +11,15 @@
 #include <ngx_http_v2_module.h>
 
 
-/* errors */
-#define NGX_HTTP_V2_NO_ERROR                     0x0
-#define NGX_HTTP_V2_PROTOCOL_ERROR               0x1
-#define NGX_HTTP_V2_INTERNAL_ERROR               0x2
-#define NGX_HTTP_V2_FLOW_CTRL_ERROR              0x3
-#define NGX_HTTP_V2_SETTINGS_TIMEOUT             0x4
-#define NGX_HTTP_V2_STREAM_CLOSED                0x5
-#define NGX_HTTP_V2_SIZE_ERROR                   0x6
-#define NGX_HTTP_V2_REFUSED_STREAM               0x7
-#define NGX_HTTP_V2_CANCEL                       0x8
-#define NGX_HTTP_V2_COMP_ERROR                   0x9
-#define NGX_HTTP_V2_CONNECT_ERROR                0xa
-#define NGX_HTTP_V2_ENHANCE_YOUR_CALM            0xb
-#define NGX_HTTP_V2_INADEQUATE_SECURITY          0xc
-#define NGX_HTTP_V2_HTTP_1_1_REQUIRED            0xd
-
-/* frame sizes */
-#define NGX_HTTP_V2_RST_STREAM_SIZE              4
-#define NGX_HTTP_V2_PRIORITY_SIZE                5
-#define NGX_HTTP_V2_PING_SIZE                    8
-#define NGX_HTTP_V2_GOAWAY_SIZE                  8
-#define NGX_HTTP_V2_WINDOW_UPDATE_SIZE           4
-
-#define NGX_HTTP_V2_STREAM_ID_SIZE               4
-
-#define NGX_HTTP_V2_SETTINGS_PARAM_SIZE          6
-
-/* settings fields */
-#define NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING    0x1
-#define NGX_HTTP_V2_MAX_STREAMS_SETTING          0x3
-#define NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING     0x4
-#define NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING       0x5
-
 #define NGX_HTTP_V2_FRAME_BUFFER_SIZE            24
 
-#define NGX_HTTP_V2_DEFAULT_FRAME_SIZE           (1 << 14)
-
-#define NGX_HTTP_V2_MAX_WINDOW                   ((1U << 31) - 1)
-#define NGX_HTTP_V2_DEFAULT_WINDOW               65535
-
 #define NGX_HTTP_V2_ROOT                         (void *) -1
 
 
 static void ngx_http_v2_read_handler(ngx_event_t *rev);
 static void ngx_http_v2_write_handler(ngx_event_t *wev);
 static void ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c);
+static size_t ngx_http_v2_sndbuf(ngx_connection_t *c);
 
 static u_char *ngx_http_v2_state_proxy_protocol(ngx_http_v2_connection_t *h2c,
     u_char *pos, u_char *end);
@@ -163,6 +126,7 @@ static ngx_int_t ngx_http_v2_cookie(ngx_http_request_t *r,
     ngx_http_v2_header_t *header);
 static ngx_int_t ngx_http_v2_construct_cookie_header(ngx_http_request_t *r);
 static void ngx_http_v2_run_request(ngx_http_request_t *r);
+static void ngx_http_v2_run_request_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_v2_init_request_body(ngx_http_request_t *r);
 
 static ngx_int_t ngx_http_v2_terminate_stream(ngx_http_v2_connection_t *h2c,
@@ -178,6 +142,7 @@ static ngx_int_t ngx_http_v2_adjust_windows(ngx_http_v2_connection_t *h2c,
 static void ngx_http_v2_set_dependency(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_node_t *node, ngx_uint_t depend, ngx_uint_t exclusive);
 static void ngx_http_v2_node_children_update(ngx_http_v2_node_t *node);
+static void ngx_http_v2_node_reschedule(ngx_http_v2_node_t *node);
 
 static void ngx_http_v2_pool_cleanup(void *data);
 
@@ -242,9 +207,17 @@ ngx_http_v2_init(ngx_event_t *rev)
     h2c->init_window = NGX_HTTP_V2_DEFAULT_WINDOW;
 
     h2c->frame_size = NGX_HTTP_V2_DEFAULT_FRAME_SIZE;
+    h2c->sndbuf = ngx_http_v2_sndbuf(c);
 
     h2scf = ngx_http_get_module_srv_conf(hc->conf_ctx, ngx_http_v2_module);
 
+    h2c->hpack_enc.max = h2scf->hpack_table_size;
+    h2c->hpack_enc.size = NGX_HTTP_V2_TABLE_SIZE;
+
+    h2c->concurrent_pushes = h2scf->concurrent_pushes;
+
+    ngx_http_v2_table_limit(h2c, NGX_HTTP_V2_TABLE_SIZE);
+
     h2c->pool = ngx_create_pool(h2scf->pool_size, h2c->connection->log);
     if (h2c->pool == NULL) {
         ngx_http_close_connection(c);
@@ -267,6 +240,9 @@ ngx_http_v2_init(ngx_event_t *rev)
         return;
     }
 
+    ngx_rbtree_init(&h2c->schedule, &h2c->schedule_sentinel,
+                    ngx_http_v2_schedule_insert_value);
+
     if (ngx_http_v2_send_settings(h2c, 0) == NGX_ERROR) {
         ngx_http_close_connection(c);
         return;
@@ -370,7 +346,9 @@ ngx_http_v2_read_handler(ngx_event_t *rev)
         return;
     }
 
-    if (h2c->last_out && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR) {
+    if (ngx_http_v2_output_queued(h2c)
+        && ngx_http_v2_send_output_queue(h2c) == NGX_ERROR)
+    {
         ngx_http_v2_finalize_connection(h2c, 0);
         return;
     }
@@ -450,10 +428,13 @@ ngx_int_t
 ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
 {
     int                        tcp_nodelay;
-    ngx_chain_t               *cl;
+    size_t                     size;
+    ngx_chain_t               *cl, **ll;
     ngx_event_t               *wev;
     ngx_connection_t          *c;
-    ngx_http_v2_out_frame_t   *out, *frame, *fn;
+    ngx_rbtree_node_t         *node;
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_out_frame_t   *out, *frame, *fn, **fl;
     ngx_http_core_loc_conf_t  *clcf;
 
     c = h2c->connection;
@@ -471,6 +452,50 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
     cl = NULL;
     out = NULL;
 
+    ll = &cl;
+    fl = &out;
+
+    /*
+     * the scheduled DATA frames go last, in the scheduler order, and only
+     * as many as the socket buffer takes, the rest are left scheduled
+     */
+
+    size = 0;
+
+    while (h2c->schedule.root != h2c->schedule.sentinel
+           && (size < h2c->sndbuf || size == 0))
+    {
+        node = ngx_rbtree_min(h2c->schedule.root, h2c->schedule.sentinel);
+        stream = ngx_rbtree_data(node, ngx_http_v2_stream_t, schedule);
+
+        ngx_rbtree_delete(&h2c->schedule, node);
+
+        frame = stream->frames;
+        stream->frames = frame->next;
+        frame->scheduled = 0;
+
+        /* the virtual time never goes backwards */
+
+        if (h2c->vtime < stream->vstart) {
+            h2c->vtime = stream->vstart;
+        }
+
+        if (stream->frames) {
+            ngx_http_v2_schedule_stream(h2c, stream);
+        }
+
+        size += frame->length;
+
+        *ll = frame->first;
+        ll = &frame->last->next;
+
+        *fl = frame;
+        fl = &frame->next;
+    }
+
+    *ll = NULL;
+    *fl = NULL;
+
     for (frame = h2c->last_out; frame; frame = fn) {
         frame->last->next = cl;
         cl = frame->first;
@@ -491,6 +516,11 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
         goto error;
     }
 
+    if (cl) {
+        /* the socket buffer is full, its size may be tuned by the kernel */
+        h2c->sndbuf = ngx_http_v2_sndbuf(c);
+    }
+
     clcf = ngx_http_get_module_loc_conf(h2c->http_connection->conf_ctx,
                                         ngx_http_core_module);
 
@@ -561,6 +591,8 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
 
     frame = NULL;
 
+    /* the frames taken from the schedule and not sent are sent first */
+
     for ( /* void */ ; out; out = fn) {
         fn = out->next;
         out->next = frame;
@@ -569,6 +601,10 @@ ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c)
 
     h2c->last_out = frame;
 
+    if (cl == NULL && h2c->schedule.root != h2c->schedule.sentinel) {
+        ngx_post_event(wev, &ngx_posted_events);
+    }
+
     return NGX_OK;
 
 error:
@@ -583,13 +619,84 @@ error:
 }
 
 
+static size_t
+ngx_http_v2_sndbuf(ngx_connection_t *c)
+{
+    int        sndbuf;
+    socklen_t  len;
+
+    len = sizeof(int);
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_SNDBUF, (void *) &sndbuf, &len)
+        == -1)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, ngx_socket_errno,
+                       "getsockopt(SO_SNDBUF) failed on fd:%d", c->fd);
+        return 0;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http2 socket send buffer: %d", sndbuf);
+
+    return (sndbuf > 0) ? (size_t) sndbuf : 0;
+}
+
+
+void
+ngx_http_v2_schedule_stream(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_stream_t *stream)
+{
+    stream->vstart = ngx_max(h2c->vtime, stream->vfinish);
+    stream->vfinish = stream->vstart
+                      + stream->frames->length / stream->node->rel_weight;
+
+    stream->schedule.key = stream->node->rank;
+
+    ngx_rbtree_insert(&h2c->schedule, &stream->schedule);
+}
+
+
+void
+ngx_http_v2_schedule_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t     **p;
+    ngx_http_v2_stream_t   *stream, *t;
+
+    stream = ngx_rbtree_data(node, ngx_http_v2_stream_t, schedule);
+
+    for ( ;; ) {
+
+        /* node->key is the stream rank, equal times are kept in order */
+
+        t = ngx_rbtree_data(temp, ngx_http_v2_stream_t, schedule);
+
+        p = (node->key < temp->key
+             || (node->key == temp->key && stream->vfinish < t->vfinish))
+            ? &temp->left : &temp->right;
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
 static void
 ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c)
 {
     ngx_connection_t          *c;
     ngx_http_v2_srv_conf_t  *h2scf;
 
-    if (h2c->last_out || h2c->processing) {
+    if (ngx_http_v2_output_queued(h2c) || h2c->processing) {
         return;
     }
 
@@ -1153,9 +1260,10 @@ ngx_http_v2_state_headers(ngx_http_v2_connection_t *h2c, u_char *pos,
 
     h2c->state.header_limit = h2scf->max_header_size;
 
-    if (h2c->processing >= h2scf->concurrent_streams) {
+    if (h2c->processing - h2c->pushing >= h2scf->concurrent_streams) {
         ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
-                      "concurrent streams exceeded %ui", h2c->processing);
+                      "concurrent streams exceeded %ui",
+                      h2c->processing - h2c->pushing);
 
         if (ngx_http_v2_send_rst_stream(h2c, h2c->state.sid,
                                         NGX_HTTP_V2_REFUSED_STREAM)
@@ -1925,6 +2033,12 @@ ngx_http_v2_state_rst_stream(ngx_http_v2_connection_t *h2c, u_char *pos,
     fc = stream->request->connection;
     fc->error = 1;
 
+#if (NGX_STAT_STUB)
+    if (node->id % 2 == 0) {
+        (void) ngx_atomic_fetch_add(ngx_stat_http2_push_cancels, 1);
+    }
+#endif
+
     switch (status) {
 
     case NGX_HTTP_V2_CANCEL:
@@ -1989,7 +2103,11 @@ static u_char *
 ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
     u_char *end)
 {
-    ngx_uint_t  id, value;
+    ngx_uint_t               id, value;
+    ngx_http_v2_srv_conf_t  *h2scf;
+
+    h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
+                                         ngx_http_v2_module);
 
     while (h2c->state.length) {
         if (end - pos < NGX_HTTP_V2_SETTINGS_PARAM_SIZE) {
@@ -2004,6 +2122,10 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         switch (id) {
 
+        case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
+            ngx_http_v2_table_limit(h2c, value);
+            break;
+
         case NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING:
 
             if (value > NGX_HTTP_V2_MAX_WINDOW) {
@@ -2040,6 +2162,24 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
             h2c->frame_size = value;
             break;
 
+        case NGX_HTTP_V2_ENABLE_PUSH_SETTING:
+
+            if (value > 1) {
+                ngx_log_error(NGX_LOG_INFO, h2c->connection->log, 0,
+                              "client sent SETTINGS frame with incorrect "
+                              "ENABLE_PUSH value %ui", value);
+
+                return ngx_http_v2_connection_error(h2c,
+                                                    NGX_HTTP_V2_PROTOCOL_ERROR);
+            }
+
+            h2c->push_disabled = !value;
+            break;
+
+        case NGX_HTTP_V2_MAX_STREAMS_SETTING:
+            h2c->concurrent_pushes = ngx_min(value, h2scf->concurrent_pushes);
+            break;
+
         default:
             break;
         }
@@ -2124,6 +2264,8 @@ ngx_http_v2_state_goaway(ngx_http_v2_connection_t *h2c, u_char *pos,
         return ngx_http_v2_state_save(h2c, pos, end, ngx_http_v2_state_goaway);
     }
 
+    h2c->goaway = 1;
+
 #if (NGX_DEBUG)
     h2c->state.length -= NGX_HTTP_V2_GOAWAY_SIZE;
 
@@ -2481,6 +2623,7 @@ ngx_http_v2_send_settings(ngx_http_v2_connection_t *h2c, ngx_uint_t ack)
     frame->length = len;
 #endif
     frame->blocked = 0;
+    frame->scheduled = 0;
 
     buf->last = ngx_http_v2_write_len_and_type(buf->last, len,
                                                NGX_HTTP_V2_SETTINGS_FRAME);
@@ -3459,6 +3602,170 @@ ngx_http_v2_run_request(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_v2_run_request_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *fc;
+    ngx_http_request_t  *r;
+
+    fc = ev->data;
+    r = fc->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                   "http2 run request handler");
+
+    ngx_http_v2_run_request(r);
+}
+
+
+ngx_http_v2_stream_t *
+ngx_http_v2_push_stream(ngx_http_v2_stream_t *parent, ngx_str_t *path,
+    ngx_http_v2_header_t *headers, ngx_uint_t n)
+{
+    ngx_int_t                   rc;
+    ngx_uint_t                  i;
+    ngx_table_elt_t            *h;
+    ngx_connection_t           *fc;
+    ngx_http_header_t          *hh;
+    ngx_http_request_t         *r;
+    ngx_http_v2_node_t         *node;
+    ngx_http_v2_header_t        header;
+    ngx_http_v2_stream_t       *stream;
+    ngx_http_v2_connection_t   *h2c;
+    ngx_http_core_main_conf_t  *cmcf;
+
+    h2c = parent->connection;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 push stream sid:%ui \"%V\"", h2c->last_push, path);
+
+    node = ngx_http_v2_get_node_by_id(h2c, h2c->last_push, 1);
+
+    if (node == NULL) {
+        goto rst_stream;
+    }
+
+    if (node->parent) {
+        ngx_queue_remove(&node->reuse);
+        h2c->closed_nodes--;
+    }
+
+    stream = ngx_http_v2_create_stream(h2c);
+    if (stream == NULL) {
+        goto rst_stream;
+    }
+
+    h2c->pushing++;
+
+    stream->in_closed = 1;
+    stream->node = node;
+
+    node->stream = stream;
+
+    /* a pushed stream depends on the stream it is associated with */
+
+    if (node->parent == NULL) {
+        node->weight = 16;
+        ngx_http_v2_set_dependency(h2c, node, parent->node->id, 0);
+    }
+
+    r = stream->request;
+    fc = r->connection;
+
+    r->method = NGX_HTTP_GET;
+    r->method_name = ngx_http_core_get_method;
+
+#if (NGX_HTTP_SSL)
+    if (fc->ssl) {
+        r->schema_start = (u_char *) "https";
+        r->schema_end = r->schema_start + sizeof("https") - 1;
+
+    } else
+#endif
+    {
+        r->schema_start = (u_char *) "http";
+        r->schema_end = r->schema_start + sizeof("http") - 1;
+    }
+
+    header.value.len = path->len;
+    header.value.data = ngx_pstrdup(r->pool, path);
+    if (header.value.data == NULL) {
+        goto close;
+    }
+
+    rc = ngx_http_v2_parse_path(r, &header);
+
+    if (rc == NGX_ABORT) {
+        return NULL;
+    }
+
+    if (rc != NGX_OK) {
+        goto close;
+    }
+
+    cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+
+    for (i = 0; i < n; i++) {
+        h = ngx_list_push(&r->headers_in.headers);
+        if (h == NULL) {
+            goto close;
+        }
+
+        h->key = headers[i].name;
+        h->lowcase_key = h->key.data;
+        h->hash = ngx_hash_key(h->key.data, h->key.len);
+
+        /*
+         * the values have to outlive the parent request and be null-terminated
+         * as the request header handlers expect
+         */
+
+        h->value.len = headers[i].value.len;
+        h->value.data = ngx_pnalloc(r->pool, h->value.len + 1);
+        if (h->value.data == NULL) {
+            goto close;
+        }
+
+        *ngx_cpymem(h->value.data, headers[i].value.data, h->value.len) = '\0';
+
+        hh = ngx_hash_find(&cmcf->headers_in_hash, h->hash,
+                           h->lowcase_key, h->key.len);
+
+        if (hh && hh->handler(r, h, hh->offset) != NGX_OK) {
+            /* request has been finalized already */
+            return NULL;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 push header: \"%V: %V\"", &h->key, &h->value);
+    }
+
+    /* the request is run after the PUSH_PROMISE frame has been queued */
+
+    fc->write->handler = ngx_http_v2_run_request_handler;
+    ngx_post_event(fc->write, &ngx_posted_events);
+
+    return stream;
+
+close:
+
+    ngx_http_v2_close_stream(stream, NGX_HTTP_INTERNAL_SERVER_ERROR);
+
+    return NULL;
+
+rst_stream:
+
+    if (ngx_http_v2_send_rst_stream(h2c, h2c->last_push,
+                                    NGX_HTTP_V2_INTERNAL_ERROR)
+        != NGX_OK)
+    {
+        h2c->connection->error = 1;
+    }
+
+    return NULL;
+}
+
+
 static ngx_int_t
 ngx_http_v2_init_request_body(ngx_http_request_t *r)
 {
@@ -3690,6 +3997,10 @@ ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc)
     fc->data = h2c->free_fake_connections;
     h2c->free_fake_connections = fc;
 
+    if (node->id % 2 == 0) {
+        h2c->pushing--;
+    }
+
     h2c->processing--;
 
     if (h2c->processing || h2c->blocked) {
@@ -3831,6 +4142,14 @@ ngx_http_v2_finalize_connection(ngx_http_v2_connection_t *h2c,
 
     h2c->last_out = NULL;
 
+    while (h2c->schedule.root != h2c->schedule.sentinel) {
+        stream = ngx_rbtree_data(h2c->schedule.root, ngx_http_v2_stream_t,
+                                 schedule);
+
+        ngx_rbtree_delete(&h2c->schedule, &stream->schedule);
+        stream->frames = NULL;
+    }
+
     h2scf = ngx_http_get_module_srv_conf(h2c->http_connection->conf_ctx,
                                          ngx_http_v2_module);
 
@@ -3984,6 +4303,8 @@ ngx_http_v2_set_dependency(ngx_http_v2_connection_t *h2c,
                                          * parent->weight;
                 }
 
+                ngx_http_v2_node_reschedule(parent);
+
                 if (!exclusive) {
                     ngx_http_v2_node_children_update(parent);
                 }
@@ -4024,6 +4345,7 @@ ngx_http_v2_set_dependency(ngx_http_v2_connection_t *h2c,
 
     node->parent = parent;
 
+    ngx_http_v2_node_reschedule(node);
     ngx_http_v2_node_children_update(node);
 }
 
@@ -4043,11 +4365,39 @@ ngx_http_v2_node_children_update(ngx_http_v2_node_t *node)
         child->rank = node->rank + 1;
         child->rel_weight = (node->rel_weight / 256) * child->weight;
 
+        ngx_http_v2_node_reschedule(child);
         ngx_http_v2_node_children_update(child);
     }
 }
 
 
+static void
+ngx_http_v2_node_reschedule(ngx_http_v2_node_t *node)
+{
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_connection_t  *h2c;
+
+    stream = node->stream;
+
+    if (stream == NULL || stream->frames == NULL) {
+        return;
+    }
+
+    /* the first frame keeps its start time, its weight is changed */
+
+    h2c = stream->connection;
+
+    ngx_rbtree_delete(&h2c->schedule, &stream->schedule);
+
+    stream->vfinish = stream->vstart
+                      + stream->frames->length / node->rel_weight;
+
+    stream->schedule.key = node->rank;
+
+    ngx_rbtree_insert(&h2c->schedule, &stream->schedule);
+}
+
+
 static void
 ngx_http_v2_pool_cleanup(void *data)
 {
@@ -29,6 +29,10 @@
 #define NGX_HTTP_V2_DATA_INTERNAL_ERROR  3
 
 #define NGX_HTTP_V2_FRAME_HEADER_SIZE    9
+#define NGX_HTTP_V2_STREAM_ID_SIZE       4
+
+#define NGX_HTTP_V2_TABLE_SIZE           4096
+#define NGX_HTTP_V2_MAX_TABLE_SIZE       65536
 
 /* frame types */
 #define NGX_HTTP_V2_DATA_FRAME           0x0
@@ -50,6 +54,90 @@
 #define NGX_HTTP_V2_PADDED_FLAG          0x08
 #define NGX_HTTP_V2_PRIORITY_FLAG        0x20
 
+/* errors */
+#define NGX_HTTP_V2_NO_ERROR                     0x0
+#define NGX_HTTP_V2_PROTOCOL_ERROR               0x1
+#define NGX_HTTP_V2_INTERNAL_ERROR               0x2
+#define NGX_HTTP_V2_FLOW_CTRL_ERROR              0x3
+#define NGX_HTTP_V2_SETTINGS_TIMEOUT             0x4
+#define NGX_HTTP_V2_STREAM_CLOSED                0x5
+#define NGX_HTTP_V2_SIZE_ERROR                   0x6
+#define NGX_HTTP_V2_REFUSED_STREAM               0x7
+#define NGX_HTTP_V2_CANCEL                       0x8
+#define NGX_HTTP_V2_COMP_ERROR                   0x9
+#define NGX_HTTP_V2_CONNECT_ERROR                0xa
+#define NGX_HTTP_V2_ENHANCE_YOUR_CALM            0xb
+#define NGX_HTTP_V2_INADEQUATE_SECURITY          0xc
+#define NGX_HTTP_V2_HTTP_1_1_REQUIRED            0xd
+
+/* frame sizes */
+#define NGX_HTTP_V2_RST_STREAM_SIZE              4
+#define NGX_HTTP_V2_PRIORITY_SIZE                5
+#define NGX_HTTP_V2_PING_SIZE                    8
+#define NGX_HTTP_V2_GOAWAY_SIZE                  8
+#define NGX_HTTP_V2_WINDOW_UPDATE_SIZE           4
+
+#define NGX_HTTP_V2_SETTINGS_PARAM_SIZE          6
+
+/* settings fields */
+#define NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING    0x1
+#define NGX_HTTP_V2_ENABLE_PUSH_SETTING          0x2
+#define NGX_HTTP_V2_MAX_STREAMS_SETTING          0x3
+#define NGX_HTTP_V2_INIT_WINDOW_SIZE_SETTING     0x4
+#define NGX_HTTP_V2_MAX_FRAME_SIZE_SETTING       0x5
+
+#define NGX_HTTP_V2_DEFAULT_FRAME_SIZE           (1 << 14)
+
+#define NGX_HTTP_V2_MAX_WINDOW                   ((1U << 31) - 1)
+#define NGX_HTTP_V2_DEFAULT_WINDOW               65535
+
+
+/*
+ * This returns precise number of octets for values in range 0..253
+ * and estimate number for the rest, but not smaller than required.
+ */
+
+#define ngx_http_v2_integer_octets(v)  (1 + (v) / 127)
+
+#define ngx_http_v2_literal_size(h)                                           \
+    (ngx_http_v2_integer_octets(sizeof(h) - 1) + sizeof(h) - 1)
+
+#define ngx_http_v2_indexed(i)      (128 + (i))
+
+#define NGX_HTTP_V2_INDEXED               0x80
+#define NGX_HTTP_V2_INC_INDEXED           0x40
+#define NGX_HTTP_V2_SIZE_UPDATE           0x20
+#define NGX_HTTP_V2_NOT_INDEXED           0x00
+
+#define NGX_HTTP_V2_ENCODE_RAW            0
+#define NGX_HTTP_V2_ENCODE_HUFF           0x80
+
+#define NGX_HTTP_V2_AUTHORITY_INDEX       1
+#define NGX_HTTP_V2_METHOD_GET_INDEX      2
+#define NGX_HTTP_V2_METHOD_POST_INDEX     3
+#define NGX_HTTP_V2_PATH_INDEX            4
+#define NGX_HTTP_V2_SCHEME_HTTP_INDEX     6
+#define NGX_HTTP_V2_SCHEME_HTTPS_INDEX    7
+#define NGX_HTTP_V2_STATUS_INDEX          8
+#define NGX_HTTP_V2_STATUS_200_INDEX      8
+#define NGX_HTTP_V2_STATUS_204_INDEX      9
+#define NGX_HTTP_V2_STATUS_206_INDEX      10
+#define NGX_HTTP_V2_STATUS_304_INDEX      11
+#define NGX_HTTP_V2_STATUS_400_INDEX      12
+#define NGX_HTTP_V2_STATUS_404_INDEX      13
+#define NGX_HTTP_V2_STATUS_500_INDEX      14
+
+#define NGX_HTTP_V2_ACCEPT_ENCODING_INDEX  16
+#define NGX_HTTP_V2_ACCEPT_LANGUAGE_INDEX  17
+#define NGX_HTTP_V2_CONTENT_LENGTH_INDEX  28
+#define NGX_HTTP_V2_CONTENT_TYPE_INDEX    31
+#define NGX_HTTP_V2_DATE_INDEX            33
+#define NGX_HTTP_V2_LAST_MODIFIED_INDEX   44
+#define NGX_HTTP_V2_LOCATION_INDEX        46
+#define NGX_HTTP_V2_SERVER_INDEX          54
+#define NGX_HTTP_V2_USER_AGENT_INDEX      58
+#define NGX_HTTP_V2_VARY_INDEX            59
+
 
 typedef struct ngx_http_v2_connection_s   ngx_http_v2_connection_t;
 typedef struct ngx_http_v2_node_s         ngx_http_v2_node_t;
@@ -111,23 +199,52 @@ typedef struct {
 } ngx_http_v2_hpack_t;
 
 
+typedef struct {
+    ngx_str_t                        name;
+    ngx_str_t                        value;
+    ngx_uint_t                       name_hash;
+    ngx_uint_t                       value_hash;
+} ngx_http_v2_hpack_entry_t;
+
+
+typedef struct {
+    ngx_http_v2_hpack_entry_t       *entries;
+
+    ngx_uint_t                       added;
+    ngx_uint_t                       deleted;
+    ngx_uint_t                       allocated;
+
+    size_t                           max;
+    size_t                           size;
+    size_t                           used;
+    u_char                          *storage;
+    u_char                          *pos;
+
+    unsigned                         size_update:1;
+} ngx_http_v2_hpack_enc_t;
+
+
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;
     ngx_http_connection_t           *http_connection;
 
     ngx_uint_t                       processing;
+    ngx_uint_t                       pushing;
+    ngx_uint_t                       concurrent_pushes;
 
     size_t                           send_window;
     size_t                           recv_window;
     size_t                           init_window;
 
     size_t                           frame_size;
+    size_t                           sndbuf;
 
     ngx_queue_t                      waiting;
 
     ngx_http_v2_state_t              state;
 
     ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_hpack_enc_t          hpack_enc;
 
     ngx_pool_t                      *pool;
 
@@ -138,14 +255,22 @@ struct ngx_http_v2_connection_s {
 
     ngx_http_v2_out_frame_t         *last_out;
 
+    /* the streams with DATA frames, ordered by the scheduler */
+    ngx_rbtree_t                     schedule;
+    ngx_rbtree_node_t                schedule_sentinel;
+    double                           vtime;
+
     ngx_queue_t                      posted;
     ngx_queue_t                      dependencies;
     ngx_queue_t                      closed;
 
     ngx_uint_t                       last_sid;
+    ngx_uint_t                       last_push;
 
     unsigned                         closed_nodes:8;
     unsigned                         blocked:1;
+    unsigned                         push_disabled:1;
+    unsigned                         goaway:1;
 };
 
 
@@ -178,6 +303,18 @@ struct ngx_http_v2_stream_s {
     ssize_t                          send_window;
     size_t                           recv_window;
 
+    /*
+     * the DATA frames waiting for the scheduler, the stream is in
+     * the schedule tree while the list is not empty
+     */
+    ngx_rbtree_node_t                schedule;
+    ngx_http_v2_out_frame_t         *frames;
+    ngx_http_v2_out_frame_t        **last_frame;
+
+    /* the virtual start and finish times of the first frame */
+    double                           vstart;
+    double                           vfinish;
+
     ngx_http_v2_out_frame_t         *free_frames;
     ngx_chain_t                     *free_data_headers;
     ngx_chain_t                     *free_bufs;
@@ -209,50 +346,60 @@ struct ngx_http_v2_out_frame_s {
 
     unsigned                         blocked:1;
     unsigned                         fin:1;
+    unsigned                         scheduled:1;
 };
 
 
+void ngx_http_v2_schedule_stream(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_stream_t *stream);
+void ngx_http_v2_schedule_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+
+
+#define ngx_http_v2_output_queued(h2c)                                        \
+    ((h2c)->last_out || (h2c)->schedule.root != (h2c)->schedule.sentinel)
+
+
+/*
+ * DATA frames are scheduled with weighted fair queuing over the dependency
+ * tree: a stream is queued once with its frames in order, streams closer
+ * to the root go first, the rest are ordered by the virtual finish time
+ * of their first frame, which grows with the frame length inversely
+ * proportionally to the stream's share of its tree level
+ */
+
 static ngx_inline void
 ngx_http_v2_queue_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
-    ngx_http_v2_out_frame_t  **out;
+    ngx_http_v2_stream_t  *stream;
 
-    for (out = &h2c->last_out; *out; out = &(*out)->next) {
+    stream = frame->stream;
 
-        if ((*out)->blocked || (*out)->stream == NULL) {
-            break;
-        }
+    frame->next = NULL;
+    frame->scheduled = 1;
 
-        if ((*out)->stream->node->rank < frame->stream->node->rank
-            || ((*out)->stream->node->rank == frame->stream->node->rank
-                && (*out)->stream->node->rel_weight
-                   >= frame->stream->node->rel_weight))
-        {
-            break;
-        }
+    if (stream->frames) {
+        *stream->last_frame = frame;
+        stream->last_frame = &frame->next;
+        return;
     }
 
-    frame->next = *out;
-    *out = frame;
+    stream->frames = frame;
+    stream->last_frame = &frame->next;
+
+    ngx_http_v2_schedule_stream(h2c, stream);
 }
 
 
+/* other frames are sent in order before any scheduled DATA frames */
+
 static ngx_inline void
 ngx_http_v2_queue_blocked_frame(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
 {
-    ngx_http_v2_out_frame_t  **out;
-
-    for (out = &h2c->last_out; *out; out = &(*out)->next)
-    {
-        if ((*out)->blocked || (*out)->stream == NULL) {
-            break;
-        }
-    }
-
-    frame->next = *out;
-    *out = frame;
+    frame->next = h2c->last_out;
+    h2c->last_out = frame;
 }
 
 
@@ -264,6 +411,9 @@ ngx_int_t ngx_http_v2_read_request_body(ngx_http_request_t *r,
 
 void ngx_http_v2_close_stream(ngx_http_v2_stream_t *stream, ngx_int_t rc);
 
+ngx_http_v2_stream_t *ngx_http_v2_push_stream(ngx_http_v2_stream_t *parent,
+    ngx_str_t *path, ngx_http_v2_header_t *headers, ngx_uint_t n);
+
 ngx_int_t ngx_http_v2_send_output_queue(ngx_http_v2_connection_t *h2c);
 
 
@@ -273,9 +423,20 @@ ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
+ngx_int_t ngx_http_v2_table_index(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value, ngx_uint_t *index, ngx_uint_t add);
+void ngx_http_v2_table_limit(ngx_http_v2_connection_t *h2c, size_t size);
+
 
 ngx_int_t ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len,
     u_char **dst, ngx_uint_t last, ngx_log_t *log);
+size_t ngx_http_v2_huff_encode(u_char *src, size_t len, u_char *dst,
+    ngx_uint_t lower);
+
+u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
+    ngx_uint_t value);
+u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
+    u_char *tmp);
 
 
 #define ngx_http_v2_prefix(bits)  ((1 << (bits)) - 1)
@@ -12,45 +12,39 @@
 #include <ngx_http_v2_module.h>
 
 
-/*
- * This returns precise number of octets for values in range 0..253
- * and estimate number for the rest, but not smaller than required.
- */
-
-#define ngx_http_v2_integer_octets(v)  (1 + (v) / 127)
-
-#define ngx_http_v2_literal_size(h)                                           \
-    (ngx_http_v2_integer_octets(sizeof(h) - 1) + sizeof(h) - 1)
+typedef struct {
+    ngx_str_t                      name;
+    ngx_uint_t                     index;
+} ngx_http_v2_push_header_t;
 
-#define ngx_http_v2_indexed(i)      (128 + (i))
-#define ngx_http_v2_inc_indexed(i)  (64 + (i))
 
-#define NGX_HTTP_V2_ENCODE_RAW            0
-#define NGX_HTTP_V2_ENCODE_HUFF           0x80
+/* the request headers passed on to the pushed requests */
 
-#define NGX_HTTP_V2_STATUS_INDEX          8
-#define NGX_HTTP_V2_STATUS_200_INDEX      8
-#define NGX_HTTP_V2_STATUS_204_INDEX      9
-#define NGX_HTTP_V2_STATUS_206_INDEX      10
-#define NGX_HTTP_V2_STATUS_304_INDEX      11
-#define NGX_HTTP_V2_STATUS_400_INDEX      12
-#define NGX_HTTP_V2_STATUS_404_INDEX      13
-#define NGX_HTTP_V2_STATUS_500_INDEX      14
+static ngx_http_v2_push_header_t  ngx_http_v2_push_headers[] = {
+    { ngx_string("accept-encoding"), NGX_HTTP_V2_ACCEPT_ENCODING_INDEX },
+    { ngx_string("accept-language"), NGX_HTTP_V2_ACCEPT_LANGUAGE_INDEX },
+    { ngx_string("user-agent"), NGX_HTTP_V2_USER_AGENT_INDEX },
+};
 
-#define NGX_HTTP_V2_CONTENT_LENGTH_INDEX  28
-#define NGX_HTTP_V2_CONTENT_TYPE_INDEX    31
-#define NGX_HTTP_V2_DATE_INDEX            33
-#define NGX_HTTP_V2_LAST_MODIFIED_INDEX   44
-#define NGX_HTTP_V2_LOCATION_INDEX        46
-#define NGX_HTTP_V2_SERVER_INDEX          54
-#define NGX_HTTP_V2_VARY_INDEX            59
+#define NGX_HTTP_V2_PUSH_HEADERS                                              \
+    (sizeof(ngx_http_v2_push_headers) / sizeof(ngx_http_v2_push_header_t))
 
 
-static u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
-    ngx_uint_t value);
+static u_char *ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c,
+    u_char *pos, ngx_uint_t index, ngx_str_t *name, ngx_str_t *value,
+    ngx_uint_t add, u_char *tmp);
+static ngx_uint_t ngx_http_v2_header_indexable(ngx_str_t *name);
 static ngx_http_v2_out_frame_t *ngx_http_v2_create_headers_frame(
     ngx_http_request_t *r, u_char *pos, u_char *end);
 
+static ngx_int_t ngx_http_v2_push_resources(ngx_http_request_t *r);
+static ngx_uint_t ngx_http_v2_link_preload(u_char *start, u_char *end);
+static ngx_int_t ngx_http_v2_push_resource(ngx_http_request_t *r,
+    ngx_str_t *path, ngx_http_v2_header_t *headers, ngx_uint_t *indices,
+    ngx_uint_t n);
+static ngx_http_v2_out_frame_t *ngx_http_v2_create_push_frame(
+    ngx_http_request_t *r, u_char *pos, u_char *end);
+
 static ngx_chain_t *ngx_http_v2_send_chain(ngx_connection_t *fc,
     ngx_chain_t *in, off_t limit);
 
@@ -70,6 +64,8 @@ static ngx_inline ngx_int_t ngx_http_v2_filter_send(
 
 static ngx_int_t ngx_http_v2_headers_frame_handler(
     ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
+static ngx_int_t ngx_http_v2_push_frame_handler(
+    ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
 static ngx_int_t ngx_http_v2_data_frame_handler(
     ngx_http_v2_connection_t *h2c, ngx_http_v2_out_frame_t *frame);
 static ngx_inline void ngx_http_v2_handle_frame(
@@ -113,21 +109,33 @@ ngx_module_t  ngx_http_v2_filter_module = {
 };
 
 
+/* the headers which values are rarely repeated are not indexed */
+
+static ngx_str_t  ngx_http_v2_unindexed_headers[] = {
+    ngx_string("content-length"),
+    ngx_string("content-range"),
+    ngx_string("etag"),
+    ngx_string("last-modified"),
+    ngx_null_string
+};
+
+
 static ngx_http_output_header_filter_pt  ngx_http_next_header_filter;
 
 
 static ngx_int_t
 ngx_http_v2_header_filter(ngx_http_request_t *r)
 {
-    u_char                     status, *pos, *start, *p;
-    size_t                     len;
-    ngx_str_t                  host, location;
+    u_char                     status, *pos, *start, *p, *tmp, *low;
+    size_t                     len, tmp_len;
+    ngx_str_t                  host, location, name, value;
     ngx_uint_t                 i, port;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
     ngx_connection_t          *fc;
     ngx_http_cleanup_t        *cln;
     ngx_http_v2_out_frame_t   *frame;
+    ngx_http_v2_connection_t  *h2c;
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
     struct sockaddr_in        *sin;
@@ -135,6 +143,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     struct sockaddr_in6       *sin6;
 #endif
     u_char                     addr[NGX_SOCKADDR_STRLEN];
+    u_char                     buf[sizeof("Wed, 31 Dec 1986 18:00:00 GMT")];
 
 
     if (!r->stream) {
@@ -210,8 +219,32 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
     }
 
+    h2c = r->stream->connection;
+
+    /* the promises have to precede the response they are referred from */
+
+    if (!h2c->push_disabled
+        && !h2c->goaway
+        && r->stream->node->id % 2 == 1
+        && r->method != NGX_HTTP_HEAD
+        && r->headers_out.status == NGX_HTTP_OK)
+    {
+        if (ngx_http_v2_push_resources(r) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
     len = status ? 1 : 1 + ngx_http_v2_literal_size("418");
 
+    if (h2c->hpack_enc.size_update) {
+        len += 1 + NGX_HTTP_V2_INT_OCTETS;
+    }
+
+    /* the longest string of the block for the Huffman encoding */
+
+    tmp_len = ngx_max(sizeof(NGINX_VER),
+                      sizeof("Wed, 31 Dec 1986 18:00:00 GMT")) - 1;
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (r->headers_out.server == NULL) {
@@ -224,12 +257,36 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     }
 
     if (r->headers_out.content_type.len) {
-        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.content_type.len;
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
         {
-            len += sizeof("; charset=") - 1 + r->headers_out.charset.len;
+            value.len = r->headers_out.content_type.len
+                        + sizeof("; charset=") - 1
+                        + r->headers_out.charset.len;
+
+            value.data = ngx_pnalloc(r->pool, value.len);
+            if (value.data == NULL) {
+                return NGX_ERROR;
+            }
+
+            p = ngx_cpymem(value.data, r->headers_out.content_type.data,
+                           r->headers_out.content_type.len);
+
+            p = ngx_cpymem(p, "; charset=", sizeof("; charset=") - 1);
+
+            ngx_memcpy(p, r->headers_out.charset.data,
+                       r->headers_out.charset.len);
+
+            /* update r->headers_out.content_type for possible logging */
+
+            r->headers_out.content_type = value;
+        }
+
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.content_type.len;
+
+        if (r->headers_out.content_type.len > tmp_len) {
+            tmp_len = r->headers_out.content_type.len;
         }
     }
 
@@ -338,6 +395,10 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         r->headers_out.location->hash = 0;
 
         len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
+
+        if (r->headers_out.location->value.len > tmp_len) {
+            tmp_len = r->headers_out.location->value.len;
+        }
     }
 
 #if (NGX_HTTP_GZIP)
@@ -386,6 +447,14 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
         len += 1 + NGX_HTTP_V2_INT_OCTETS + header[i].key.len
                  + NGX_HTTP_V2_INT_OCTETS + header[i].value.len;
+
+        if (header[i].key.len > tmp_len) {
+            tmp_len = header[i].key.len;
+        }
+
+        if (header[i].value.len > tmp_len) {
+            tmp_len = header[i].value.len;
+        }
     }
 
     pos = ngx_palloc(r->pool, len);
@@ -393,109 +462,141 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         return NGX_ERROR;
     }
 
+    tmp = ngx_palloc(r->pool, 2 * tmp_len);
+    if (tmp == NULL) {
+        return NGX_ERROR;
+    }
+
+    low = tmp + tmp_len;
+
     start = pos;
 
+    /*
+     * from now on the hpack encoder state is changed, so any failure
+     * has to close the connection
+     */
+
+    if (h2c->hpack_enc.size_update) {
+        *pos = NGX_HTTP_V2_SIZE_UPDATE;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5),
+                                    h2c->hpack_enc.size);
+
+        h2c->hpack_enc.size_update = 0;
+    }
+
     if (status) {
         *pos++ = status;
 
     } else {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
-        *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
-        pos = ngx_sprintf(pos, "%03ui", r->headers_out.status);
+        ngx_str_set(&name, ":status");
+
+        value.len = 3;
+        value.data = buf;
+        ngx_sprintf(buf, "%03ui", r->headers_out.status);
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                       &name, &value, 1, tmp);
+        if (pos == NULL) {
+            goto failed;
+        }
     }
 
     if (r->headers_out.server == NULL) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
+        ngx_str_set(&name, "server");
 
         if (clcf->server_tokens) {
-            *pos++ = NGX_HTTP_V2_ENCODE_RAW | (sizeof(NGINX_VER) - 1);
-            pos = ngx_cpymem(pos, NGINX_VER, sizeof(NGINX_VER) - 1);
+            ngx_str_set(&value, NGINX_VER);
 
         } else {
-            *pos++ = NGX_HTTP_V2_ENCODE_RAW | (sizeof("nginx") - 1);
-            pos = ngx_cpymem(pos, "nginx", sizeof("nginx") - 1);
+            ngx_str_set(&value, "nginx");
+        }
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_SERVER_INDEX,
+                                       &name, &value, 1, tmp);
+        if (pos == NULL) {
+            goto failed;
         }
     }
 
     if (r->headers_out.date == NULL) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
-        *pos++ = (u_char) ngx_cached_http_time.len;
+        ngx_str_set(&name, "date");
 
-        pos = ngx_cpymem(pos, ngx_cached_http_time.data,
-                         ngx_cached_http_time.len);
+        value.len = ngx_cached_http_time.len;
+        value.data = ngx_cached_http_time.data;
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_DATE_INDEX,
+                                       &name, &value, 1, tmp);
+        if (pos == NULL) {
+            goto failed;
+        }
     }
 
     if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
+        ngx_str_set(&name, "content-type");
 
-        if (r->headers_out.content_type_len == r->headers_out.content_type.len
-            && r->headers_out.charset.len)
-        {
-            *pos = NGX_HTTP_V2_ENCODE_RAW;
-            pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7),
-                                        r->headers_out.content_type.len
-                                        + sizeof("; charset=") - 1
-                                        + r->headers_out.charset.len);
-
-            p = pos;
-
-            pos = ngx_cpymem(pos, r->headers_out.content_type.data,
-                             r->headers_out.content_type.len);
-
-            pos = ngx_cpymem(pos, "; charset=", sizeof("; charset=") - 1);
-
-            pos = ngx_cpymem(pos, r->headers_out.charset.data,
-                             r->headers_out.charset.len);
-
-            /* update r->headers_out.content_type for possible logging */
-
-            r->headers_out.content_type.len = pos - p;
-            r->headers_out.content_type.data = p;
-
-        } else {
-            *pos = NGX_HTTP_V2_ENCODE_RAW;
-            pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7),
-                                        r->headers_out.content_type.len);
-            pos = ngx_cpymem(pos, r->headers_out.content_type.data,
-                             r->headers_out.content_type.len);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_TYPE_INDEX, &name,
+                                       &r->headers_out.content_type, 1, tmp);
+        if (pos == NULL) {
+            goto failed;
         }
     }
 
     if (r->headers_out.content_length == NULL
         && r->headers_out.content_length_n >= 0)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+        ngx_str_set(&name, "content-length");
+
+        value.data = buf;
+        value.len = ngx_sprintf(buf, "%O", r->headers_out.content_length_n)
+                    - buf;
 
-        p = pos;
-        pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
-        *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_LENGTH_INDEX,
+                                       &name, &value, 0, tmp);
+        if (pos == NULL) {
+            goto failed;
+        }
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
+        ngx_str_set(&name, "last-modified");
+
+        value.data = buf;
+        value.len = ngx_http_time(buf, r->headers_out.last_modified_time)
+                    - buf;
 
-        *pos++ = NGX_HTTP_V2_ENCODE_RAW
-                 | (sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1);
-        pos = ngx_http_time(pos, r->headers_out.last_modified_time);
+        pos = ngx_http_v2_write_header(h2c, pos,
+                                       NGX_HTTP_V2_LAST_MODIFIED_INDEX,
+                                       &name, &value, 0, tmp);
+        if (pos == NULL) {
+            goto failed;
+        }
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
+        ngx_str_set(&name, "location");
 
-        *pos = NGX_HTTP_V2_ENCODE_RAW;
-        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7),
-                                    r->headers_out.location->value.len);
-        pos = ngx_cpymem(pos, r->headers_out.location->value.data,
-                              r->headers_out.location->value.len);
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_LOCATION_INDEX,
+                                       &name, &r->headers_out.location->value,
+                                       0, tmp);
+        if (pos == NULL) {
+            goto failed;
+        }
     }
 
 #if (NGX_HTTP_GZIP)
     if (r->gzip_vary) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        *pos++ = NGX_HTTP_V2_ENCODE_RAW | (sizeof("Accept-Encoding") - 1);
-        pos = ngx_cpymem(pos, "Accept-Encoding", sizeof("Accept-Encoding") - 1);
+        ngx_str_set(&name, "vary");
+        ngx_str_set(&value, "Accept-Encoding");
+
+        pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_VARY_INDEX,
+                                       &name, &value, 1, tmp);
+        if (pos == NULL) {
+            goto failed;
+        }
     }
 #endif
 
@@ -518,45 +619,126 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
             continue;
         }
 
-        *pos++ = 0;
+        name.len = header[i].key.len;
+        name.data = low;
+        ngx_strlow(low, header[i].key.data, header[i].key.len);
+
+        pos = ngx_http_v2_write_header(h2c, pos, 0, &name, &header[i].value,
+                                       ngx_http_v2_header_indexable(&name),
+                                       tmp);
+        if (pos == NULL) {
+            goto failed;
+        }
+    }
 
-        *pos = NGX_HTTP_V2_ENCODE_RAW;
-        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7),
-                                    header[i].key.len);
-        ngx_strlow(pos, header[i].key.data, header[i].key.len);
-        pos += header[i].key.len;
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                   "http2 header block: %uz of %uz bytes",
+                   (size_t) (pos - start), len);
 
-        *pos = NGX_HTTP_V2_ENCODE_RAW;
-        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7),
-                                    header[i].value.len);
-        pos = ngx_cpymem(pos, header[i].value.data, header[i].value.len);
+    cln = ngx_http_cleanup_add(r, 0);
+    if (cln == NULL) {
+        goto failed;
     }
 
     frame = ngx_http_v2_create_headers_frame(r, start, pos);
     if (frame == NULL) {
-        return NGX_ERROR;
+        goto failed;
     }
 
-    ngx_http_v2_queue_blocked_frame(r->stream->connection, frame);
-
-    cln = ngx_http_cleanup_add(r, 0);
-    if (cln == NULL) {
-        return NGX_ERROR;
-    }
+    ngx_http_v2_queue_blocked_frame(h2c, frame);
 
     cln->handler = ngx_http_v2_filter_cleanup;
     cln->data = r->stream;
 
-    r->stream->queued = 1;
+    r->stream->queued++;
 
     fc->send_chain = ngx_http_v2_send_chain;
     fc->need_last_buf = 1;
 
     return ngx_http_v2_filter_send(fc, r->stream);
+
+failed:
+
+    h2c->connection->error = 1;
+
+    return NGX_ERROR;
 }
 
 
 static u_char *
+ngx_http_v2_write_header(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, ngx_uint_t add,
+    u_char *tmp)
+{
+    ngx_int_t  rc;
+
+    rc = ngx_http_v2_table_index(h2c, name, value, &index, add);
+
+    switch (rc) {
+
+    case NGX_OK:
+        *pos = NGX_HTTP_V2_INDEXED;
+        return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), index);
+
+    case NGX_DONE:
+        *pos = NGX_HTTP_V2_INC_INDEXED;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(6), index);
+        break;
+
+    case NGX_DECLINED:
+        *pos = NGX_HTTP_V2_NOT_INDEXED;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), index);
+        break;
+
+    default: /* NGX_ERROR */
+        return NULL;
+    }
+
+    if (index == 0) {
+        pos = ngx_http_v2_string_encode(pos, name->data, name->len, tmp);
+    }
+
+    return ngx_http_v2_string_encode(pos, value->data, value->len, tmp);
+}
+
+
+u_char *
+ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len, u_char *tmp)
+{
+    size_t  hlen;
+
+    hlen = ngx_http_v2_huff_encode(src, len, tmp, 0);
+
+    if (hlen) {
+        *dst = NGX_HTTP_V2_ENCODE_HUFF;
+        dst = ngx_http_v2_write_int(dst, ngx_http_v2_prefix(7), hlen);
+        return ngx_cpymem(dst, tmp, hlen);
+    }
+
+    *dst = NGX_HTTP_V2_ENCODE_RAW;
+    dst = ngx_http_v2_write_int(dst, ngx_http_v2_prefix(7), len);
+    return ngx_cpymem(dst, src, len);
+}
+
+
+static ngx_uint_t
+ngx_http_v2_header_indexable(ngx_str_t *name)
+{
+    ngx_str_t  *h;
+
+    for (h = ngx_http_v2_unindexed_headers; h->len; h++) {
+        if (h->len == name->len
+            && ngx_strncmp(h->data, name->data, name->len) == 0)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+u_char *
 ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix, ngx_uint_t value)
 {
     if (value < prefix) {
@@ -602,6 +784,7 @@ ngx_http_v2_create_headers_frame(ngx_http_request_t *r, u_char *pos,
     frame->length = rest;
     frame->blocked = 1;
     frame->fin = r->header_only;
+    frame->scheduled = 0;
 
     ll = &frame->first;
 
@@ -679,11 +862,553 @@ ngx_http_v2_create_headers_frame(ngx_http_request_t *r, u_char *pos,
 }
 
 
+static ngx_int_t
+ngx_http_v2_push_resources(ngx_http_request_t *r)
+{
+    u_char                    *start, *end, *last;
+    ngx_int_t                  rc;
+    ngx_str_t                  path;
+    ngx_uint_t                 i, j, n, push;
+    ngx_list_part_t           *part;
+    ngx_table_elt_t           *h;
+    ngx_http_v2_header_t       headers[NGX_HTTP_V2_PUSH_HEADERS + 1];
+    ngx_uint_t                 indices[NGX_HTTP_V2_PUSH_HEADERS + 1];
+    ngx_http_v2_loc_conf_t    *h2lcf;
+    ngx_http_complex_value_t  *pushes;
+    ngx_http_core_srv_conf_t  *cscf;
+
+    /* subrequests share the stream and never send their own headers */
+
+    if (r != r->main) {
+        return NGX_OK;
+    }
+
+    h2lcf = ngx_http_get_module_loc_conf(r, ngx_http_v2_module);
+
+    if (h2lcf->pushes == NULL && !h2lcf->push_preload) {
+        return NGX_OK;
+    }
+
+    /* the pushed requests inherit the authority and a few request headers */
+
+    ngx_str_set(&headers[0].name, "host");
+    indices[0] = NGX_HTTP_V2_AUTHORITY_INDEX;
+
+    if (r->headers_in.host) {
+        headers[0].value = r->headers_in.host->value;
+
+    } else if (r->headers_in.server.len) {
+        headers[0].value = r->headers_in.server;
+
+    } else {
+        cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
+        headers[0].value = cscf->server_name;
+    }
+
+    n = 1;
+
+    for (j = 0; j < NGX_HTTP_V2_PUSH_HEADERS; j++) {
+
+        part = &r->headers_in.headers.part;
+        h = part->elts;
+
+        for (i = 0; /* void */; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
+
+                part = part->next;
+                h = part->elts;
+                i = 0;
+            }
+
+            if (h[i].key.len == ngx_http_v2_push_headers[j].name.len
+                && ngx_strncmp(h[i].lowcase_key,
+                               ngx_http_v2_push_headers[j].name.data,
+                               h[i].key.len)
+                   == 0)
+            {
+                headers[n].name = ngx_http_v2_push_headers[j].name;
+                headers[n].value = h[i].value;
+                indices[n] = ngx_http_v2_push_headers[j].index;
+                n++;
+                break;
+            }
+        }
+    }
+
+    if (h2lcf->pushes) {
+        pushes = h2lcf->pushes->elts;
+
+        for (i = 0; i < h2lcf->pushes->nelts; i++) {
+
+            if (ngx_http_complex_value(r, &pushes[i], &path) != NGX_OK) {
+                return NGX_ERROR;
+            }
+
+            if (path.len == 0) {
+                continue;
+            }
+
+            if (path.len == 3 && ngx_strncmp(path.data, "off", 3) == 0) {
+                continue;
+            }
+
+            rc = ngx_http_v2_push_resource(r, &path, headers, indices, n);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (rc == NGX_ABORT) {
+                return NGX_OK;
+            }
+
+            /* NGX_OK, NGX_DECLINED */
+        }
+    }
+
+    if (!h2lcf->push_preload) {
+        return NGX_OK;
+    }
+
+    /*
+     * Link: </style.css>; rel=preload; as=style, </app.js>; rel=preload
+     *
+     * links with the "nopush" parameter and absolute URIs are not pushed
+     */
+
+    part = &r->headers_out.headers.part;
+    h = part->elts;
+
+    for (i = 0; /* void */; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            h = part->elts;
+            i = 0;
+        }
+
+        if (h[i].hash == 0
+            || h[i].key.len != sizeof("Link") - 1
+            || ngx_strncasecmp(h[i].key.data, (u_char *) "Link", 4) != 0)
+        {
+            continue;
+        }
+
+        start = h[i].value.data;
+        end = h[i].value.data + h[i].value.len;
+
+        while (start < end) {
+
+            while (start < end && (*start == ' ' || *start == ',')) {
+                start++;
+            }
+
+            if (start == end || *start++ != '<') {
+                break;
+            }
+
+            last = ngx_strlchr(start, end, '>');
+            if (last == NULL) {
+                break;
+            }
+
+            path.data = start;
+            path.len = last - start;
+
+            push = 0;
+            start = last + 1;
+
+            /* link parameters up to the next link-value */
+
+            while (start < end && *start != ',') {
+
+                while (start < end && (*start == ' ' || *start == ';')) {
+                    start++;
+                }
+
+                for (last = start; last < end; last++) {
+                    if (*last == ';' || *last == ',') {
+                        break;
+                    }
+
+                    if (*last == '"') {
+                        last = ngx_strlchr(last + 1, end, '"');
+                        if (last == NULL) {
+                            last = end;
+                            break;
+                        }
+                    }
+                }
+
+                if (last - start == sizeof("nopush") - 1
+                    && ngx_strncasecmp(start, (u_char *) "nopush", 6) == 0)
+                {
+                    push = 0;
+                    start = ngx_strlchr(last, end, ',');
+                    if (start == NULL) {
+                        start = end;
+                    }
+
+                    break;
+                }
+
+                if (last - start > (ssize_t) sizeof("rel=") - 1
+                    && ngx_strncasecmp(start, (u_char *) "rel=", 4) == 0
+                    && ngx_http_v2_link_preload(start + 4, last))
+                {
+                    push = 1;
+                }
+
+                start = last;
+            }
+
+            if (!push) {
+                continue;
+            }
+
+            if (path.len > 1 && path.data[0] == '/' && path.data[1] == '/') {
+                continue;
+            }
+
+            rc = ngx_http_v2_push_resource(r, &path, headers, indices, n);
+
+            if (rc == NGX_ERROR) {
+                return NGX_ERROR;
+            }
+
+            if (rc == NGX_ABORT) {
+                return NGX_OK;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_link_preload(u_char *start, u_char *end)
+{
+    u_char  *p;
+
+    /* rel=preload, rel="preload", rel="prefetch preload" */
+
+    if (start < end && *start == '"') {
+        start++;
+
+        if (end > start && end[-1] == '"') {
+            end--;
+        }
+    }
+
+    while (start < end) {
+
+        while (start < end && *start == ' ') {
+            start++;
+        }
+
+        for (p = start; p < end && *p != ' '; p++) { /* void */ }
+
+        if (p - start == sizeof("preload") - 1
+            && ngx_strncasecmp(start, (u_char *) "preload", 7) == 0)
+        {
+            return 1;
+        }
+
+        start = p;
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
+    ngx_http_v2_header_t *headers, ngx_uint_t *indices, ngx_uint_t n)
+{
+    u_char                    *start, *pos, *tmp;
+    size_t                     len, tmp_len;
+    ngx_str_t                  name;
+    ngx_uint_t                 i;
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_out_frame_t   *frame;
+    ngx_http_v2_connection_t  *h2c;
+
+    h2c = r->stream->connection;
+
+    if (path->len == 0
+        || path->len > NGX_HTTP_V2_MAX_FIELD
+        || path->data[0] != '/'
+        || (path->len > 1 && path->data[1] == '/'))
+    {
+        goto invalid;
+    }
+
+    for (i = 0; i < path->len; i++) {
+        if (path->data[i] <= 0x20 || path->data[i] == 0x7f) {
+            goto invalid;
+        }
+    }
+
+    if (h2c->last_push == 0x7ffffffe) {
+        return NGX_ABORT;
+    }
+
+    if (h2c->pushing >= h2c->concurrent_pushes) {
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http2 push \"%V\" skipped, concurrent pushes: %ui",
+                       path, h2c->pushing);
+        return NGX_ABORT;
+    }
+
+    len = 1 + 1 + 1 + NGX_HTTP_V2_INT_OCTETS + path->len;
+    tmp_len = path->len;
+
+    if (h2c->hpack_enc.size_update) {
+        len += 1 + NGX_HTTP_V2_INT_OCTETS;
+    }
+
+    for (i = 0; i < n; i++) {
+
+        if (headers[i].value.len > NGX_HTTP_V2_MAX_FIELD) {
+            return NGX_DECLINED;
+        }
+
+        len += 1 + NGX_HTTP_V2_INT_OCTETS + headers[i].value.len;
+
+        if (headers[i].value.len > tmp_len) {
+            tmp_len = headers[i].value.len;
+        }
+    }
+
+    pos = ngx_palloc(r->pool, len);
+    if (pos == NULL) {
+        return NGX_ERROR;
+    }
+
+    tmp = ngx_palloc(r->pool, tmp_len);
+    if (tmp == NULL) {
+        return NGX_ERROR;
+    }
+
+    start = pos;
+
+    /* the same hpack encoder state is shared with the response headers */
+
+    if (h2c->hpack_enc.size_update) {
+        *pos = NGX_HTTP_V2_SIZE_UPDATE;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5),
+                                    h2c->hpack_enc.size);
+
+        h2c->hpack_enc.size_update = 0;
+    }
+
+    *pos++ = ngx_http_v2_indexed(NGX_HTTP_V2_METHOD_GET_INDEX);
+
+#if (NGX_HTTP_SSL)
+    if (r->connection->ssl) {
+        *pos++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTPS_INDEX);
+
+    } else
+#endif
+    {
+        *pos++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
+    }
+
+    /* the paths are too varied to be worth adding to the dynamic table */
+
+    ngx_str_set(&name, ":path");
+
+    pos = ngx_http_v2_write_header(h2c, pos, NGX_HTTP_V2_PATH_INDEX, &name,
+                                   path, 0, tmp);
+    if (pos == NULL) {
+        goto failed;
+    }
+
+    ngx_str_set(&name, ":authority");
+
+    pos = ngx_http_v2_write_header(h2c, pos, indices[0], &name,
+                                   &headers[0].value, 1, tmp);
+    if (pos == NULL) {
+        goto failed;
+    }
+
+    for (i = 1; i < n; i++) {
+        pos = ngx_http_v2_write_header(h2c, pos, indices[i], &headers[i].name,
+                                       &headers[i].value, 1, tmp);
+        if (pos == NULL) {
+            goto failed;
+        }
+    }
+
+    h2c->last_push += 2;
+
+    frame = ngx_http_v2_create_push_frame(r, start, pos);
+    if (frame == NULL) {
+        goto failed;
+    }
+
+    ngx_http_v2_queue_blocked_frame(h2c, frame);
+
+    r->stream->queued++;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_http2_pushes, 1);
+#endif
+
+    stream = ngx_http_v2_push_stream(r->stream, path, headers, n);
+
+    if (stream == NULL) {
+        return h2c->connection->error ? NGX_ERROR : NGX_ABORT;
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                  "non-local or invalid push path \"%V\"", path);
+
+    return NGX_DECLINED;
+
+failed:
+
+    h2c->connection->error = 1;
+
+    return NGX_ERROR;
+}
+
+
+static ngx_http_v2_out_frame_t *
+ngx_http_v2_create_push_frame(ngx_http_request_t *r, u_char *pos, u_char *end)
+{
+    u_char                     type, flags;
+    size_t                     rest, frame_size, len;
+    ngx_buf_t                 *b;
+    ngx_chain_t               *cl, **ll;
+    ngx_http_v2_stream_t      *stream;
+    ngx_http_v2_out_frame_t   *frame;
+    ngx_http_v2_connection_t  *h2c;
+
+    stream = r->stream;
+    h2c = stream->connection;
+    rest = NGX_HTTP_V2_STREAM_ID_SIZE + (end - pos);
+
+    frame = ngx_palloc(r->pool, sizeof(ngx_http_v2_out_frame_t));
+    if (frame == NULL) {
+        return NULL;
+    }
+
+    frame->handler = ngx_http_v2_push_frame_handler;
+    frame->stream = stream;
+    frame->length = rest;
+    frame->blocked = 1;
+    frame->fin = 0;
+    frame->scheduled = 0;
+
+    ll = &frame->first;
+
+    type = NGX_HTTP_V2_PUSH_PROMISE_FRAME;
+    flags = NGX_HTTP_V2_NO_FLAG;
+    frame_size = h2c->frame_size;
+
+    for ( ;; ) {
+        if (rest <= frame_size) {
+            frame_size = rest;
+            flags |= NGX_HTTP_V2_END_HEADERS_FLAG;
+        }
+
+        len = NGX_HTTP_V2_FRAME_HEADER_SIZE;
+
+        if (type == NGX_HTTP_V2_PUSH_PROMISE_FRAME) {
+            len += NGX_HTTP_V2_STREAM_ID_SIZE;
+        }
+
+        b = ngx_create_temp_buf(r->pool, len);
+        if (b == NULL) {
+            return NULL;
+        }
+
+        b->last = ngx_http_v2_write_len_and_type(b->last, frame_size, type);
+        *b->last++ = flags;
+        b->last = ngx_http_v2_write_sid(b->last, stream->node->id);
+
+        if (type == NGX_HTTP_V2_PUSH_PROMISE_FRAME) {
+            b->last = ngx_http_v2_write_sid(b->last, h2c->last_push);
+            frame_size -= NGX_HTTP_V2_STREAM_ID_SIZE;
+            rest -= NGX_HTTP_V2_STREAM_ID_SIZE;
+        }
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NULL;
+        }
+
+        cl->buf = b;
+
+        *ll = cl;
+        ll = &cl->next;
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            return NULL;
+        }
+
+        b->pos = pos;
+
+        pos += frame_size;
+
+        b->last = pos;
+        b->start = b->pos;
+        b->end = b->last;
+        b->temporary = 1;
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NULL;
+        }
+
+        cl->buf = b;
+
+        *ll = cl;
+        ll = &cl->next;
+
+        rest -= frame_size;
+
+        if (rest) {
+            type = NGX_HTTP_V2_CONTINUATION_FRAME;
+            flags = NGX_HTTP_V2_NO_FLAG;
+            frame_size = h2c->frame_size;
+            continue;
+        }
+
+        cl->next = NULL;
+        frame->last = cl;
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http2:%ui create PUSH_PROMISE frame %p: "
+                       "sid:%ui len:%uz",
+                       stream->node->id, frame, h2c->last_push,
+                       frame->length);
+
+        return frame;
+    }
+}
+
+
 static ngx_chain_t *
 ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in, off_t limit)
 {
     off_t                      size, offset;
-    size_t                     rest, frame_size;
+    size_t                     rest, frame_size, sndbuf;
     ngx_chain_t               *cl, *out, **ln;
     ngx_http_request_t        *r;
     ngx_http_v2_stream_t      *stream;
@@ -756,8 +1481,41 @@ ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in, off_t limit)
 
     h2lcf = ngx_http_get_module_loc_conf(r, ngx_http_v2_module);
 
-    frame_size = (h2lcf->chunk_size < h2c->frame_size)
-                 ? h2lcf->chunk_size : h2c->frame_size;
+    sndbuf = 0;
+
+    if (in->buf->in_file && !ngx_buf_in_memory(in->buf)) {
+
+        /*
+         * a file buffer is only passed here with sendfile on a cleartext
+         * connection: each DATA frame costs a writev() of its header and
+         * a sendfile() of the body whatever its size, so frames are made
+         * as large as the client allows, while no more full frames are
+         * queued at once than the socket send buffer can take
+         */
+
+        frame_size = h2c->frame_size;
+
+        if (h2c->sndbuf) {
+            sndbuf = ngx_max(h2c->sndbuf / frame_size, 1) * frame_size;
+
+            if (limit > (off_t) sndbuf) {
+                limit = sndbuf;
+
+            } else {
+                sndbuf = 0;
+            }
+        }
+
+    } else if (h2c->processing == 1) {
+
+        /* the only stream does not need to be interleaved with others */
+
+        frame_size = h2c->frame_size;
+
+    } else {
+        frame_size = (h2lcf->chunk_size < h2c->frame_size)
+                     ? h2lcf->chunk_size : h2c->frame_size;
+    }
 
 #if (NGX_SUPPRESS_WARN)
     cl = NULL;
@@ -860,6 +1618,15 @@ ngx_http_v2_send_chain(ngx_connection_t *fc, ngx_chain_t *in, off_t limit)
 
     if (in && ngx_http_v2_flow_control(h2c, stream) == NGX_DECLINED) {
         fc->write->delayed = 1;
+
+    } else if (in && sndbuf && !stream->queued) {
+
+        /*
+         * the amount limited by the socket send buffer was sent at once,
+         * no frame is left to resume the stream
+         */
+
+        ngx_post_event(fc->write, &ngx_posted_events);
     }
 
     return in;
@@ -1079,6 +1846,35 @@ ngx_http_v2_headers_frame_handler(ngx_http_v2_connection_t *h2c,
 }
 
 
+static ngx_int_t
+ngx_http_v2_push_frame_handler(ngx_http_v2_connection_t *h2c,
+    ngx_http_v2_out_frame_t *frame)
+{
+    ngx_chain_t           *cl;
+    ngx_http_v2_stream_t  *stream;
+
+    for (cl = frame->first; cl; cl = cl->next) {
+        if (cl->buf->pos != cl->buf->last) {
+            return NGX_AGAIN;
+        }
+    }
+
+    stream = frame->stream;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2:%ui PUSH_PROMISE frame %p was sent",
+                   stream->node->id, frame);
+
+    ngx_free_chain(stream->request->pool, frame->first);
+
+    ngx_http_v2_handle_frame(stream, frame);
+
+    ngx_http_v2_handle_stream(h2c, stream);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_v2_data_frame_handler(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_out_frame_t *frame)
@@ -1240,6 +2036,7 @@ ngx_http_v2_filter_cleanup(void *data)
 
     window = 0;
     h2c = stream->connection;
+
     fn = &h2c->last_out;
 
     for ( ;; ) {
@@ -1264,6 +2061,21 @@ ngx_http_v2_filter_cleanup(void *data)
         fn = &frame->next;
     }
 
+    /* the frames not yet taken by the scheduler */
+
+    if (stream->frames) {
+        ngx_rbtree_delete(&h2c->schedule, &stream->schedule);
+
+        for (frame = stream->frames; frame; frame = frame->next) {
+            frame->scheduled = 0;
+
+            window += frame->length;
+            stream->queued--;
+        }
+
+        stream->frames = NULL;
+    }
+
     if (h2c->send_window == 0 && window && !ngx_queue_empty(&h2c->waiting)) {
         ngx_queue_add(&h2c->posted, &h2c->waiting);
         ngx_queue_init(&h2c->waiting);
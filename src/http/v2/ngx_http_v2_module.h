@@ -23,8 +23,10 @@ typedef struct {
 typedef struct {
     size_t                          pool_size;
     ngx_uint_t                      concurrent_streams;
+    ngx_uint_t                      concurrent_pushes;
     size_t                          max_field_size;
     size_t                          max_header_size;
+    size_t                          hpack_table_size;
     ngx_uint_t                      streams_index_mask;
     ngx_msec_t                      recv_timeout;
     ngx_msec_t                      idle_timeout;
@@ -33,6 +35,11 @@ typedef struct {
 
 typedef struct {
     size_t                          chunk_size;
+
+    ngx_flag_t                      push_preload;
+
+    ngx_flag_t                      push;
+    ngx_array_t                    *pushes;
 } ngx_http_v2_loc_conf_t;
 
 
@@ -10,12 +10,17 @@
 #include <ngx_http.h>
 
 
-#define NGX_HTTP_V2_TABLE_SIZE  4096
-
-
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
     size_t size);
 
+static ngx_int_t ngx_http_v2_table_init_enc(ngx_http_v2_connection_t *h2c);
+static void ngx_http_v2_table_evict(ngx_http_v2_hpack_enc_t *hpack,
+    size_t size);
+static u_char *ngx_http_v2_table_put(ngx_http_v2_hpack_enc_t *hpack,
+    u_char *src, size_t len);
+static ngx_int_t ngx_http_v2_table_cmp(ngx_http_v2_hpack_enc_t *hpack,
+    u_char *data, u_char *s, size_t len);
+
 
 static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
     { ngx_string(":authority"), ngx_string("") },
@@ -347,3 +352,207 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 
     return NGX_OK;
 }
+
+
+/*
+ * The encoder side table mirrors the dynamic table of the client decoder:
+ * header blocks are sent in the same order they are encoded, so entries
+ * are added and evicted here exactly as the client does it.
+ */
+
+ngx_int_t
+ngx_http_v2_table_index(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value, ngx_uint_t *index, ngx_uint_t add)
+{
+    size_t                      size;
+    ngx_uint_t                  i, name_hash, value_hash;
+    ngx_http_v2_hpack_enc_t    *hpack;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    hpack = &h2c->hpack_enc;
+
+    if (hpack->size == 0) {
+        return NGX_DECLINED;
+    }
+
+    if (hpack->entries == NULL) {
+        if (ngx_http_v2_table_init_enc(h2c) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    name_hash = ngx_hash_key(name->data, name->len);
+    value_hash = ngx_hash_key(value->data, value->len);
+
+    for (i = hpack->added; i != hpack->deleted; /* void */) {
+        entry = &hpack->entries[--i % hpack->allocated];
+
+        if (entry->name_hash != name_hash
+            || entry->name.len != name->len
+            || ngx_http_v2_table_cmp(hpack, entry->name.data, name->data,
+                                     name->len)
+               != 0)
+        {
+            continue;
+        }
+
+        if (entry->value_hash == value_hash
+            && entry->value.len == value->len
+            && ngx_http_v2_table_cmp(hpack, entry->value.data, value->data,
+                                     value->len)
+               == 0)
+        {
+            *index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + hpack->added - i;
+
+            ngx_log_debug3(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                           "http2 hpack table hit: %ui \"%V: %V\"",
+                           *index, name, value);
+
+            return NGX_OK;
+        }
+
+        if (*index == 0) {
+            *index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + hpack->added - i;
+        }
+    }
+
+    if (!add) {
+        return NGX_DECLINED;
+    }
+
+    size = 32 + name->len + value->len;
+
+    /* an entry taking more than half of the table would flush it */
+
+    if (size > hpack->size / 2) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack table add: \"%V: %V\"", name, value);
+
+    ngx_http_v2_table_evict(hpack, hpack->size - size);
+
+    entry = &hpack->entries[hpack->added++ % hpack->allocated];
+
+    entry->name.len = name->len;
+    entry->name.data = ngx_http_v2_table_put(hpack, name->data, name->len);
+    entry->name_hash = name_hash;
+
+    entry->value.len = value->len;
+    entry->value.data = ngx_http_v2_table_put(hpack, value->data, value->len);
+    entry->value_hash = value_hash;
+
+    hpack->used += size;
+
+    return NGX_DONE;
+}
+
+
+void
+ngx_http_v2_table_limit(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_http_v2_hpack_enc_t  *hpack;
+
+    hpack = &h2c->hpack_enc;
+
+    if (size > hpack->max) {
+        size = hpack->max;
+    }
+
+    if (size == hpack->size) {
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 hpack encoder table size: %uz was:%uz",
+                   size, hpack->size);
+
+    /* the client evicts the same entries once it gets the size update */
+
+    ngx_http_v2_table_evict(hpack, size);
+
+    hpack->size = size;
+    hpack->size_update = 1;
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_init_enc(ngx_http_v2_connection_t *h2c)
+{
+    ngx_http_v2_hpack_enc_t  *hpack;
+
+    hpack = &h2c->hpack_enc;
+
+    hpack->allocated = hpack->max / 32 + 1;
+
+    hpack->entries = ngx_palloc(h2c->connection->pool,
+                                sizeof(ngx_http_v2_hpack_entry_t)
+                                * hpack->allocated);
+    if (hpack->entries == NULL) {
+        return NGX_ERROR;
+    }
+
+    hpack->storage = ngx_palloc(h2c->connection->pool, hpack->max);
+    if (hpack->storage == NULL) {
+        return NGX_ERROR;
+    }
+
+    hpack->pos = hpack->storage;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_table_evict(ngx_http_v2_hpack_enc_t *hpack, size_t size)
+{
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    while (hpack->used > size) {
+        entry = &hpack->entries[hpack->deleted++ % hpack->allocated];
+        hpack->used -= 32 + entry->name.len + entry->value.len;
+    }
+}
+
+
+static u_char *
+ngx_http_v2_table_put(ngx_http_v2_hpack_enc_t *hpack, u_char *src,
+    size_t len)
+{
+    u_char  *start;
+    size_t   avail;
+
+    start = hpack->pos;
+    avail = hpack->storage + hpack->max - hpack->pos;
+
+    if (len < avail) {
+        hpack->pos = ngx_cpymem(hpack->pos, src, len);
+        return start;
+    }
+
+    ngx_memcpy(hpack->pos, src, avail);
+    hpack->pos = ngx_cpymem(hpack->storage, src + avail, len - avail);
+
+    return start;
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_cmp(ngx_http_v2_hpack_enc_t *hpack, u_char *data, u_char *s,
+    size_t len)
+{
+    size_t  rest;
+
+    rest = hpack->storage + hpack->max - data;
+
+    if (len <= rest) {
+        return ngx_memcmp(data, s, len);
+    }
+
+    if (ngx_memcmp(data, s, rest) != 0) {
+        return 1;
+    }
+
+    return ngx_memcmp(hpack->storage, s + rest, len - rest);
+}
@@ -12,6 +12,7 @@
 #if (NGX_THREADS)
 #include <ngx_thread_pool.h>
 static void ngx_thread_read_handler(void *data, ngx_log_t *log);
+static void ngx_thread_write_chain_to_file_handler(void *data, ngx_log_t *log);
 #endif
 
 
@@ -172,6 +173,140 @@ ngx_thread_read_handler(void *data, ngx_log_t *log)
 
 #endif
 
+
+typedef struct {
+    ngx_fd_t      fd;
+    ngx_chain_t  *chain;
+    off_t         offset;
+
+    size_t        written;
+    ngx_err_t     err;
+} ngx_thread_write_ctx_t;
+
+
+/*
+ * The first call posts the write of the chain to a thread pool and returns
+ * NGX_AGAIN, the call after the task completion returns the result and
+ * ignores the chain argument.  The chain bufs must not be changed meanwhile.
+ */
+
+ssize_t
+ngx_thread_write_chain_to_file(ngx_file_t *file, ngx_chain_t *cl, off_t offset,
+    ngx_pool_t *pool)
+{
+    ngx_thread_task_t       *task;
+    ngx_thread_write_ctx_t  *ctx;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, file->log, 0,
+                   "thread write chain: %d, %p, %O",
+                   file->fd, cl, offset);
+
+    task = file->thread_task;
+
+    if (task == NULL) {
+        task = ngx_thread_task_alloc(pool, sizeof(ngx_thread_write_ctx_t));
+        if (task == NULL) {
+            return NGX_ERROR;
+        }
+
+        task->handler = ngx_thread_write_chain_to_file_handler;
+
+        file->thread_task = task;
+    }
+
+    ctx = task->ctx;
+
+    if (task->event.complete) {
+        task->event.complete = 0;
+
+        if (ctx->err) {
+            ngx_log_error(NGX_LOG_CRIT, file->log, ctx->err,
+                          "pwrite() \"%s\" failed", file->name.data);
+            return NGX_ERROR;
+        }
+
+        file->offset += ctx->written;
+
+        return ctx->written;
+    }
+
+    ctx->fd = file->fd;
+    ctx->chain = cl;
+    ctx->offset = offset;
+
+    if (file->thread_handler(task, file) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+#if (NGX_HAVE_PWRITE)
+
+static void
+ngx_thread_write_chain_to_file_handler(void *data, ngx_log_t *log)
+{
+    ngx_thread_write_ctx_t *ctx = data;
+
+    off_t         offset;
+    size_t        size;
+    u_char       *buf;
+    ssize_t       n;
+    ngx_err_t     err;
+    ngx_chain_t  *cl;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, log, 0, "thread write handler");
+
+    ctx->written = 0;
+    ctx->err = 0;
+
+    offset = ctx->offset;
+
+    for (cl = ctx->chain; cl; cl = cl->next) {
+
+        buf = cl->buf->pos;
+        size = cl->buf->last - cl->buf->pos;
+
+        /* coalesce the neighbouring bufs */
+
+        while (cl->next && cl->next->buf->pos == buf + size) {
+            cl = cl->next;
+            size += cl->buf->last - cl->buf->pos;
+        }
+
+        while (size) {
+            n = pwrite(ctx->fd, buf, size, offset);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err == NGX_EINTR) {
+                    continue;
+                }
+
+                ctx->err = err;
+                return;
+            }
+
+            buf += n;
+            size -= n;
+            offset += n;
+            ctx->written += n;
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, log, 0,
+                   "pwrite: %uz (err: %d) @%O",
+                   ctx->written, ctx->err, ctx->offset);
+}
+
+#else
+
+#error pwrite() is required!
+
+#endif
+
 #endif /* NGX_THREADS */
 
 
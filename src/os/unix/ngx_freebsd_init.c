@@ -34,11 +34,12 @@ static ngx_os_io_t ngx_freebsd_io = {
     ngx_unix_send,
 #if (NGX_HAVE_SENDFILE)
     ngx_freebsd_sendfile_chain,
-    NGX_IO_SENDFILE
+    NGX_IO_SENDFILE,
 #else
     ngx_writev_chain,
-    0
+    0,
 #endif
+    NULL
 };
 
 
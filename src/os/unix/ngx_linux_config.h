@@ -77,7 +77,12 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
-#if (NGX_HAVE_POLL)
+#if (NGX_HAVE_REUSEPORT_EBPF)
+#include <linux/bpf.h>
+#endif
+
+
+#if (NGX_HAVE_POLL || NGX_HAVE_IO_URING)
 #include <poll.h>
 #endif
 
@@ -87,7 +92,12 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
-#if (NGX_HAVE_SYS_EVENTFD_H)
+#if (NGX_HAVE_IO_URING)
+#include <linux/io_uring.h>
+#endif
+
+
+#if (NGX_HAVE_SYS_EVENTFD_H || NGX_HAVE_IO_URING)
 #include <sys/eventfd.h>
 #endif
 #include <sys/syscall.h>
@@ -14,12 +14,15 @@
 
 
 #define NGX_IO_SENDFILE    1
+#define NGX_IO_ASYNC_RECV  2
 
 
 typedef ssize_t (*ngx_recv_pt)(ngx_connection_t *c, u_char *buf, size_t size);
 typedef ssize_t (*ngx_recv_chain_pt)(ngx_connection_t *c, ngx_chain_t *in, off_t limit);
 typedef ssize_t (*ngx_send_pt)(ngx_connection_t *c, u_char *buf, size_t size);
 typedef ngx_chain_t *(*ngx_send_chain_pt)(ngx_connection_t *c, ngx_chain_t *in, off_t limit);
+typedef ngx_socket_t (*ngx_accept_pt)(ngx_connection_t *lc, struct sockaddr *sa,
+    socklen_t *socklen);
 
 typedef struct {
     ngx_recv_pt        recv;
@@ -28,6 +31,7 @@ typedef struct {
     ngx_send_pt        send;
     ngx_send_chain_pt  send_chain;
     ngx_uint_t         flags;
+    ngx_accept_pt      accept;
 } ngx_os_io_t;
 
 
@@ -26,7 +26,8 @@ ngx_os_io_t ngx_os_io =
     ngx_udp_unix_recv,
     ngx_unix_send,
     ngx_writev_chain,
-    0
+    0,
+    NULL
 };
 
 
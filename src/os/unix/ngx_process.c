@@ -24,7 +24,7 @@ typedef struct
 static void ngx_execute_proc(ngx_cycle_t *cycle, void *data);
 static void ngx_signal_handler(int signo);
 static void ngx_process_get_status(void);
-static void ngx_unlock_mutexes(ngx_pid_t pid);
+static void ngx_unlock_mutexes(ngx_pid_t pid, int status);
 
 
 int              ngx_argc;
@@ -544,18 +544,19 @@ ngx_process_get_status(void)
             ngx_processes[i].respawn = 0;
         }
 
-        ngx_unlock_mutexes(pid);
+        ngx_unlock_mutexes(pid, status);
     }
 }
 
 
 static void
-ngx_unlock_mutexes(ngx_pid_t pid)
+ngx_unlock_mutexes(ngx_pid_t pid, int status)
 {
-    ngx_uint_t        i;
-    ngx_shm_zone_t   *shm_zone;
-    ngx_list_part_t  *part;
-    ngx_slab_pool_t  *sp;
+    ngx_uint_t         i, n;
+    ngx_shm_zone_t    *shm_zone;
+    ngx_list_part_t   *part;
+    ngx_slab_pool_t   *sp;
+    ngx_slab_shard_t  *shard;
 
     /*
      * unlock the accept mutex if the abnormally exited process
@@ -592,6 +593,26 @@ ngx_unlock_mutexes(ngx_pid_t pid)
                           "shared memory zone \"%V\" was locked by %P",
                           &shm_zone[i].shm.name, pid);
         }
+
+        for (n = 0; n < sp->nshards; n++) {
+            shard = (ngx_slab_shard_t *) (sp->shards + n * sp->shard_size);
+
+            if (ngx_shmtx_force_unlock(&shard->mutex, pid)) {
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                              "shard %ui of shared memory zone \"%V\" "
+                              "was locked by %P",
+                              n, &shm_zone[i].shm.name, pid);
+            }
+        }
+
+        /* a worker that exited normally has flushed its chunk cache */
+
+        if (status && sp->caches && !ngx_slab_cache_orphan(sp, pid)) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                          "chunk cache of %P leaked in "
+                          "shared memory zone \"%V\"",
+                          pid, &shm_zone[i].shm.name);
+        }
     }
 }
 
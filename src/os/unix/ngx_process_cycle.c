@@ -736,7 +736,7 @@ ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data)
 		{
             ngx_event_cancel_timers();
 
-            if (ngx_event_timer_rbtree.root == ngx_event_timer_rbtree.sentinel)
+            if (ngx_event_no_timers_left() == NGX_OK)
             {
                 ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "exiting");
 
@@ -856,6 +856,12 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
         }
     }
 
+	/*ֻworker̲ſڴchunk棬˳ʱngx_worker_process_exitй黹*/
+    if (worker >= 0 && ccf->slab_cache)
+	{
+        ngx_slab_cache_init(cycle, ccf->slab_cache);
+    }
+
 #if (NGX_HAVE_PR_SET_DUMPABLE)
 
     /* allow coredump after setuid() in Linux 2.4.x */
@@ -952,6 +958,8 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+    ngx_slab_cache_flush();
+
     if (ngx_exiting) {
         c = cycle->connections;
         for (i = 0; i < cycle->connection_n; i++) {
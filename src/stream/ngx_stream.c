@@ -292,7 +292,7 @@ ngx_stream_add_ports(ngx_conf_t *cf, ngx_array_t *ports, ngx_stream_listen_t *li
     port = ports->elts;
     for (i = 0; i < ports->nelts; i++) 
 	{
-        if (p == port[i].port && sa->sa_family == port[i].family)
+        if (p == port[i].port && listen->type == port[i].type && sa->sa_family == port[i].family)
 		{
             /* a port is already in the port list */
             port = &port[i];
@@ -308,6 +308,7 @@ ngx_stream_add_ports(ngx_conf_t *cf, ngx_array_t *ports, ngx_stream_listen_t *li
     }
 
     port->family = sa->sa_family;
+    port->type = listen->type;
     port->port = p;
 
     if (ngx_array_init(&port->addrs, cf->temp_pool, 2, sizeof(ngx_stream_conf_addr_t)) != NGX_OK)
@@ -382,6 +383,7 @@ ngx_stream_optimize_servers(ngx_conf_t *cf, ngx_array_t *ports)
 
             ls->addr_ntop = 1;
             ls->handler = ngx_stream_init_connection;
+            ls->type = addr[i].opt.type;
             ls->pool_size = 256;
 
             cscf = addr->opt.ctx->srv_conf[ngx_stream_core_module.ctx_index];
@@ -260,6 +260,7 @@ ngx_stream_core_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 static char *
 ngx_stream_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
+    int                           type;
     size_t                        len, off;
     in_port_t                     port;
     ngx_str_t                    *value;
@@ -291,6 +292,17 @@ ngx_stream_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     cmcf = ngx_stream_conf_get_module_main_conf(cf, ngx_stream_core_module);
 
+	/*the same address and port may be used by both tcp and udp*/
+    type = SOCK_STREAM;
+
+    for (i = 2; i < cf->args->nelts; i++)
+	{
+        if (ngx_strcmp(value[i].data, "udp") == 0)
+		{
+            type = SOCK_DGRAM;
+        }
+    }
+
     ls = cmcf->listen.elts;
 
 	/*check if we have a duplicate listen*/
@@ -298,7 +310,7 @@ ngx_stream_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 	{
         sa = &ls[i].u.sockaddr;
 
-        if (sa->sa_family != u.family)
+        if (sa->sa_family != u.family || ls[i].type != type)
 		{
             continue;
         }
@@ -357,6 +369,7 @@ ngx_stream_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ls->socklen = u.socklen;
     ls->backlog = NGX_LISTEN_BACKLOG;
     ls->wildcard = u.wildcard;
+    ls->type = type;
     ls->ctx = cf->ctx;
 
 #if (NGX_HAVE_INET6 && defined IPV6_V6ONLY)
@@ -372,6 +385,16 @@ ngx_stream_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[i].data, "udp") == 0)
+		{
+#if (NGX_WIN32)
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "the \"udp\" parameter is not supported on this platform");
+            return NGX_CONF_ERROR;
+#else
+            continue;
+#endif
+        }
+
         if (ngx_strncmp(value[i].data, "backlog=", 8) == 0)
 		{
             ls->backlog = ngx_atoi(value[i].data + 8, value[i].len - 8);
@@ -548,5 +571,35 @@ ngx_stream_core_listen(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (ls->type == SOCK_DGRAM)
+	{
+        /*
+         * sessions are kept by each worker, so the datagrams of a client
+         * have to be received by the same worker every time
+         */
+
+        if (!ls->reuseport)
+		{
+            return "\"udp\" parameter requires \"reuseport\"";
+        }
+
+        if (ls->backlog != NGX_LISTEN_BACKLOG)
+		{
+            return "\"backlog\" parameter is incompatible with \"udp\"";
+        }
+
+#if (NGX_STREAM_SSL)
+        if (ls->ssl)
+		{
+            return "\"ssl\" parameter is incompatible with \"udp\"";
+        }
+#endif
+
+        if (ls->so_keepalive)
+		{
+            return "\"so_keepalive\" parameter is incompatible with \"udp\"";
+        }
+    }
+
     return NGX_CONF_OK;
 }
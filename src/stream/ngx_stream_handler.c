@@ -174,7 +174,7 @@ ngx_stream_init_connection(ngx_connection_t *c)
         }
     }
 
-    if (cscf->tcp_nodelay && c->tcp_nodelay == NGX_TCP_NODELAY_UNSET)
+    if (cscf->tcp_nodelay && c->type == SOCK_STREAM && c->tcp_nodelay == NGX_TCP_NODELAY_UNSET)
 	{
         ngx_log_debug0(NGX_LOG_DEBUG_STREAM, c->log, 0, "tcp_nodelay");
 
@@ -174,7 +174,7 @@ ngx_stream_limit_conn_handler(ngx_stream_session_t *s)
 
         shpool = (ngx_slab_pool_t *) limits[i].shm_zone->shm.addr;
 
-        ngx_shmtx_lock(&shpool->mutex);
+        ngx_slab_lock(shpool);
 
         node = ngx_stream_limit_conn_lookup(ctx->rbtree, &key, hash);
 
@@ -187,7 +187,7 @@ ngx_stream_limit_conn_handler(ngx_stream_session_t *s)
             node = ngx_slab_alloc_locked(shpool, n);
 
             if (node == NULL) {
-                ngx_shmtx_unlock(&shpool->mutex);
+                ngx_slab_unlock(shpool);
                 ngx_stream_limit_conn_cleanup_all(s->connection->pool);
                 return NGX_ABORT;
             }
@@ -207,7 +207,7 @@ ngx_stream_limit_conn_handler(ngx_stream_session_t *s)
 
             if ((ngx_uint_t) lc->conn >= limits[i].conn) {
 
-                ngx_shmtx_unlock(&shpool->mutex);
+                ngx_slab_unlock(shpool);
 
                 ngx_log_error(lccf->log_level, s->connection->log, 0,
                               "limiting connections by zone \"%V\"",
@@ -223,7 +223,7 @@ ngx_stream_limit_conn_handler(ngx_stream_session_t *s)
         ngx_log_debug2(NGX_LOG_DEBUG_STREAM, s->connection->log, 0,
                        "limit conn: %08XD %d", node->key, lc->conn);
 
-        ngx_shmtx_unlock(&shpool->mutex);
+        ngx_slab_unlock(shpool);
 
         cln = ngx_pool_cleanup_add(s->connection->pool,
                                    sizeof(ngx_stream_limit_conn_cleanup_t));
@@ -338,7 +338,7 @@ ngx_stream_limit_conn_cleanup(void *data)
     node = lccln->node;
     lc = (ngx_stream_limit_conn_node_t *) &node->color;
 
-    ngx_shmtx_lock(&shpool->mutex);
+    ngx_slab_lock(shpool);
 
     ngx_log_debug2(NGX_LOG_DEBUG_STREAM, lccln->shm_zone->shm.log, 0,
                    "limit conn cleanup: %08XD %d", node->key, lc->conn);
@@ -350,7 +350,7 @@ ngx_stream_limit_conn_cleanup(void *data)
         ngx_slab_free_locked(shpool, node);
     }
 
-    ngx_shmtx_unlock(&shpool->mutex);
+    ngx_slab_unlock(shpool);
 }
 
 
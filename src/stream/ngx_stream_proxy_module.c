@@ -21,10 +21,15 @@ typedef struct {
     size_t                           upload_rate;
     size_t                           download_rate;
     ngx_uint_t                       next_upstream_tries;
+    ngx_uint_t                       responses;
     ngx_flag_t                       next_upstream;
     ngx_flag_t                       proxy_protocol;
     ngx_addr_t                      *local;
 
+#if (NGX_HAVE_SPLICE)
+    ngx_flag_t                       splice;
+#endif
+
 #if (NGX_STREAM_SSL)
     ngx_flag_t                       ssl_enable;
     ngx_flag_t                       ssl_session_reuse;
@@ -59,6 +64,9 @@ static void ngx_stream_proxy_connect_handler(ngx_event_t *ev);
 static ngx_int_t ngx_stream_proxy_test_connect(ngx_connection_t *c);
 static ngx_int_t ngx_stream_proxy_process(ngx_stream_session_t *s,
     ngx_uint_t from_upstream, ngx_uint_t do_write);
+#if !(NGX_WIN32)
+static ngx_int_t ngx_stream_proxy_process_udp(ngx_stream_session_t *s);
+#endif
 static void ngx_stream_proxy_next_upstream(ngx_stream_session_t *s);
 static void ngx_stream_proxy_finalize(ngx_stream_session_t *s, ngx_int_t rc);
 static u_char *ngx_stream_proxy_log_error(ngx_log_t *log, u_char *buf, size_t len);
@@ -72,6 +80,18 @@ static char *ngx_stream_proxy_bind(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_stream_proxy_send_proxy_protocol(ngx_stream_session_t *s);
 
+#if (NGX_HAVE_SPLICE)
+
+#define NGX_STREAM_PROXY_PIPE_SIZE  65536
+
+static ngx_int_t ngx_stream_proxy_splice_init(ngx_stream_session_t *s);
+static void ngx_stream_proxy_splice_cleanup(void *data);
+static ngx_int_t ngx_stream_proxy_splice(ngx_stream_session_t *s,
+    ngx_connection_t *src, ngx_connection_t *dst, ngx_buf_t *b,
+    off_t *received);
+
+#endif
+
 #if (NGX_STREAM_SSL)
 
 static char *ngx_stream_proxy_ssl_password_file(ngx_conf_t *cf,
@@ -190,6 +210,13 @@ static ngx_command_t  ngx_stream_proxy_commands[] = {
       offsetof(ngx_stream_proxy_srv_conf_t, next_upstream_timeout),
       NULL },
 
+    { ngx_string("proxy_responses"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, responses),
+      NULL },
+
     { ngx_string("proxy_protocol"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
       ngx_conf_set_flag_slot,
@@ -197,6 +224,17 @@ static ngx_command_t  ngx_stream_proxy_commands[] = {
       offsetof(ngx_stream_proxy_srv_conf_t, proxy_protocol),
       NULL },
 
+#if (NGX_HAVE_SPLICE)
+
+    { ngx_string("proxy_splice"),
+      NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      offsetof(ngx_stream_proxy_srv_conf_t, splice),
+      NULL },
+
+#endif
+
 #if (NGX_STREAM_SSL)
 
     { ngx_string("proxy_ssl"),
@@ -354,6 +392,7 @@ ngx_stream_proxy_handler(ngx_stream_session_t *s)
     u->peer.log_error = NGX_ERROR_ERR;
 
     u->peer.local = pscf->local;
+    u->peer.type = c->type;
 
     uscf = pscf->upstream;
 
@@ -370,7 +409,8 @@ ngx_stream_proxy_handler(ngx_stream_session_t *s)
         u->peer.tries = pscf->next_upstream_tries;
     }
 
-    u->proxy_protocol = pscf->proxy_protocol;
+    /* the PROXY protocol header is not sent over udp */
+    u->proxy_protocol = (c->type == SOCK_DGRAM) ? 0 : pscf->proxy_protocol;
     u->start_sec = ngx_time();
 
     p = ngx_pnalloc(c->pool, pscf->buffer_size);
@@ -492,7 +532,9 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
 
     cscf = ngx_stream_get_module_srv_conf(s, ngx_stream_core_module);
 
-    if (cscf->tcp_nodelay && pc->tcp_nodelay == NGX_TCP_NODELAY_UNSET) {
+    if (cscf->tcp_nodelay && pc->type == SOCK_STREAM
+        && pc->tcp_nodelay == NGX_TCP_NODELAY_UNSET)
+    {
         ngx_log_debug0(NGX_LOG_DEBUG_STREAM, pc->log, 0, "tcp_nodelay");
 
         tcp_nodelay = 1;
@@ -561,6 +603,31 @@ ngx_stream_proxy_init_upstream(ngx_stream_session_t *s)
 
     u->connected = 1;
 
+#if (NGX_HAVE_SPLICE)
+
+    /*
+     * splice() moves data between the sockets through a pipe without
+     * copying it to user space, so it cannot be used when the data have
+     * to be counted out by rate limits or passed through SSL, or when
+     * the event method may have a receive request in flight on a socket
+     */
+
+    if (pscf->splice && !u->splice && pc->type == SOCK_STREAM
+        && pscf->upload_rate == 0 && pscf->download_rate == 0
+        && !(ngx_io.flags & NGX_IO_ASYNC_RECV)
+#if (NGX_STREAM_SSL)
+        && pc->ssl == NULL && c->ssl == NULL
+#endif
+        && ngx_stream_proxy_splice_init(s) == NGX_OK)
+    {
+        ngx_log_debug0(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                       "stream proxy splice");
+
+        u->splice = 1;
+    }
+
+#endif
+
     pc->read->handler = ngx_stream_proxy_upstream_handler;
     pc->write->handler = ngx_stream_proxy_upstream_handler;
 
@@ -932,6 +999,27 @@ ngx_stream_proxy_process_connection(ngx_event_t *ev, ngx_uint_t from_upstream)
         } 
 		else
 		{
+            if (c->type == SOCK_DGRAM) {
+                pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_proxy_module);
+
+                if (pscf->responses == NGX_MAX_INT32_VALUE
+                    || u->responses >= pscf->responses * u->requests)
+                {
+                    /* no responses are pending, the session is just idle */
+
+                    ngx_log_debug0(NGX_LOG_DEBUG_STREAM, c->log, 0,
+                                   "udp session timed out");
+
+                    ngx_stream_proxy_finalize(s, NGX_OK);
+                    return;
+                }
+
+                ngx_log_error(NGX_LOG_ERR, c->log, NGX_ETIMEDOUT,
+                              "upstream timed out");
+                ngx_stream_proxy_finalize(s, NGX_DECLINED);
+                return;
+            }
+
             ngx_connection_error(c, NGX_ETIMEDOUT, "connection timed out");
             ngx_stream_proxy_finalize(s, NGX_DECLINED);
             return;
@@ -1054,6 +1142,12 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream, ngx_
 
     pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_proxy_module);
 
+#if !(NGX_WIN32)
+    if (c->type == SOCK_DGRAM) {
+        return ngx_stream_proxy_process_udp(s);
+    }
+#endif
+
     if (from_upstream) {
         src = pc;
         dst = c;
@@ -1069,6 +1163,19 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream, ngx_
         received = &s->received;
     }
 
+#if (NGX_HAVE_SPLICE)
+
+    if (u->splice) {
+        if (ngx_stream_proxy_splice(s, src, dst, b, received) != NGX_OK) {
+            ngx_stream_proxy_finalize(s, NGX_DECLINED);
+            return NGX_ERROR;
+        }
+
+        goto done;
+    }
+
+#endif
+
     for ( ;; ) {
 
         if (do_write) {
@@ -1146,7 +1253,19 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream, ngx_
         break;
     }
 
-    if (src->read->eof && (b->pos == b->last || (dst && dst->read->eof))) {
+#if (NGX_HAVE_SPLICE)
+done:
+#endif
+
+    size = b->last - b->pos;
+
+#if (NGX_HAVE_SPLICE)
+    if (u->splice) {
+        size += from_upstream ? u->upstream_piped : u->downstream_piped;
+    }
+#endif
+
+    if (src->read->eof && (size == 0 || (dst && dst->read->eof))) {
         handler = c->log->handler;
         c->log->handler = NULL;
 
@@ -1188,6 +1307,337 @@ ngx_stream_proxy_process(ngx_stream_session_t *s, ngx_uint_t from_upstream, ngx_
 }
 
 
+#if !(NGX_WIN32)
+
+static ngx_int_t
+ngx_stream_proxy_process_udp(ngx_stream_session_t *s)
+{
+    size_t                        size;
+    ssize_t                       n;
+    ngx_int_t                     rc;
+    ngx_buf_t                    *b;
+    ngx_uint_t                    max, expected;
+    ngx_connection_t             *c, *pc;
+    ngx_log_handler_pt            handler;
+    ngx_stream_upstream_t        *u;
+    ngx_stream_proxy_srv_conf_t  *pscf;
+
+    u = s->upstream;
+
+    c = s->connection;
+    pc = u->connected ? u->peer.connection : NULL;
+
+    pscf = ngx_stream_get_module_srv_conf(s, ngx_stream_proxy_module);
+
+    b = &u->downstream_buf;
+
+    /*
+     * the datagrams are never merged: the next one is received from
+     * the client only after the previous one was sent to the upstream,
+     * the datagrams arriving meanwhile are dropped
+     */
+
+    if (b->pos == b->last && c->read->ready) {
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n > 0) {
+            s->received += n;
+            b->last += n;
+        }
+    }
+
+    if (b->pos < b->last && pc && pc->write->ready) {
+        n = pc->send(pc, b->pos, b->last - b->pos);
+
+        if (n == NGX_ERROR) {
+            ngx_stream_proxy_finalize(s, NGX_DECLINED);
+            return NGX_ERROR;
+        }
+
+        if (n > 0) {
+            b->pos = b->start;
+            b->last = b->start;
+            u->requests++;
+        }
+    }
+
+    /* the responses are moved to the client in batches */
+
+    while (pc && pc->read->ready) {
+
+        max = NGX_UDP_BATCH;
+
+        if (pscf->responses != NGX_MAX_INT32_VALUE) {
+            expected = pscf->responses * u->requests;
+
+            if (u->responses >= expected) {
+                break;
+            }
+
+            if (expected - u->responses < max) {
+                max = expected - u->responses;
+            }
+        }
+
+        rc = ngx_udp_relay(pc, c, max, &size);
+
+        if (rc == NGX_AGAIN) {
+            break;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_stream_proxy_finalize(s, NGX_DECLINED);
+            return NGX_ERROR;
+        }
+
+        u->received += size;
+        u->responses += rc;
+    }
+
+    if (pscf->responses != NGX_MAX_INT32_VALUE
+        && u->requests
+        && u->responses >= pscf->responses * u->requests
+        && b->pos == b->last)
+    {
+        handler = c->log->handler;
+        c->log->handler = NULL;
+
+        ngx_log_error(NGX_LOG_INFO, c->log, 0,
+                      "udp session done"
+                      ", datagrams from/to upstream:%ui/%ui"
+                      ", bytes from/to client:%O/%O"
+                      ", bytes from/to upstream:%O/%O",
+                      u->responses, u->requests,
+                      s->received, c->sent, u->received, pc->sent);
+
+        c->log->handler = handler;
+
+        ngx_stream_proxy_finalize(s, NGX_OK);
+        return NGX_DONE;
+    }
+
+    if (pc) {
+        if (ngx_handle_read_event(pc->read, 0) != NGX_OK
+            || ngx_handle_write_event(pc->write, 0) != NGX_OK)
+        {
+            ngx_stream_proxy_finalize(s, NGX_ERROR);
+            return NGX_ERROR;
+        }
+
+        ngx_add_timer(c->write, pscf->timeout);
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+#if (NGX_HAVE_SPLICE)
+
+static ngx_int_t
+ngx_stream_proxy_splice_init(ngx_stream_session_t *s)
+{
+    ngx_connection_t       *c;
+    ngx_pool_cleanup_t     *cln;
+    ngx_stream_upstream_t  *u;
+
+    c = s->connection;
+    u = s->upstream;
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    u->downstream_pipe[0] = NGX_INVALID_FILE;
+    u->downstream_pipe[1] = NGX_INVALID_FILE;
+    u->upstream_pipe[0] = NGX_INVALID_FILE;
+    u->upstream_pipe[1] = NGX_INVALID_FILE;
+
+    cln->handler = ngx_stream_proxy_splice_cleanup;
+    cln->data = u;
+
+    if (pipe2(u->downstream_pipe, O_NONBLOCK|O_CLOEXEC) == -1
+        || pipe2(u->upstream_pipe, O_NONBLOCK|O_CLOEXEC) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, c->log, ngx_errno,
+                      "pipe2() failed, splice disabled");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_proxy_splice_cleanup(void *data)
+{
+    ngx_stream_upstream_t  *u = data;
+
+    ngx_uint_t  i;
+    ngx_fd_t   *fd[4];
+
+    fd[0] = &u->downstream_pipe[0];
+    fd[1] = &u->downstream_pipe[1];
+    fd[2] = &u->upstream_pipe[0];
+    fd[3] = &u->upstream_pipe[1];
+
+    for (i = 0; i < 4; i++) {
+        if (*fd[i] == NGX_INVALID_FILE) {
+            continue;
+        }
+
+        if (close(*fd[i]) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                          "close() pipe failed");
+        }
+
+        *fd[i] = NGX_INVALID_FILE;
+    }
+}
+
+
+static ngx_int_t
+ngx_stream_proxy_splice(ngx_stream_session_t *s, ngx_connection_t *src,
+    ngx_connection_t *dst, ngx_buf_t *b, off_t *received)
+{
+    size_t                 *piped;
+    ssize_t                 n;
+    ngx_fd_t               *fd;
+    ngx_err_t               err;
+    ngx_uint_t              progress;
+    ngx_stream_upstream_t  *u;
+
+    u = s->upstream;
+
+    if (src == u->peer.connection) {
+        fd = u->upstream_pipe;
+        piped = &u->upstream_piped;
+
+    } else {
+        fd = u->downstream_pipe;
+        piped = &u->downstream_piped;
+    }
+
+    /*
+     * the PROXY protocol header and the data read from the client
+     * before the upstream was connected are still in the buffer
+     */
+
+    if (b->pos < b->last) {
+
+        if (!dst->write->ready) {
+            return NGX_OK;
+        }
+
+        n = dst->send(dst, b->pos, b->last - b->pos);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        if (n > 0) {
+            b->pos += n;
+        }
+
+        if (b->pos < b->last) {
+            return NGX_OK;
+        }
+
+        b->pos = b->start;
+        b->last = b->start;
+    }
+
+    do {
+        progress = 0;
+
+        if (*piped && dst->write->ready) {
+
+            n = splice(fd[0], NULL, dst->fd, NULL, *piped,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_STREAM, dst->log, 0,
+                           "splice to socket: %z of %uz", n, *piped);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err == NGX_EAGAIN) {
+                    dst->write->ready = 0;
+
+                } else if (err == NGX_EINTR) {
+                    progress = 1;
+
+                } else {
+                    dst->write->error = 1;
+                    (void) ngx_connection_error(dst, err,
+                                                "splice() failed");
+                    return NGX_ERROR;
+                }
+
+            } else {
+                *piped -= n;
+                dst->sent += n;
+                progress = 1;
+            }
+        }
+
+        if (*piped < NGX_STREAM_PROXY_PIPE_SIZE
+            && src->read->ready && !src->read->eof)
+        {
+            n = splice(src->fd, NULL, fd[1], NULL,
+                       NGX_STREAM_PROXY_PIPE_SIZE - *piped,
+                       SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+
+            ngx_log_debug1(NGX_LOG_DEBUG_STREAM, src->log, 0,
+                           "splice from socket: %z", n);
+
+            if (n == -1) {
+                err = ngx_errno;
+
+                if (err == NGX_EAGAIN) {
+
+                    /*
+                     * a non-empty pipe may be full before its nominal
+                     * size is reached, so only an empty pipe tells
+                     * that the socket has been drained
+                     */
+
+                    if (*piped == 0) {
+                        src->read->ready = 0;
+                    }
+
+                } else if (err == NGX_EINTR) {
+                    progress = 1;
+
+                } else {
+                    src->read->error = 1;
+                    src->read->ready = 0;
+                    src->read->eof = 1;
+                    (void) ngx_connection_error(src, err,
+                                                "splice() failed");
+                }
+
+            } else if (n == 0) {
+                src->read->ready = 0;
+                src->read->eof = 1;
+
+            } else {
+                *received += n;
+                *piped += n;
+                progress = 1;
+            }
+        }
+
+    } while (progress);
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static void
 ngx_stream_proxy_next_upstream(ngx_stream_session_t *s)
 {
@@ -1347,10 +1797,15 @@ ngx_stream_proxy_create_srv_conf(ngx_conf_t *cf)
     conf->upload_rate = NGX_CONF_UNSET_SIZE;
     conf->download_rate = NGX_CONF_UNSET_SIZE;
     conf->next_upstream_tries = NGX_CONF_UNSET_UINT;
+    conf->responses = NGX_CONF_UNSET_UINT;
     conf->next_upstream = NGX_CONF_UNSET;
     conf->proxy_protocol = NGX_CONF_UNSET;
     conf->local = NGX_CONF_UNSET_PTR;
 
+#if (NGX_HAVE_SPLICE)
+    conf->splice = NGX_CONF_UNSET;
+#endif
+
 #if (NGX_STREAM_SSL)
     conf->ssl_enable = NGX_CONF_UNSET;
     conf->ssl_session_reuse = NGX_CONF_UNSET;
@@ -1391,12 +1846,19 @@ ngx_stream_proxy_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->next_upstream_tries,
                               prev->next_upstream_tries, 0);
 
+    ngx_conf_merge_uint_value(conf->responses,
+                              prev->responses, NGX_MAX_INT32_VALUE);
+
     ngx_conf_merge_value(conf->next_upstream, prev->next_upstream, 1);
 
     ngx_conf_merge_value(conf->proxy_protocol, prev->proxy_protocol, 0);
 
     ngx_conf_merge_ptr_value(conf->local, prev->local, NULL);
 
+#if (NGX_HAVE_SPLICE)
+    ngx_conf_merge_value(conf->splice, prev->splice, 0);
+#endif
+
 #if (NGX_STREAM_SSL)
 
     ngx_conf_merge_value(conf->ssl_enable, prev->ssl_enable, 0);
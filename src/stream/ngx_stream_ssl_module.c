@@ -436,7 +436,11 @@ ngx_stream_ssl_session_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
                 return NGX_CONF_ERROR;
             }
 
-            scf->shm_zone->init = ngx_ssl_session_cache_init;
+            if (ngx_ssl_session_cache_create(cf, scf->shm_zone, 1, 0, 0, 0)
+                != NGX_OK)
+            {
+                return NGX_CONF_ERROR;
+            }
 
             continue;
         }
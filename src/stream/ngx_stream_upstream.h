@@ -87,11 +87,20 @@ typedef struct
     ngx_buf_t                          upstream_buf;
     off_t                              received;
     time_t                             start_sec;
+    ngx_uint_t                         requests;
+    ngx_uint_t                         responses;
 #if (NGX_STREAM_SSL)
     ngx_str_t                          ssl_name;
+#endif
+#if (NGX_HAVE_SPLICE)
+    ngx_fd_t                           downstream_pipe[2];
+    ngx_fd_t                           upstream_pipe[2];
+    size_t                             downstream_piped;
+    size_t                             upstream_piped;
 #endif
     unsigned                           connected:1;
     unsigned                           proxy_protocol:1;
+    unsigned                           splice:1;
 } ngx_stream_upstream_t;
 
 
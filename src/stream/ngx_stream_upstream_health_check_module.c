@@ -0,0 +1,626 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_stream.h>
+
+
+typedef struct {
+    ngx_msec_t                          interval;
+    ngx_msec_t                          timeout;
+    ngx_uint_t                          fails;
+    ngx_uint_t                          passes;
+    in_port_t                           port;
+
+    ngx_stream_upstream_srv_conf_t     *uscf;
+
+    /* process local */
+    ngx_event_t                         event;
+    ngx_uint_t                          pending;
+} ngx_stream_upstream_hc_srv_conf_t;
+
+
+typedef struct {
+    ngx_stream_upstream_hc_srv_conf_t  *conf;
+    ngx_stream_upstream_rr_peers_t     *peers;
+    ngx_stream_upstream_rr_peer_t      *peer;
+
+    ngx_peer_connection_t               pc;
+    ngx_log_t                           log;
+    ngx_str_t                           name;
+
+    u_char                              sockaddr[NGX_SOCKADDRLEN];
+    u_char                              text[NGX_SOCKADDR_STRLEN];
+} ngx_stream_upstream_hc_peer_t;
+
+
+static void ngx_stream_upstream_hc_start(ngx_event_t *ev);
+static void ngx_stream_upstream_hc_connect(
+    ngx_stream_upstream_hc_srv_conf_t *hcf,
+    ngx_stream_upstream_rr_peers_t *peers, ngx_stream_upstream_rr_peer_t *peer);
+static void ngx_stream_upstream_hc_handler(ngx_event_t *ev);
+static ngx_int_t ngx_stream_upstream_hc_test_connect(ngx_connection_t *c);
+static void ngx_stream_upstream_hc_done(ngx_stream_upstream_hc_peer_t *hp,
+    ngx_uint_t ok);
+static u_char *ngx_stream_upstream_hc_log_error(ngx_log_t *log, u_char *buf,
+    size_t len);
+
+static ngx_int_t ngx_stream_upstream_hc_postconfiguration(ngx_conf_t *cf);
+static void *ngx_stream_upstream_hc_create_conf(ngx_conf_t *cf);
+static char *ngx_stream_upstream_health_check(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
+static ngx_int_t ngx_stream_upstream_hc_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_stream_upstream_hc_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_STREAM_UPS_CONF|NGX_CONF_ANY,
+      ngx_stream_upstream_health_check,
+      NGX_STREAM_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_stream_module_t  ngx_stream_upstream_health_check_module_ctx = {
+    ngx_stream_upstream_hc_postconfiguration, /* postconfiguration */
+
+    NULL,                                    /* create main configuration */
+    NULL,                                    /* init main configuration */
+
+    ngx_stream_upstream_hc_create_conf,      /* create server configuration */
+    NULL,                                    /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_stream_upstream_health_check_module = {
+    NGX_MODULE_V1,
+    &ngx_stream_upstream_health_check_module_ctx, /* module context */
+    ngx_stream_upstream_hc_commands,         /* module directives */
+    NGX_STREAM_MODULE,                       /* module type */
+    NULL,                                    /* init master */
+    NULL,                                    /* init module */
+    ngx_stream_upstream_hc_init_process,     /* init process */
+    NULL,                                    /* init thread */
+    NULL,                                    /* exit thread */
+    NULL,                                    /* exit process */
+    NULL,                                    /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static void
+ngx_stream_upstream_hc_start(ngx_event_t *ev)
+{
+    ngx_uint_t                          i, n;
+    ngx_stream_upstream_rr_peer_t      *peer, **list;
+    ngx_stream_upstream_rr_peers_t     *peers, *backup;
+    ngx_stream_upstream_hc_srv_conf_t  *hcf;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    hcf = ev->data;
+
+    ngx_add_timer(ev, hcf->interval);
+
+    /* a round is not started until the previous one completes */
+
+    if (hcf->pending) {
+        return;
+    }
+
+    /*
+     * stream peers are never added or removed at run time,
+     * so the lists may be walked without the lock
+     */
+
+    peers = hcf->uscf->peer.data;
+    backup = peers->next;
+
+    n = peers->number + (backup ? backup->number : 0);
+
+    list = ngx_alloc(n * sizeof(ngx_stream_upstream_rr_peer_t *), ev->log);
+    if (list == NULL) {
+        return;
+    }
+
+    n = 0;
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+        list[n++] = peer;
+    }
+
+    if (backup) {
+        for (peer = backup->peer; peer; peer = peer->next) {
+            list[n++] = peer;
+        }
+    }
+
+    hcf->pending = n;
+
+    for (i = 0; i < n; i++) {
+        ngx_stream_upstream_hc_connect(hcf,
+                                       i < peers->number ? peers : backup,
+                                       list[i]);
+    }
+
+    ngx_free(list);
+}
+
+
+static void
+ngx_stream_upstream_hc_connect(ngx_stream_upstream_hc_srv_conf_t *hcf,
+    ngx_stream_upstream_rr_peers_t *peers, ngx_stream_upstream_rr_peer_t *peer)
+{
+    ngx_int_t                       rc;
+    struct sockaddr                *sa;
+    ngx_connection_t               *c;
+    ngx_stream_upstream_hc_peer_t  *hp;
+
+    hp = ngx_calloc(sizeof(ngx_stream_upstream_hc_peer_t), ngx_cycle->log);
+    if (hp == NULL) {
+        hcf->pending--;
+        return;
+    }
+
+    hp->conf = hcf;
+    hp->peers = peers;
+    hp->peer = peer;
+
+    sa = (struct sockaddr *) hp->sockaddr;
+    ngx_memcpy(sa, peer->sockaddr, peer->socklen);
+
+    if (hcf->port) {
+        switch (sa->sa_family) {
+
+#if (NGX_HAVE_INET6)
+        case AF_INET6:
+            ((struct sockaddr_in6 *) sa)->sin6_port = htons(hcf->port);
+            break;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+        case AF_UNIX:
+            break;
+#endif
+
+        default: /* AF_INET */
+            ((struct sockaddr_in *) sa)->sin_port = htons(hcf->port);
+        }
+    }
+
+    hp->name.data = hp->text;
+    hp->name.len = ngx_sock_ntop(sa, peer->socklen, hp->text,
+                                 NGX_SOCKADDR_STRLEN, 1);
+
+    hp->log = *ngx_cycle->log;
+    hp->log.handler = ngx_stream_upstream_hc_log_error;
+    hp->log.data = hp;
+    hp->log.action = NULL;
+
+    hp->pc.sockaddr = sa;
+    hp->pc.socklen = peer->socklen;
+    hp->pc.name = &hp->name;
+    hp->pc.get = ngx_event_get_peer;
+    hp->pc.log = &hp->log;
+    hp->pc.log_error = NGX_ERROR_ERR;
+
+    rc = ngx_event_connect_peer(&hp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_stream_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    c = hp->pc.connection;
+
+    c->data = hp;
+    c->pool = NULL;
+
+    c->write->handler = ngx_stream_upstream_hc_handler;
+    c->read->handler = ngx_stream_upstream_hc_handler;
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, hcf->timeout);
+        return;
+    }
+
+    ngx_stream_upstream_hc_done(hp, 1);
+}
+
+
+static void
+ngx_stream_upstream_hc_handler(ngx_event_t *ev)
+{
+    ngx_connection_t               *c;
+    ngx_stream_upstream_hc_peer_t  *hp;
+
+    c = ev->data;
+    hp = c->data;
+
+    if (ev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, ev->log, NGX_ETIMEDOUT,
+                      "health check timed out");
+        ngx_stream_upstream_hc_done(hp, 0);
+        return;
+    }
+
+    ngx_stream_upstream_hc_done(hp,
+                         ngx_stream_upstream_hc_test_connect(c) == NGX_OK);
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT) {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        /*
+         * BSDs and Linux return 0 and set a pending error in err
+         * Solaris returns -1 and sets errno
+         */
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_stream_upstream_hc_done(ngx_stream_upstream_hc_peer_t *hp, ngx_uint_t ok)
+{
+    ngx_stream_upstream_rr_peer_t      *peer;
+    ngx_stream_upstream_rr_peers_t     *peers;
+    ngx_stream_upstream_hc_srv_conf_t  *hcf;
+
+    hcf = hp->conf;
+    peers = hp->peers;
+    peer = hp->peer;
+
+    if (hp->pc.connection) {
+        ngx_close_connection(hp->pc.connection);
+        hp->pc.connection = NULL;
+    }
+
+    ngx_stream_upstream_rr_peers_wlock(peers);
+
+    if (ok) {
+        peer->check_fails = 0;
+
+        if (!(peer->down & NGX_STREAM_UPSTREAM_PEER_UNHEALTHY)) {
+            goto done;
+        }
+
+        if (++peer->check_passes < hcf->passes) {
+            goto done;
+        }
+
+        peer->down &= ~NGX_STREAM_UPSTREAM_PEER_UNHEALTHY;
+        peer->check_passes = 0;
+        peer->fails = 0;
+
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "upstream \"%V\": server %V is healthy",
+                      &hcf->uscf->host, &peer->name);
+
+    } else {
+        peer->check_passes = 0;
+
+        if (peer->down & NGX_STREAM_UPSTREAM_PEER_UNHEALTHY) {
+            goto done;
+        }
+
+        if (++peer->check_fails < hcf->fails) {
+            goto done;
+        }
+
+        peer->down |= NGX_STREAM_UPSTREAM_PEER_UNHEALTHY;
+        peer->check_fails = 0;
+
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "upstream \"%V\": server %V is unhealthy",
+                      &hcf->uscf->host, &peer->name);
+    }
+
+done:
+
+    ngx_stream_upstream_rr_peers_unlock(peers);
+
+    hcf->pending--;
+
+    ngx_free(hp);
+}
+
+
+static u_char *
+ngx_stream_upstream_hc_log_error(ngx_log_t *log, u_char *buf, size_t len)
+{
+    ngx_stream_upstream_hc_peer_t  *hp;
+
+    hp = log->data;
+
+    return ngx_snprintf(buf, len,
+                        " while checking health of %V in upstream \"%V\"",
+                        &hp->name, &hp->conf->uscf->host);
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_postconfiguration(ngx_conf_t *cf)
+{
+    ngx_uint_t                           i;
+    ngx_stream_upstream_srv_conf_t     **uscfp;
+    ngx_stream_upstream_main_conf_t     *umcf;
+    ngx_stream_upstream_hc_srv_conf_t   *hcf;
+
+    umcf = ngx_stream_conf_get_module_main_conf(cf,
+                                                ngx_stream_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_stream_conf_upstream_srv_conf(uscfp[i],
+                                      ngx_stream_upstream_health_check_module);
+
+        if (hcf->interval == 0) {
+            continue;
+        }
+
+        /* results are shared by workers through the peers in the zone */
+
+        if (uscfp[i]->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "health_check requires upstream \"%V\" in %s:%ui "
+                          "to be in shared memory",
+                          &uscfp[i]->host, uscfp[i]->file_name,
+                          uscfp[i]->line);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_stream_upstream_hc_create_conf(ngx_conf_t *cf)
+{
+    ngx_stream_upstream_hc_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_stream_upstream_hc_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->interval = 0;
+     *     conf->port = 0;
+     *     conf->uscf = NULL;
+     *     conf->pending = 0;
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_stream_upstream_health_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_stream_upstream_hc_srv_conf_t  *hcf = conf;
+
+    ngx_int_t    n;
+    ngx_str_t   *value, s;
+    ngx_uint_t   i;
+
+    if (hcf->interval) {
+        return "is duplicate";
+    }
+
+    hcf->uscf = ngx_stream_conf_get_module_srv_conf(cf,
+                                                    ngx_stream_upstream_module);
+    hcf->interval = 5000;
+    hcf->timeout = NGX_CONF_UNSET_MSEC;
+    hcf->fails = 1;
+    hcf->passes = 1;
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = &value[i].data[9];
+
+            hcf->interval = ngx_parse_time(&s, 0);
+
+            if (hcf->interval == (ngx_msec_t) NGX_ERROR
+                || hcf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            hcf->timeout = ngx_parse_time(&s, 0);
+
+            if (hcf->timeout == (ngx_msec_t) NGX_ERROR
+                || hcf->timeout == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "port=", 5) == 0) {
+
+            n = ngx_atoi(&value[i].data[5], value[i].len - 5);
+
+            if (n < 1 || n > 65535) {
+                goto invalid;
+            }
+
+            hcf->port = (in_port_t) n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (hcf->timeout == NGX_CONF_UNSET_MSEC) {
+        hcf->timeout = ngx_min(hcf->interval, 1000);
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static ngx_int_t
+ngx_stream_upstream_hc_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                           i, n;
+    ngx_core_conf_t                     *ccf;
+    ngx_stream_upstream_srv_conf_t     **uscfp;
+    ngx_stream_upstream_main_conf_t     *umcf;
+    ngx_stream_upstream_hc_srv_conf_t   *hcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_stream_cycle_get_module_main_conf(cycle,
+                                                 ngx_stream_upstream_module);
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    /* each upstream is checked by a single worker */
+
+    n = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_stream_conf_upstream_srv_conf(uscfp[i],
+                                      ngx_stream_upstream_health_check_module);
+
+        if (hcf->interval == 0) {
+            continue;
+        }
+
+        if (ngx_process == NGX_PROCESS_WORKER
+            && n++ % ccf->worker_processes != ngx_worker)
+        {
+            continue;
+        }
+
+        hcf->event.handler = ngx_stream_upstream_hc_start;
+        hcf->event.data = hcf;
+        hcf->event.log = cycle->log;
+        hcf->event.cancelable = 1;
+
+        ngx_add_timer(&hcf->event, 1);
+    }
+
+    return NGX_OK;
+}
@@ -641,7 +641,7 @@ ngx_stream_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc,
         ngx_stream_upstream_rr_peer_lock(peers, peer);
 
         if (len > peer->ssl_session_len) {
-            ngx_shmtx_lock(&peers->shpool->mutex);
+            ngx_slab_lock(peers->shpool);
 
             if (peer->ssl_session) {
                 ngx_slab_free_locked(peers->shpool, peer->ssl_session);
@@ -649,7 +649,7 @@ ngx_stream_upstream_save_round_robin_peer_session(ngx_peer_connection_t *pc,
 
             peer->ssl_session = ngx_slab_alloc_locked(peers->shpool, len);
 
-            ngx_shmtx_unlock(&peers->shpool->mutex);
+            ngx_slab_unlock(peers->shpool);
 
             if (peer->ssl_session == NULL) {
                 peer->ssl_session_len = 0;
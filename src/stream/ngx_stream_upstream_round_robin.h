@@ -35,7 +35,7 @@ struct ngx_stream_upstream_rr_peer_s {
     ngx_uint_t                       max_fails;
     time_t                           fail_timeout;
 
-    ngx_uint_t                       down;         /* unsigned  down:1; */
+    ngx_uint_t                       down;
 
 #if (NGX_STREAM_SSL)
     void                            *ssl_session;
@@ -46,10 +46,18 @@ struct ngx_stream_upstream_rr_peer_s {
 
 #if (NGX_STREAM_UPSTREAM_ZONE)
     ngx_atomic_t                     lock;
+    ngx_uint_t                       check_fails;
+    ngx_uint_t                       check_passes;
 #endif
 };
 
 
+/* peers with any of the down bits set are skipped by all balancers */
+
+#define NGX_STREAM_UPSTREAM_PEER_DOWN       0x01
+#define NGX_STREAM_UPSTREAM_PEER_UNHEALTHY  0x02
+
+
 typedef struct ngx_stream_upstream_rr_peers_s  ngx_stream_upstream_rr_peers_t;
 
 struct ngx_stream_upstream_rr_peers_s {